@@ -0,0 +1,55 @@
+#include "benchmark.hpp"
+#include "programs.hpp"
+
+#include "vm/actor_system.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <future>
+#include <string>
+#include <thread>
+#include <vector>
+
+/**
+@file
+
+Messages per second between pairs of actors, from one thread to one per core.
+*/
+
+using perseus::detail::actor_system;
+
+PERSEUS_BENCHMARK( actors )
+{
+  constexpr std::int32_t round_trips = 1000;
+  const std::size_t cores = std::max( std::thread::hardware_concurrency(), 1u );
+  std::vector< std::size_t > thread_counts;
+  for( std::size_t threads = 1; threads < cores; threads *= 2 )
+  {
+    thread_counts.push_back( threads );
+  }
+  thread_counts.push_back( cores );
+  for( const std::size_t threads : thread_counts )
+  {
+    // enough pairs to keep every thread busy
+    const std::size_t pairs = 2 * threads;
+    context.measure( "ping_pong/" + std::to_string( threads ) + "_threads", "messages", [ & ]()
+    {
+      actor_system system( threads );
+      std::vector< std::future< perseus::stack > > results;
+      for( std::size_t i = 0; i < pairs; ++i )
+      {
+        const actor_system::actor_id ponger = system.spawn( programs::pong_actor() ).id;
+        perseus::stack parameters;
+        parameters.push< actor_system::actor_id >( ponger );
+        parameters.push< std::int32_t >( round_trips );
+        parameters.push< std::int32_t >( 0 );
+        results.push_back( system.spawn( programs::ping_actor(), 0, std::move( parameters ) ).result );
+      }
+      for( std::future< perseus::stack >& result : results )
+      {
+        result.get();
+      }
+      return std::uint64_t( 2 * round_trips * pairs );
+    } );
+  }
+}
@@ -0,0 +1,140 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <chrono>
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+
+/**
+@file
+
+Minimal benchmark harness for perseus_bench.
+
+Benchmarks are registered using @ref PERSEUS_BENCHMARK and report one or more measurements via benchmark::context::measure().
+
+Each measurement is repeated and reported as the median of its repetitions. `perseus_bench --json <file>` also writes the results as JSON, which `bench/compare.py` compares against a stored baseline.
+*/
+
+namespace benchmark
+{
+  /// A single measurement
+  struct result
+  {
+    /// full name, e.g. `dispatch/factorial/switch`
+    std::string name;
+    /// what is being counted, e.g. `instructions`
+    std::string unit;
+    /// how often the measured function ran, in all repetitions
+    std::uint64_t iterations;
+    /// the throughput of each repetition, in units per second
+    std::vector< double > repetitions;
+
+    /// the median throughput of the repetitions
+    double items_per_second() const
+    {
+      std::vector< double > sorted = repetitions;
+      std::sort( sorted.begin(), sorted.end() );
+      const std::size_t middle = sorted.size() / 2;
+      return sorted.size() % 2 == 1 ? sorted[ middle ] : ( sorted[ middle - 1 ] + sorted[ middle ] ) / 2;
+    }
+
+    /// the difference between the fastest and slowest repetition, relative to the median
+    double spread() const
+    {
+      const auto minmax = std::minmax_element( repetitions.begin(), repetitions.end() );
+      return ( *minmax.second - *minmax.first ) / items_per_second();
+    }
+  };
+
+  /// Passed to the benchmark functions to take measurements
+  class context
+  {
+  public:
+    /**
+    @param name name of the benchmark, prefixed to the measurements
+    @param min_time minimum number of seconds to run each repetition of a measurement for
+    @param repetitions how often to repeat each measurement, at least 1; more make the median more stable
+    @param filter only measurements whose full name contains this are taken
+    */
+    context( std::string name, const double min_time, const unsigned int repetitions, std::string filter = std::string() )
+      : _name( std::move( name ) )
+      , _min_time( min_time )
+      , _repetitions( repetitions > 0 ? repetitions : 1 )
+      , _filter( std::move( filter ) )
+    {
+    }
+
+    /**
+    @brief Runs the given function repeatedly until the minimum time has passed, after one untimed warmup run, and repeats that for each repetition.
+
+    Does nothing if the measurement's name doesn't match the filter.
+    @param label appended to the benchmark name to identify this measurement
+    @param unit what the numbers returned by body count
+    @param body runs one iteration, returning how many units it processed
+    */
+    template< typename function >
+    void measure( const std::string& label, const std::string& unit, function body )
+    {
+      typedef std::chrono::steady_clock clock;
+      result res{ label.empty() ? _name : _name + "/" + label, unit, 0, {} };
+      if( res.name.find( _filter ) == std::string::npos )
+      {
+        return;
+      }
+      body();
+      for( unsigned int repetition = 0; repetition < _repetitions; ++repetition )
+      {
+        std::uint64_t items = 0;
+        const clock::time_point start = clock::now();
+        clock::time_point now;
+        do
+        {
+          items += body();
+          res.iterations += 1;
+          now = clock::now();
+        } while( std::chrono::duration< double >( now - start ).count() < _min_time );
+        res.repetitions.push_back( items / std::chrono::duration< double >( now - start ).count() );
+      }
+      _results.push_back( std::move( res ) );
+    }
+
+    /// The measurements taken so far
+    const std::vector< result >& results() const
+    {
+      return _results;
+    }
+
+  private:
+    std::string _name;
+    double _min_time;
+    unsigned int _repetitions;
+    std::string _filter;
+    std::vector< result > _results;
+  };
+
+  /// Signature of benchmark functions
+  typedef void ( *function )( context& );
+
+  /// All registered benchmarks, in registration order
+  std::vector< std::pair< std::string, function > >& registry();
+
+  /// Registers a benchmark on construction; used by @ref PERSEUS_BENCHMARK
+  struct registrar
+  {
+    registrar( const char* name, const function func )
+    {
+      registry().emplace_back( name, func );
+    }
+  };
+}
+
+/**
+@brief Defines and registers a benchmark function. Usage: `PERSEUS_BENCHMARK( name ) { context.measure( ... ); }`
+*/
+#define PERSEUS_BENCHMARK( name ) \
+  static void name( ::benchmark::context& context ); \
+  static const ::benchmark::registrar name##_registrar( #name, &name ); \
+  static void name( ::benchmark::context& context )
@@ -0,0 +1,45 @@
+#include "benchmark.hpp"
+#include "programs.hpp"
+
+#include "vm/processor.hpp"
+
+#include <string>
+
+/**
+@file
+
+The cost of counting instructions: the arithmetic loop without a budget, with one too big to run out, and sliced into many short runs.
+*/
+
+using perseus::detail::processor;
+using perseus::detail::dispatch_engine;
+using perseus::detail::execution_budget;
+
+PERSEUS_BENCHMARK( budget )
+{
+  for( dispatch_engine engine : { dispatch_engine::switch_, dispatch_engine::top_of_stack, dispatch_engine::jit } )
+  {
+    const std::string name = perseus::detail::get_name( engine );
+    processor proc( programs::arithmetic_loop_function(), {}, engine );
+    context.measure( "unlimited/" + name, "runs", [ & ]()
+    {
+      proc.execute( 0, programs::arithmetic_loop_arguments( 10000 ) );
+      return 1;
+    } );
+    context.measure( "large/" + name, "runs", [ & ]()
+    {
+      proc.execute( 0, programs::arithmetic_loop_arguments( 10000 ), execution_budget{ 1u << 30 } );
+      return 1;
+    } );
+    context.measure( "sliced_1000/" + name, "runs", [ & ]()
+    {
+      perseus::stack result;
+      bool finished = proc.try_execute( 0, programs::arithmetic_loop_arguments( 10000 ), result, execution_budget{ 1000 } );
+      while( !finished )
+      {
+        finished = proc.try_resume( result, execution_budget{ 1000 } );
+      }
+      return 1;
+    } );
+  }
+}
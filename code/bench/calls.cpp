@@ -0,0 +1,30 @@
+#include "benchmark.hpp"
+#include "programs.hpp"
+
+#include "vm/processor.hpp"
+
+#include <cstdint>
+#include <string>
+
+/**
+@file
+
+Function call and return on their own, calling a function that returns right away.
+*/
+
+using perseus::detail::processor;
+using perseus::detail::dispatch_engine;
+
+PERSEUS_BENCHMARK( calls )
+{
+  constexpr std::int32_t calls = 10000;
+  for( dispatch_engine engine : { dispatch_engine::switch_, dispatch_engine::computed_goto, dispatch_engine::tail_call, dispatch_engine::top_of_stack, dispatch_engine::jit } )
+  {
+    processor proc( programs::call_loop(), {}, engine );
+    context.measure( std::string( "empty_function/" ) + perseus::detail::get_name( engine ), "calls", [ & ]()
+    {
+      proc.execute( 0, programs::single_argument( calls ) );
+      return std::uint64_t( calls );
+    } );
+  }
+}
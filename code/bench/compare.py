@@ -0,0 +1,70 @@
+"""Compares perseus_bench results against a baseline.
+
+Usage: compare.py <baseline.json> <current.json> [--threshold <fraction>]
+
+Both files are written by `perseus_bench --json <file>`. A measurement counts as
+a regression if its throughput dropped by more than the threshold (default 0.05),
+or by more than the spread between the repetitions of either run, whichever is
+larger, so noisy measurements don't get flagged. Exits with 1 if there are any
+regressions.
+"""
+
+import json
+import sys
+
+
+def load(path):
+    with open(path) as f:
+        return {result["name"]: result for result in json.load(f)["results"]}
+
+
+def spread(result):
+    values = result["repetitions"]
+    return (max(values) - min(values)) / result["items_per_second"] if result["items_per_second"] > 0 else 0
+
+
+def main(argv):
+    threshold = 0.05
+    paths = []
+    i = 1
+    while i < len(argv):
+        if argv[i] == "--threshold" and i + 1 < len(argv):
+            threshold = float(argv[i + 1])
+            i += 2
+        else:
+            paths.append(argv[i])
+            i += 1
+    if len(paths) != 2:
+        sys.stderr.write(__doc__)
+        return 2
+
+    baseline, current = load(paths[0]), load(paths[1])
+    regressions = 0
+    for name, result in current.items():
+        if name not in baseline:
+            print("{:<48} {:>16} {:>16}   new".format(name, "", "{:.0f}".format(result["items_per_second"])))
+            continue
+        before = baseline[name]
+        if before["items_per_second"] <= 0:
+            continue
+        change = result["items_per_second"] / before["items_per_second"] - 1
+        tolerance = max(threshold, spread(before), spread(result))
+        if change < -tolerance:
+            verdict = "REGRESSION"
+            regressions += 1
+        elif change > tolerance:
+            verdict = "improvement"
+        else:
+            verdict = ""
+        print("{:<48} {:>16.0f} {:>16.0f} {:>+7.1f}%  {}".format(
+            name, before["items_per_second"], result["items_per_second"], 100 * change, verdict))
+    for name in baseline:
+        if name not in current:
+            print("{:<48} {:>16.0f} {:>16}   missing".format(name, baseline[name]["items_per_second"], ""))
+
+    print("{} regression(s) beyond {:.0f}%".format(regressions, 100 * threshold))
+    return 1 if regressions > 0 else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main(sys.argv))
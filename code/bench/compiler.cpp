@@ -0,0 +1,147 @@
+#include "benchmark.hpp"
+
+#include "compiler/compiler.hpp"
+#include "compiler/iterators.hpp"
+#include "compiler/token_definitions.hpp"
+#include "compiler/scanner.hpp"
+
+#include <boost/spirit/home/lex/tokenize_and_parse.hpp>
+
+#include <cstdint>
+#include <sstream>
+#include <string>
+
+/**
+@file
+
+Compiler throughput on a large generated source: lexing alone, lexing and parsing, and everything up to a linked program, both from a stream and from a buffer.
+
+The `lexer/` measurements compare the table-driven lexer the compiler uses with one building its DFA at runtime from the same definitions, which is what constructing a compiler used to cost, and with the hand-written @ref perseus::detail::scanner "scanner".
+*/
+
+/// A source with the given number of functions, each calling the previous one, and a main() calling the last
+static std::string generated_source( const unsigned int functions )
+{
+  std::ostringstream source;
+  source << "function f0( a : i32, b : i32 ) -> i32\n    a + b\n\n";
+  for( unsigned int i = 1; i < functions; ++i )
+  {
+    source << "function f" << i << "( a : i32, b : i32 ) -> i32\n"
+      "{\n"
+      "    // mixes the arguments\n"
+      "    let c = ( a * 3 ) % 7;\n"
+      "    let d = ( c + b ) * 2;\n"
+      "    if a > b\n"
+      "        f" << i - 1 << "( a - 1, d )\n"
+      "    else\n"
+      "        d - c\n"
+      "}\n\n";
+  }
+  source << "function main() -> i32\n    f" << functions - 1 << "( 10, 3 )\n";
+  return source.str();
+}
+
+/// The number of tokens in the source, or 0 if it couldn't be tokenized
+template< typename Definitions >
+static std::uint64_t count_tokens( const std::string& source, const Definitions& definitions )
+{
+  std::istringstream stream( source );
+  perseus::detail::enhanced_istream_iterator begin, end;
+  std::tie( begin, end ) = perseus::detail::enhanced_iterators( stream );
+  std::uint64_t tokens = 0;
+  const bool success = boost::spirit::lex::tokenize( begin, end, definitions, [ &tokens ]( const perseus::detail::token& )
+  {
+    ++tokens;
+    return true;
+  } );
+  return success ? tokens : 0;
+}
+
+PERSEUS_BENCHMARK( compiler )
+{
+  const std::string source = generated_source( 1000 );
+  const std::uint64_t bytes = source.size();
+
+  const perseus::detail::token_definitions lexer;
+  context.measure( "lex", "bytes", [ & ]()
+  {
+    return count_tokens( source, lexer ) > 0 ? bytes : 0;
+  } );
+
+  typedef perseus::detail::basic_token_definitions< perseus::detail::dynamic_lexer > dynamic_definitions;
+  context.measure( "lexer/construct/static", "lexers", []()
+  {
+    const perseus::detail::token_definitions definitions;
+    // the first tokenization is when the DFA gets built, if any
+    return count_tokens( "x", definitions ) > 0 ? 1 : 0;
+  } );
+  context.measure( "lexer/construct/dynamic", "lexers", []()
+  {
+    const dynamic_definitions definitions;
+    return count_tokens( "x", definitions ) > 0 ? 1 : 0;
+  } );
+  context.measure( "lexer/tokens/static", "tokens", [ & ]()
+  {
+    return count_tokens( source, lexer );
+  } );
+  const dynamic_definitions dynamic_lexer;
+  context.measure( "lexer/tokens/dynamic", "tokens", [ & ]()
+  {
+    return count_tokens( source, dynamic_lexer );
+  } );
+
+  context.measure( "lexer/tokens/scanner", "tokens", [ & ]()
+  {
+    perseus::detail::scanner scanner( source.data(), source.data() + source.size() );
+    perseus::detail::scanned_token token;
+    std::uint64_t tokens = 0;
+    while( scanner.next( token ) )
+    {
+      ++tokens;
+    }
+    return scanner.at_end() ? tokens : 0;
+  } );
+
+  context.measure( "first_parse", "compilers", []()
+  {
+    // a new compiler constructs its lexer and parser on its first parse
+    perseus::compiler compiler;
+    std::istringstream stream( "function main() -> i32\n    0\n" );
+    compiler.parse( stream, "<small>" );
+    return 1;
+  } );
+
+  perseus::compiler compiler;
+  context.measure( "parse", "bytes", [ & ]()
+  {
+    std::istringstream stream( source );
+    compiler.parse( stream, "<generated>" );
+    compiler.reset();
+    return bytes;
+  } );
+
+  context.measure( "compile_link", "bytes", [ & ]()
+  {
+    std::istringstream stream( source );
+    compiler.parse( stream, "<generated>" );
+    perseus::detail::processor proc = compiler.link();
+    compiler.reset();
+    return bytes;
+  } );
+
+  // like parse_file(), but without measuring the file system
+  context.measure( "parse_buffer", "bytes", [ & ]()
+  {
+    compiler.parse( source.data(), source.size(), "<generated>" );
+    compiler.reset();
+    return bytes;
+  } );
+
+  context.measure( "compile_link_buffer", "bytes", [ & ]()
+  {
+    compiler.parse( source.data(), source.size(), "<generated>" );
+    perseus::detail::processor proc = compiler.link();
+    compiler.reset();
+    return bytes;
+  } );
+}
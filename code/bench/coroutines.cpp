@@ -0,0 +1,95 @@
+#include "benchmark.hpp"
+#include "programs.hpp"
+
+#include "vm/coroutine_manager.hpp"
+#include "vm/code_segment.hpp"
+#include "vm/processor.hpp"
+#include "shared/opcodes.hpp"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/**
+@file
+
+Coroutine switches, and coroutine management with many simultaneous coroutines.
+*/
+
+using perseus::detail::coroutine_manager;
+using perseus::detail::dispatch_engine;
+using perseus::detail::processor;
+using identifier = perseus::detail::coroutine::identifier;
+
+PERSEUS_BENCHMARK( coroutines )
+{
+  constexpr std::int32_t rounds = 10000;
+  for( dispatch_engine engine : { dispatch_engine::switch_, dispatch_engine::computed_goto, dispatch_engine::tail_call, dispatch_engine::top_of_stack } )
+  {
+    processor proc( programs::ping_pong(), {}, engine );
+    context.measure( std::string( "ping_pong/" ) + perseus::detail::get_name( engine ), "switches", [ & ]()
+    {
+      proc.execute( 0, programs::single_argument( rounds ) );
+      // a resume and a yield per round
+      return std::uint64_t( 2 * rounds );
+    } );
+  }
+
+  for( bool pooled : { true, false } )
+  {
+    processor proc( programs::generators() );
+    perseus::detail::stack_pool::limits limits;
+    if( !pooled )
+    {
+      limits.max_stacks_per_bucket = 0;
+    }
+    proc.stacks().set_limits( limits );
+    context.measure( pooled ? "generators/pooled" : "generators/unpooled", "coroutines", [ & ]()
+    {
+      proc.execute( 0, programs::single_argument( rounds ) );
+      return std::uint64_t( rounds );
+    } );
+  }
+
+  constexpr std::uint64_t count = 100000;
+  perseus::detail::code_segment code;
+  code.push< perseus::detail::opcode >( perseus::detail::opcode::exit );
+
+  coroutine_manager manager;
+  std::vector< identifier > ids;
+  ids.reserve( count );
+  context.measure( "create_delete", "coroutines", [ & ]()
+  {
+    ids.clear();
+    for( std::uint64_t i = 0; i < count; ++i )
+    {
+      ids.push_back( manager.new_coroutine( code, 0 ).index );
+    }
+    for( identifier id : ids )
+    {
+      manager.delete_coroutine( id );
+    }
+    return count;
+  } );
+
+  std::vector< identifier > live;
+  for( std::uint64_t i = 0; i < count; ++i )
+  {
+    live.push_back( manager.new_coroutine( code, 0 ).index );
+  }
+  ids.clear();
+  for( std::uint64_t i = 0; i < count; ++i )
+  {
+    // scattered, like the coroutines a scheduler resumes
+    ids.push_back( live[ i * 7919 % count ] );
+  }
+  context.measure( "lookup", "lookups", [ & ]()
+  {
+    std::uint64_t suspended = 0;
+    for( identifier id : ids )
+    {
+      suspended += manager.get_coroutine( id ).current_state == perseus::detail::coroutine::state::suspended;
+    }
+    return suspended;
+  } );
+}
@@ -0,0 +1,45 @@
+#include "benchmark.hpp"
+#include "programs.hpp"
+
+#include "vm/processor.hpp"
+
+#include <string>
+#include <functional>
+#include <utility>
+
+/**
+@file
+
+Instructions per second of the different dispatch engines, with and without verification.
+*/
+
+using perseus::detail::processor;
+using perseus::detail::dispatch_engine;
+
+static void measure_engines( benchmark::context& context, const std::string& program_name, const perseus::detail::code_segment& code, std::function< perseus::stack() > arguments )
+{
+  for( dispatch_engine engine : { dispatch_engine::switch_, dispatch_engine::computed_goto, dispatch_engine::tail_call, dispatch_engine::top_of_stack } )
+  {
+    // verified code runs unchecked; the unverified runs show what the checks cost
+    for( bool verify : { true, false } )
+    {
+      processor proc( perseus::detail::code_segment( code ), {}, engine, verify );
+      perseus::detail::instruction_counter counter;
+      proc.execute( 0, arguments(), counter );
+      const std::uint64_t instructions = counter.instructions;
+      const std::string label = program_name + "/" + perseus::detail::get_name( engine ) + ( perseus::detail::is_native( engine ) ? "" : "(fallback)" ) + ( verify ? "" : "/unverified" );
+      context.measure( label, "instructions", [ & ]()
+      {
+        proc.execute( 0, arguments() );
+        return instructions;
+      } );
+    }
+  }
+}
+
+PERSEUS_BENCHMARK( dispatch )
+{
+  measure_engines( context, "factorial", programs::factorial(), [](){ return programs::single_argument( 12 ); } );
+  measure_engines( context, "fibonacci", programs::fibonacci(), [](){ return programs::single_argument( 20 ); } );
+  measure_engines( context, "arithmetic_loop", programs::arithmetic_loop(), [](){ return programs::arithmetic_loop_arguments( 10000 ); } );
+}
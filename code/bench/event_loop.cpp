@@ -0,0 +1,66 @@
+#include "benchmark.hpp"
+#include "programs.hpp"
+
+#include "vm/event_loop.hpp"
+#include "vm/processor.hpp"
+
+#include <cstdint>
+#include <future>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <sys/socket.h>
+#include <unistd.h>
+
+/**
+@file
+
+Messages per second exchanged through socket pairs by executions waiting on the event loop, for one pair and for many at once.
+*/
+
+using perseus::detail::event_loop;
+using perseus::detail::processor;
+
+PERSEUS_BENCHMARK( event_loop )
+{
+  constexpr std::int32_t round_trips = 1000;
+  for( const std::size_t pairs : { 1, 64 } )
+  {
+    context.measure( "socket_ping_pong/" + std::to_string( pairs ) + "_pairs", "messages", [ & ]()
+    {
+      perseus::detail::event_loop loop;
+      std::vector< int > sockets;
+      std::vector< std::unique_ptr< processor > > processors;
+      std::vector< std::future< perseus::stack > > results;
+      for( std::size_t i = 0; i < pairs; ++i )
+      {
+        int fds[ 2 ];
+        if( socketpair( AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, fds ) != 0 )
+        {
+          throw std::runtime_error( "socketpair failed" );
+        }
+        for( const int fd : fds )
+        {
+          sockets.push_back( fd );
+          processors.emplace_back( new processor( programs::socket_ping_pong(), { loop.read_syscall(), loop.write_syscall() } ) );
+          perseus::stack parameters;
+          parameters.push< std::int32_t >( fd );
+          parameters.push< std::int32_t >( round_trips );
+          results.push_back( loop.spawn( *processors.back(), 0, std::move( parameters ) ) );
+        }
+      }
+      loop.run();
+      for( std::future< perseus::stack >& result : results )
+      {
+        result.get();
+      }
+      for( const int fd : sockets )
+      {
+        close( fd );
+      }
+      return std::uint64_t( 2 * round_trips * pairs );
+    } );
+  }
+}
@@ -0,0 +1,35 @@
+#include "benchmark.hpp"
+#include "programs.hpp"
+
+#include "vm/processor.hpp"
+
+#include <string>
+#include <functional>
+
+/**
+@file
+
+Compiled functions compared with the interpreters they fall back to. Each processor executes the program repeatedly, so the first runs compile the hot functions and the remaining ones measure native code.
+*/
+
+using perseus::detail::processor;
+using perseus::detail::dispatch_engine;
+
+static void measure_engines( benchmark::context& context, const std::string& program_name, const perseus::detail::code_segment& code, std::function< perseus::stack() > arguments )
+{
+  for( dispatch_engine engine : { dispatch_engine::switch_, dispatch_engine::top_of_stack, dispatch_engine::jit } )
+  {
+    processor proc( perseus::detail::code_segment( code ), {}, engine );
+    context.measure( program_name + "/" + perseus::detail::get_name( engine ), "runs", [ & ]()
+    {
+      proc.execute( 0, arguments() );
+      return 1;
+    } );
+  }
+}
+
+PERSEUS_BENCHMARK( jit )
+{
+  measure_engines( context, "fibonacci", programs::fibonacci_fused(), [](){ return programs::single_argument( 20 ); } );
+  measure_engines( context, "arithmetic_function", programs::arithmetic_loop_function(), [](){ return programs::arithmetic_loop_arguments( 10000 ); } );
+}
@@ -0,0 +1,158 @@
+#include "benchmark.hpp"
+
+#include <algorithm>
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <limits>
+#include <string>
+#include <cstdlib>
+
+using namespace std::string_literals;
+
+namespace benchmark
+{
+  std::vector< std::pair< std::string, function > >& registry()
+  {
+    static std::vector< std::pair< std::string, function > > benchmarks;
+    return benchmarks;
+  }
+}
+
+void print_usage( const char* program )
+{
+  std::cout << "Usage: " << program << R"( [-h] [--min-time <seconds>] [--repetitions <count>] [--json <file>] [<filter>]
+ -h                      : show this help
+ --min-time <seconds>    : minimum duration of each repetition of a measurement (default 0.2)
+ --repetitions <count>   : how often to repeat each measurement; the median is reported (default 3)
+ --json <file>           : also write the results to this file as JSON, e.g. for bench/compare.py
+ <filter>                : only take measurements whose name, as printed, contains this)" << std::endl;
+}
+
+/// Writes a string as a JSON string literal
+static void write_json_string( std::ostream& out, const std::string& str )
+{
+  out << '"';
+  for( const char c : str )
+  {
+    if( c == '"' || c == '\\' )
+    {
+      out << '\\' << c;
+    }
+    else if( static_cast< unsigned char >( c ) < 0x20 )
+    {
+      out << "\\u" << std::hex << std::setfill( '0' ) << std::setw( 4 ) << static_cast< unsigned int >( c ) << std::dec << std::setfill( ' ' );
+    }
+    else
+    {
+      out << c;
+    }
+  }
+  out << '"';
+}
+
+/// Writes the results as `{ "min_time": ..., "repetitions": ..., "results": [ { "name": ..., "unit": ..., "iterations": ..., "items_per_second": ..., "repetitions": [ ... ] }, ... ] }`
+static void write_json( std::ostream& out, const std::vector< benchmark::result >& results, const double min_time, const unsigned int repetitions )
+{
+  out << std::setprecision( std::numeric_limits< double >::max_digits10 );
+  out << "{\n  \"min_time\": " << min_time << ",\n  \"repetitions\": " << repetitions << ",\n  \"results\": [";
+  const char* separator = "\n";
+  for( const benchmark::result& result : results )
+  {
+    out << separator << "    { \"name\": ";
+    separator = ",\n";
+    write_json_string( out, result.name );
+    out << ", \"unit\": ";
+    write_json_string( out, result.unit );
+    out << ", \"iterations\": " << result.iterations << ", \"items_per_second\": " << result.items_per_second() << ", \"repetitions\": [";
+    const char* value_separator = " ";
+    for( const double value : result.repetitions )
+    {
+      out << value_separator << value;
+      value_separator = ", ";
+    }
+    out << " ] }";
+  }
+  out << "\n  ]\n}\n";
+}
+
+int main( int argc, const char** argv )
+{
+  double min_time = 0.2;
+  unsigned int repetitions = 3;
+  std::string json_path;
+  std::string filter;
+  for( int i = 1; i < argc; ++i )
+  {
+    if( argv[ i ] == "-h"s || argv[ i ] == "--help"s )
+    {
+      print_usage( argv[ 0 ] );
+      return 0;
+    }
+    else if( argv[ i ] == "--min-time"s || argv[ i ] == "--repetitions"s || argv[ i ] == "--json"s )
+    {
+      const std::string option = argv[ i ];
+      if( ++i == argc )
+      {
+        print_usage( argv[ 0 ] );
+        return 1;
+      }
+      if( option == "--min-time" )
+      {
+        min_time = std::atof( argv[ i ] );
+      }
+      else if( option == "--repetitions" )
+      {
+        repetitions = static_cast< unsigned int >( std::max( 1, std::atoi( argv[ i ] ) ) );
+      }
+      else
+      {
+        json_path = argv[ i ];
+      }
+    }
+    else
+    {
+      filter = argv[ i ];
+    }
+  }
+
+  std::vector< benchmark::result > results;
+  try
+  {
+    for( const auto& entry : benchmark::registry() )
+    {
+      // the measurements' names are only known once the benchmark runs, so measure() does the filtering
+      benchmark::context context( entry.first, min_time, repetitions, filter );
+      entry.second( context );
+      for( const benchmark::result& result : context.results() )
+      {
+        std::cout << std::left << std::setw( 48 ) << result.name
+          << std::right << std::setw( 16 ) << std::fixed << std::setprecision( 0 ) << result.items_per_second()
+          << ' ' << result.unit << "/s"
+          << std::setw( 8 ) << std::setprecision( 1 ) << 100 * result.spread() << "% spread" << std::endl;
+        results.push_back( result );
+      }
+    }
+  }
+  catch( std::exception& e )
+  {
+    std::cerr << "Exception: " << e.what() << std::endl;
+    return 1;
+  }
+  if( results.empty() )
+  {
+    std::cerr << "No measurement matches " << filter << "!" << std::endl;
+    return 1;
+  }
+
+  if( !json_path.empty() )
+  {
+    std::ofstream json( json_path );
+    write_json( json, results, min_time, repetitions );
+    if( !json )
+    {
+      std::cerr << "Failed to write " << json_path << "!" << std::endl;
+      return 1;
+    }
+  }
+}
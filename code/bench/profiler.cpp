@@ -0,0 +1,35 @@
+#include "benchmark.hpp"
+#include "programs.hpp"
+
+#include "vm/processor.hpp"
+
+#include <cstdint>
+#include <string>
+
+/**
+@file
+
+The cost of sampling: recursive fibonacci without profiling, and sampled at different intervals.
+*/
+
+using perseus::detail::processor;
+using perseus::detail::dispatch_engine;
+
+PERSEUS_BENCHMARK( profiler )
+{
+  processor proc( programs::fibonacci_fused(), {}, dispatch_engine::switch_ );
+  context.measure( "off", "runs", [ & ]()
+  {
+    proc.execute( 0, programs::single_argument( 20 ) );
+    return 1;
+  } );
+  for( const std::uint64_t interval : { 10000u, 1000u, 100u } )
+  {
+    proc.start_profiling( interval );
+    context.measure( "interval_" + std::to_string( interval ), "runs", [ & ]()
+    {
+      proc.execute( 0, programs::single_argument( 20 ) );
+      return 1;
+    } );
+  }
+}
@@ -0,0 +1,457 @@
+#pragma once
+
+#include "../test/write_code_segment.hpp"
+
+#include "vm/stack.hpp"
+#include "vm/actor_system.hpp"
+#include "shared/opcodes.hpp"
+
+#include <cstdint>
+
+/**
+@file
+
+Bytecode programs used by several benchmarks, modelled after those in the execution tests.
+*/
+
+namespace programs
+{
+  using perseus::detail::opcode;
+
+  /// Recursive factorial( n ); expects n on the stack, leaves the result. The program from the call_and_return_factorial test.
+  inline perseus::detail::code_segment factorial()
+  {
+    return create_code_segment(
+      opcode::relative_load_stack, std::uint32_t( 4 ), std::int32_t( -4 ),
+      opcode::call, label_reference( "factorial" ),
+      opcode::exit,
+
+      label( "factorial" ),
+      opcode::relative_load_stack, std::uint32_t( 4 ), std::int32_t( -8 ),
+      opcode::push_32, std::int32_t( 1 ),
+      opcode::less_than_or_equals_i32,
+      opcode::relative_jump_if_false, label_reference_offset( "n > 1" ),
+      opcode::push_32, std::int32_t( 1 ),
+      opcode::relative_jump, label_reference_offset( "return_top_of_stack" ),
+
+      label( "n > 1" ),
+      opcode::reserve, std::uint32_t( 4 ),
+      opcode::relative_load_stack, std::uint32_t( 4 ), std::int32_t( -12 ),
+      opcode::push_32, std::int32_t( 1 ),
+      opcode::subtract_i32,
+      opcode::call, label_reference( "factorial" ),
+      opcode::relative_load_stack, std::uint32_t( 4 ), std::int32_t( -12 ),
+      opcode::multiply_i32,
+
+      label( "return_top_of_stack" ),
+      opcode::relative_store_stack, std::uint32_t( 4 ), std::int32_t( -16 ),
+      opcode::pop, std::uint32_t( 4 ),
+      opcode::return_, std::uint32_t( 4 )
+      );
+  }
+
+  /// Recursive fibonacci( n ), as in scripts/fib.per; expects n on the stack, leaves n and the result.
+  inline perseus::detail::code_segment fibonacci()
+  {
+    return create_code_segment(
+      opcode::reserve, std::uint32_t( 4 ),
+      opcode::relative_load_stack, std::uint32_t( 4 ), std::int32_t( -8 ),
+      opcode::call, label_reference( "fib" ),
+      opcode::exit,
+
+      label( "fib" ),
+      // stack: [-12: return_value] [-8: n] [-4: return_address]
+      opcode::relative_load_stack, std::uint32_t( 4 ), std::int32_t( -8 ),
+      opcode::push_32, std::int32_t( 1 ),
+      opcode::less_than_or_equals_i32,
+      opcode::relative_jump_if_false, label_reference_offset( "recurse" ),
+      opcode::relative_load_stack, std::uint32_t( 4 ), std::int32_t( -8 ),
+      opcode::relative_jump, label_reference_offset( "return_top_of_stack" ),
+
+      label( "recurse" ),
+      opcode::reserve, std::uint32_t( 4 ),
+      opcode::relative_load_stack, std::uint32_t( 4 ), std::int32_t( -12 ),
+      opcode::push_32, std::int32_t( 1 ),
+      opcode::subtract_i32,
+      opcode::call, label_reference( "fib" ),
+      opcode::reserve, std::uint32_t( 4 ),
+      opcode::relative_load_stack, std::uint32_t( 4 ), std::int32_t( -16 ),
+      opcode::push_32, std::int32_t( 2 ),
+      opcode::subtract_i32,
+      opcode::call, label_reference( "fib" ),
+      opcode::add_i32,
+
+      label( "return_top_of_stack" ),
+      // stack: [-16: return_value] [-12: n] [-8: return_address] [-4: result]
+      opcode::relative_store_stack, std::uint32_t( 4 ), std::int32_t( -16 ),
+      opcode::pop, std::uint32_t( 4 ),
+      opcode::return_, std::uint32_t( 4 )
+      );
+  }
+
+  /// @ref fibonacci() using superinstructions, as the compiler generates it
+  inline perseus::detail::code_segment fibonacci_fused()
+  {
+    return create_code_segment(
+      opcode::reserve, std::uint32_t( 4 ),
+      opcode::load_local_32, std::int32_t( -8 ),
+      opcode::call, label_reference( "fib" ),
+      opcode::exit,
+
+      label( "fib" ),
+      // stack: [-12: return_value] [-8: n] [-4: return_address]
+      opcode::load_local_32, std::int32_t( -8 ),
+      opcode::push_32, std::int32_t( 1 ),
+      opcode::less_than_or_equals_i32_jump_if_false, label_reference_offset( "recurse" ),
+      opcode::load_local_32, std::int32_t( -8 ),
+      opcode::store_pop_return, std::uint32_t( 4 ), std::uint32_t( 4 ), std::uint32_t( 4 ),
+
+      label( "recurse" ),
+      opcode::reserve, std::uint32_t( 4 ),
+      opcode::load_local_32, std::int32_t( -12 ),
+      opcode::add_immediate_i32, std::int32_t( -1 ),
+      opcode::call, label_reference( "fib" ),
+      opcode::reserve, std::uint32_t( 4 ),
+      opcode::load_local_32, std::int32_t( -16 ),
+      opcode::add_immediate_i32, std::int32_t( -2 ),
+      opcode::call, label_reference( "fib" ),
+      opcode::add_i32,
+      opcode::store_pop_return, std::uint32_t( 4 ), std::uint32_t( 4 ), std::uint32_t( 4 )
+      );
+  }
+
+  /// Arithmetic loop: `while n > 0 { acc = acc + n * 3 % 7; n = n - 1 }`; expects acc and n on the stack, leaves acc.
+  inline perseus::detail::code_segment arithmetic_loop()
+  {
+    return create_code_segment(
+      label( "loop" ),
+      // stack: [-8: acc] [-4: n]
+      opcode::relative_load_stack, std::uint32_t( 4 ), std::int32_t( -4 ),
+      opcode::push_32, std::int32_t( 0 ),
+      opcode::greater_than_i32,
+      opcode::relative_jump_if_false, label_reference_offset( "end" ),
+
+      opcode::relative_load_stack, std::uint32_t( 4 ), std::int32_t( -8 ),
+      opcode::relative_load_stack, std::uint32_t( 4 ), std::int32_t( -8 ),
+      opcode::push_32, std::int32_t( 3 ),
+      opcode::multiply_i32,
+      opcode::push_32, std::int32_t( 7 ),
+      opcode::modulo_i32,
+      opcode::add_i32,
+      opcode::relative_store_stack, std::uint32_t( 4 ), std::int32_t( -12 ),
+      opcode::pop, std::uint32_t( 4 ),
+
+      opcode::relative_load_stack, std::uint32_t( 4 ), std::int32_t( -4 ),
+      opcode::push_32, std::int32_t( 1 ),
+      opcode::subtract_i32,
+      opcode::relative_store_stack, std::uint32_t( 4 ), std::int32_t( -8 ),
+      opcode::pop, std::uint32_t( 4 ),
+      opcode::relative_jump, label_reference_offset( "loop" ),
+
+      label( "end" ),
+      opcode::pop, std::uint32_t( 4 ),
+      opcode::exit
+      );
+  }
+
+  /// @ref arithmetic_loop() using superinstructions
+  inline perseus::detail::code_segment arithmetic_loop_fused()
+  {
+    return create_code_segment(
+      label( "loop" ),
+      // stack: [-8: acc] [-4: n]
+      opcode::load_local_32, std::int32_t( -4 ),
+      opcode::push_32, std::int32_t( 0 ),
+      opcode::greater_than_i32_jump_if_false, label_reference_offset( "end" ),
+
+      opcode::load_local_32, std::int32_t( -8 ),
+      opcode::load_local_32, std::int32_t( -8 ),
+      opcode::push_32, std::int32_t( 3 ),
+      opcode::multiply_i32,
+      opcode::push_32, std::int32_t( 7 ),
+      opcode::modulo_i32,
+      opcode::add_i32,
+      opcode::relative_store_stack, std::uint32_t( 4 ), std::int32_t( -12 ),
+      opcode::pop, std::uint32_t( 4 ),
+
+      opcode::load_local_32, std::int32_t( -4 ),
+      opcode::add_immediate_i32, std::int32_t( -1 ),
+      opcode::relative_store_stack, std::uint32_t( 4 ), std::int32_t( -8 ),
+      opcode::pop, std::uint32_t( 4 ),
+      opcode::relative_jump, label_reference_offset( "loop" ),
+
+      label( "end" ),
+      opcode::pop, std::uint32_t( 4 ),
+      opcode::exit
+      );
+  }
+
+  /// @ref arithmetic_loop_fused() as a function called by the program, so a JIT compiling functions can compile it
+  inline perseus::detail::code_segment arithmetic_loop_function()
+  {
+    return create_code_segment(
+      opcode::call, label_reference( "function" ),
+      opcode::pop, std::uint32_t( 4 ),
+      opcode::exit,
+
+      label( "function" ),
+      label( "loop" ),
+      // stack: [-12: acc] [-8: n] [-4: return_address]
+      opcode::load_local_32, std::int32_t( -8 ),
+      opcode::push_32, std::int32_t( 0 ),
+      opcode::greater_than_i32_jump_if_false, label_reference_offset( "end" ),
+
+      opcode::load_local_32, std::int32_t( -12 ),
+      opcode::load_local_32, std::int32_t( -12 ),
+      opcode::push_32, std::int32_t( 3 ),
+      opcode::multiply_i32,
+      opcode::push_32, std::int32_t( 7 ),
+      opcode::modulo_i32,
+      opcode::add_i32,
+      opcode::relative_store_stack, std::uint32_t( 4 ), std::int32_t( -16 ),
+      opcode::pop, std::uint32_t( 4 ),
+
+      opcode::load_local_32, std::int32_t( -8 ),
+      opcode::add_immediate_i32, std::int32_t( -1 ),
+      opcode::relative_store_stack, std::uint32_t( 4 ), std::int32_t( -12 ),
+      opcode::pop, std::uint32_t( 4 ),
+      opcode::relative_jump, label_reference_offset( "loop" ),
+
+      label( "end" ),
+      opcode::return_, std::uint32_t( 0 )
+      );
+  }
+
+  /// Calls a function that returns right away n times, to measure call and return on their own; expects n on the stack, leaves it at 0.
+  inline perseus::detail::code_segment call_loop()
+  {
+    return create_code_segment(
+      label( "loop" ),
+      // stack: [-4: n]
+      opcode::load_local_32, std::int32_t( -4 ),
+      opcode::push_32, std::int32_t( 0 ),
+      opcode::greater_than_i32_jump_if_false, label_reference_offset( "end" ),
+      opcode::call, label_reference( "empty" ),
+      opcode::add_immediate_i32, std::int32_t( -1 ),
+      opcode::relative_jump, label_reference_offset( "loop" ),
+
+      label( "end" ),
+      opcode::exit,
+
+      label( "empty" ),
+      opcode::return_, std::uint32_t( 0 )
+      );
+  }
+
+  /// Coroutine ping-pong: resumes a coroutine n times, passing it 4 bytes that it yields back incremented; expects n on the stack, leaves it at 0.
+  inline perseus::detail::code_segment ping_pong()
+  {
+    return create_code_segment(
+      opcode::absolute_coroutine, label_reference( "pong" ),
+
+      label( "loop" ),
+      // stack: [-8: n] [-4: coroutine]
+      opcode::relative_load_stack, std::uint32_t( 4 ), std::int32_t( -8 ),
+      opcode::push_32, std::int32_t( 0 ),
+      opcode::greater_than_i32,
+      opcode::relative_jump_if_false, label_reference_offset( "end" ),
+
+      // ping n, get n + 1 back
+      opcode::relative_load_stack, std::uint32_t( 8 ), std::int32_t( -8 ),
+      opcode::resume_coroutine, std::uint32_t( 4 ),
+      opcode::pop, std::uint32_t( 4 ),
+
+      opcode::relative_load_stack, std::uint32_t( 4 ), std::int32_t( -8 ),
+      opcode::push_32, std::int32_t( 1 ),
+      opcode::subtract_i32,
+      opcode::relative_store_stack, std::uint32_t( 4 ), std::int32_t( -12 ),
+      opcode::pop, std::uint32_t( 4 ),
+      opcode::relative_jump, label_reference_offset( "loop" ),
+
+      label( "end" ),
+      opcode::delete_coroutine,
+      opcode::exit,
+
+      label( "pong" ),
+      // stack: [-4: value]
+      opcode::push_32, std::int32_t( 1 ),
+      opcode::add_i32,
+      opcode::yield, std::uint32_t( 4 ),
+      opcode::relative_jump, label_reference_offset( "pong" )
+      );
+  }
+
+  /// Short-lived generators: creates, resumes and deletes a coroutine n times, each using 256 bytes of stack; expects n on the stack, leaves it at 0.
+  inline perseus::detail::code_segment generators()
+  {
+    return create_code_segment(
+      label( "loop" ),
+      // stack: [-4: n]
+      opcode::relative_load_stack, std::uint32_t( 4 ), std::int32_t( -4 ),
+      opcode::push_32, std::int32_t( 0 ),
+      opcode::greater_than_i32,
+      opcode::relative_jump_if_false, label_reference_offset( "end" ),
+
+      opcode::absolute_coroutine, label_reference( "generator" ),
+      opcode::relative_load_stack, std::uint32_t( 4 ), std::int32_t( -4 ),
+      opcode::resume_coroutine, std::uint32_t( 0 ),
+      opcode::pop, std::uint32_t( 4 ),
+      opcode::delete_coroutine,
+
+      opcode::relative_load_stack, std::uint32_t( 4 ), std::int32_t( -4 ),
+      opcode::push_32, std::int32_t( 1 ),
+      opcode::subtract_i32,
+      opcode::relative_store_stack, std::uint32_t( 4 ), std::int32_t( -8 ),
+      opcode::pop, std::uint32_t( 4 ),
+      opcode::relative_jump, label_reference_offset( "loop" ),
+
+      label( "end" ),
+      opcode::exit,
+
+      label( "generator" ),
+      opcode::reserve, std::uint32_t( 256 ),
+      opcode::push_32, std::int32_t( 42 ),
+      opcode::coroutine_return, std::uint32_t( 4 )
+      );
+  }
+
+  /// Actor sending n messages to a @ref pong_actor(), one at a time, summing the replies; expects the ponger's identifier, n and 0 on the stack.
+  inline perseus::detail::code_segment ping_actor()
+  {
+    using perseus::detail::actor_system;
+    return create_code_segment(
+      label( "loop" ),
+      // stack: [-12: ponger] [-8: n] [-4: sum]
+      opcode::relative_load_stack, std::uint32_t( 4 ), std::int32_t( -8 ),
+      opcode::push_32, std::int32_t( 0 ),
+      opcode::greater_than_i32,
+      opcode::relative_jump_if_false, label_reference_offset( "end" ),
+
+      // send [n] [self]
+      opcode::relative_load_stack, std::uint32_t( 4 ), std::int32_t( -8 ),
+      opcode::syscall, std::uint32_t( actor_system::self_syscall ),
+      opcode::push_32, std::uint32_t( 8 ),
+      opcode::relative_load_stack, std::uint32_t( 4 ), std::int32_t( -24 ),
+      opcode::syscall, std::uint32_t( actor_system::send_syscall ),
+
+      // sum += reply
+      opcode::syscall, std::uint32_t( actor_system::receive_syscall ),
+      opcode::pop, std::uint32_t( 4 ),
+      opcode::add_i32,
+
+      opcode::relative_load_stack, std::uint32_t( 4 ), std::int32_t( -8 ),
+      opcode::push_32, std::int32_t( 1 ),
+      opcode::subtract_i32,
+      opcode::relative_store_stack, std::uint32_t( 4 ), std::int32_t( -12 ),
+      opcode::pop, std::uint32_t( 4 ),
+      opcode::relative_jump, label_reference_offset( "loop" ),
+
+      label( "end" ),
+      opcode::exit
+      );
+  }
+
+  /// Actor replying to every message [value] [sender] with [value + 1], forever
+  inline perseus::detail::code_segment pong_actor()
+  {
+    using perseus::detail::actor_system;
+    return create_code_segment(
+      label( "loop" ),
+      opcode::syscall, std::uint32_t( actor_system::receive_syscall ),
+      opcode::pop, std::uint32_t( 4 ),
+      // stack: [-8: value] [-4: sender]
+      opcode::relative_load_stack, std::uint32_t( 4 ), std::int32_t( -8 ),
+      opcode::push_32, std::int32_t( 1 ),
+      opcode::add_i32,
+      opcode::push_32, std::uint32_t( 4 ),
+      opcode::relative_load_stack, std::uint32_t( 4 ), std::int32_t( -12 ),
+      opcode::syscall, std::uint32_t( actor_system::send_syscall ),
+      opcode::pop, std::uint32_t( 8 ),
+      opcode::relative_jump, label_reference_offset( "loop" )
+      );
+  }
+
+  /// Sends n (4 bytes) through the socket, then receives 4 bytes, and repeats that n times, using @ref perseus::detail::event_loop syscalls 0 (read) and 1 (write); expects [fd] [n] on the stack
+  inline perseus::detail::code_segment socket_ping_pong()
+  {
+    return create_code_segment(
+      label( "loop" ),
+      // stack: [-8: fd] [-4: n]
+      opcode::relative_load_stack, std::uint32_t( 4 ), std::int32_t( -4 ),
+      opcode::push_32, std::int32_t( 0 ),
+      opcode::greater_than_i32,
+      opcode::relative_jump_if_false, label_reference_offset( "end" ),
+
+      // write [n]
+      opcode::relative_load_stack, std::uint32_t( 4 ), std::int32_t( -4 ),
+      opcode::push_32, std::uint32_t( 4 ),
+      opcode::relative_load_stack, std::uint32_t( 4 ), std::int32_t( -16 ),
+      opcode::syscall, std::uint32_t( 1 ),
+      opcode::pop, std::uint32_t( 4 ),
+
+      // read 4 bytes
+      opcode::push_32, std::uint32_t( 4 ),
+      opcode::relative_load_stack, std::uint32_t( 4 ), std::int32_t( -12 ),
+      opcode::syscall, std::uint32_t( 0 ),
+      opcode::pop, std::uint32_t( 8 ),
+
+      opcode::relative_load_stack, std::uint32_t( 4 ), std::int32_t( -4 ),
+      opcode::push_32, std::int32_t( 1 ),
+      opcode::subtract_i32,
+      opcode::relative_store_stack, std::uint32_t( 4 ), std::int32_t( -8 ),
+      opcode::pop, std::uint32_t( 4 ),
+      opcode::relative_jump, label_reference_offset( "loop" ),
+
+      label( "end" ),
+      opcode::exit
+      );
+  }
+
+  /// Pushes the squares of n down to 1, then calls syscall 0 and exits; expects n on the stack. Stands in for initialization worth saving in a snapshot.
+  inline perseus::detail::code_segment squares()
+  {
+    return create_code_segment(
+      label( "loop" ),
+      // stack: [squares] [-4: n]
+      opcode::relative_load_stack, std::uint32_t( 4 ), std::int32_t( -4 ),
+      opcode::push_32, std::int32_t( 0 ),
+      opcode::greater_than_i32,
+      opcode::relative_jump_if_false, label_reference_offset( "end" ),
+
+      // [n] -> [n * n] [n - 1]
+      opcode::relative_load_stack, std::uint32_t( 4 ), std::int32_t( -4 ),
+      opcode::relative_load_stack, std::uint32_t( 4 ), std::int32_t( -8 ),
+      opcode::multiply_i32,
+      opcode::relative_load_stack, std::uint32_t( 4 ), std::int32_t( -8 ),
+      opcode::push_32, std::int32_t( 1 ),
+      opcode::subtract_i32,
+      opcode::relative_load_stack, std::uint32_t( 4 ), std::int32_t( -8 ),
+      opcode::relative_store_stack, std::uint32_t( 4 ), std::int32_t( -16 ),
+      opcode::pop, std::uint32_t( 4 ),
+      opcode::relative_store_stack, std::uint32_t( 4 ), std::int32_t( -8 ),
+      opcode::pop, std::uint32_t( 4 ),
+      opcode::relative_jump, label_reference_offset( "loop" ),
+
+      label( "end" ),
+      opcode::syscall, std::uint32_t( 0 ),
+      opcode::exit
+      );
+  }
+
+  /// Initial stack containing a single i32
+  inline perseus::stack single_argument( const std::int32_t n )
+  {
+    perseus::stack result;
+    result.push< std::int32_t >( n );
+    return result;
+  }
+
+  /// Initial stack for @ref arithmetic_loop()
+  inline perseus::stack arithmetic_loop_arguments( const std::int32_t n )
+  {
+    perseus::stack result;
+    result.push< std::int32_t >( 0 );
+    result.push< std::int32_t >( n );
+    return result;
+  }
+}
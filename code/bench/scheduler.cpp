@@ -0,0 +1,50 @@
+#include "benchmark.hpp"
+#include "programs.hpp"
+
+#include "vm/processor.hpp"
+#include "vm/scheduler.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <future>
+#include <string>
+#include <thread>
+#include <vector>
+
+/**
+@file
+
+Scaling of the scheduler from one worker thread to one per core.
+*/
+
+using perseus::detail::processor;
+
+PERSEUS_BENCHMARK( scheduler )
+{
+  constexpr std::uint64_t tasks = 256;
+  const processor proc( programs::fibonacci(), {}, perseus::detail::dispatch_engine::computed_goto );
+  const std::size_t cores = std::max( std::thread::hardware_concurrency(), 1u );
+  std::vector< std::size_t > thread_counts;
+  for( std::size_t threads = 1; threads < cores; threads *= 2 )
+  {
+    thread_counts.push_back( threads );
+  }
+  thread_counts.push_back( cores );
+  for( const std::size_t threads : thread_counts )
+  {
+    perseus::detail::scheduler sched( proc, threads );
+    std::vector< std::future< perseus::stack > > results( tasks );
+    context.measure( "fibonacci/" + std::to_string( threads ) + "_threads", "runs", [ & ]()
+    {
+      for( std::future< perseus::stack >& result : results )
+      {
+        result = sched.submit( 0, programs::single_argument( 15 ) );
+      }
+      for( std::future< perseus::stack >& result : results )
+      {
+        result.get();
+      }
+      return tasks;
+    } );
+  }
+}
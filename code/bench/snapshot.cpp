@@ -0,0 +1,85 @@
+#include "benchmark.hpp"
+#include "programs.hpp"
+
+#include "vm/processor.hpp"
+#include "vm/exceptions.hpp"
+
+#include <cstdint>
+#include <cstdio>
+#include <stdexcept>
+#include <string>
+
+#include <stdlib.h>
+#include <unistd.h>
+
+/**
+@file
+
+Getting a processor into a warmed-up state by running its initialization, compared to restoring a snapshot of that state; and periodic checkpoints of that state, full or as deltas.
+*/
+
+using perseus::detail::processor;
+
+namespace
+{
+  /// a processor whose syscall suspends execution
+  processor suspending_processor( const perseus::stack_backend backend )
+  {
+    return processor( programs::squares(), { []( perseus::stack& ){ throw perseus::would_block( "initialized" ); } }, perseus::detail::dispatch_engine::switch_, true, backend );
+  }
+
+  /// runs the initialization, leaving 4 MiB on the stack
+  void initialize( processor& proc )
+  {
+    try
+    {
+      proc.execute( 0, programs::single_argument( 1 << 20 ) );
+    }
+    catch( const perseus::would_block& )
+    {
+    }
+  }
+}
+
+PERSEUS_BENCHMARK( snapshot )
+{
+  char path[] = "/tmp/perseus_bench_snapshot_XXXXXX";
+  const int descriptor = mkstemp( path );
+  if( descriptor < 0 )
+  {
+    throw std::runtime_error( "can't create a temporary file" );
+  }
+  close( descriptor );
+  processor initialized = suspending_processor( perseus::stack_backend::heap );
+  initialize( initialized );
+  initialized.save_snapshot( path );
+
+  context.measure( "initialize", "processors", [ & ]()
+  {
+    processor proc = suspending_processor( perseus::stack_backend::heap );
+    initialize( proc );
+    return std::uint64_t( 1 );
+  } );
+  for( const perseus::stack_backend backend : { perseus::stack_backend::heap, perseus::stack_backend::reserved } )
+  {
+    context.measure( backend == perseus::stack_backend::heap ? "restore/heap" : "restore/reserved", "processors", [ & ]()
+    {
+      processor proc = suspending_processor( backend );
+      proc.restore_snapshot( path );
+      return std::uint64_t( 1 );
+    } );
+  }
+
+  // nothing changes in between, like an idle processor's stacks
+  context.measure( "checkpoint/full", "checkpoints", [ & ]()
+  {
+    initialized.save_snapshot( path );
+    return std::uint64_t( 1 );
+  } );
+  context.measure( "checkpoint/delta", "checkpoints", [ & ]()
+  {
+    initialized.save_delta( path );
+    return std::uint64_t( 1 );
+  } );
+  std::remove( path );
+}
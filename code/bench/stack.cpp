@@ -0,0 +1,64 @@
+#include "benchmark.hpp"
+
+#include "vm/stack.hpp"
+
+#include <cstdint>
+
+/**
+@file
+
+Pushing and popping values on a @ref perseus::stack directly, without an interpreter around it.
+*/
+
+PERSEUS_BENCHMARK( stack )
+{
+  constexpr std::uint64_t values = 1000;
+  perseus::stack st;
+
+  context.measure( "push_pop_i32", "values", [ & ]()
+  {
+    for( std::uint64_t i = 0; i < values; ++i )
+    {
+      st.push< std::int32_t >( static_cast< std::int32_t >( i ) );
+    }
+    std::int32_t sum = 0;
+    for( std::uint64_t i = 0; i < values; ++i )
+    {
+      sum += st.pop< std::int32_t >();
+    }
+    // keeps the pops from being optimized away
+    st.push< std::int32_t >( sum );
+    st.pop< std::int32_t >();
+    return values;
+  } );
+
+  context.measure( "push_pop_mixed", "values", [ & ]()
+  {
+    // unaligned values, like bools between i32s
+    for( std::uint64_t i = 0; i < values; i += 2 )
+    {
+      st.push< bool >( i % 4 == 0 );
+      st.push< std::int32_t >( static_cast< std::int32_t >( i ) );
+    }
+    std::int32_t sum = 0;
+    for( std::uint64_t i = 0; i < values; i += 2 )
+    {
+      sum += st.pop< std::int32_t >();
+      sum += st.pop< bool >();
+    }
+    st.push< std::int32_t >( sum );
+    st.pop< std::int32_t >();
+    return values;
+  } );
+
+  context.measure( "grow", "values", [ & ]()
+  {
+    // a fresh stack each time, so its buffer grows from nothing
+    perseus::stack fresh;
+    for( std::uint64_t i = 0; i < values; ++i )
+    {
+      fresh.push< std::int32_t >( static_cast< std::int32_t >( i ) );
+    }
+    return values;
+  } );
+}
@@ -0,0 +1,39 @@
+#include "benchmark.hpp"
+#include "programs.hpp"
+
+#include "vm/processor.hpp"
+
+#include <string>
+#include <functional>
+
+/**
+@file
+
+Programs with and without superinstructions; runs per second are comparable, unlike the instructions per second of the dispatch benchmark.
+*/
+
+using perseus::detail::processor;
+using perseus::detail::dispatch_engine;
+
+static void measure_variants( benchmark::context& context, const std::string& program_name, const perseus::detail::code_segment& plain, const perseus::detail::code_segment& fused, std::function< perseus::stack() > arguments )
+{
+  for( dispatch_engine engine : { dispatch_engine::switch_, dispatch_engine::computed_goto, dispatch_engine::tail_call, dispatch_engine::top_of_stack } )
+  {
+    for( const bool use_fused : { false, true } )
+    {
+      processor proc( perseus::detail::code_segment( use_fused ? fused : plain ), {}, engine );
+      const std::string label = program_name + "/" + perseus::detail::get_name( engine ) + ( use_fused ? "/fused" : "/plain" );
+      context.measure( label, "runs", [ & ]()
+      {
+        proc.execute( 0, arguments() );
+        return 1;
+      } );
+    }
+  }
+}
+
+PERSEUS_BENCHMARK( superinstructions )
+{
+  measure_variants( context, "fibonacci", programs::fibonacci(), programs::fibonacci_fused(), [](){ return programs::single_argument( 20 ); } );
+  measure_variants( context, "arithmetic_loop", programs::arithmetic_loop(), programs::arithmetic_loop_fused(), [](){ return programs::arithmetic_loop_arguments( 10000 ); } );
+}
@@ -0,0 +1,34 @@
+#include "compiler/basic_token_definitions.hpp"
+
+#include <boost/spirit/home/lex/lexer/lexertl/generate_static.hpp>
+
+#include <fstream>
+#include <iostream>
+
+/**
+@file
+
+Build step writing the DFA of the token definitions as C++ tables, so the compiler's lexer doesn't need to build it at runtime; see token_definitions.hpp.
+*/
+
+int main( int argc, const char** argv )
+{
+  if( argc != 2 )
+  {
+    std::cout << "Usage: " << argv[ 0 ] << " <header>" << std::endl;
+    return 1;
+  }
+  const perseus::detail::basic_token_definitions< perseus::detail::dynamic_lexer > definitions;
+  std::ofstream out( argv[ 1 ], std::ios::trunc );
+  if( !boost::spirit::lex::lexertl::generate_static_dfa( definitions, out, "perseus" ) )
+  {
+    std::cerr << "Failed to generate the lexer tables!" << std::endl;
+    return 1;
+  }
+  out.close();
+  if( !out )
+  {
+    std::cerr << "Failed to write " << argv[ 1 ] << "!" << std::endl;
+    return 1;
+  }
+}
@@ -1,20 +1,35 @@
 #include "compiler/compiler.hpp"
 #include "compiler/token_definitions.hpp"
 #include "compiler/exceptions.hpp"
+#include "vm/exceptions.hpp"
 
 #include <iostream>
 #include <sstream>
 #include <fstream>
 #include <iomanip>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <system_error>
+#include <utility>
+#include <vector>
 
 #include <boost/spirit/home/qi/operator/expect.hpp>
 
 using namespace std::string_literals;
 
+/// counted instructions between profile samples
+static const std::uint64_t sample_interval = 1000;
+
 void print_usage( const char* program )
 {
-  std::cout << "Usage: " << program << " (-e <code>|<filename>)*" << std::endl;
+  std::cout << "Usage: " << program << " [-p <profile>] [-s] [--cache <directory>] [--emit-image <image>] (-e <code>|<filename>)*" << std::endl;
+  std::cout << "   or: " << program << " [-p <profile>] [-s] --image <image>" << std::endl;
   std::cout << "Your program must have a main() function." << std::endl;
+  std::cout << "--cache keeps compiled programs in the given directory and reuses them when the same sources are compiled again." << std::endl;
+  std::cout << "--emit-image compiles the program to an image file instead of running it; --image runs such a file without compiling anything." << std::endl;
+  std::cout << "-p writes a profile of the execution to the given file, as collapsed stacks for flame graph tools." << std::endl;
+  std::cout << "-s prints how often each opcode was executed and roughly how long it took." << std::endl;
 }
 
 int main( int argc, const char** argv )
@@ -26,10 +41,47 @@ int main( int argc, const char** argv )
   }
   try
   {
-    perseus::compiler compiler;
+    // constructing the compiler takes a while, so it's only done when there's something to compile
+    std::unique_ptr< perseus::compiler > compiler;
+    std::string profile_path;
+    std::string emit_image_path;
+    std::string image_path;
+    std::string cache_path;
+    bool statistics = false;
+    // the indices of the arguments that are code (after -e) or file names, and which of the two; compiled once all options are known
+    std::vector< std::pair< int, bool > > sources;
     int i = 1;
     while( i < argc )
     {
+      if( argv[ i ] == "-p"s )
+      {
+        if( ++i == argc )
+        {
+          print_usage( argv[ 0 ] );
+          return 1;
+        }
+        profile_path = argv[ i ];
+        i += 1;
+        continue;
+      }
+      if( argv[ i ] == "--emit-image"s || argv[ i ] == "--image"s || argv[ i ] == "--cache"s )
+      {
+        std::string& path = argv[ i ] == "--image"s ? image_path : argv[ i ] == "--cache"s ? cache_path : emit_image_path;
+        if( ++i == argc )
+        {
+          print_usage( argv[ 0 ] );
+          return 1;
+        }
+        path = argv[ i ];
+        i += 1;
+        continue;
+      }
+      if( argv[ i ] == "-s"s )
+      {
+        statistics = true;
+        i += 1;
+        continue;
+      }
       if( argv[ i ] == "-e"s )
       {
         if( ++i == argc )
@@ -37,25 +89,81 @@ int main( int argc, const char** argv )
           print_usage( argv[ 0 ] );
           return 1;
         }
-        std::stringstream code( argv[ i ] );
-        compiler.parse( code, "<argument"s + std::to_string( i ) + " code>"s );
+        sources.emplace_back( i, true );
+      }
+      else
+      {
+        sources.emplace_back( i, false );
+      }
+      i += 1;
+    }
+    if( !sources.empty() )
+    {
+      compiler = std::make_unique< perseus::compiler >();
+      compiler->set_cache_directory( cache_path );
+    }
+    for( const auto& source : sources )
+    {
+      const int index = source.first;
+      if( source.second )
+      {
+        compiler->parse( argv[ index ], std::strlen( argv[ index ] ), "<argument"s + std::to_string( index ) + " code>"s );
       }
       else
       {
-        std::ifstream file( argv[ i ] );
-        if( !file )
+        try
+        {
+          compiler->parse_file( argv[ index ] );
+        }
+        catch( const std::system_error& e )
         {
-          std::cerr << "Failed to open file " << argv[ i ] << "!" << std::endl;
+          std::cerr << "Failed to open file " << argv[ index ] << ": " << e.code().message() << std::endl;
           return 1;
         }
-        compiler.parse( file, argv[ i ] );
       }
-      std::cout << "Compiled " << argv[ i ] << std::endl;
-      i += 1;
+      std::cout << "Compiled " << argv[ index ] << std::endl;
+    }
+    if( image_path.empty() == !compiler || ( !emit_image_path.empty() && !compiler ) )
+    {
+      // either an image or source code is required, not both, and only source code can be turned into an image
+      print_usage( argv[ 0 ] );
+      return 1;
+    }
+    if( !emit_image_path.empty() )
+    {
+      compiler->link_image( emit_image_path );
+      std::cout << "Wrote image " << emit_image_path << std::endl;
+      return 0;
+    }
+    perseus::detail::instruction_pointer::value_type entry_point = 0;
+    auto processor = compiler ? compiler->link() : perseus::compiler::load_image( image_path, entry_point );
+    std::cout << ( compiler ? "Linked program." : "Loaded image " + image_path ) << std::endl;
+    if( compiler && compiler->cache_statistics() )
+    {
+      const auto& statistics = *compiler->cache_statistics();
+      std::cout << "Cache " << cache_path << ": " << statistics.hits << " hits, " << statistics.misses << " misses, " << statistics.stores << " stores, " << statistics.failed_stores << " failed stores" << std::endl;
+    }
+    if( !profile_path.empty() )
+    {
+      processor.start_profiling( sample_interval );
+    }
+    perseus::detail::opcode_statistics opcodes;
+    auto result_stack = statistics ? processor.execute( entry_point, perseus::stack(), opcodes ) : processor.execute( entry_point );
+    if( !profile_path.empty() )
+    {
+      std::ofstream profile( profile_path );
+      processor.profile()->write_collapsed( profile );
+      if( !profile )
+      {
+        std::cerr << "Failed to write profile " << profile_path << "!" << std::endl;
+        return 1;
+      }
+      std::cout << "Wrote " << processor.profile()->samples() << " samples to " << profile_path << std::endl;
+    }
+    if( statistics )
+    {
+      opcodes.write_table( std::cout );
     }
-    auto processor = compiler.link();
-    std::cout << "Linked program." << std::endl;
-    auto result_stack = processor.execute();
     std::cout << "Result stack:";
     for( auto byte : result_stack )
     {
@@ -68,6 +176,10 @@ int main( int argc, const char** argv )
     // FIXME: the dereferencing presumably fails for empty inputs
     std::cerr << "Expectation failure: " << e.first->id() << " at " << e.first->value().begin().get_position() << std::endl;
   }
+  catch( perseus::invalid_image& e )
+  {
+    std::cerr << "Invalid image: " << e.what() << std::endl;
+  }
   catch( perseus::compile_error& e )
   {
     std::cerr << "Compile error at " << e.location << ": " << e.what() << std::endl;
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "vm/image.hpp"
+
+namespace perseus
+{
+  namespace detail
+  {
+    /**
+    @brief On-disk cache of linked programs, keyed by their sources, so processes compiling the same scripts only compile them once; see compiler::set_cache_directory().
+
+    Entries are @ref program_image "program images" named after the key. They are written to a temporary file first and then renamed, so concurrent writers, even in different processes, never leave a partially written entry behind; the last rename wins, and all writers of a key write the same program.
+
+    The key is a 128 bit hash of the sources and the @ref compiler_version. It is not cryptographic: the cache directory must only be writable by those trusted to provide code.
+    */
+    class compilation_cache
+    {
+    public:
+      /// Incremented whenever the generated code changes, so entries of older compilers aren't used anymore
+      static constexpr std::uint32_t compiler_version = 1;
+
+      /// Counts of cache operations since construction
+      struct statistics
+      {
+        /// link() calls that loaded their program from the cache
+        std::uint64_t hits = 0;
+        /// link() calls that had to compile, including those finding a damaged entry
+        std::uint64_t misses = 0;
+        /// entries written
+        std::uint64_t stores = 0;
+        /// entries that couldn't be written, e.g. because the directory isn't writable
+        std::uint64_t failed_stores = 0;
+      };
+
+      /// @param directory an existing directory to keep the entries in
+      explicit compilation_cache( std::string directory );
+
+      /// The key of the given sources, in the order they're parsed in; 32 hexadecimal digits
+      static std::string get_key( const std::vector< std::string >& sources );
+
+      /**
+      @brief Loads the entry with the given key, if there is a valid one
+      @returns whether there was, i.e. whether this was a hit
+      @throws std::bad_alloc if the system is out of memory
+      */
+      bool load( const std::string& key, program_image& out_program );
+
+      /**
+      @brief Saves a program as the entry with the given key; failures are only counted, since the program can still be used
+      @throws std::bad_alloc if the system is out of memory
+      */
+      void store( const std::string& key, const program_image& program );
+
+      const statistics& get_statistics() const
+      {
+        return _statistics;
+      }
+
+    private:
+      std::string get_path( const std::string& key ) const;
+
+      std::string _directory;
+      statistics _statistics;
+    };
+  }
+}
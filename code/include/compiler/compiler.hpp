@@ -1,9 +1,12 @@
 #pragma once
 
+#include <cstddef>
 #include <istream>
 #include <memory>
 
 #include "vm/processor.hpp"
+#include "vm/image.hpp"
+#include "compilation_cache.hpp"
 
 namespace perseus
 {
@@ -39,13 +42,57 @@ namespace perseus
     */
     void parse( std::istream& source_stream, const std::string& filename );
 
+    /**
+    Parse source code in memory, like parse( std::istream&, const std::string& ), but iterating over it directly instead of through a stream buffer, which is considerably faster.
+    @param source the source code, which only needs to stay valid during the call
+    @param size the size of the source code in bytes
+    @param filename name of the source file, for errors
+    */
+    void parse( const char* source, std::size_t size, const std::string& filename );
+
+    /**
+    Parse a source file, which is mapped into memory instead of being read through a stream; see parse( const char*, std::size_t, const std::string& ).
+    @param path the file, also used as its name in errors
+    @throws std::system_error if the file can't be opened or mapped
+    */
+    void parse_file( const std::string& path );
+
     void reset();
 
+    /**
+    Makes link() look up the program in a cache of compiled programs first, see detail::compilation_cache. parse() then only reads the sources, and link() only parses and compiles them if the cache doesn't have them yet, so syntax errors surface in link() instead.
+    @param directory an existing directory to keep the cache in, shared by any number of processes; empty to stop using a cache
+    @throws std::logic_error if called after parse()
+    */
+    void set_cache_directory( const std::string& directory );
+
+    /// Hits and misses of the cache set by set_cache_directory(), or nullptr if there is none
+    const detail::compilation_cache::statistics* cache_statistics() const;
+
     /**
     Generates code for all the parsed files. Places code to call main() at address 0.
     */
     detail::processor link();
+
+    /**
+    Generates code like link(), but saves it to a program image instead, which load_image() can run without parsing anything again.
+    @throws std::system_error if the file can't be written
+    */
+    void link_image( const std::string& path );
+
+    /**
+    Loads a program image written by link_image(), with the builtin functions it uses.
+    @param path the image file
+    @param out_entry_point where to start execution
+    @throws invalid_image if the file isn't a valid image, or uses builtins this version doesn't have
+    @throws std::system_error if the file can't be opened or mapped
+    */
+    static detail::processor load_image( const std::string& path, detail::instruction_pointer::value_type& out_entry_point );
+
   private:
+    /// The implementation of link() and link_image()
+    detail::program_image link_program();
+
     struct impl;
     std::unique_ptr< impl > _impl;
   };
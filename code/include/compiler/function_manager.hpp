@@ -12,6 +12,7 @@
 #include "types.hpp"
 #include "shared/opcodes.hpp"
 #include "vm/instruction_pointer.hpp"
+#include "vm/profiler.hpp"
 
 namespace perseus
 {
@@ -112,6 +113,16 @@ namespace perseus
         return _address.is_initialized();
       }
 
+      bool get_address( instruction_pointer::value_type& out_result ) const
+      {
+        if( _address )
+        {
+          out_result = *_address;
+          return true;
+        }
+        return false;
+      }
+
     private:
       /// for builtin functions, this is the opcode that can be issued in lieu of a call
       boost::optional< opcode > _opcode;
@@ -157,6 +168,11 @@ namespace perseus
       @returns iterator range, i.e. tuple(begin, end)
       */
       std::pair< function_map::const_iterator, function_map::const_iterator > get_functions( const std::string& name ) const;
+
+      /**
+      @brief The signatures of all functions with code, by address, for naming them in profiles.
+      */
+      function_names get_function_names() const;
     private:
       function_map _functions;
     };
@@ -65,7 +65,11 @@ namespace perseus
       return os << pos.line << ':' << pos.column;
     }
 
-    /// UTF-8 aware file position tracking multipass istreambuff iterator
+    /**
+    @brief UTF-8 aware file position tracking multipass istreambuff iterator
+
+    Alternatively iterates over a contiguous buffer using plain pointers, which avoids the virtual calls and buffering of the stream iterators; see enhanced_iterators( const char*, const char* ).
+    */
     class istreambuf_multipass_position_iterator : public std::iterator< std::forward_iterator_tag, char >
     {
     public:
@@ -73,6 +77,8 @@ namespace perseus
       istreambuf_multipass_position_iterator();
       /// Adapting an istreambuf_multipass_utf32_iterator
       istreambuf_multipass_position_iterator( istreambuf_multipass_iterator current, istreambuf_multipass_iterator end );
+      /// Iterating over [current, end), which must outlive the iterator
+      istreambuf_multipass_position_iterator( const char* current, const char* end );
       /// Destructible
       ~istreambuf_multipass_position_iterator();
       /// MoveConstructible
@@ -106,6 +112,9 @@ namespace perseus
       file_position _position;
       istreambuf_multipass_iterator _current;
       istreambuf_multipass_iterator _end;
+      /// when iterating over a buffer, the current character, otherwise nullptr
+      const char* _buffer_current = nullptr;
+      const char* _buffer_end = nullptr;
       value_type _value = '\0';
     };
 
@@ -115,6 +124,9 @@ namespace perseus
     /// create utf32-yielding begin & end iterator with positional information for the given stream
     std::tuple< enhanced_istream_iterator, enhanced_istream_iterator > enhanced_iterators( std::istream& stream );
 
+    /// create begin & end iterator with positional information for the given buffer, which must outlive them
+    std::tuple< enhanced_istream_iterator, enhanced_istream_iterator > enhanced_iterators( const char* begin, const char* end );
+
     /**
     @brief Skip byte order mark (U+FEFF) if there is any
     @param it potential BOM location
@@ -0,0 +1,83 @@
+#pragma once
+
+#include "token_ids.hpp"
+#include "iterators.hpp"
+
+#include <cstddef>
+#include <vector>
+
+namespace perseus
+{
+  namespace detail
+  {
+    /// A token found by the @ref scanner, as offsets into the scanned buffer
+    struct scanned_token
+    {
+      token_id::token_id id;
+      std::size_t begin;
+      std::size_t end;
+    };
+
+    /**
+    @brief Hand-written lexer over a contiguous buffer, an alternative to the @ref token_definitions that doesn't need the multipass stream iterators.
+
+    It produces the same tokens as the token definitions, i.e. each token is the longest match of any of their regular expressions, with the earlier definition winning ties. Instead of running a DFA per character, each definition is matched by a loop over the runs of characters it accepts. Runs of whitespace, identifier characters and digits, and the ends of comments and strings, are found 16 bytes at a time with SSE2, or 32 bytes at a time if the compiler targets AVX2. Keywords are found with a perfect hash of their first and last character.
+
+    Positions are not tracked while scanning; see @ref position_tracker.
+    */
+    class scanner
+    {
+    public:
+      /// Scans [begin, end), which must stay valid while scanning
+      scanner( const char* begin, const char* end );
+
+      /**
+      @brief Scans the next token
+      @returns false at the end of the input, or if no token matches at the current offset; see at_end()
+      */
+      bool next( scanned_token& out_token );
+
+      /// Whether all of the input has been scanned
+      bool at_end() const
+      {
+        return _current == _end;
+      }
+
+      /// The offset of the next token, or of the input that didn't match any
+      std::size_t offset() const
+      {
+        return static_cast< std::size_t >( _current - _begin );
+      }
+
+    private:
+      const char* _begin;
+      const char* _current;
+      const char* _end;
+    };
+
+    /**
+    @brief Scans all of [begin, end)
+    @returns whether the whole input consisted of tokens; if not, the tokens up to the first mismatch are still returned
+    */
+    bool scan( const char* begin, const char* end, std::vector< scanned_token >& out_tokens );
+
+    /// Calculates the @ref file_position of offsets into a buffer like the @ref enhanced_istream_iterator does, for increasing offsets
+    class position_tracker
+    {
+    public:
+      explicit position_tracker( const char* begin )
+        : _begin( begin )
+        , _current( begin )
+      {
+      }
+
+      /// The position of the character at the given offset, which must not be less than that of the previous call
+      const file_position& advance( std::size_t offset );
+
+    private:
+      const char* _begin;
+      const char* _current;
+      file_position _position;
+    };
+  }
+}
@@ -1,35 +1,22 @@
 #pragma once
 
-#include <boost/spirit/home/lex/lexer/lexer.hpp>
-#include <boost/spirit/home/lex/lexer/lexertl/token.hpp>
-#include <boost/spirit/home/lex/lexer/lexertl/lexer.hpp>
+#include <boost/spirit/home/lex/lexer/lexertl/static_lexer.hpp>
 
-#include "token_ids.hpp"
-#include "iterators.hpp"
+#include "basic_token_definitions.hpp"
+// generated by perseus_lexer_generator from basic_token_definitions
+#include "compiler/lexer_tables.hpp"
 
 namespace perseus
 {
   namespace detail
   {
-    typedef boost::spirit::lex::lexertl::token<
-      enhanced_istream_iterator,
-      boost::mpl::vector<>, // don't do automatic attribute conversion, just supply the plain iterator ranges
-      boost::mpl::false_, // not interested in lexer states
-      perseus::detail::token_id::token_id // token id type
-    > token;
-    typedef boost::spirit::lex::lexertl::lexer< token > lexer;
+    /// Table-driven lexer using the DFA generated at build time, so constructing it doesn't compile any regular expressions
+    typedef boost::spirit::lex::lexertl::static_lexer< token, boost::spirit::lex::lexertl::static_::lexer_perseus > static_lexer;
 
-    /**
-    @brief Definition of the various tokens
+    /// The token definitions used by the compiler
+    typedef basic_token_definitions< static_lexer > token_definitions;
 
-    The first phase of perseus compilation is tokenization, or lexical analysis. The char stream is split into tokens according to regular expressions; those tokens are then parsed according to the grammar.
-    */
-    class token_definitions : public boost::spirit::lex::lexer< lexer >
-    {
-    public:
-      /// constructor (contains definitions)
-      token_definitions();
-    };
+    extern template class basic_token_definitions< static_lexer >;
 
     typedef token_definitions::iterator_type token_iterator;
   }
@@ -771,6 +771,116 @@ namespace perseus
       */
       modulo_i32,
 
+      //    Superinstructions
+      //    Fused versions of sequences the compiler generates a lot, saving dispatches.
+
+      /**
+      # Load 32 bit local
+
+      Same as relative_load_stack with a size of 4.
+
+      ## Parameters
+
+      -   offset (4 bytes) - signed offset into current coroutine's stack (must be negative)
+
+      ## Output
+
+      -   value (4 bytes) - copied data
+
+      @throws stack_segmentation_fault if attempting read from above top of stack
+      */
+      load_local_32,
+      /**
+      # 32 bit signed int addition of a constant
+
+      Same as push_32 followed by add_i32; subtracting a constant is adding its negation.
+
+      ## Parameters
+
+      -   operand2 (4 bytes) - signed constant to add
+
+      ## Input
+
+      -   operand1 (4 bytes)
+
+      ## Output
+
+      -   result (4 bytes) - operand1 + operand2
+      */
+      add_immediate_i32,
+      /**
+      # 32 bit signed int equals, then Relative Jump if false
+
+      Same as equals_i32 followed by relative_jump_if_false.
+
+      ## Parameters
+
+      -   offset (4 bytes) - signed offset to change the instruction pointer by if the comparison is false, relative to the end of this instruction
+
+      ## Input
+
+      -   operand2 (4 bytes)
+      -   operand1 (4 bytes)
+
+      @throws code_segmentation_fault if jumping outside valid code
+      */
+      equals_i32_jump_if_false,
+      /**
+      # 32 bit signed int not equals, then Relative Jump if false
+
+      Same as not_equals_i32 followed by relative_jump_if_false; see equals_i32_jump_if_false.
+      */
+      not_equals_i32_jump_if_false,
+      /**
+      # 32 bit signed int less than, then Relative Jump if false
+
+      Same as less_than_i32 followed by relative_jump_if_false; see equals_i32_jump_if_false.
+      */
+      less_than_i32_jump_if_false,
+      /**
+      # 32 bit signed int less than or equals, then Relative Jump if false
+
+      Same as less_than_or_equals_i32 followed by relative_jump_if_false; see equals_i32_jump_if_false.
+      */
+      less_than_or_equals_i32_jump_if_false,
+      /**
+      # 32 bit signed int greater than, then Relative Jump if false
+
+      Same as greater_than_i32 followed by relative_jump_if_false; see equals_i32_jump_if_false.
+      */
+      greater_than_i32_jump_if_false,
+      /**
+      # 32 bit signed int greater than or equals, then Relative Jump if false
+
+      Same as greater_than_or_equals_i32 followed by relative_jump_if_false; see equals_i32_jump_if_false.
+      */
+      greater_than_or_equals_i32_jump_if_false,
+      /**
+      # Store, Pop and Return
+
+      The end of a function with a result: stores the result in the space reserved by the caller, pops everything above the return address and returns.
+
+      Same as relative_store_stack (size, -(size + pop_size + 4 + argument_size)), pop (pop_size), return_ (argument_size).
+
+      ## Parameters
+
+      -   size (4 bytes) - unsigned size of the result on top of the stack
+      -   pop_size (4 bytes) - unsigned number of bytes above the return address, including the result
+      -   argument_size (4 bytes) - the number of bytes to pop off the stack in addition to the return address
+
+      ## Input
+
+      -   result (varying, as given in size) - written to the reserved space below the arguments
+      -   (further data (varying, as given in pop_size minus size) - discarded)
+      -   return address (4 bytes) - unsigned location to jump to
+      -   arguments (varying, as given in argument_size) - arguments of this function to now discard
+
+      @throws stack_segmentation_fault if there is not enough data on the stack
+      @throws code_segmentation_fault if jumping outside valid code
+      @throws invalid_opcode if the store offset doesn't fit into 4 bytes, like relative_store_stack's
+      */
+      store_pop_return,
+
       /**
       @brief end marker
       
@@ -784,6 +894,12 @@ namespace perseus
     /// Maximum number of bytes for multibyte opcode encoding
     static constexpr unsigned int opcode_max_bytes = 4;
 
+    /**
+    @brief The name of an opcode as written in @ref opcode, e.g. "push_32"
+    @return "opcode_end" for @ref opcode::opcode_end and any value past it
+    */
+    const char* get_name( const opcode code );
+
     /**
     @brief Feeding an opcode into an std::ostream
     */
@@ -0,0 +1,177 @@
+#pragma once
+
+#include "processor.hpp"
+#include "mailbox.hpp"
+#include "stack.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace perseus
+{
+  namespace detail
+  {
+    /**
+    @brief Runs many @ref processor "processors" as isolated actors on a fixed pool of threads.
+
+    Every actor owns its processor, and with it its code and coroutines, so actors share no mutable state. They communicate by sending each other messages, which are byte strings, through lock-free @ref mailbox "mailboxes".
+
+    Actors use these syscalls, which come before any syscalls of their own:
+    -   @ref send_syscall: pops the recipient's identifier (`u32`), the message size (`u32`) and that many bytes, and sends them
+    -   @ref receive_syscall: pushes the oldest message and its size (`u32`). If there is none, the actor is parked until one arrives.
+    -   @ref self_syscall: pushes the actor's identifier (`u32`)
+
+    Parked actors don't occupy a thread; they're suspended via @ref would_block and resumed once a message arrives. An actor only ever runs on one thread at a time.
+    */
+    class actor_system
+    {
+    public:
+      /// Identifies an actor
+      typedef std::uint32_t actor_id;
+
+      /// @ref actor_system syscalls
+      enum syscall_index : std::uint32_t
+      {
+        send_syscall,
+        receive_syscall,
+        self_syscall,
+        /// index of the first syscall given to spawn()
+        first_user_syscall
+      };
+
+      /// A spawned actor
+      struct actor_handle
+      {
+        /// to send messages to it
+        actor_id id;
+        /// the final stack, once the actor exits, or the exception it failed with
+        std::future< stack > result;
+      };
+
+      /// Default maximum number of actors
+      static constexpr std::size_t default_max_actors = 1 << 16;
+
+      /**
+      @brief Constructor, starting the threads
+      @param threads number of threads running the actors, at least 1
+      @param max_actors maximum number of actors that can be spawned
+      @throws std::system_error if the threads can't be started
+      */
+      explicit actor_system( const std::size_t threads = std::max( std::thread::hardware_concurrency(), 1u ), const std::size_t max_actors = default_max_actors );
+      /// Destructor; waits until the actors are idle, then stops the threads. Actors that are still parked never finish.
+      ~actor_system();
+      /// non-copyable
+      actor_system( const actor_system& ) = delete;
+      /// non-copyable
+      actor_system& operator=( const actor_system& ) = delete;
+
+      /**
+      @brief Create a new actor, which starts running right away.
+      @param code the actor's code
+      @param start_address where the actor starts
+      @param parameters its initial stack
+      @param syscalls further syscalls, starting at index @ref first_user_syscall; they may be called concurrently by different actors
+      @param engine how the actor dispatches instructions
+      @throws too_many_actors if there are already as many actors as allowed
+      @throws std::bad_alloc if the system runs out of memory
+      */
+      actor_handle spawn( code_segment&& code, const instruction_pointer::value_type start_address = 0, stack&& parameters = stack(), std::vector< syscall >&& syscalls = {}, const dispatch_engine engine = dispatch_engine::switch_ );
+
+      /**
+      @brief Send a message to an actor; may be called by any thread.
+
+      Messages to actors that have exited are discarded.
+      @throws invalid_actor_identifier if there is no such actor
+      @throws std::bad_alloc if the system runs out of memory
+      */
+      void send( const actor_id recipient, stack&& message );
+
+      /// Blocks until no actor is running or waiting to run, i.e. all of them have exited or are parked on empty mailboxes.
+      void wait_until_idle();
+
+      /// Number of threads running actors
+      std::size_t threads() const
+      {
+        return _threads.size();
+      }
+
+    private:
+      /// whether an actor is parked
+      enum class actor_state
+      {
+        /// runnable or running
+        running,
+        /// received a message while running, so it mustn't park
+        notified,
+        /// waiting for a message; whoever changes this has to schedule the actor
+        parked
+      };
+
+      struct actor
+      {
+        actor( const actor_id id, const instruction_pointer::value_type start_address, stack&& parameters )
+          : id( id )
+          , start_address( start_address )
+          , parameters( std::move( parameters ) )
+        {
+        }
+
+        const actor_id id;
+        mailbox messages;
+        std::atomic< actor_state > state{ actor_state::running };
+        /// where execution starts, until it has started
+        instruction_pointer::value_type start_address;
+        stack parameters;
+        bool started = false;
+        /// null once exited
+        std::unique_ptr< processor > proc;
+        std::promise< stack > result;
+      };
+
+      /// the syscalls given to every actor's processor
+      std::vector< syscall > actor_syscalls( actor& a );
+      /// the actor with the given identifier, or nullptr
+      actor* find( const actor_id id ) const;
+      /// puts a message into the actor's mailbox and wakes it, if parked
+      void deliver( actor& a, stack&& message );
+      /// queues the actor to run
+      void schedule( actor& a );
+      /// runs the actor until it exits or parks
+      void run( actor& a );
+      /// body of the threads
+      void work();
+      /// lets the threads finish and joins them
+      void stop();
+
+      /// the actors, by identifier; entries below _actor_count are set and never change
+      std::unique_ptr< std::atomic< actor* >[] > _actors;
+      const std::size_t _max_actors;
+      std::atomic< std::size_t > _actor_count{ 0 };
+      /// owns the actors
+      std::vector< std::unique_ptr< actor > > _owned_actors;
+      /// guards spawning
+      std::mutex _spawn_mutex;
+
+      /// guards _runnable, _busy and _stopping
+      std::mutex _mutex;
+      std::condition_variable _work_available;
+      std::condition_variable _idle;
+      std::deque< actor* > _runnable;
+      /// number of actors that are runnable or running
+      std::size_t _busy = 0;
+      bool _stopping = false;
+
+      std::vector< std::thread > _threads;
+    };
+  }
+}
@@ -22,7 +22,7 @@ namespace perseus
     */
     struct coroutine
     {
-      /// coroutine identifier
+      /// coroutine identifier, made up of a slot index and generation by the @ref coroutine_manager
       typedef std::uint32_t identifier;
 
       /// State of a @ref coroutine
@@ -1,8 +1,11 @@
 #pragma once
 
 #include "coroutine.hpp"
+#include "stack_pool.hpp"
 
-#include <map>
+#include <memory>
+#include <new>
+#include <type_traits>
 #include <vector>
 
 namespace perseus
@@ -12,14 +15,31 @@ namespace perseus
     /**
     @brief Manager responsible for @ref coroutine identifier allocation.
 
-    Also stores the coroutines.
+    Also stores the coroutines, in a slot map: an identifier is the index of the coroutine's slot in its lower @ref index_bits bits, and the slot's generation in the rest. Every deletion increments the slot's generation, so identifiers of deleted coroutines are detected as invalid, even once their slot is reused. The generation wraps around after @ref max_generation, so a stale identifier matches again once its slot has been freed max_generation + 1 more times (the ABA problem); retiring the slot instead would eventually run out of slots in long-running programs that keep creating coroutines.
+
+    The slots live in fixed size chunks, so lookups are O(1) and coroutines never move.
+
+    The stacks of deleted coroutines go to a @ref stack_pool, which new coroutines take their stacks from.
     @todo allow custom allocator? (remove references to std::bad_alloc then)
     */
     class coroutine_manager
     {
     public:
-      /// constructor
-      coroutine_manager() = default;
+      /**
+      @brief constructor
+
+      Managers with disjoint ranges of slot indices never accept each other's identifiers, since those always refer to a slot outside their range.
+
+      @param backend where the coroutines keep their stacks
+      @param first_index the index of the first slot
+      @param capacity maximum number of simultaneous coroutines; first_index + capacity must not exceed @ref max_coroutines
+      */
+      explicit coroutine_manager( const stack_backend backend = stack_backend::heap, const coroutine::identifier first_index = 0, const coroutine::identifier capacity = max_coroutines )
+        : _stacks( backend )
+        , _first_index( first_index )
+        , _capacity( capacity )
+      {
+      }
       /// non-copyable
       coroutine_manager( const coroutine_manager& ) = delete;
       /// non-copyable
@@ -29,25 +49,30 @@ namespace perseus
       /// move assignment
       coroutine_manager& operator=( coroutine_manager&& ) = default;
 
+      /// Number of bits of a @ref coroutine::identifier used for the slot index
+      static constexpr unsigned index_bits = 20;
+      /// Maximum number of simultaneous coroutines
+      static constexpr coroutine::identifier max_coroutines = coroutine::identifier( 1 ) << index_bits;
+
       /**
       @brief Create a new coroutine
       
-      The new coroutine is assigned the lowest free identifier
+      Slots of deleted coroutines are reused in the order they were freed, which spreads the generations across slots.
 
       @param code @ref code_segment the coroutine operates in
       @param start_address address in the code to start execution at
-      @param initial_stack Initial values on the stack of the coroutine
+      @param initial_stack Initial values on the stack of the coroutine; used as is if it has memory of the manager's @ref stack_backend, otherwise copied to a stack from the @ref stack_pool
       @returns the new coroutine
       @throws std::bad_alloc if the system runs out of memory
-      @throws too_many_coroutines if we run out of identifiers (basically only possible on incorrect usage)
-      @pre The total number of coroutines fits into @ref coroutine::identifier
+      @throws too_many_coroutines if there are already as many coroutines as the manager's capacity
+      @throws stack_overflow if the initial stack doesn't fit into a reserved stack
       */
       coroutine& new_coroutine( const code_segment& code, const instruction_pointer::value_type start_address, stack&& initial_stack = stack() );
 
       /**
       @brief Delete a given @ref coroutine by identifier.
       @param index Identifier of the coroutine to delete
-      @throws invalid_coroutine_identifier if no such coroutine exists
+      @throws invalid_coroutine_identifier if no such coroutine exists, e.g. because it has already been deleted
       @throws deleting_live_coroutine if trying to delete a live coroutine (i.e. the active one or one waiting on it)
       */
       void delete_coroutine( const coroutine::identifier index );
@@ -60,7 +85,7 @@ namespace perseus
       */
       coroutine& get_coroutine( const coroutine::identifier index );
 
-      /// @ref delete_coroutine() for const coroutine_manager.
+      /// @ref get_coroutine() for const coroutine_manager.
       const coroutine& get_coroutine( const coroutine::identifier index ) const;
 
       /**
@@ -68,21 +93,90 @@ namespace perseus
       */
       bool empty() const
       {
-        return _coroutines.empty();
+        return _size == 0;
+      }
+
+      /// The pool of stacks for new coroutines
+      stack_pool& stacks()
+      {
+        return _stacks;
+      }
+
+      /// @copydoc stacks()
+      const stack_pool& stacks() const
+      {
+        return _stacks;
       }
 
       /**
       @brief Deletes all coroutines.
+
+      Their identifiers stay invalid, like those of coroutines deleted one by one.
       */
       void clear();
 
     private:
-      /// Index of the first coroutine; 0 is reserved for heap memory
-      static constexpr coroutine::identifier FIRST_INDEX = 0;
+      /// saves and restores the slots in snapshots
+      friend class processor;
+
+      /// Number of slots per chunk
+      static constexpr coroutine::identifier chunk_size = 256;
+      /// Generation after which a slot's generation wraps around to 0
+      static constexpr coroutine::identifier max_generation = ( coroutine::identifier( 1 ) << ( 32 - index_bits ) ) - 1;
+      /// Marks the end of the free list
+      static constexpr coroutine::identifier no_slot = max_coroutines;
+
+      /// storage for a coroutine, which may be empty
+      struct slot
+      {
+        slot() = default;
+        slot( const slot& ) = delete;
+        slot& operator=( const slot& ) = delete;
+        ~slot()
+        {
+          if( occupied )
+          {
+            get().~coroutine();
+          }
+        }
+
+        coroutine& get()
+        {
+          return *reinterpret_cast< coroutine* >( &storage );
+        }
+
+        typename std::aligned_storage< sizeof( coroutine ), alignof( coroutine ) >::type storage;
+        /// incremented on deletion, wrapping around after max_generation
+        coroutine::identifier generation = 0;
+        /// next slot in the free list, if this one is free
+        coroutine::identifier next_free = no_slot;
+        bool occupied = false;
+      };
+
+      /// the slot with the given index, which must exist
+      slot& get_slot( const coroutine::identifier index ) const
+      {
+        return _chunks[ index / chunk_size ][ index % chunk_size ];
+      }
+
+      /// the slot of the coroutine with the given identifier, if it exists
+      slot* find( const coroutine::identifier id ) const;
+
+      /// destroys the coroutine in the given slot, pooling its stack, and frees the slot
+      void release( const coroutine::identifier index, slot& s );
 
-      std::map< coroutine::identifier, coroutine > _coroutines;
-      std::vector< coroutine::identifier > _free_indices;
-      coroutine::identifier _next_index = FIRST_INDEX;
+      stack_pool _stacks;
+      std::vector< std::unique_ptr< slot[] > > _chunks;
+      /// the slot index identifiers start at; slot indices used internally are relative to it
+      coroutine::identifier _first_index;
+      /// maximum number of slots
+      coroutine::identifier _capacity;
+      /// number of slots in use or freed, i.e. the index of the next slot never used so far
+      coroutine::identifier _used_slots = 0;
+      /// number of coroutines
+      coroutine::identifier _size = 0;
+      /// head and tail of the free list, oldest first
+      coroutine::identifier _first_free = no_slot, _last_free = no_slot;
     };
   }
 }
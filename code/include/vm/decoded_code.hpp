@@ -0,0 +1,147 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+
+#include "shared/opcodes.hpp"
+#include "code_segment.hpp"
+#include "instruction_pointer.hpp"
+#include "exceptions.hpp"
+
+namespace perseus
+{
+  namespace detail
+  {
+    /**
+    @brief Handlers of @ref decoded_instruction "decoded instructions" that don't correspond to an @ref opcode.
+
+    They are numbered after the opcodes so both share one dispatch table.
+    */
+    enum class internal_handler : std::uint32_t
+    {
+      /// Continues at `target`; ends runs of instructions that were decoded out of order.
+      fall_through = static_cast< std::uint32_t >( opcode::opcode_end ),
+      /// Throws @ref code_segmentation_fault; placed where execution would run past the end of the @ref code_segment.
+      end_of_code,
+      /// Throws @ref code_segmentation_fault; an instruction whose parameters are cut off by the end of the @ref code_segment.
+      truncated_instruction,
+      /// Throws @ref invalid_opcode; `operand` is the value of the invalid opcode.
+      invalid_instruction,
+      /// Throws @ref code_segmentation_fault; the target of jumps outside the @ref code_segment.
+      invalid_jump_target,
+      /// Returns from the dispatch engine without finishing execution; never part of decoded code, the engines use it to hand over to another engine.
+      leave_engine,
+
+      /// end marker
+      handler_end
+    };
+
+    /// Number of handlers of decoded instructions, i.e. the size of dispatch tables
+    static constexpr std::uint32_t handler_count = static_cast< std::uint32_t >( internal_handler::handler_end );
+
+    /// Position of an opcode in dispatch tables
+    constexpr std::uint32_t get_handler( const opcode code )
+    {
+      return static_cast< std::uint32_t >( code );
+    }
+
+    /// Position of an internal handler in dispatch tables
+    constexpr std::uint32_t get_handler( const internal_handler handler )
+    {
+      return static_cast< std::uint32_t >( handler );
+    }
+
+    /**
+    @brief A fixed size instruction with its parameters already read from the bytecode.
+
+    Which fields are used depends on the handler:
+
+    -   `operand`: the first parameter from the bytecode, e.g. a size, a constant or a syscall index. For @ref opcode::call "call" and @ref opcode::indirect_call "indirect_call" it is the return address instead.
+    -   `offset`: the offset of relative loads/stores, including the one @ref opcode::store_pop_return "store_pop_return" starts with
+    -   `target`: the index of the instruction a jump or call leads to; the argument size for @ref opcode::store_pop_return "store_pop_return"
+    */
+    struct decoded_instruction
+    {
+      /// An @ref opcode or @ref internal_handler; see @ref get_handler()
+      std::uint32_t handler;
+      /// First parameter
+      std::uint32_t operand;
+      /// Offset of relative stack accesses
+      std::int32_t offset;
+      /// Resolved jump target
+      std::uint32_t target;
+    };
+
+    static_assert( sizeof( decoded_instruction ) == 16, "decoded_instruction should fit four of them per cache line" );
+
+    /**
+    @brief A @ref code_segment translated into @ref decoded_instruction "decoded instructions".
+
+    The bytecode is decoded front to back; jump targets in the middle of previously decoded instructions get decoded separately, continuing until they line up with known instructions again. Jumps with constant targets are resolved to instruction indices, targets outside the code lead to an @ref internal_handler::invalid_jump_target "invalid_jump_target" instruction.
+
+    Addresses only known at runtime (return addresses, indirect jumps, coroutine starts) are mapped using at(), which only accepts addresses at the start of an instruction.
+    */
+    class decoded_code
+    {
+    public:
+      /**
+      @brief Decodes the given code.
+      @param code the bytecode to decode; not referenced afterwards.
+      @throws std::bad_alloc if the system is out of memory
+      */
+      explicit decoded_code( const code_segment& code );
+
+      /// The decoded instructions
+      const decoded_instruction* data() const
+      {
+        return _instructions.data();
+      }
+
+      /// Number of decoded instructions
+      std::size_t size() const
+      {
+        return _instructions.size();
+      }
+
+      /**
+      @brief Retrieves the instruction at the given bytecode address.
+      @throws code_segmentation_fault if the address is outside the code or in the middle of an instruction.
+      */
+      const decoded_instruction* at( const instruction_pointer::value_type address ) const
+      {
+        if( address >= _index_of.size() )
+        {
+          throw code_segmentation_fault( "Moved instruction_pointer past end of code_segment!" );
+        }
+        const std::uint32_t index = _index_of[ address ];
+        if( index == no_instruction )
+        {
+          throw code_segmentation_fault( "Moved instruction_pointer into the middle of an instruction!" );
+        }
+        return &_instructions[ index ];
+      }
+
+      /// The bytecode address of a decoded instruction
+      instruction_pointer::value_type address_of( const decoded_instruction* instruction ) const
+      {
+        return _addresses[ instruction - _instructions.data() ];
+      }
+
+    private:
+      /// marks addresses without instruction in _index_of
+      static constexpr std::uint32_t no_instruction = ~std::uint32_t( 0 );
+
+      /// decodes from the given address until reaching a known instruction or the end; returns the index of the first instruction
+      std::uint32_t decode_run( const code_segment& code, instruction_pointer::value_type address );
+      /// appends an instruction
+      void append( const decoded_instruction& instruction, const instruction_pointer::value_type address );
+
+    private:
+      std::vector< decoded_instruction > _instructions;
+      /// bytecode address of each instruction
+      std::vector< instruction_pointer::value_type > _addresses;
+      /// instruction index for each bytecode address, or no_instruction
+      std::vector< std::uint32_t > _index_of;
+    };
+  }
+}
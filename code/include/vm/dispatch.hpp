@@ -0,0 +1,283 @@
+#pragma once
+
+#include <vector>
+#include <functional>
+#include <cstdint>
+#include <utility>
+#include <chrono>
+#include <limits>
+
+#include "code_segment.hpp"
+#include "stack.hpp"
+#include "coroutine_manager.hpp"
+#include "decoded_code.hpp"
+
+/// Defined if the compiler supports computed gotos ("labels as values")
+#if defined( __GNUC__ )
+# define PERSEUS_HAS_COMPUTED_GOTO
+#endif
+
+/// Guaranteed tail call attribute, if the compiler has one
+#if defined( __has_cpp_attribute )
+# if __has_cpp_attribute( clang::musttail )
+#   define PERSEUS_MUSTTAIL [[clang::musttail]]
+# elif __has_cpp_attribute( gnu::musttail )
+#   define PERSEUS_MUSTTAIL [[gnu::musttail]]
+# endif
+#endif
+
+namespace perseus
+{
+  namespace detail
+  {
+    /**
+    @brief Syscall callback
+
+    Invoked by the @ref opcode::syscall "syscall opcode". A syscall that can't complete yet may throw @ref would_block to suspend the execution.
+    */
+    typedef std::function< void( stack& ) > syscall;
+
+    /**
+    @brief The available implementations of the instruction dispatch loop.
+
+    All engines execute the same instruction definitions and are observably identical; they only differ in how control passes from one instruction to the next.
+    */
+    enum class dispatch_engine
+    {
+      /// A single loop around a switch statement; the portable default.
+      switch_,
+      /// Threaded code using computed gotos (GCC/Clang "labels as values"); every instruction dispatches the next one itself. Falls back to switch_ on compilers without the extension.
+      computed_goto,
+      /// Every instruction is a separate function which tail-calls the next one. Without guaranteed tail calls (`musttail`) each function returns to a trampoline loop instead.
+      tail_call,
+      /// Like switch_, but keeps up to two i32 values from the top of the stack in registers between instructions, flushing them to the stack before instructions which need it in memory. Only faster than switch_ for code spending most of its time in i32 arithmetic on locals; calls are slower.
+      top_of_stack,
+      /// Like switch_, but compiles frequently called functions to native code using a @ref jit_compiler. Only native on x86-64 Linux, elsewhere nothing gets compiled.
+      jit
+    };
+
+    class jit_compiler;
+    class profiler;
+    class opcode_statistics;
+
+    /**
+    @brief Whether the given engine is implemented natively on this compiler, as opposed to falling back to a simpler one.
+    */
+    bool is_native( dispatch_engine engine );
+
+    /**
+    @brief Human readable name of a @ref dispatch_engine, e.g. for benchmarks.
+    */
+    const char* get_name( dispatch_engine engine );
+
+    /**
+    @brief Instrumentation that does nothing; what a normal @ref processor::execute() uses.
+
+    Instrumentation types are passed to the dispatch engines, which call `on_instruction()` before executing each instruction. Since this is resolved at compile time, the uninstrumented engines contain no trace of it.
+
+    @ref internal_handler "Internal handlers" are reported too, with their value cast to @ref opcode.
+    */
+    struct no_instrumentation
+    {
+      /// called before every instruction
+      void on_instruction( const opcode )
+      {
+      }
+    };
+
+    /**
+    @brief Instrumentation that counts the executed instructions.
+    */
+    struct instruction_counter
+    {
+      /// called before every instruction
+      void on_instruction( const opcode )
+      {
+        ++instructions;
+      }
+
+      /// number of instructions executed so far
+      std::uint64_t instructions = 0;
+    };
+
+    /**
+    @brief Limits how long an execution runs before it gets preempted, see @ref processor::execute() "processor::execute()".
+
+    To keep the checks off the hot path, instructions are only counted at backward jumps and calls: a backward jump costs the instructions between its target and itself, a call costs 1. So the count is approximate; straight-line code runs at most once more than counted. The time is checked every @ref clock_interval counted instructions.
+
+    Native code of @ref dispatch_engine::jit counts the same way. Once a native function runs out of instructions before the next time check, the rest of its call gets interpreted.
+    */
+    struct execution_budget
+    {
+      /// Number of counted instructions between time checks
+      static constexpr std::uint64_t clock_interval = 1 << 16;
+
+      /// Number of instructions, counted as described above
+      std::uint64_t instructions = std::numeric_limits< std::uint64_t >::max();
+      /// Wall-clock time, starting with the processor::execute() or processor::resume() call
+      std::chrono::steady_clock::duration time = std::chrono::steady_clock::duration::max();
+    };
+
+    /**
+    @brief State of an ongoing @ref processor::execute() call, shared by the dispatch engines.
+
+    The engines keep the position in the active coroutine as a pointer to its @ref decoded_instruction; the coroutines' @ref instruction_pointer "instruction pointers" are only updated when switching coroutines or when an exception leaves the engine.
+    */
+    struct execution_state
+    {
+      /**
+      @brief Constructor
+      @param code the code being executed
+      @param program the decoded code
+      @param coroutines the processor's coroutines
+      @param syscalls the processor's syscalls
+      @param root the coroutine in which execution begins
+      */
+      execution_state( const code_segment& code, const decoded_code& program, coroutine_manager& coroutines, const std::vector< syscall >& syscalls, coroutine& root )
+        : code( code )
+        , program( program )
+        , instructions( program.data() )
+        , coroutines( coroutines )
+        , syscalls( syscalls )
+        , active_coroutines{ &root }
+        , co( &root )
+      {
+      }
+
+      /**
+      @brief Constructor continuing a suspended execution
+      @param code the code being executed
+      @param program the decoded code
+      @param coroutines the processor's coroutines
+      @param syscalls the processor's syscalls
+      @param chain the live coroutines, each one waiting on the next; the last one continues at its instruction pointer
+      */
+      execution_state( const code_segment& code, const decoded_code& program, coroutine_manager& coroutines, const std::vector< syscall >& syscalls, std::vector< coroutine* >&& chain )
+        : code( code )
+        , program( program )
+        , instructions( program.data() )
+        , coroutines( coroutines )
+        , syscalls( syscalls )
+        , active_coroutines( std::move( chain ) )
+        , co( active_coroutines.back() )
+      {
+      }
+
+      /**
+      @brief Where the active coroutine continues.
+      @throws code_segmentation_fault if its instruction pointer is not at an instruction
+      */
+      const decoded_instruction* resume_position() const
+      {
+        return program.at( co->instruction_pointer );
+      }
+
+      /// Stores the position of the active coroutine in its instruction pointer.
+      void save_position( const decoded_instruction* position )
+      {
+        co->instruction_pointer = instruction_pointer( code, program.address_of( position ) );
+      }
+
+      /**
+      @brief Makes the given coroutine the active one, keeping the current one waiting on it.
+      @param next the coroutine to enter
+      @param continuation where the current coroutine continues once it is active again
+      @returns where to continue execution
+      */
+      const decoded_instruction* enter( coroutine& next, const decoded_instruction* continuation )
+      {
+        const decoded_instruction* position = program.at( next.instruction_pointer );
+        save_position( continuation );
+        active_coroutines.push_back( &next );
+        co = &next;
+        return position;
+      }
+
+      /**
+      @brief Returns to the coroutine waiting on the active one.
+      @param continuation where the current coroutine continues if resumed
+      @returns where to continue execution
+      */
+      const decoded_instruction* leave( const decoded_instruction* continuation )
+      {
+        coroutine& previous = *active_coroutines[ active_coroutines.size() - 2 ];
+        const decoded_instruction* position = program.at( previous.instruction_pointer );
+        save_position( continuation );
+        active_coroutines.pop_back();
+        co = &previous;
+        return position;
+      }
+
+      /// Limits the execution to the given budget, from now on; also starts the countdown to the first sample, if profiling
+      void set_budget( const execution_budget& budget );
+
+      /**
+      @brief Charges instructions to the budget once the countdown doesn't cover them anymore, and takes a sample if profiling.
+      @param cost number of instructions
+      @param next where the active coroutine continues, with the stack as it is
+      @param cached_bytes bytes on top of the active coroutine's stack that aren't in memory yet, see @ref dispatch_engine::top_of_stack
+      @returns false if the budget ran out; otherwise they're charged and the countdown restarts
+      */
+      bool recharge( const std::uint64_t cost, const decoded_instruction* next, const std::size_t cached_bytes );
+
+      const code_segment& code;
+      const decoded_code& program;
+      /// `program.data()`, cached.
+      const decoded_instruction* const instructions;
+      coroutine_manager& coroutines;
+      const std::vector< syscall >& syscalls;
+      /// The chain of live coroutines, each one waiting on the next.
+      std::vector< coroutine* > active_coroutines;
+      /// The active coroutine, i.e. `active_coroutines.back()`, cached.
+      coroutine* co;
+      /// Whether the engines have to perform all checks, as opposed to only those the @ref verification couldn't rule out
+      bool checked = true;
+      /// Compiler of hot functions, for dispatch_engine::jit
+      jit_compiler* jit = nullptr;
+      /// Where recharge() records samples, if profiling
+      profiler* profile = nullptr;
+      /// The instrumentation, if it's @ref opcode_statistics; recharge() discards its sample in progress, which would include the sampling and time checks
+      opcode_statistics* statistics = nullptr;
+      /// Position of the current instruction, for engines that can't catch exceptions where they keep it
+      const decoded_instruction* position = nullptr;
+      /// Set by opcode::exit
+      bool finished = false;
+      /// Set by opcode::syscall if the syscall threw @ref would_block, the active coroutine's instruction pointer is at the syscall; or once the budget ran out
+      bool suspended = false;
+      /// Set along with `suspended` if the budget ran out
+      bool preempted = false;
+      /// Instructions that may be counted before recharge() has to be called, see @ref execution_budget
+      std::uint64_t countdown = std::numeric_limits< std::uint64_t >::max();
+      /// Instructions of the budget beyond the countdown
+      std::uint64_t instructions_left = 0;
+      /// When the budget's time runs out
+      std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::time_point::max();
+      /// The final stack, once finished
+      stack result;
+    };
+
+    /**
+    @brief Runs the given execution, using the engine implemented by the respective function.
+
+    Execution continues at the active coroutine's instruction pointer, using the checked or unchecked instructions depending on execution_state::checked.
+    It ends when execution_state::finished or execution_state::suspended is set, or when the unchecked instructions encounter something the verification didn't account for. In the latter case the position is saved in the active coroutine, so a checked engine can take over.
+    @tparam instrumentation type of the instrumentation, e.g. @ref no_instrumentation
+    @see processor::execute() for the exceptions thrown
+    */
+    template< typename instrumentation >
+    void run_switch_engine( execution_state& state, instrumentation& instr );
+    /// @copydoc run_switch_engine()
+    template< typename instrumentation >
+    void run_computed_goto_engine( execution_state& state, instrumentation& instr );
+    /// @copydoc run_switch_engine()
+    template< typename instrumentation >
+    void run_tail_call_engine( execution_state& state, instrumentation& instr );
+    /// @copydoc run_switch_engine()
+    template< typename instrumentation >
+    void run_top_of_stack_engine( execution_state& state, instrumentation& instr );
+    /// @copydoc run_switch_engine()
+    /// @pre execution_state::jit is set
+    template< typename instrumentation >
+    void run_jit_engine( execution_state& state, instrumentation& instr );
+  }
+}
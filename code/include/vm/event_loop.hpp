@@ -0,0 +1,163 @@
+#pragma once
+
+#include "processor.hpp"
+#include "stack.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <future>
+#include <list>
+#include <unordered_map>
+
+namespace perseus
+{
+  namespace detail
+  {
+    /**
+    @brief Runs executions of several @ref processor "processors" on the current thread, suspending those waiting for file descriptors.
+
+    A syscall that would have to wait for a file descriptor calls await() instead, which suspends the execution via @ref would_block until the descriptor is ready. Meanwhile the other executions keep running. Once it's ready, the execution is resumed and the syscall runs again, so it must leave the stack unchanged when calling await(). read_syscall() and write_syscall() work like that.
+
+    Readiness is waited for using epoll, level-triggered. The file descriptors must be non-blocking, otherwise the syscalls block the whole loop. Regular files, which epoll doesn't support, count as always ready.
+
+    A processor can only have one suspended execution, so each execution needs its own processor. The processors must outlive their executions and must not be executed on by anybody else meanwhile.
+    */
+    class event_loop
+    {
+    public:
+      /// What to wait for
+      enum class readiness
+      {
+        /// reading won't block
+        readable,
+        /// writing won't block
+        writable
+      };
+
+      /**
+      @brief Constructor
+      @throws std::system_error if no epoll instance can be created
+      */
+      event_loop();
+      /// Destructor; executions that haven't finished never will
+      ~event_loop();
+      /// non-copyable
+      event_loop( const event_loop& ) = delete;
+      /// non-copyable
+      event_loop& operator=( const event_loop& ) = delete;
+
+      /**
+      @brief Queue an execution, which starts during the next run() or run_once().
+      @param proc the processor to execute on
+      @param start_address Location in the code to begin execution at
+      @param parameters Initial stack
+      @returns the final stack, or any exception processor::execute() throws
+      @throws std::bad_alloc if the system runs out of memory
+      */
+      std::future< stack > spawn( processor& proc, const instruction_pointer::value_type start_address = 0, stack&& parameters = stack() );
+
+      /**
+      @brief Run until every execution has finished.
+      @throws std::system_error if waiting for the file descriptors fails
+      */
+      void run();
+
+      /**
+      @brief Run the executions that can make progress, waiting for file descriptors at most once.
+      @param timeout_milliseconds how long to wait for a file descriptor if no execution can make progress right away; -1 for no limit
+      @returns whether any executions remain
+      @throws std::system_error if waiting for the file descriptors fails
+      */
+      bool run_once( const int timeout_milliseconds = -1 );
+
+      /**
+      @brief Suspend the current execution until the file descriptor is ready; only to be called by syscalls of this loop's executions.
+
+      The syscall runs again once the execution is resumed, so it must leave the stack as it found it.
+      @throws would_block always, to suspend the execution
+      @throws invalid_suspension_state if none of this loop's executions is running
+      @throws std::system_error if the file descriptor can't be waited for
+      */
+      [[noreturn]] void await( const int file_descriptor, const readiness what );
+
+      /**
+      @brief A syscall reading from a file descriptor, suspending until there's something to read.
+
+      Pops the file descriptor (`i32`) and the maximum number of bytes to read (`u32`). Pushes the bytes read, followed by their number (`i32`), which is 0 at the end of the file and the negated `errno` on failure.
+      */
+      syscall read_syscall();
+
+      /**
+      @brief A syscall writing to a file descriptor, suspending until it can be written to.
+
+      Pops the file descriptor (`i32`), the number of bytes to write (`u32`) and that many bytes. Pushes the number of bytes written (`i32`), which may be fewer, or the negated `errno` on failure.
+      */
+      syscall write_syscall();
+
+      /**
+      @brief Limit how long an execution runs before the others get their turn.
+
+      Executions running out of their slice continue after the other ready ones, so a runaway loop can't stall the rest.
+      @param slice the budget of each turn; unlimited by default
+      */
+      void set_time_slice( const execution_budget& slice )
+      {
+        _slice = slice;
+      }
+
+      /// Number of executions that haven't finished yet
+      std::size_t pending() const
+      {
+        return _tasks.size();
+      }
+
+    private:
+      struct task
+      {
+        task( processor& proc, const instruction_pointer::value_type start_address, stack&& parameters )
+          : proc( proc )
+          , start_address( start_address )
+          , parameters( std::move( parameters ) )
+        {
+        }
+
+        processor& proc;
+        /// where execution starts, until it has started
+        instruction_pointer::value_type start_address;
+        stack parameters;
+        bool started = false;
+        std::promise< stack > result;
+      };
+
+      /// the executions waiting for a file descriptor
+      struct waiters
+      {
+        std::deque< std::list< task >::iterator > readers;
+        std::deque< std::list< task >::iterator > writers;
+      };
+
+      /// runs the task until it finishes or gets suspended
+      void run( const std::list< task >::iterator t );
+      /// runs the ready tasks, including those becoming ready in the meantime
+      void run_ready();
+      /// moves the tasks waiting on the file descriptor for the given epoll events to _ready
+      void wake( const int file_descriptor, const std::uint32_t events );
+      /// tells epoll what the file descriptor's waiters wait for, if anything
+      void update( const int file_descriptor, waiters& w, const bool registered );
+
+      int _epoll;
+      /// every unfinished execution
+      std::list< task > _tasks;
+      std::deque< std::list< task >::iterator > _ready;
+      std::unordered_map< int, waiters > _waiting;
+      /// the running task, if any
+      std::list< task >::iterator _current;
+      bool _running = false;
+      /// whether the running task called await()
+      bool _awaiting = false;
+      /// the budget of each turn
+      execution_budget _slice;
+    };
+  }
+}
@@ -56,8 +56,20 @@ namespace perseus
     using std::out_of_range::out_of_range;
   };
 
+  /**
+  @brief Push onto a full stack
+
+  Tried to grow a @ref stack with fixed capacity, i.e. one using @ref stack_backend::reserved, beyond that capacity.
+  */
+  struct stack_overflow : std::out_of_range
+  {
+    using std::out_of_range::out_of_range;
+  };
+
   /**
   @brief Supplied a @ref detail::coroutine::identifier "coroutine identifier" with no corresponding coroutine
+
+  This includes identifiers of deleted coroutines.
   */
   struct invalid_coroutine_identifer : std::out_of_range
   {
@@ -89,7 +101,7 @@ namespace perseus
   };
 
   /**
-  @brief Tried to have more coroutines simultaneously than fit into @ref detail::coroutine::identifier
+  @brief Tried to have more coroutines simultaneously than @ref detail::coroutine_manager::max_coroutines
   @note Realistically this will never happen during normal usage
   */
   struct too_many_coroutines : std::logic_error
@@ -121,4 +133,88 @@ namespace perseus
   {
     using std::range_error::range_error;
   };
+
+  /**
+  @brief Thrown by a syscall that can't complete yet, e.g. one receiving from an empty mailbox.
+
+  The syscall must leave the stack unchanged. Execution stops right before the syscall, and @ref detail::processor::resume() "processor::resume()" runs it again.
+  */
+  struct would_block : std::runtime_error
+  {
+    using std::runtime_error::runtime_error;
+  };
+
+  /**
+  @brief An execution ran out of its @ref detail::execution_budget "execution_budget".
+
+  Execution stops at the backward jump or call that exceeded the budget, and @ref detail::processor::resume() "processor::resume()" continues it. It's a @ref would_block, so code handling suspended executions handles preempted ones alike.
+  */
+  struct budget_exhausted : would_block
+  {
+    using would_block::would_block;
+  };
+
+  /**
+  @brief Tried to start a new execution on a processor with a suspended one, or to resume one that isn't suspended
+  */
+  struct invalid_suspension_state : std::logic_error
+  {
+    using std::logic_error::logic_error;
+  };
+
+  /**
+  @brief Supplied an actor identifier with no corresponding actor
+  */
+  struct invalid_actor_identifier : std::out_of_range
+  {
+    using std::out_of_range::out_of_range;
+  };
+
+  /**
+  @brief Tried to spawn more actors than the actor system has room for
+  */
+  struct too_many_actors : std::length_error
+  {
+    using std::length_error::length_error;
+  };
+
+  /**
+  @brief Tried to restore a file that isn't a snapshot, is damaged, or belongs to different code, or deltas that don't follow the snapshot in the order they were saved
+  */
+  struct invalid_snapshot : std::runtime_error
+  {
+    using std::runtime_error::runtime_error;
+  };
+
+  /**
+  @brief Tried to save a delta snapshot without a previous snapshot to build on
+  */
+  struct no_base_snapshot : std::logic_error
+  {
+    using std::logic_error::logic_error;
+  };
+
+  /**
+  @brief Tried to restore data that isn't a serialized coroutine, is damaged, belongs to different code, or was written on a machine of different byte order
+  */
+  struct invalid_migration : std::runtime_error
+  {
+    using std::runtime_error::runtime_error;
+  };
+
+  /**
+  @brief Tried to serialize a coroutine that isn't suspended, i.e. a dead one or one of a suspended execution
+  */
+  struct migrating_unsuspended_coroutine : std::invalid_argument
+  {
+    using std::invalid_argument::invalid_argument;
+  };
+
+  /**
+  @brief Tried to load a file that isn't a program image, is damaged, was written by an incompatible version, or needs syscalls that aren't available
+  */
+  struct invalid_image : std::runtime_error
+  {
+    using std::runtime_error::runtime_error;
+  };
 }
\ No newline at end of file
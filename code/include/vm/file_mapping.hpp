@@ -0,0 +1,40 @@
+#pragma once
+
+#include <cstddef>
+
+namespace perseus
+{
+  namespace detail
+  {
+    /// A file descriptor, closed on destruction
+    struct file
+    {
+      explicit file( const int descriptor )
+        : descriptor( descriptor )
+      {
+      }
+      ~file();
+      file( const file& ) = delete;
+      file& operator=( const file& ) = delete;
+
+      /// the size of the file
+      /// @throws std::system_error if it can't be determined
+      std::size_t size() const;
+
+      const int descriptor;
+    };
+
+    /// A read-only mapping of a whole file, unmapped on destruction
+    struct file_mapping
+    {
+      /// @throws std::system_error if the file can't be mapped
+      file_mapping( const int descriptor, const std::size_t size );
+      ~file_mapping();
+      file_mapping( const file_mapping& ) = delete;
+      file_mapping& operator=( const file_mapping& ) = delete;
+
+      void* const data;
+      const std::size_t size;
+    };
+  }
+}
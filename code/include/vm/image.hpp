@@ -0,0 +1,90 @@
+#pragma once
+
+#include "code_segment.hpp"
+#include "instruction_pointer.hpp"
+#include "profiler.hpp"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace perseus
+{
+  namespace detail
+  {
+    /// A linked program, as saved to and loaded from a program image; see @ref image for the file format.
+    struct program_image
+    {
+      code_segment code;
+      /// where execution starts
+      instruction_pointer::value_type entry_point = 0;
+      /// the names of the syscalls the code uses, by index, so the loader can supply matching ones
+      std::vector< std::string > syscalls;
+      /// the function symbol table
+      function_names functions;
+    };
+
+    /**
+    @brief Binary layout of the files written by save_image(), so a program only needs to be compiled once to be run many times.
+
+    An image consists of a @ref header, a @ref symbol record per syscall followed by one per function, the symbols' names and the code.
+
+    All values are in the byte order of the machine that wrote the image.
+    */
+    namespace image
+    {
+      /// Start of every image
+      constexpr char magic[ 8 ] = { 'P', 'E', 'R', 'S', 'I', 'M', 'G', '\0' };
+      /// Incremented on incompatible changes to the layout or the bytecode
+      constexpr std::uint32_t version = 1;
+
+      /// Start of the file
+      struct header
+      {
+        char magic[ 8 ];
+        std::uint32_t version;
+        /// program_image::entry_point
+        std::uint32_t entry_point;
+        /// number of @ref symbol records for syscalls
+        std::uint32_t syscalls;
+        /// number of @ref symbol records for functions
+        std::uint32_t functions;
+        /// where the names start in the file
+        std::uint64_t names_offset;
+        std::uint64_t names_size;
+        /// where the code starts in the file
+        std::uint64_t code_offset;
+        std::uint64_t code_size;
+        /// snapshot::code_hash() of the code, to detect damaged files
+        std::uint64_t code_hash;
+      };
+
+      /// A syscall or function
+      struct symbol
+      {
+        /// the address of a function; unused for syscalls, whose index is their position
+        std::uint32_t address;
+        /// the name, relative to header::names_offset
+        std::uint32_t name_offset;
+        std::uint32_t name_size;
+      };
+    }
+
+    /**
+    @brief Writes a program to a file; see @ref image for the format.
+    @throws std::system_error if the file can't be written
+    @throws std::bad_alloc if the system is out of memory
+    */
+    void save_image( const std::string& path, const program_image& program );
+
+    /**
+    @brief Reads a file written by save_image().
+
+    The file is mapped into memory rather than read through a stream; the code is copied out of the mapping once, since a @ref code_segment owns its bytes.
+    @throws invalid_image if the file isn't a valid image, or one of a different version
+    @throws std::system_error if the file can't be opened or mapped
+    @throws std::bad_alloc if the system is out of memory
+    */
+    program_image load_image( const std::string& path );
+  }
+}
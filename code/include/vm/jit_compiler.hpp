@@ -0,0 +1,94 @@
+#pragma once
+
+#include <vector>
+#include <memory>
+#include <cstdint>
+#include <cstddef>
+
+#include "decoded_code.hpp"
+#include "instruction_pointer.hpp"
+#include "stack.hpp"
+
+/// Defined if native code can be generated for this platform (x86-64 Linux)
+#if defined( __x86_64__ ) && defined( __linux__ )
+# define PERSEUS_HAS_JIT
+#endif
+
+namespace perseus
+{
+  namespace detail
+  {
+    /**
+    @brief Baseline compiler from @ref decoded_code to x86-64 machine code, used by @ref dispatch_engine::jit.
+
+    The interpreter reports every call; once a function has been called often enough, it is compiled, instruction by instruction, into native code that works directly on the coroutine's @ref stack, keeping its exact memory layout. Native functions call each other natively and return to the interpreter when they return to code that isn't native.
+
+    Anything the compiler doesn't support, like syscalls, coroutine switches and absolute stack accesses, hands execution back to the interpreter right before that instruction, with the stack as the interpreter would have it. So does anything that would throw, e.g. a stack underflow or a division by zero, so the interpreter throws the usual exception, and a backward jump or call the @ref execution_budget doesn't cover. Instrumentation only sees interpreted instructions.
+
+    On other platforms nothing is ever compiled.
+    */
+    class jit_compiler
+    {
+    public:
+      /// Entry point of a compiled function, to be passed to run()
+      typedef const void* native_function;
+
+      /// Number of calls after which a function gets compiled, by default
+      static constexpr std::uint32_t default_hot_call_count = 64;
+
+      /**
+      @brief Constructor
+      @param program_size size of the @ref decoded_code that will be compiled
+      @param hot_call_count number of calls after which a function gets compiled; 0 disables compilation
+      */
+      explicit jit_compiler( const std::size_t program_size, const std::uint32_t hot_call_count = default_hot_call_count );
+      ~jit_compiler();
+      /// Non-copyable
+      jit_compiler( const jit_compiler& ) = delete;
+      /// Non-copyable
+      jit_compiler& operator=( const jit_compiler& ) = delete;
+
+      /**
+      @brief To be called whenever the interpreter calls a function.
+      @param program the code being executed
+      @param index instruction index of the called function
+      @returns the function's native code, if it has been compiled (possibly just now), otherwise nullptr
+      @throws std::bad_alloc if the system is out of memory
+      */
+      native_function on_call( const decoded_code& program, const std::uint32_t index );
+
+      /**
+      @brief Runs a compiled function.
+      @param function the function, as returned by on_call()
+      @param st the stack, with the return address on top
+      @param countdown instructions native code may charge at backward jumps and calls, see execution_state::countdown; decreased by those it did. If they don't cover a backward jump or call, native code leaves it to the interpreter.
+      @returns where the interpreter continues: the return address, or the instruction the native code couldn't execute
+      @throws std::bad_alloc if the system is out of memory
+      */
+      instruction_pointer::value_type run( const native_function function, stack& st, std::uint64_t& countdown ) const;
+
+      /// Number of functions compiled so far
+      std::size_t compiled_functions() const
+      {
+        return _compiled_functions;
+      }
+
+    private:
+      /// Compiles the function at the given index into _functions, unless it contains code the compiler can't handle
+      void compile( const decoded_code& program, const std::uint32_t index );
+      /// Copies machine code into newly allocated executable memory, returning it or nullptr on failure
+      const void* load( const std::vector< std::uint8_t >& machine_code );
+
+      std::uint32_t _hot_call_count;
+      /// calls so far per instruction index; hot_call_count + 1 once compilation was attempted
+      std::vector< std::uint32_t > _call_counts;
+      /// native code per instruction index, nullptr if not compiled; compiled code calls through these
+      std::unique_ptr< native_function[] > _functions;
+      /// the code entering native functions from C++
+      const void* _trampoline = nullptr;
+      /// all executable memory, with its size
+      std::vector< std::pair< void*, std::size_t > > _memory;
+      std::size_t _compiled_functions = 0;
+    };
+  }
+}
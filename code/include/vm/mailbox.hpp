@@ -0,0 +1,60 @@
+#pragma once
+
+#include "stack.hpp"
+
+#include <atomic>
+
+namespace perseus
+{
+  namespace detail
+  {
+    /**
+    @brief Lock-free queue of messages with any number of senders and a single receiver.
+
+    An intrusive linked list with a stub node: senders atomically swap themselves in as the newest node, then link up the previous one. The receiver follows the links from the oldest node. A message whose sender has swapped itself in but not linked up yet is not visible to the receiver yet.
+    */
+    class mailbox
+    {
+    public:
+      /// Constructor
+      mailbox();
+      /// Destructor; discards any remaining messages
+      ~mailbox();
+      /// non-copyable
+      mailbox( const mailbox& ) = delete;
+      /// non-copyable
+      mailbox& operator=( const mailbox& ) = delete;
+
+      /**
+      @brief Add a message; may be called by any thread.
+      @throws std::bad_alloc if the system is out of memory
+      */
+      void push( stack&& message );
+
+      /**
+      @brief Remove the oldest message; may only be called by one thread at a time.
+      @param out where to store the message
+      @returns whether there was a message
+      */
+      bool pop( stack& out );
+
+      /// Whether there are no messages; may only be called by the receiver.
+      bool empty() const
+      {
+        return _tail->next.load() == nullptr;
+      }
+
+    private:
+      struct node
+      {
+        std::atomic< node* > next{ nullptr };
+        stack message;
+      };
+
+      /// newest node, swapped by the senders
+      std::atomic< node* > _head;
+      /// oldest node, whose message has already been received (or the stub); only used by the receiver
+      node* _tail;
+    };
+  }
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace perseus
+{
+  namespace detail
+  {
+    /**
+    @brief Byte stream layout of coroutines serialized by processor::save_coroutine().
+
+    | bytes | content |
+    |-------|---------|
+    | 4     | @ref magic |
+    | 4     | @ref version |
+    | 1     | byte order of the stack's values: @ref little_endian or @ref big_endian |
+    | 3     | padding |
+    | 8     | snapshot::code_hash() of the code |
+    | 8     | size of the code |
+    | 4     | instruction pointer |
+    | 8     | stack size |
+    | *     | the stack |
+
+    The numbers in the header are little endian, no matter the machine. The stack is copied as is, since it carries no type information, so its values keep the byte order of the machine the coroutine ran on; it can only be restored on machines with the same byte order.
+    */
+    namespace migration
+    {
+      /// Start of every stream
+      constexpr char magic[ 4 ] = { 'P', 'C', 'O', 'R' };
+      /// Incremented on incompatible changes to the layout
+      constexpr std::uint32_t version = 1;
+      /// Size of the header preceding the stack
+      constexpr std::size_t header_size = 40;
+
+      /// Byte order markers
+      enum byte_order : std::uint8_t
+      {
+        little_endian = 1,
+        big_endian = 2
+      };
+
+      /// The byte order of this machine
+      byte_order native_byte_order();
+
+      /**
+      @brief Total size of a stream, given its header, e.g. to know how much more to read from a pipe.
+      @param header the first @ref header_size bytes of the stream
+      @throws invalid_migration if the header doesn't start a stream of this version
+      */
+      std::size_t stream_size( const char* header );
+    }
+  }
+}
@@ -0,0 +1,146 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+
+#if defined( _MSC_VER ) && ( defined( _M_X64 ) || defined( _M_IX86 ) )
+# include <intrin.h>
+# define PERSEUS_HAS_TIME_STAMP_COUNTER
+#elif defined( __GNUC__ ) && ( defined( __x86_64__ ) || defined( __i386__ ) )
+# include <x86intrin.h>
+# define PERSEUS_HAS_TIME_STAMP_COUNTER
+#endif
+
+#include "shared/opcodes.hpp"
+#include "decoded_code.hpp"
+
+namespace perseus
+{
+  namespace detail
+  {
+    /**
+    @brief Instrumentation that counts how often each instruction executes and estimates how long each takes, to find out which superinstructions, specialized opcodes or dispatch changes would pay off.
+
+    Every instruction is counted. Every @ref sample_interval() th one is also timed using the time stamp counter, from its `on_instruction()` to the next one, so the time includes its dispatch and a bit of the instrumentation itself, but not the budget checks and profile samples of @ref execution_state::recharge(), which discards the sample; compare opcodes with each other rather than trusting the absolute numbers. Each handler gets a histogram of its samples, with power of two buckets.
+
+    Times are in time stamp counter ticks, which are about a cycle at the nominal clock rate; on processors without a time stamp counter they are nanoseconds instead.
+
+    Instructions the @ref dispatch_engine::jit "jit engine" runs natively aren't reported, so use an interpreting engine for complete numbers. A sample still in progress when an execution ends other than by @ref opcode::exit "exit", e.g. by an exception, is completed by the next execution's first instruction.
+    */
+    class opcode_statistics
+    {
+    public:
+      /// samples with at least 2^(histogram_size-1) ticks share the last bucket
+      static constexpr std::size_t histogram_size = 24;
+      /// prime, so loops rarely line up with it and get the same instruction sampled every time
+      static constexpr std::uint32_t default_sample_interval = 61;
+
+      /// What was recorded about one handler
+      struct handler_statistics
+      {
+        /// how often the handler was executed
+        std::uint64_t executions = 0;
+        /// how many of those executions were timed
+        std::uint64_t samples = 0;
+        /// ticks spent in the timed executions
+        std::uint64_t sampled_ticks = 0;
+        /// number of samples by ticks; bucket 0 holds 0 and 1 tick, bucket i > 0 holds [2^i, 2^(i+1))
+        std::array< std::uint64_t, histogram_size > histogram{};
+
+        /// average ticks per execution, or 0 without samples
+        double mean_ticks() const;
+        /// estimated ticks spent in all executions
+        double estimated_ticks() const;
+        /// upper bound of the histogram bucket containing the given fraction of the samples, e.g. 0.5 for the median
+        std::uint64_t percentile( const double fraction ) const;
+      };
+
+      /// @param sample_interval every how many instructions one gets timed; 1 times every instruction
+      explicit opcode_statistics( const std::uint32_t sample_interval = default_sample_interval );
+
+      /// called before every instruction
+      void on_instruction( const opcode code )
+      {
+        const std::uint32_t handler = static_cast< std::uint32_t >( code );
+        ++_handlers[ handler ].executions;
+        if( _timed != untimed )
+        {
+          record( read_time_stamp() - _timed_start );
+        }
+        if( --_countdown == 0 )
+        {
+          _countdown = _sample_interval;
+          // nothing follows exit to end its sample
+          if( code != opcode::exit )
+          {
+            _timed = handler;
+            _timed_start = read_time_stamp();
+          }
+        }
+      }
+
+      /// forgets the sample in progress, if the time until the next instruction includes something else, like a profile sample
+      void discard_sample()
+      {
+        _timed = untimed;
+      }
+
+      /// every how many instructions one gets timed
+      std::uint32_t sample_interval() const
+      {
+        return _sample_interval;
+      }
+
+      /// statistics of an @ref opcode
+      const handler_statistics& get( const opcode code ) const
+      {
+        return _handlers[ get_handler( code ) ];
+      }
+
+      /// statistics of an @ref internal_handler
+      const handler_statistics& get( const internal_handler handler ) const
+      {
+        return _handlers[ get_handler( handler ) ];
+      }
+
+      /// number of instructions executed so far
+      std::uint64_t instructions() const;
+
+      /// forgets everything recorded so far
+      void clear();
+
+      /**
+      @brief Writes a table of all executed handlers, the ones taking the most estimated time first.
+
+      The columns are the handler's name, its executions, their share of all executions, the mean ticks per execution, the estimated share of all ticks, and the upper bounds of the histogram buckets containing the median and the 90th percentile of the samples.
+      */
+      void write_table( std::ostream& out ) const;
+
+    private:
+      static constexpr std::uint32_t untimed = handler_count;
+
+      static std::uint64_t read_time_stamp()
+      {
+#ifdef PERSEUS_HAS_TIME_STAMP_COUNTER
+        return __rdtsc();
+#else
+        return static_cast< std::uint64_t >( std::chrono::duration_cast< std::chrono::nanoseconds >( std::chrono::steady_clock::now().time_since_epoch() ).count() );
+#endif
+      }
+
+      /// adds a sample of the timed handler and stops timing
+      void record( const std::uint64_t ticks );
+
+      std::array< handler_statistics, handler_count > _handlers;
+      std::uint32_t _sample_interval;
+      /// instructions until the next one gets timed
+      std::uint32_t _countdown;
+      /// the handler being timed, or @ref untimed
+      std::uint32_t _timed = untimed;
+      std::uint64_t _timed_start = 0;
+    };
+  }
+}
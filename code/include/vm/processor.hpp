@@ -2,28 +2,32 @@
 
 #include <vector>
 #include <functional>
+#include <memory>
+#include <string>
 
 #include "code_segment.hpp"
 #include "instruction_pointer.hpp"
 #include "stack.hpp"
 #include "coroutine_manager.hpp"
+#include "dispatch.hpp"
+#include "decoded_code.hpp"
+#include "verification.hpp"
+#include "jit_compiler.hpp"
+#include "snapshot.hpp"
+#include "profiler.hpp"
+#include "opcode_statistics.hpp"
 
 namespace perseus
 {
   namespace detail
   {
-    /**
-    @brief Syscall callback
-
-    Invoked by the @ref opcode::syscall "syscall opcode"
-    */
-    typedef std::function< void( stack& ) > syscall;
-
     /**
     @brief Processor for Perseus bytecode.
 
     Responsible for execution of bytecode from a given @ref code_segment.
 
+    The code is translated into @ref decoded_code once on construction, so executing it doesn't need to decode any bytecode. It is also verified, if desired, so execution of verified functions can skip most stack checks; see @ref verification.
+
     @todo Support custom allocators? (Remove std::bad_alloc throw declarations then)
     */
     class processor
@@ -32,10 +36,13 @@ namespace perseus
       /**
       @brief Constructor.
 
-      @param code Code this processor will execute. The processor takes ownership of it.
+      @param code Code this processor will execute. The processor takes ownership of it and decodes it.
       @param syscalls Vector of syscalls for the @ref opcode::syscall "syscall opcode"
+      @param engine How to dispatch instructions; purely a performance choice, the engines behave identically.
+      @param verify Whether to verify the code. Verified functions run without stack checks; execution is identical otherwise.
+      @param backend Where coroutines keep their stacks. With @ref stack_backend::reserved, stacks never move, so syscalls can keep pointers into them, but their size is limited.
       */
-      processor( code_segment&& code, std::vector< syscall >&& syscalls = {} );
+      processor( code_segment&& code, std::vector< syscall >&& syscalls = {}, const dispatch_engine engine = dispatch_engine::switch_, const bool verify = true, const stack_backend backend = stack_backend::heap );
       /// Non-copyable
       processor( const processor& ) = delete;
       /// Non-copyable
@@ -51,16 +58,211 @@ namespace perseus
       @param start_address Location in the code to begin execution at
       @param parameters Initial stack
       @returns Final stack
-      @throws code_segmentation_fault if the instruction pointer reaches the end of the @ref code_segment.
+      @throws code_segmentation_fault if the instruction pointer reaches the end of the @ref code_segment, or if a return address, indirect jump or coroutine start points into the middle of an instruction.
       @throws invalid_opcode if the instruction pointer points to an invalid instruction.
-      @throws too_many_coroutines if we run out of coroutine identifiers (basically only possible on incorrect usage)
+      @throws too_many_coroutines if there are already coroutine_manager::max_coroutines coroutines
       @throws invalid_coroutine_identifier if an invalid coroutine identifier is supplied
       @throws resuming_dead_coroutine when trying to resume a dead coroutine
       @throws resuming_live_coroutine when trying to resume an already live coroutine
+      @throws stack_overflow if a coroutine's stack exceeds its capacity, which only reserved stacks have
+      @throws would_block if a syscall can't complete yet; the execution is suspended and can be continued using resume()
+      @throws invalid_suspension_state if an execution is suspended
       @throws bad_alloc if the system runs out of memory
       **/
       stack execute( const instruction_pointer::value_type start_address = 0, stack&& parameters = stack() );
 
+      /**
+      @brief Start execution at the given location, reporting each instruction to the given instrumentation.
+
+      Supported instrumentation types are @ref no_instrumentation, @ref instruction_counter and @ref opcode_statistics.
+      @see execute() for parameters and exceptions
+      **/
+      template< typename instrumentation >
+      stack execute( const instruction_pointer::value_type start_address, stack&& parameters, instrumentation& instr );
+
+      /**
+      @brief Start execution at the given location, preempting it once the given budget runs out, so a runaway loop can't block the thread.
+
+      @param start_address Location in the code to begin execution at
+      @param parameters Initial stack
+      @param budget how long to run, see @ref execution_budget
+      @returns Final stack
+      @throws budget_exhausted if the budget ran out; the execution is suspended, with all coroutines intact, and can be continued using resume()
+      @see execute() for the other exceptions
+      **/
+      stack execute( const instruction_pointer::value_type start_address, stack&& parameters, const execution_budget budget );
+
+      /**
+      @brief Continue the suspended execution: the syscall that threw @ref would_block, or where the budget ran out.
+      @param budget how long to run, see @ref execution_budget; unlimited by default
+      @returns Final stack
+      @throws invalid_suspension_state if no execution is suspended
+      @see execute() for the other exceptions, including another @ref would_block or @ref budget_exhausted
+      **/
+      stack resume( const execution_budget budget = execution_budget() );
+
+      /**
+      @brief Like execute(), but returns whether the execution finished instead of throwing @ref would_block or @ref budget_exhausted
+      @param start_address Location in the code to begin execution at
+      @param parameters Initial stack
+      @param result where to store the final stack, if the execution finished
+      @param budget how long to run, see @ref execution_budget; unlimited by default
+      @returns false if the execution got suspended
+      @see execute() for the other exceptions
+      **/
+      bool try_execute( const instruction_pointer::value_type start_address, stack&& parameters, stack& result, const execution_budget budget = execution_budget() );
+
+      /**
+      @brief Like resume(), but returns whether the execution finished instead of throwing @ref would_block or @ref budget_exhausted
+      @param result where to store the final stack, if the execution finished
+      @param budget how long to run, see @ref execution_budget; unlimited by default
+      @returns false if the execution got suspended again
+      @see resume() for the exceptions
+      **/
+      bool try_resume( stack& result, const execution_budget budget = execution_budget() );
+
+      /**
+      @brief Whether an execution has been suspended, by a syscall throwing @ref would_block or by running out of budget, and can be continued using resume()
+      */
+      bool is_suspended() const
+      {
+        return !_suspension.chain.empty();
+      }
+
+      /**
+      @brief Whether the suspended execution ran out of budget, as opposed to waiting for a syscall
+      */
+      bool is_preempted() const
+      {
+        return is_suspended() && _suspension.preempted;
+      }
+
+      /**
+      @brief Start execution at the given location, with the given coroutines instead of the processor's own.
+
+      Doesn't modify the processor, so several threads may execute concurrently, each with its own @ref coroutine_manager, provided the syscalls can be called concurrently. Coroutine identifiers refer to the given coroutines only.
+
+      The JIT isn't thread-safe, so dispatch_engine::jit interprets like dispatch_engine::switch_ here. Executions can't be suspended; a syscall throwing @ref would_block ends them.
+      @see execute() for parameters and exceptions
+      **/
+      stack execute( coroutine_manager& coroutines, const instruction_pointer::value_type start_address, stack&& parameters ) const;
+
+      /**
+      @brief Save the coroutines, including a suspended execution, to a file; see @ref snapshot for the format.
+
+      Together with the code, that's everything needed to continue where the processor left off, e.g. to resume a suspended execution in another process. Must not be called during an execution, e.g. by a syscall.
+
+      Starts a new checkpoint: save_delta() only saves what changes from here on.
+      @param path the file to write, which is replaced if it exists; the new file is written next to it and then renamed, so the old one stays intact until the save is complete, and stacks restored from it keep mapping it
+      @throws std::system_error if the file can't be written
+      @throws std::bad_alloc if the system runs out of memory
+      */
+      void save_snapshot( const std::string& path );
+
+      /**
+      @brief Save what changed since the last save_snapshot(), save_delta() or restore_snapshot() to a file, and start a new checkpoint.
+
+      Only the pages of stacks that changed are written, see stack::dirty_ranges(), so periodic checkpoints of big, mostly idle stacks stay cheap. Restore by passing the snapshot and all deltas since to restore_snapshot(). Must not be called during an execution, e.g. by a syscall.
+      @param path the file to write, which is replaced like by save_snapshot()
+      @throws no_base_snapshot if there's no checkpoint to build on
+      @throws std::system_error if the file can't be written; the checkpoint stays, so a later delta covers these changes as well
+      @throws std::bad_alloc if the system runs out of memory
+      */
+      void save_delta( const std::string& path );
+
+      /**
+      @brief Replace the coroutines, including any suspended execution, with those from a file written by save_snapshot() of a processor with the same code, followed by the deltas saved after it.
+
+      Stacks of at least a page are stored page-aligned in the file. With @ref stack_backend::reserved they're mapped from it copy-on-write, so each page is only read once it's used; heap stacks are copied. The snapshot file must therefore not be modified in place while the restored coroutines exist; replacing it, like save_snapshot() does, is fine. The deltas are applied on top, in order. The processor is unchanged if restoring fails. Must not be called during an execution, e.g. by a syscall.
+
+      The stacks in the file haven't been seen by the verifier, so a suspended execution always continues with checked instructions.
+
+      Starts a new checkpoint, so save_delta() can continue the chain of deltas.
+      @param path the snapshot to read
+      @param deltas the files written by save_delta() since, in the order they were saved
+      @throws invalid_snapshot if the file isn't a valid snapshot of this processor's code, or the deltas don't follow it
+      @throws std::system_error if the file can't be read or mapped
+      @throws std::bad_alloc if the system runs out of memory
+      */
+      void restore_snapshot( const std::string& path, const std::vector< std::string >& deltas = {} );
+
+      /**
+      @brief Serialize a suspended coroutine, so a processor with the same code can continue it, e.g. in another process; see @ref migration for the format.
+
+      The coroutine stays; delete it once it continues elsewhere to move it.
+      @param id the coroutine's identifier
+      @returns the serialized coroutine
+      @throws invalid_coroutine_identifier if there is no such coroutine
+      @throws migrating_unsuspended_coroutine if the coroutine is dead or part of the suspended execution
+      @throws std::bad_alloc if the system runs out of memory
+      */
+      std::vector< char > save_coroutine( const coroutine::identifier id ) const;
+
+      /**
+      @brief Create a coroutine from one serialized by save_coroutine() of a processor with the same code.
+      @param data the serialized coroutine
+      @param size its size in bytes
+      @returns the new coroutine's identifier, which generally differs from the original one
+      @throws invalid_migration if the data isn't a complete serialized coroutine of this processor's code and byte order
+      @throws too_many_coroutines if there are already coroutine_manager::max_coroutines coroutines
+      @throws stack_overflow if the stack doesn't fit into a reserved stack
+      @throws std::bad_alloc if the system runs out of memory
+      */
+      coroutine::identifier restore_coroutine( const char* data, const std::size_t size );
+
+      /// The @ref dispatch_engine used by execute()
+      dispatch_engine engine() const
+      {
+        return _engine;
+      }
+
+      /**
+      @brief Whether execute() can skip the stack checks when starting at the given address with the given number of bytes of parameters.
+      */
+      bool is_verified( const instruction_pointer::value_type start_address, const std::size_t parameters_size ) const
+      {
+        return _verification.is_verified( start_address, parameters_size );
+      }
+
+      /**
+      @brief The compiler of hot functions, if the @ref dispatch_engine is dispatch_engine::jit, otherwise nullptr.
+      */
+      const jit_compiler* jit() const
+      {
+        return _jit.get();
+      }
+
+      /**
+      @brief Set the names of the functions, for profiles; done by compiler::link().
+      */
+      void set_function_names( function_names&& names )
+      {
+        _function_names = std::move( names );
+      }
+
+      /**
+      @brief Start sampling where executions spend their time, discarding any previous profile.
+
+      Every @p interval counted instructions, see @ref execution_budget, the call stack of the active coroutine is recorded; see @ref profiler. Call stacks can only be walked through functions the @ref verification accepts; callers of others show up as unknown. Functions compiled by dispatch_engine::jit hand over to the interpreter for the rest of their call at every sample, so profiling slows them down.
+
+      While profiling is off, executions don't pay for it at all.
+      @param interval counted instructions between samples
+      @throws std::bad_alloc if the system runs out of memory
+      */
+      void start_profiling( const std::uint64_t interval );
+
+      /// Stop sampling, keeping the profile
+      void stop_profiling()
+      {
+        _profiling = false;
+      }
+
+      /// The profile of the last start_profiling(), if any, otherwise nullptr
+      const profiler* profile() const
+      {
+        return _profiler.get();
+      }
+
       /**
       @brief Whether there are any coroutines
       */
@@ -68,7 +270,63 @@ namespace perseus
       {
         return !_coroutine_manager.empty();
       }
+
+      /// Where coroutines keep their stacks
+      stack_backend backend() const
+      {
+        return _coroutine_manager.stacks().backend();
+      }
+
+      /**
+      @brief The pool recycling the stacks of deleted coroutines, for adjusting its limits and reading its statistics
+      */
+      stack_pool& stacks()
+      {
+        return _coroutine_manager.stacks();
+      }
+
+      /// @copydoc stacks()
+      const stack_pool& stacks() const
+      {
+        return _coroutine_manager.stacks();
+      }
     private:
+      /// A suspended execution
+      struct suspension
+      {
+        /// the live coroutines, each one waiting on the next; empty if nothing is suspended
+        std::vector< coroutine* > chain;
+        /// whether the execution was running checked
+        bool checked = true;
+        /// whether it ran out of budget
+        bool preempted = false;
+      };
+
+      /// Throws @ref budget_exhausted or @ref would_block, depending on why the execution got suspended
+      [[noreturn]] void throw_suspended() const;
+
+      /**
+      @brief Implementation of execute() and resume(), running the given execution until it finishes or gets suspended
+      @param suspended where to store the execution if it gets suspended; if nullptr, it can't be resumed
+      @param result where to store the final stack
+      @returns whether the execution finished
+      */
+      template< typename instrumentation >
+      bool run( execution_state& state, instrumentation& instr, suspension* suspended, stack& result ) const;
+
+      /// The execution_state for a new execution on the given coroutines
+      execution_state start( coroutine_manager& coroutines, const instruction_pointer::value_type start_address, stack&& parameters ) const;
+
+      /**
+      @brief The parts of save_snapshot() and save_delta() that are the same
+      @param slots filled with a record per slot, apart from the stacks' offsets
+      @returns the header, apart from its magic, page size and checkpoints
+      */
+      snapshot::header snapshot_tables( std::vector< snapshot::slot >& slots ) const;
+
+      /// Forgets about the stacks' changes, since they're in the file with the given checkpoint
+      void start_checkpoint( const std::uint64_t checkpoint );
+
       //    Opcodes
 
     private:
@@ -76,8 +334,23 @@ namespace perseus
 
       /// Memory segment containing the code to be executed.
       code_segment _code;
+      /// _code, decoded
+      decoded_code _program;
+      /// which parts of _program can run unchecked
+      verification _verification;
       coroutine_manager _coroutine_manager;
       std::vector< syscall > _syscalls;
+      dispatch_engine _engine;
+      /// for dispatch_engine::jit; refers to nothing but its own memory, so the processor stays movable
+      std::unique_ptr< jit_compiler > _jit;
+      /// the execution to resume(), if any
+      suspension _suspension;
+      /// header::checkpoint of the last snapshot or delta saved or restored, 0 if none
+      std::uint64_t _checkpoint = 0;
+      function_names _function_names;
+      std::unique_ptr< profiler > _profiler;
+      /// whether executions record samples in _profiler
+      bool _profiling = false;
     };
   }
 }
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <map>
+#include <vector>
+#include <string>
+#include <ostream>
+#include <cstddef>
+#include <cstdint>
+
+#include "decoded_code.hpp"
+#include "instruction_pointer.hpp"
+#include "stack.hpp"
+#include "verification.hpp"
+
+namespace perseus
+{
+  namespace detail
+  {
+    /// Function names by the address of their first instruction, e.g. "fib(i32)"
+    typedef std::map< instruction_pointer::value_type, std::string > function_names;
+
+    /**
+    @brief Sampling profiler recording where executions spend their time, see processor::start_profiling().
+
+    Samples are taken by the dispatch engines whenever the @ref execution_budget countdown runs out, which is capped at the sampling interval while profiling. So, like the budget, they happen at backward jumps and calls, every @ref interval() counted instructions. A sample is the call stack of the active coroutine, found using the @ref frame_layout, and the profile counts how often each call stack was seen.
+    */
+    class profiler
+    {
+    public:
+      /**
+      @brief Constructor
+      @param program the code that's going to be sampled; only used to analyze its frame layout
+      @param interval counted instructions between samples, at least 1
+      @param names the names to write the functions with; others are written as their address
+      @throws std::bad_alloc if the system is out of memory
+      */
+      profiler( const decoded_code& program, const std::uint64_t interval, function_names names );
+
+      /// counted instructions between samples
+      std::uint64_t interval() const
+      {
+        return _interval;
+      }
+
+      /**
+      @brief Records the call stack of a coroutine.
+      @param program the code the profiler was constructed with
+      @param position where the coroutine is
+      @param st its stack
+      @param stack_size the size of the stack, which may exceed st.size() by values cached elsewhere, see @ref dispatch_engine::top_of_stack
+      @throws std::bad_alloc if the system is out of memory
+      */
+      void sample( const decoded_code& program, const decoded_instruction* position, const stack& st, const std::size_t stack_size );
+
+      /// Number of samples taken
+      std::uint64_t samples() const
+      {
+        return _samples;
+      }
+
+      /**
+      @brief Writes the profile as collapsed stacks, the input format of flame graph tools.
+
+      Each line is a call stack, outermost function first, separated by semicolons, followed by a space and the number of samples with that call stack. Functions without a name are written as their hexadecimal address; `[unknown]` stands for the callers of functions whose frame layout isn't known, see @ref frame_layout.
+      */
+      void write_collapsed( std::ostream& out ) const;
+
+    private:
+      /// marks a call stack whose outer frames are unknown
+      static constexpr instruction_pointer::value_type unknown_caller = 0xffffffff;
+      /// call stacks deeper than this are cut off
+      static constexpr std::size_t max_depth = 1024;
+
+      std::uint64_t _interval;
+      frame_layout _layout;
+      function_names _names;
+      /// number of samples of each call stack, given as function addresses, outermost first
+      std::map< std::vector< instruction_pointer::value_type >, std::uint64_t > _profile;
+      std::uint64_t _samples = 0;
+      /// the call stack of the current sample, innermost first; kept to avoid allocations
+      std::vector< instruction_pointer::value_type > _frames;
+    };
+  }
+}
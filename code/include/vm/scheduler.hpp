@@ -0,0 +1,113 @@
+#pragma once
+
+#include "processor.hpp"
+#include "coroutine_manager.hpp"
+#include "stack.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace perseus
+{
+  namespace detail
+  {
+    /**
+    @brief Runs independent executions of a @ref processor's code on a pool of worker threads.
+
+    Each submitted task is a chain of coroutines like a processor::execute() call: a root coroutine and whatever coroutines it creates. A task runs to completion on one worker, using that worker's @ref coroutine_manager, which is cleared afterwards. Every worker's manager has its own range of slot indices, so identifiers of coroutines on another worker are invalid there, and clearing invalidates those of the worker's previous tasks like deleting does. Coroutine identifiers therefore only refer to coroutines of the same task: one passed from another task throws invalid_coroutine_identifier, unless the receiving worker has reused its slot as often as coroutine_manager describes. Absolute stack accesses and coroutine switches never reach another task's coroutines, and those within a task are serialized by running on one thread. A task can have at most coroutine_manager::max_coroutines / threads() coroutines at a time.
+
+    Every worker has its own deque of tasks. Tasks submitted from a worker, e.g. by a syscall, go to that worker's deque, other tasks are distributed round-robin. A worker takes the newest task from its own deque and steals the oldest one from another deque once its own is empty.
+
+    The processor must outlive the scheduler and must not be executed on by anybody else meanwhile; its syscalls must be safe to call concurrently.
+    */
+    class scheduler
+    {
+    public:
+      /**
+      @brief Constructor, starting the worker threads
+      @param proc the processor whose code to run
+      @param threads number of worker threads, at least 1
+      @throws std::system_error if the threads can't be started
+      */
+      explicit scheduler( const processor& proc, const std::size_t threads = std::max( std::thread::hardware_concurrency(), 1u ) );
+      /// Destructor; runs all submitted tasks, then stops the workers
+      ~scheduler();
+      /// non-copyable
+      scheduler( const scheduler& ) = delete;
+      /// non-copyable
+      scheduler& operator=( const scheduler& ) = delete;
+
+      /**
+      @brief Queue an execution
+      @param start_address Location in the code to begin execution at
+      @param parameters Initial stack
+      @returns the final stack, or any exception processor::execute() throws
+      @throws std::bad_alloc if the system runs out of memory
+      */
+      std::future< stack > submit( const instruction_pointer::value_type start_address, stack&& parameters = stack() );
+
+      /// Number of worker threads
+      std::size_t threads() const
+      {
+        return _workers.size();
+      }
+
+      /// Number of tasks taken from another worker's deque so far
+      std::uint64_t steals() const
+      {
+        return _steals;
+      }
+
+    private:
+      struct task
+      {
+        instruction_pointer::value_type start_address;
+        stack parameters;
+        std::promise< stack > result;
+      };
+
+      struct worker
+      {
+        worker( const stack_backend backend, const coroutine::identifier first_index, const coroutine::identifier capacity )
+          : coroutines( backend, first_index, capacity )
+        {
+        }
+
+        /// guards tasks
+        std::mutex mutex;
+        std::deque< task > tasks;
+        /// only used by this worker's thread
+        coroutine_manager coroutines;
+        std::thread thread;
+      };
+
+      /// lets the workers finish the queued tasks and joins them
+      void stop();
+      /// body of the worker threads
+      void work( const std::size_t index );
+      /// takes a task from the worker's own deque or, failing that, another one's
+      bool take( const std::size_t index, task& out );
+
+      const processor& _processor;
+      std::vector< std::unique_ptr< worker > > _workers;
+      /// where the next task from outside goes
+      std::atomic< std::size_t > _next_worker{ 0 };
+      /// number of tasks in all deques; workers sleep while it's 0
+      std::atomic< std::size_t > _queued{ 0 };
+      std::atomic< std::uint64_t > _steals{ 0 };
+      /// guards _stopping and waiting on _wake
+      std::mutex _idle_mutex;
+      std::condition_variable _wake;
+      bool _stopping = false;
+    };
+  }
+}
@@ -0,0 +1,90 @@
+#pragma once
+
+#include "code_segment.hpp"
+
+#include <cstdint>
+
+namespace perseus
+{
+  namespace detail
+  {
+    /**
+    @brief Binary layout of the files written by processor::save_snapshot().
+
+    A snapshot consists of a @ref header, a @ref slot record for every slot of the @ref coroutine_manager, the identifiers of the suspended execution's coroutines (`u32` each), and the stacks' contents.
+
+    Stacks smaller than header::page_size are packed right after the identifiers. Bigger ones start at multiples of header::page_size and are padded to whole pages, so they can be mapped straight from the file.
+
+    A delta, written by processor::save_delta(), has the same layout, but starts with @ref delta_magic and only contains what changed since the file named by header::previous. Each occupied slot's stack_offset points to a `u64` count of @ref range records, followed by the ranges' bytes in the same order; header::page_size is stack::dirty_page_size. Unoccupied slots, the free list and the suspended execution are stored in full.
+
+    All values are in the byte order of the machine that wrote the snapshot.
+    */
+    namespace snapshot
+    {
+      /// Start of every snapshot
+      constexpr char magic[ 8 ] = { 'P', 'E', 'R', 'S', 'N', 'A', 'P', '\0' };
+      /// Start of every delta
+      constexpr char delta_magic[ 8 ] = { 'P', 'E', 'R', 'S', 'D', 'L', 'T', 'A' };
+      /// Incremented on incompatible changes to the layout
+      constexpr std::uint32_t version = 3;
+
+      /// Start of the file
+      struct header
+      {
+        char magic[ 8 ];
+        std::uint32_t version;
+        /// alignment of the big stacks
+        std::uint32_t page_size;
+        /// @ref code_hash() of the processor's code
+        std::uint64_t code_hash;
+        std::uint64_t code_size;
+        /// number of @ref slot records
+        std::uint32_t used_slots;
+        /// number of coroutines
+        std::uint32_t coroutines;
+        /// head and tail of the free list, or coroutine_manager::max_coroutines if empty
+        std::uint32_t first_free;
+        std::uint32_t last_free;
+        /// number of coroutines in the suspended execution, 0 if there is none
+        std::uint32_t chain_length;
+        /// whether the suspended execution was running checked; informational, restored executions always continue checked
+        std::uint32_t checked;
+        /// whether the suspended execution ran out of budget
+        std::uint32_t preempted;
+        std::uint32_t padding;
+        /// random identifier of this file, so deltas can name what they build on
+        std::uint64_t checkpoint;
+        /// the checkpoint of the file a delta builds on; 0 for full snapshots
+        std::uint64_t previous;
+      };
+
+      /// A slot of the @ref coroutine_manager
+      struct slot
+      {
+        /// where the coroutine's stack is in the file
+        std::uint64_t stack_offset;
+        std::uint64_t stack_size;
+        std::uint32_t generation;
+        /// next slot in the free list, if this one is free
+        std::uint32_t next_free;
+        std::uint32_t instruction_pointer;
+        /// whether the slot holds a coroutine
+        std::uint8_t occupied;
+        /// its coroutine::state
+        std::uint8_t state;
+        std::uint8_t padding[ 2 ];
+      };
+
+      /// Changed part of a stack in a delta
+      struct range
+      {
+        /// from the bottom of the stack
+        std::uint64_t offset;
+        std::uint64_t size;
+      };
+
+      /// 64 bit FNV-1a hash of the code, so snapshots are only restored into processors with the same code
+      std::uint64_t code_hash( const code_segment& code );
+    }
+  }
+}
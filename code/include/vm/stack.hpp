@@ -2,49 +2,223 @@
 
 #include "exceptions.hpp"
 
-#include <vector>
 #include <type_traits>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <utility>
+#include <vector>
 
 namespace perseus
 {
+  /**
+  @brief Where a @ref stack keeps its data.
+  */
+  enum class stack_backend
+  {
+    /// Heap memory, reallocated as the stack grows, which moves the data.
+    heap,
+    /**
+    @brief A fixed capacity region of address space reserved up front, followed by an inaccessible guard page.
+
+    The operating system only commits the memory once it's used. The data never moves, so pointers into the stack stay valid, and growing beyond the capacity throws @ref stack_overflow.
+
+    Without `mmap()` the whole capacity is allocated on the heap up front and there is no guard page.
+    */
+    reserved
+  };
+
   /**
   @brief A coroutine's stack.
 
   Most operations use the stack for their parameters and results, function parameters and return values go there as well as return addresses and local variables.
 
-  @todo Add support for custom allocators? (remove mention of std::bad_alloc in push_back() then)
+  It's a contiguous array of bytes, like a `std::vector< char >`, with the memory coming from the given @ref stack_backend.
+
+  It keeps track of which parts changed since the last clear_dirty(), in pages of @ref dirty_page_size bytes, so snapshots can be saved incrementally. Writing to the top (push(), append(), resize() etc.) only lowers a watermark; writes below it have to be reported with mark_dirty().
+
+  @todo Add support for custom allocators? (remove mention of std::bad_alloc in push() then)
   */
-  class stack : public std::vector< char >
+  class stack
   {
   public:
-    /// Constructor for empty stack
+    typedef char value_type;
+    typedef std::size_t size_type;
+    typedef char* pointer;
+    typedef const char* const_pointer;
+    typedef char* iterator;
+    typedef const char* const_iterator;
+
+    /// Capacity of @ref stack_backend::reserved stacks unless specified otherwise
+    static constexpr size_type default_reserved_capacity = 16 * 1024 * 1024;
+    /// Granularity of the tracking of changes, see dirty_ranges()
+    static constexpr size_type dirty_page_size = 4096;
+
+    /// Constructor for empty stack on the heap
     stack() = default;
+    /**
+    @brief Constructor for empty stack using the given backend
+    @param backend where to keep the data
+    @param reserved_capacity the capacity of a @ref stack_backend::reserved stack, rounded up to whole pages; ignored for other backends
+    @throws std::bad_alloc if the memory can't be reserved
+    */
+    explicit stack( const stack_backend backend, const size_type reserved_capacity = default_reserved_capacity );
+    /**
+    @brief Constructor for a @ref stack_backend::reserved stack whose contents are mapped from a file.
+
+    The mapping is private, so writes don't reach the file, and the data is only read from the file once it's used.
+    @param file_descriptor the file, opened for reading; may be closed afterwards
+    @param offset where the contents start in the file, a multiple of the page size
+    @param size the size of the contents; the file must extend at least to the end of the page they end in
+    @param reserved_capacity the capacity, which is at least the size
+    @throws std::bad_alloc if the memory can't be reserved
+    @throws std::system_error if the file can't be mapped, or if there is no `mmap()`
+    */
+    stack( const int file_descriptor, const std::uint64_t offset, const size_type size, const size_type reserved_capacity = default_reserved_capacity );
     /// Destructor
-    ~stack() = default;
-    /// Move constructor
+    ~stack();
+    /// Move constructor; the other stack is left empty, on the heap
     stack( stack&& );
-    /// Move assignment
+    /// Move assignment; the other stack is left empty, on the heap
     stack& operator=( stack&& );
     /// non-copyable
     stack( const stack& ) = delete;
     /// non-copyable
     stack& operator=( const stack& ) = delete;
 
+    /// The backend this stack's memory comes from
+    stack_backend backend() const
+    {
+      return _backend;
+    }
+
+    /// Number of bytes on the stack
+    size_type size() const
+    {
+      return _size;
+    }
+
+    /// Whether the stack is empty
+    bool empty() const
+    {
+      return _size == 0;
+    }
+
+    /// Number of bytes the stack can hold without reallocating
+    size_type capacity() const
+    {
+      return _capacity;
+    }
+
+    /// Maximum number of bytes the stack can hold; the capacity, if it's fixed
+    size_type max_size() const;
+
+    /// Pointer to the bottom of the stack
+    pointer data()
+    {
+      return _data;
+    }
+
+    /// @copydoc data()
+    const_pointer data() const
+    {
+      return _data;
+    }
+
+    iterator begin()
+    {
+      return _data;
+    }
+
+    const_iterator begin() const
+    {
+      return _data;
+    }
+
+    iterator end()
+    {
+      return _data + _size;
+    }
+
+    const_iterator end() const
+    {
+      return _data + _size;
+    }
+
+    /**
+    @brief Ensures the stack can hold the given number of bytes without reallocating
+    @throws std::bad_alloc if the system is out of memory
+    @throws stack_overflow if the stack can't grow this much
+    */
+    void reserve( const size_type new_capacity )
+    {
+      if( new_capacity > _capacity )
+      {
+        grow( new_capacity );
+      }
+    }
+
+    /**
+    @brief Changes the size of the stack, filling new bytes with zeroes
+    @throws std::bad_alloc if the system is out of memory
+    @throws stack_overflow if the stack can't grow this much
+    */
+    void resize( const size_type new_size )
+    {
+      reserve( new_size );
+      if( new_size > _size )
+      {
+        touch_top();
+        std::memset( _data + _size, 0, new_size - _size );
+      }
+      _size = new_size;
+    }
+
+    /// Removes everything from the stack, keeping its memory
+    void clear()
+    {
+      _size = 0;
+    }
+
+    /**
+    @brief Removes everything from the stack, and gives the memory beyond the first keep bytes back to the operating system
+
+    Only does more than clear() for @ref stack_backend::reserved stacks, whose pages otherwise stay committed once used. Their memory is replaced by fresh pages, which read as zero; contents mapped from a file are replaced entirely, so the stack no longer uses the file.
+    @returns false if the memory couldn't be replaced, leaving the stack unusable, so it should be destroyed
+    */
+    bool clear_and_decommit( const size_type keep ) noexcept;
+
+    /// Whether both stacks have the same contents
+    bool operator==( const stack& rhs ) const
+    {
+      return _size == rhs._size && ( _size == 0 || std::memcmp( _data, rhs._data, _size ) == 0 );
+    }
+
+    /// Whether the stacks' contents differ
+    bool operator!=( const stack& rhs ) const
+    {
+      return !( *this == rhs );
+    }
+
     /**
     @brief Push an arbitrary value onto the stack
     @tparam T type of value to push back. Should probably be a POD type since it's copied bitwise.
     @param value what to push onto the top of the stack
     @returns Reference to this stack, allowing for chaining.
     @throws std::bad_alloc if the system is out of memory
+    @throws stack_overflow if the stack is full
     */
     template< typename T >
     stack& push( const T& value )
     {
       static_assert( std::is_trivially_copyable< T >::value, "stack data must be trivially copyable!" );
-      // this code is copied from code_segment::push() - it could be factored out, but that seems like overkill to me
-      const_pointer begin = reinterpret_cast< const_pointer >( &value );
-      const_pointer end = begin + sizeof( T );
-      insert( std::vector< char >::end(), begin, end );
+      if( _capacity - _size < sizeof( T ) )
+      {
+        grow( _size + sizeof( T ) );
+      }
+      touch_top();
+      std::memcpy( _data + _size, &value, sizeof( T ) );
+      _size += sizeof( T );
       return *this;
     }
 
@@ -62,8 +236,22 @@ namespace perseus
       {
         throw stack_underflow( "Stack underflow" );
       }
-      const T top = *reinterpret_cast< const T* >( data() + size() - sizeof( T ) );
-      resize( size() - sizeof( T ) );
+      return pop_unchecked< T >();
+    }
+
+    /**
+    @brief Pop the topmost value off the stack without checking its size
+    @tparam T type of value to pop
+    @returns The top of the stack
+    @pre `size() >= sizeof( T )`, e.g. because the code has been verified
+    */
+    template< typename T >
+    T pop_unchecked()
+    {
+      static_assert( std::is_trivially_copyable< T >::value, "stack data must be trivially copyable!" );
+      T top;
+      _size -= sizeof( T );
+      std::memcpy( &top, _data + _size, sizeof( T ) );
       return top;
     }
 
@@ -93,9 +281,68 @@ namespace perseus
     @param other stack to push onto this one (in order)
     @returns a reference to this stack, to allow for chaining.
     @throws std::bad_alloc if the system is out of memory
+    @throws stack_overflow if the stack can't grow this much
     */
     stack& append( const stack& other );
 
+    /**
+    @brief Push a copy of the given bytes onto this stack
+    @param bytes the data to push, which may be part of this stack
+    @param size number of bytes to push
+    @returns a reference to this stack, to allow for chaining.
+    @throws std::bad_alloc if the system is out of memory
+    @throws stack_overflow if the stack can't grow this much
+    */
+    stack& append( const_pointer bytes, const size_type size );
+
+    /**
+    @brief Move the top of another stack onto this one
+
+    Like `append( other.split( size ) )`, but copies the bytes straight over without creating a temporary stack.
+    @param other stack to take the bytes from; shrinks by the given size
+    @param size number of bytes to move
+    @returns a reference to this stack, to allow for chaining.
+    @throws stack_underflow if the other stack contains less than the given number of bytes. Both stacks remain unchanged.
+    @throws std::bad_alloc if the system is out of memory. Both stacks remain unchanged.
+    @throws stack_overflow if this stack can't grow this much. Both stacks remain unchanged.
+    */
+    stack& transfer( stack& other, const size_type size );
+
+    /**
+    @brief Records that bytes have been changed without going through this stack's methods, e.g. through data().
+    @param offset the first changed byte, from the bottom
+    @param size number of changed bytes
+    @throws std::bad_alloc if the system is out of memory
+    */
+    void mark_dirty( const size_type offset, const size_type size )
+    {
+      if( size > 0 && offset < _clean_size )
+      {
+        mark_pages_dirty( offset, size );
+      }
+    }
+
+    /// Records that the whole stack changed, e.g. because it's been reused for another coroutine
+    void mark_all_dirty()
+    {
+      _clean_size = 0;
+      _dirty_pages.clear();
+    }
+
+    /// Forgets about all changes, e.g. once they've been saved
+    void clear_dirty()
+    {
+      _clean_size = _size;
+      _dirty_pages.clear();
+    }
+
+    /**
+    @brief The parts of the stack that changed since the last clear_dirty().
+    @returns pairs of offset and size, in ascending order and not touching each other; they start at multiples of @ref dirty_page_size and only the last one may end within a page, at the top of the stack.
+    @throws std::bad_alloc if the system is out of memory
+    */
+    std::vector< std::pair< size_type, size_type > > dirty_ranges() const;
+
   private:
     /**
     @brief creates a stack by taking the top off another one
@@ -103,5 +350,31 @@ namespace perseus
     @pre `other.size() >= size` (not checked; that check is in split())
     */
     stack( stack& other, const size_type size );
+
+    /// makes room for at least the given number of bytes
+    void grow( const size_type required_capacity );
+    /// frees the memory
+    void release();
+    /// records a write at the top of the stack
+    void touch_top()
+    {
+      if( _size < _clean_size )
+      {
+        _clean_size = _size;
+      }
+    }
+    /// mark_dirty() for writes below the watermark
+    void mark_pages_dirty( const size_type offset, const size_type size );
+
+    pointer _data = nullptr;
+    size_type _size = 0;
+    size_type _capacity = 0;
+    stack_backend _backend = stack_backend::heap;
+    /// bytes below this are unchanged since clear_dirty(), apart from those in _dirty_pages
+    size_type _clean_size = 0;
+    /// one bit per page below _clean_size, set if the page changed
+    std::vector< std::uint64_t > _dirty_pages;
+    /// whether the start of a reserved stack is mapped from a file
+    bool _mapped_from_file = false;
   };
 }
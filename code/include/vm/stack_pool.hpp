@@ -0,0 +1,106 @@
+#pragma once
+
+#include "stack.hpp"
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace perseus
+{
+  namespace detail
+  {
+    /**
+    @brief Recycles the stacks of deleted coroutines, so short-lived coroutines don't allocate.
+
+    Released stacks are cleared and kept in buckets by capacity, one per power of two. @ref acquire() returns the smallest pooled stack that fits.
+
+    All stacks come from, and are returned to, the pool's @ref stack_backend.
+    */
+    class stack_pool
+    {
+    public:
+      /// How much the pool keeps
+      struct limits
+      {
+        /// Maximum number of stacks per bucket; 0 disables pooling
+        std::size_t max_stacks_per_bucket = 64;
+        /// Heap stacks bigger than this are freed instead of pooled. Reserved stacks are kept regardless, since their capacity is mostly address space, but only this many bytes of them stay committed; see stack::clear_and_decommit().
+        stack::size_type max_capacity = 1024 * 1024;
+      };
+
+      /// What the pool has done so far
+      struct statistics
+      {
+        /// number of @ref acquire() calls that got a pooled stack
+        std::uint64_t hits = 0;
+        /// number of @ref acquire() calls that created a new stack
+        std::uint64_t misses = 0;
+        /// number of released stacks that were freed instead of pooled
+        std::uint64_t discarded = 0;
+        /// number of stacks currently in the pool
+        std::size_t pooled = 0;
+      };
+
+      /**
+      @brief Constructor
+      @param backend where the stacks keep their data
+      */
+      explicit stack_pool( const stack_backend backend = stack_backend::heap )
+        : _backend( backend )
+      {
+      }
+
+      /// where the stacks keep their data
+      stack_backend backend() const
+      {
+        return _backend;
+      }
+
+      /**
+      @brief Retrieve an empty stack, preferably one from the pool
+      @param min_capacity the number of bytes the stack should have room for
+      @throws std::bad_alloc if a new stack can't be reserved
+      */
+      stack acquire( const stack::size_type min_capacity );
+
+      /**
+      @brief Return a stack to the pool, or free it if it's not worth keeping
+      */
+      void release( stack&& st ) noexcept;
+
+      /// Frees all pooled stacks
+      void clear() noexcept;
+
+      /// Changes what the pool keeps, freeing any stacks beyond the new limits
+      void set_limits( const limits& new_limits ) noexcept;
+
+      /// What the pool keeps
+      const limits& get_limits() const
+      {
+        return _limits;
+      }
+
+      /// What the pool has done so far
+      const statistics& get_statistics() const
+      {
+        return _statistics;
+      }
+
+    private:
+      /// number of buckets; the last one takes all remaining capacities
+      static constexpr std::size_t bucket_count = 64;
+
+      /// number of bits of a capacity, i.e. the index of its bucket
+      static std::size_t bucket_index( stack::size_type capacity );
+
+      stack_backend _backend;
+      limits _limits;
+      statistics _statistics;
+      std::array< std::vector< stack >, bucket_count > _buckets;
+      /// bit i is set if bucket i isn't empty, so @ref acquire() doesn't have to look at every bucket
+      std::uint64_t _occupied_buckets = 0;
+    };
+  }
+}
@@ -0,0 +1,105 @@
+#pragma once
+
+#include <unordered_map>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+#include "decoded_code.hpp"
+#include "instruction_pointer.hpp"
+
+namespace perseus
+{
+  namespace detail
+  {
+    /**
+    @brief Proves which parts of a @ref decoded_code can run without stack checks.
+
+    The code is interpreted abstractly, tracking the stack size relative to the start of each function, i.e. address 0 and every call target. A function is verified if
+
+    -   the stack size at each instruction is the same on every path leading there,
+    -   it never pops or accesses (via relative loads/stores) more than a fixed number of bytes below its start,
+    -   it only returns when the return address is on top of the stack, always popping the same number of argument bytes, and never overwrites the return address,
+    -   it can't reach any instruction with an unpredictable stack effect, invalid jump targets or the end of the code, and
+    -   the same holds for every function it calls.
+
+    Instructions with unpredictable effects are coroutine switches, indirect jumps and calls as well as absolute stores, which could overwrite return addresses. Syscalls are assumed to leave the stack's size and the return addresses on it unchanged; the unchecked engines make sure of the size and hand over to the checked ones otherwise.
+    */
+    class verification
+    {
+    public:
+      /// Constructor for a verification of nothing
+      verification() = default;
+
+      /**
+      @brief Verifies the given code.
+      @throws std::bad_alloc if the system is out of memory
+      */
+      explicit verification( const decoded_code& program );
+
+      /**
+      @brief Whether execution starting at the given address with a stack of the given size can skip the checks.
+
+      That's the case for verified functions which don't return (as there's no return address), given the stack is big enough for everything they access below their start.
+      */
+      bool is_verified( const instruction_pointer::value_type start_address, const std::size_t stack_size ) const
+      {
+        const auto it = _required_stack_sizes.find( start_address );
+        return it != _required_stack_sizes.end() && stack_size >= it->second;
+      }
+
+    private:
+      /// Minimum initial stack size of each verified start address
+      std::unordered_map< instruction_pointer::value_type, std::size_t > _required_stack_sizes;
+    };
+
+    /**
+    @brief Where the return addresses are on the stack, for walking the call stack of a running coroutine.
+
+    Uses the analysis of @ref verification: in a verified function, the stack size relative to the function's start is known at every instruction, and so is the number of argument bytes it pops when returning. So given the position and stack size of a coroutine, its return address is found below the current function's part of the stack, and from there the caller's.
+    */
+    class frame_layout
+    {
+    public:
+      /// Constructor for a layout of nothing
+      frame_layout() = default;
+
+      /**
+      @brief Analyzes the given code.
+      @throws std::bad_alloc if the system is out of memory
+      */
+      explicit frame_layout( const decoded_code& program );
+
+      /**
+      @brief The verified function the given instruction belongs to, and the stack size relative to the function's start there.
+      @param index index of the instruction in the decoded_code
+      @param out_function index of the function's first instruction
+      @param out_depth bytes on the stack above the function's start, i.e. above its return address if it has one
+      @returns false if the instruction isn't part of exactly one verified function
+      */
+      bool get_frame( const std::uint32_t index, std::uint32_t& out_function, std::int64_t& out_depth ) const;
+
+      /**
+      @brief Whether the function starting at the given instruction returns, i.e. was called, and how many argument bytes it pops then.
+      @param function index of the function's first instruction
+      @param out_argument_size bytes of arguments below the return address
+      @returns false if the function doesn't return, e.g. the function an execution started with
+      */
+      bool get_argument_size( const std::uint32_t function, std::uint32_t& out_argument_size ) const;
+
+    private:
+      struct frame
+      {
+        /// index of the function's first instruction, or unknown
+        std::uint32_t function;
+        std::int64_t depth;
+      };
+      static constexpr std::uint32_t unknown = 0xffffffff;
+
+      /// one per instruction
+      std::vector< frame > _frames;
+      /// argument sizes of the verified functions that return
+      std::unordered_map< std::uint32_t, std::uint32_t > _argument_sizes;
+    };
+  }
+}
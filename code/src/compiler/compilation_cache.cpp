@@ -0,0 +1,125 @@
+#include "compiler/compilation_cache.hpp"
+#include "vm/exceptions.hpp"
+
+#include <cstdio>
+#include <iomanip>
+#include <random>
+#include <sstream>
+#include <system_error>
+#include <utility>
+
+namespace perseus
+{
+  namespace detail
+  {
+    constexpr std::uint32_t compilation_cache::compiler_version;
+
+    namespace
+    {
+      /// Two unrelated 64 bit hashes, FNV-1a and a multiplicative one, so a collision needs both to collide
+      class source_hash
+      {
+      public:
+        void add( const char* data, const std::size_t size )
+        {
+          for( std::size_t i = 0; i < size; ++i )
+          {
+            const unsigned char byte = static_cast< unsigned char >( data[ i ] );
+            _fnv = ( _fnv ^ byte ) * 1099511628211ull;
+            _mix = ( _mix + byte + 1 ) * 0x9e3779b97f4a7c15ull;
+            _mix ^= _mix >> 29;
+          }
+        }
+
+        template< typename T >
+        void add( const T value )
+        {
+          add( reinterpret_cast< const char* >( &value ), sizeof( value ) );
+        }
+
+        std::string hex() const
+        {
+          std::ostringstream result;
+          result << std::hex << std::setfill( '0' ) << std::setw( 16 ) << _fnv << std::setw( 16 ) << _mix;
+          return result.str();
+        }
+
+      private:
+        std::uint64_t _fnv = 14695981039346656037ull;
+        std::uint64_t _mix = 0;
+      };
+    }
+
+    compilation_cache::compilation_cache( std::string directory )
+      : _directory( std::move( directory ) )
+    {
+    }
+
+    std::string compilation_cache::get_key( const std::vector< std::string >& sources )
+    {
+      source_hash hash;
+      hash.add( compiler_version );
+      hash.add( image::version );
+      hash.add( std::uint64_t( sources.size() ) );
+      for( const std::string& source : sources )
+      {
+        // the sizes keep the boundaries between sources from being ambiguous
+        hash.add( std::uint64_t( source.size() ) );
+        hash.add( source.data(), source.size() );
+      }
+      return hash.hex();
+    }
+
+    std::string compilation_cache::get_path( const std::string& key ) const
+    {
+      return _directory + "/" + key + ".img";
+    }
+
+    bool compilation_cache::load( const std::string& key, program_image& out_program )
+    {
+      try
+      {
+        out_program = load_image( get_path( key ) );
+      }
+      catch( const std::system_error& )
+      {
+        // usually, there is no such entry yet
+        ++_statistics.misses;
+        return false;
+      }
+      catch( const invalid_image& )
+      {
+        // gets replaced by the next store()
+        ++_statistics.misses;
+        return false;
+      }
+      ++_statistics.hits;
+      return true;
+    }
+
+    void compilation_cache::store( const std::string& key, const program_image& program )
+    {
+      std::random_device random;
+      std::ostringstream temporary;
+      temporary << get_path( key ) << ".tmp" << std::hex << random() << random();
+      try
+      {
+        save_image( temporary.str(), program );
+      }
+      catch( const std::system_error& )
+      {
+        std::remove( temporary.str().c_str() );
+        ++_statistics.failed_stores;
+        return;
+      }
+      if( std::rename( temporary.str().c_str(), get_path( key ).c_str() ) != 0 )
+      {
+        // where renaming doesn't replace existing files, another writer was faster
+        std::remove( temporary.str().c_str() );
+        ++_statistics.failed_stores;
+        return;
+      }
+      ++_statistics.stores;
+    }
+  }
+}
@@ -6,6 +6,8 @@
 #include "compiler/function_manager.hpp"
 #include "compiler/steps.hpp"
 #include "shared/opcodes.hpp"
+#include "vm/exceptions.hpp"
+#include "vm/file_mapping.hpp"
 
 #include <boost/spirit/home/qi/parse.hpp>
 
@@ -13,18 +15,39 @@
 #include <utility>
 #include <stdexcept>
 #include <iostream>
+#include <sstream>
+#include <algorithm>
+#include <cerrno>
+#include <system_error>
+
+#include <fcntl.h>
 
 namespace perseus
 {
   using namespace std::string_literals;
 
-  struct compiler::impl
+  /// The lexer and parser; constructing them takes a while, so that only happens once something needs parsing
+  struct front_end
   {
     detail::token_definitions lexer;
     detail::grammar parser;
     detail::skip_grammar skipper;
+  };
+
+  struct compiler::impl
+  {
+    std::unique_ptr< front_end > front;
     bool linking = false;
     std::vector< detail::ast::parser::file > files;
+    /// set by set_cache_directory()
+    std::unique_ptr< detail::compilation_cache > cache;
+    /// with a cache, the sources passed to parse(), which are only parsed if the cache doesn't have them
+    std::vector< std::string > sources;
+    /// the file names of the sources
+    std::vector< std::string > source_names;
+
+    /// parses a source into files
+    void parse( detail::enhanced_istream_iterator input_it, const detail::enhanced_istream_iterator& input_end, const std::string& filename );
   };
 
   compiler::compiler()
@@ -41,21 +64,85 @@ namespace perseus
     // keep lexer, parser & skipper intact - the entire point of the compiler class is keeping their results cached
     _impl->linking = false;
     _impl->files.clear();
+    _impl->sources.clear();
+    _impl->source_names.clear();
+  }
+
+  void compiler::set_cache_directory( const std::string& directory )
+  {
+    if( !_impl->files.empty() || !_impl->sources.empty() )
+    {
+      throw std::logic_error{ "Called compiler::set_cache_directory() after compiler::parse()!" };
+    }
+    _impl->cache = directory.empty() ? nullptr : std::make_unique< detail::compilation_cache >( directory );
+  }
+
+  const detail::compilation_cache::statistics* compiler::cache_statistics() const
+  {
+    return _impl->cache ? &_impl->cache->get_statistics() : nullptr;
   }
 
   void compiler::parse( std::istream& source_stream, const std::string& filename )
   {
+    if( _impl->cache )
+    {
+      std::ostringstream source;
+      source << source_stream.rdbuf();
+      _impl->sources.push_back( source.str() );
+      _impl->source_names.push_back( filename );
+      return;
+    }
     detail::enhanced_istream_iterator input_it, input_end;
-    // TODO: add filename to file_position and track it
     std::tie( input_it, input_end ) = detail::enhanced_iterators( source_stream );
+    _impl->parse( std::move( input_it ), input_end, filename );
+  }
+
+  void compiler::parse( const char* const source, const std::size_t size, const std::string& filename )
+  {
+    if( _impl->cache )
+    {
+      _impl->sources.emplace_back( source, size );
+      _impl->source_names.push_back( filename );
+      return;
+    }
+    detail::enhanced_istream_iterator input_it, input_end;
+    std::tie( input_it, input_end ) = detail::enhanced_iterators( source, source + size );
+    _impl->parse( std::move( input_it ), input_end, filename );
+  }
+
+  void compiler::parse_file( const std::string& path )
+  {
+    const detail::file f( open( path.c_str(), O_RDONLY | O_CLOEXEC ) );
+    if( f.descriptor < 0 )
+    {
+      throw std::system_error( errno, std::system_category(), "open " + path );
+    }
+    const std::size_t size = f.size();
+    if( size == 0 )
+    {
+      // empty files can't be mapped
+      parse( "", 0, path );
+      return;
+    }
+    const detail::file_mapping mapping( f.descriptor, size );
+    parse( static_cast< const char* >( mapping.data ), size, path );
+  }
+
+  void compiler::impl::parse( detail::enhanced_istream_iterator input_it, const detail::enhanced_istream_iterator& input_end, const std::string& filename )
+  {
+    if( !front )
+    {
+      front = std::make_unique< front_end >();
+    }
+    // TODO: add filename to file_position and track it
     detail::skip_byte_order_mark( input_it, input_end );
 
     // I suppose unless I need tokens_it/tokens_end, I could just lex::tokenize_and_phrase_parse, but doing it manually gives me more options
-    detail::token_iterator tokens_it = _impl->lexer.begin( input_it, input_end );
-    const detail::token_iterator tokens_end = _impl->lexer.end();
+    detail::token_iterator tokens_it = front->lexer.begin( input_it, input_end );
+    const detail::token_iterator tokens_end = front->lexer.end();
 
     detail::ast::parser::file result;
-    bool success = boost::spirit::qi::phrase_parse( tokens_it, tokens_end, _impl->parser, _impl->skipper, result );
+    bool success = boost::spirit::qi::phrase_parse( tokens_it, tokens_end, front->parser, front->skipper, result );
 
     if( !success )
     {
@@ -66,10 +153,71 @@ namespace perseus
         );
     }
     // no need to check if it == end, since the grammar contains an eoi parser.
-    _impl->files.emplace_back( std::move( result ) );
+    files.emplace_back( std::move( result ) );
   }
 
-  detail::processor compiler::link()
+  namespace
+  {
+    /// A builtin function, implemented by a syscall
+    struct builtin
+    {
+      detail::function_signature signature;
+      detail::type_id return_type;
+      bool pure;
+      detail::syscall definition;
+    };
+
+    /// All builtin functions
+    const std::vector< builtin >& builtins()
+    {
+      static const std::vector< builtin > result{
+        // print i32
+        { detail::function_signature{ "print"s, { detail::type_id::i32 } }, detail::type_id::void_, false, []( stack& s ) {
+          const char* memory = s.data() + s.size() - sizeof( detail::instruction_pointer::value_type ) - detail::get_size( detail::type_id::i32 );
+          std::cout << *reinterpret_cast< const int* >( memory ) << std::endl;
+        } },
+        // print bool
+        { detail::function_signature{ "print"s, { detail::type_id::bool_ } }, detail::type_id::void_, false, []( stack& s ) {
+          const char* memory = s.data() + s.size() - sizeof( detail::instruction_pointer::value_type ) - detail::get_size( detail::type_id::bool_ );
+          bool value = *memory;
+          std::cout << std::boolalpha << value << std::endl;
+        } }
+      };
+      return result;
+    }
+
+    /// The name of a builtin's syscall in program images, e.g. "print(i32)"
+    std::string get_syscall_name( const builtin& function )
+    {
+      std::ostringstream name;
+      name << function.signature;
+      return name.str();
+    }
+
+    /// A processor running the given program, with the builtins it uses as syscalls
+    detail::processor create_processor( detail::program_image&& program )
+    {
+      std::vector< detail::syscall > syscalls;
+      for( const std::string& name : program.syscalls )
+      {
+        const auto& available = builtins();
+        const auto function = std::find_if( available.begin(), available.end(), [ &name ]( const builtin& candidate )
+        {
+          return get_syscall_name( candidate ) == name;
+        } );
+        if( function == available.end() )
+        {
+          throw invalid_image( "Program image uses unknown builtin " + name + "!" );
+        }
+        syscalls.push_back( function->definition );
+      }
+      detail::processor result{ std::move( program.code ), std::move( syscalls ) };
+      result.set_function_names( std::move( program.functions ) );
+      return result;
+    }
+  }
+
+  detail::program_image compiler::link_program()
   {
     if( _impl->linking )
     {
@@ -77,12 +225,38 @@ namespace perseus
     }
     _impl->linking = true; // set it now in case of exceptions since we don't roll back on failure
 
+    std::string cache_key;
+    if( _impl->cache )
+    {
+      const std::vector< std::string > sources = std::move( _impl->sources );
+      const std::vector< std::string > source_names = std::move( _impl->source_names );
+      _impl->sources.clear();
+      _impl->source_names.clear();
+      cache_key = detail::compilation_cache::get_key( sources );
+      detail::program_image cached;
+      if( _impl->cache->load( cache_key, cached ) )
+      {
+        _impl->linking = false;
+        return cached;
+      }
+      for( std::size_t i = 0; i < sources.size(); ++i )
+      {
+        detail::enhanced_istream_iterator input_it, input_end;
+        std::tie( input_it, input_end ) = detail::enhanced_iterators( sources[ i ].data(), sources[ i ].data() + sources[ i ].size() );
+        _impl->parse( std::move( input_it ), input_end, source_names[ i ] );
+      }
+    }
+
     detail::function_manager function_manager;
 
     // register builtin functions
-    detail::function_manager::function_pointer print_i32_function, print_bool_function;
-    function_manager.register_function( detail::function_signature{ "print"s, { detail::type_id::i32 } }, detail::function_info{ detail::type_id::void_, false }, print_i32_function );
-    function_manager.register_function( detail::function_signature{ "print"s, { detail::type_id::bool_ } }, detail::function_info{ detail::type_id::void_, false }, print_bool_function );
+    std::vector< detail::function_manager::function_pointer > builtin_functions;
+    for( const builtin& function : builtins() )
+    {
+      detail::function_manager::function_pointer pointer;
+      function_manager.register_function( detail::function_signature( function.signature ), detail::function_info{ function.return_type, function.pure }, pointer );
+      builtin_functions.push_back( pointer );
+    }
 
     // collect available functions
     for( auto& file_ast : _impl->files )
@@ -95,12 +269,14 @@ namespace perseus
     //    entry point
 
     // find main function
-    detail::code_segment code;
+    detail::program_image result;
+    detail::code_segment& code = result.code;
     detail::function_manager::function_pointer main_function;
     if( !function_manager.get_function( { "main"s, {} }, main_function ) )
     {
       throw semantic_error{ "no main() function (without parameters) defined!"s, { 0, 0 } };
     }
+    result.entry_point = static_cast< detail::instruction_pointer::value_type >( code.size() );
     // reserve return value space
     {
       auto size = get_size( main_function->second.return_type );
@@ -117,28 +293,16 @@ namespace perseus
     code.push< detail::opcode >( detail::opcode::exit );
 
     //    generate builtin functions
-    std::vector< detail::syscall > syscalls;
-    auto generate_builtin_code = [ &syscalls, &code ]( detail::function_manager::function_pointer function, detail::syscall&& definition )
+    for( std::size_t i = 0; i < builtins().size(); ++i )
     {
+      const detail::function_manager::function_pointer function = builtin_functions[ i ];
       function->second.set_address( code.size(), code );
       code.push< detail::opcode >( detail::opcode::syscall );
-      code.push< std::uint32_t >( syscalls.size() );
+      code.push< std::uint32_t >( static_cast< std::uint32_t >( result.syscalls.size() ) );
       code.push< detail::opcode >( detail::opcode::return_ );
       code.push< std::uint32_t >( function->first.parameters_size() );
-      syscalls.emplace_back( std::move( definition ) );
-    };
-
-    // print i32
-    generate_builtin_code( print_i32_function, []( stack& s ) {
-      const char* memory = s.data() + s.size() - sizeof( detail::instruction_pointer::value_type ) - detail::get_size( detail::type_id::i32 );
-      std::cout << *reinterpret_cast< const int* >( memory ) << std::endl;
-    } );
-    // print bool
-    generate_builtin_code( print_bool_function, []( stack& s ) {
-      const char* memory = s.data() + s.size() - sizeof( detail::instruction_pointer::value_type ) - detail::get_size( detail::type_id::bool_ );
-      bool value = *memory;
-      std::cout << std::boolalpha << value << std::endl;
-    } );
+      result.syscalls.push_back( get_syscall_name( builtins()[ i ] ) );
+    }
 
     //    append functions
     while( !_impl->files.empty() )
@@ -151,7 +315,29 @@ namespace perseus
       throw std::logic_error{ "Unhandled address requests?!" };
     }
     _impl->linking = false;
-    return detail::processor{ std::move( code ), std::move( syscalls ) };
+    result.functions = function_manager.get_function_names();
+    if( _impl->cache )
+    {
+      _impl->cache->store( cache_key, result );
+    }
+    return result;
+  }
+
+  detail::processor compiler::link()
+  {
+    return create_processor( link_program() );
+  }
+
+  void compiler::link_image( const std::string& path )
+  {
+    detail::save_image( path, link_program() );
+  }
+
+  detail::processor compiler::load_image( const std::string& path, detail::instruction_pointer::value_type& out_entry_point )
+  {
+    detail::program_image program = detail::load_image( path );
+    out_entry_point = program.entry_point;
+    return create_processor( std::move( program ) );
   }
 
 }
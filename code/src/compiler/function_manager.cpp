@@ -3,6 +3,7 @@
 
 #include <tuple>
 #include <cassert>
+#include <sstream>
 
 namespace perseus
 {
@@ -76,17 +77,10 @@ namespace perseus
       // invoke operation
       code.push( operation );
       // stack: <result memory> <arguments> <return address> <result>
-      // write result to result memory
-      code.push( opcode::relative_store_stack );
+      // write result to result memory, pop it and return, popping arguments
+      code.push( opcode::store_pop_return );
       code.push( return_size );
-      code.push( -2 * static_cast< std::int32_t >( return_size ) - static_cast< std::int32_t >( address_size ) - static_cast< std::int32_t >( argument_size ) );
-      // stack: <result> <arguments> <return address> <result>
-      // pop result
-      code.push( opcode::pop );
       code.push( return_size );
-      // stack: <result> <arguments> <return address>
-      // return, popping arguments
-      code.push( opcode::return_ );
       code.push( argument_size );
       // stack: <result>
     }
@@ -171,5 +165,21 @@ namespace perseus
       }
       return std::make_pair( begin, end );
     }
+
+    function_names function_manager::get_function_names() const
+    {
+      function_names result;
+      for( const auto& entry : _functions )
+      {
+        instruction_pointer::value_type address;
+        if( entry.second.get_address( address ) )
+        {
+          std::ostringstream name;
+          name << entry.first;
+          result.emplace( address, name.str() );
+        }
+      }
+      return result;
+    }
   }
 }
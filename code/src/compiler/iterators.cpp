@@ -13,11 +13,16 @@ namespace perseus
       : _current( current ), _end( end ), _value( current == end ? '\0' : *current )
     {
     }
+    /// Iterating over a buffer
+    istreambuf_multipass_position_iterator::istreambuf_multipass_position_iterator( const char* current, const char* end )
+      : _buffer_current( current ), _buffer_end( end ), _value( current == end ? '\0' : *current )
+    {
+    }
     /// Destructible
     istreambuf_multipass_position_iterator::~istreambuf_multipass_position_iterator() = default;
     /// MoveConstructible
     istreambuf_multipass_position_iterator::istreambuf_multipass_position_iterator( istreambuf_multipass_position_iterator && rhs )
-      : _current( rhs._current ), _end( rhs._end ), _position( rhs._position ), _value( rhs._value )
+      : _position( rhs._position ), _current( rhs._current ), _end( rhs._end ), _buffer_current( rhs._buffer_current ), _buffer_end( rhs._buffer_end ), _value( rhs._value )
     {
       rhs._current = istreambuf_multipass_iterator{};
       rhs._end = istreambuf_multipass_iterator{};
@@ -27,6 +32,8 @@ namespace perseus
     {
       _current = rhs._current;
       _end = rhs._end;
+      _buffer_current = rhs._buffer_current;
+      _buffer_end = rhs._buffer_end;
       _position = rhs._position;
       _value = rhs._value;
       rhs._current = istreambuf_multipass_iterator{};
@@ -35,7 +42,7 @@ namespace perseus
     }
     /// CopyConstructible
     istreambuf_multipass_position_iterator::istreambuf_multipass_position_iterator( const istreambuf_multipass_position_iterator& rhs )
-      : _current( rhs._current ), _end( rhs._end ), _position( rhs._position ), _value( rhs._value )
+      : _position( rhs._position ), _current( rhs._current ), _end( rhs._end ), _buffer_current( rhs._buffer_current ), _buffer_end( rhs._buffer_end ), _value( rhs._value )
     {
     }
     /// CopyAssignable
@@ -43,6 +50,8 @@ namespace perseus
     {
       _current = rhs._current;
       _end = rhs._end;
+      _buffer_current = rhs._buffer_current;
+      _buffer_end = rhs._buffer_end;
       _position = rhs._position;
       _value = rhs._value;
       return *this;
@@ -51,7 +60,18 @@ namespace perseus
     /// EqualityComparable
     bool istreambuf_multipass_position_iterator::operator==( const istreambuf_multipass_position_iterator& rhs ) const
     {
-      return std::tie( _current, _end ) == std::tie( rhs._current, rhs._end );
+      if( _buffer_current == nullptr && rhs._buffer_current == nullptr )
+      {
+        return std::tie( _current, _end ) == std::tie( rhs._current, rhs._end );
+      }
+      if( _buffer_current != nullptr && rhs._buffer_current != nullptr )
+      {
+        return _buffer_current == rhs._buffer_current;
+      }
+      // a buffer iterator equals a stream iterator only if both are at their end, which includes default constructed ones
+      const istreambuf_multipass_position_iterator& buffer = _buffer_current != nullptr ? *this : rhs;
+      const istreambuf_multipass_position_iterator& stream = _buffer_current != nullptr ? rhs : *this;
+      return buffer._buffer_current == buffer._buffer_end && stream._current == stream._end;
     }
 
     /// Inequality comparison
@@ -84,22 +104,37 @@ namespace perseus
 
     istreambuf_multipass_position_iterator& istreambuf_multipass_position_iterator::operator++()
     {
-      assert( _current != _end );
       if( _value == '\n' )
       {
         _position.line += 1;
         _position.column = 0;
       }
-      ++_current;
-      if( _current != _end )
+      bool at_end;
+      if( _buffer_current != nullptr )
+      {
+        assert( _buffer_current != _buffer_end );
+        ++_buffer_current;
+        at_end = _buffer_current == _buffer_end;
+        if( !at_end )
+        {
+          _value = *_buffer_current;
+        }
+      }
+      else
       {
-        _value = *_current;
-        // don't count continuation bytes
-        if( ( _value & 0b1100'0000 ) != 0b1000'0000 )
+        assert( _current != _end );
+        ++_current;
+        at_end = _current == _end;
+        if( !at_end )
         {
-          _position.column += 1;
+          _value = *_current;
         }
       }
+      // don't count continuation bytes
+      if( !at_end && ( _value & 0b1100'0000 ) != 0b1000'0000 )
+      {
+        _position.column += 1;
+      }
       return *this;
     }
 
@@ -112,6 +147,11 @@ namespace perseus
       return std::make_tuple( begin, end );
     }
 
+    std::tuple< enhanced_istream_iterator, enhanced_istream_iterator > enhanced_iterators( const char* const begin, const char* const end )
+    {
+      return std::make_tuple( enhanced_istream_iterator{ begin, end }, enhanced_istream_iterator{ end, end } );
+    }
+
     bool skip_byte_order_mark( enhanced_istream_iterator& it, const enhanced_istream_iterator& end )
     {
       const detail::enhanced_istream_iterator begin = it;
@@ -0,0 +1,590 @@
+#include "compiler/scanner.hpp"
+
+#include <cstdint>
+#include <cstring>
+
+#if defined( __AVX2__ )
+# include <immintrin.h>
+# define PERSEUS_SCANNER_AVX2
+#elif defined( __SSE2__ ) || defined( _M_X64 ) || ( defined( _M_IX86_FP ) && _M_IX86_FP >= 2 )
+# include <emmintrin.h>
+# define PERSEUS_SCANNER_SSE2
+#endif
+
+namespace perseus
+{
+  namespace detail
+  {
+    namespace
+    {
+#if defined( PERSEUS_SCANNER_AVX2 ) || defined( PERSEUS_SCANNER_SSE2 )
+      /// The bytes of a block of input; each byte of a comparison's result is 0xFF where it's true and 0 otherwise
+      struct block
+      {
+# ifdef PERSEUS_SCANNER_AVX2
+        typedef __m256i value_type;
+        static constexpr std::size_t size = 32;
+
+        static block load( const char* data )
+        {
+          return{ _mm256_loadu_si256( reinterpret_cast< const __m256i* >( data ) ) };
+        }
+
+        static block broadcast( const char c )
+        {
+          return{ _mm256_set1_epi8( c ) };
+        }
+
+        block operator|( const block& rhs ) const
+        {
+          return{ _mm256_or_si256( value, rhs.value ) };
+        }
+
+        block operator+( const block& rhs ) const
+        {
+          return{ _mm256_add_epi8( value, rhs.value ) };
+        }
+
+        block operator==( const block& rhs ) const
+        {
+          return{ _mm256_cmpeq_epi8( value, rhs.value ) };
+        }
+
+        /// signed comparison
+        block operator<( const block& rhs ) const
+        {
+          return{ _mm256_cmpgt_epi8( rhs.value, value ) };
+        }
+
+        /// A bit per byte, set where the byte's highest bit is
+        std::uint32_t mask() const
+        {
+          return static_cast< std::uint32_t >( _mm256_movemask_epi8( value ) );
+        }
+# else
+        typedef __m128i value_type;
+        static constexpr std::size_t size = 16;
+
+        static block load( const char* data )
+        {
+          return{ _mm_loadu_si128( reinterpret_cast< const __m128i* >( data ) ) };
+        }
+
+        static block broadcast( const char c )
+        {
+          return{ _mm_set1_epi8( c ) };
+        }
+
+        block operator|( const block& rhs ) const
+        {
+          return{ _mm_or_si128( value, rhs.value ) };
+        }
+
+        block operator+( const block& rhs ) const
+        {
+          return{ _mm_add_epi8( value, rhs.value ) };
+        }
+
+        block operator==( const block& rhs ) const
+        {
+          return{ _mm_cmpeq_epi8( value, rhs.value ) };
+        }
+
+        /// signed comparison
+        block operator<( const block& rhs ) const
+        {
+          return{ _mm_cmplt_epi8( value, rhs.value ) };
+        }
+
+        /// A bit per byte, set where the byte's highest bit is
+        std::uint32_t mask() const
+        {
+          return static_cast< std::uint32_t >( _mm_movemask_epi8( value ) );
+        }
+# endif
+
+        /// Where the bytes are in [first, last]
+        block in_range( const char first, const char last ) const
+        {
+          // shifts the range to start at the smallest signed value, so a single signed comparison checks both bounds
+          return ( *this + broadcast( static_cast< char >( -128 - first ) ) ) < broadcast( static_cast< char >( -128 + ( last - first ) + 1 ) );
+        }
+
+        value_type value;
+      };
+
+      inline unsigned int count_trailing_zeros( const std::uint32_t mask )
+      {
+# ifdef _MSC_VER
+        unsigned long index;
+        _BitScanForward( &index, mask );
+        return index;
+# else
+        return static_cast< unsigned int >( __builtin_ctz( mask ) );
+# endif
+      }
+#endif
+
+      /*
+      Character classes, usable both on single characters and on blocks.
+      They must agree with the regular expressions in basic_token_definitions, which only consider ASCII.
+      */
+
+      /// `\s`
+      struct whitespace_class
+      {
+        static bool contains( const char c )
+        {
+          return c == ' ' || ( c >= '\t' && c <= '\r' );
+        }
+
+#if defined( PERSEUS_SCANNER_AVX2 ) || defined( PERSEUS_SCANNER_SSE2 )
+        static block contains( const block& b )
+        {
+          return ( b == block::broadcast( ' ' ) ) | b.in_range( '\t', '\r' );
+        }
+#endif
+      };
+
+      /// `\w`
+      struct word_class
+      {
+        static bool contains( const char c )
+        {
+          return ( c >= 'a' && c <= 'z' ) || ( c >= 'A' && c <= 'Z' ) || ( c >= '0' && c <= '9' ) || c == '_';
+        }
+
+#if defined( PERSEUS_SCANNER_AVX2 ) || defined( PERSEUS_SCANNER_SSE2 )
+        static block contains( const block& b )
+        {
+          // setting bit 5 turns upper case letters into lower case ones, and no other character into one
+          return ( b | block::broadcast( 0x20 ) ).in_range( 'a', 'z' ) | b.in_range( '0', '9' ) | ( b == block::broadcast( '_' ) );
+        }
+#endif
+      };
+
+      /// `\d`
+      struct digit_class
+      {
+        static bool contains( const char c )
+        {
+          return c >= '0' && c <= '9';
+        }
+
+#if defined( PERSEUS_SCANNER_AVX2 ) || defined( PERSEUS_SCANNER_SSE2 )
+        static block contains( const block& b )
+        {
+          return b.in_range( '0', '9' );
+        }
+#endif
+      };
+
+      /// A single character
+      template< char C >
+      struct character_class
+      {
+        static bool contains( const char c )
+        {
+          return c == C;
+        }
+
+#if defined( PERSEUS_SCANNER_AVX2 ) || defined( PERSEUS_SCANNER_SSE2 )
+        static block contains( const block& b )
+        {
+          return b == block::broadcast( C );
+        }
+#endif
+      };
+
+      /// What needs handling inside of a string literal
+      struct string_special_class
+      {
+        static bool contains( const char c )
+        {
+          return c == '"' || c == '\\' || c == '\n';
+        }
+
+#if defined( PERSEUS_SCANNER_AVX2 ) || defined( PERSEUS_SCANNER_SSE2 )
+        static block contains( const block& b )
+        {
+          return ( b == block::broadcast( '"' ) ) | ( b == block::broadcast( '\\' ) ) | ( b == block::broadcast( '\n' ) );
+        }
+#endif
+      };
+
+      /// Skips characters as long as they are (or aren't) in the given class
+      template< typename Class, bool Inside >
+      const char* skip( const char* current, const char* const end )
+      {
+#if defined( PERSEUS_SCANNER_AVX2 ) || defined( PERSEUS_SCANNER_SSE2 )
+        while( end - current >= static_cast< std::ptrdiff_t >( block::size ) )
+        {
+          std::uint32_t stop = Class::contains( block::load( current ) ).mask();
+          if( Inside )
+          {
+            stop = ~stop;
+            if( block::size < 32 )
+            {
+              stop &= ( std::uint32_t( 1 ) << block::size ) - 1;
+            }
+          }
+          if( stop != 0 )
+          {
+            return current + count_trailing_zeros( stop );
+          }
+          current += block::size;
+        }
+#endif
+        while( current != end && Class::contains( *current ) == Inside )
+        {
+          ++current;
+        }
+        return current;
+      }
+
+      template< typename Class >
+      const char* skip_while( const char* current, const char* const end )
+      {
+        return skip< Class, true >( current, end );
+      }
+
+      template< typename Class >
+      const char* skip_until( const char* current, const char* const end )
+      {
+        return skip< Class, false >( current, end );
+      }
+
+      /// `[0-9a-zA-Z]`, the HEX pattern
+      bool is_hex_character( const char c )
+      {
+        return word_class::contains( c ) && c != '_';
+      }
+
+      bool is_binary_digit( const char c )
+      {
+        return c == '0' || c == '1';
+      }
+
+      /// `[\+\-\*\.\/\|\\\!#$%&<=>\?@\^~]`
+      bool is_operator_character( const char c )
+      {
+        switch( c )
+        {
+        case '+': case '-': case '*': case '.': case '/': case '|': case '\\': case '!': case '#':
+        case '$': case '%': case '&': case '<': case '=': case '>': case '?': case '@': case '^': case '~':
+          return true;
+        default:
+          return false;
+        }
+      }
+
+      /// The end of `C('?C+)*` starting at current, where C is characters matching the predicate, or nullptr if it doesn't start there
+      template< typename Predicate >
+      const char* match_separated( const char* current, const char* const end, Predicate is_digit )
+      {
+        if( current == end || !is_digit( *current ) )
+        {
+          return nullptr;
+        }
+        do
+        {
+          do
+          {
+            ++current;
+          } while( current != end && is_digit( *current ) );
+          // a separator is only part of the literal if a digit follows
+          if( current != end && *current == '\'' && end - current >= 2 && is_digit( current[ 1 ] ) )
+          {
+            ++current;
+          }
+        } while( current != end && is_digit( *current ) );
+        return current;
+      }
+
+      /// The end of `\d('?\d+)*`, or nullptr
+      const char* match_decimal( const char* const current, const char* const end )
+      {
+        if( current == end || !digit_class::contains( *current ) )
+        {
+          return nullptr;
+        }
+        const char* result = skip_while< digit_class >( current, end );
+        if( result != end && *result == '\'' )
+        {
+          result = match_separated( result - 1, end, []( const char c ) { return digit_class::contains( c ); } );
+        }
+        return result;
+      }
+
+      /// The end of a `0x` or `0b` literal after the given prefix, or nullptr
+      template< typename Predicate >
+      const char* match_prefixed( const char* const current, const char* const end, const char prefix, Predicate is_digit )
+      {
+        if( end - current < 3 || current[ 0 ] != '0' || ( current[ 1 ] | 0x20 ) != prefix )
+        {
+          return nullptr;
+        }
+        return match_separated( current + 2, end, is_digit );
+      }
+
+      /// The end of `\/\/[^\n]*|\/\*([^\*]|\*[^\/])*\*\/`, or nullptr
+      const char* match_comment( const char* const current, const char* const end )
+      {
+        if( end - current < 2 || current[ 0 ] != '/' )
+        {
+          return nullptr;
+        }
+        if( current[ 1 ] == '/' )
+        {
+          return skip_until< character_class< '\n' > >( current + 2, end );
+        }
+        if( current[ 1 ] != '*' )
+        {
+          return nullptr;
+        }
+        // a star always takes the next character with it, unless that's the closing slash, so the comment ends at the first star followed by a slash that isn't itself taken by a star
+        const char* position = current + 2;
+        while( true )
+        {
+          position = skip_until< character_class< '*' > >( position, end );
+          if( end - position < 2 )
+          {
+            return nullptr;
+          }
+          if( position[ 1 ] == '/' )
+          {
+            return position + 2;
+          }
+          position += 2;
+        }
+      }
+
+      /// The end of `\"([^\n\"\\]|\\[\"nrt\\])*\"`, or nullptr
+      const char* match_string( const char* current, const char* const end )
+      {
+        ++current;
+        while( true )
+        {
+          current = skip_until< string_special_class >( current, end );
+          if( current == end || *current == '\n' )
+          {
+            return nullptr;
+          }
+          if( *current == '"' )
+          {
+            return current + 1;
+          }
+          // backslash
+          if( end - current < 2 )
+          {
+            return nullptr;
+          }
+          switch( current[ 1 ] )
+          {
+          case '"': case 'n': case 'r': case 't': case '\\':
+            current += 2;
+            break;
+          default:
+            return nullptr;
+          }
+        }
+      }
+
+      struct keyword
+      {
+        const char* text;
+        std::size_t length;
+        token_id::token_id id;
+      };
+
+      /// Keywords by ( 5 * first character + 2 * last character ) % 16, which is unique for each
+      const keyword keywords[ 16 ] = {
+        { nullptr, 0, token_id::identifier },
+        { nullptr, 0, token_id::identifier },
+        { nullptr, 0, token_id::identifier },
+        { "else", 4, token_id::else_ },
+        { "let", 3, token_id::let_ },
+        { nullptr, 0, token_id::identifier },
+        { "return", 6, token_id::return_ },
+        { "impure", 6, token_id::impure_ },
+        { "false", 5, token_id::false_ },
+        { "if", 2, token_id::if_ },
+        { "function", 8, token_id::function_ },
+        { "mutable", 7, token_id::mutable_ },
+        { nullptr, 0, token_id::identifier },
+        { "while", 5, token_id::while_ },
+        { "true", 4, token_id::true_ },
+        { nullptr, 0, token_id::identifier },
+      };
+
+      /// The id of the word [begin, end), an identifier unless it's a keyword
+      token_id::token_id classify_word( const char* const begin, const char* const end )
+      {
+        const std::size_t length = static_cast< std::size_t >( end - begin );
+        const keyword& candidate = keywords[ ( 5 * static_cast< unsigned char >( *begin ) + 2 * static_cast< unsigned char >( end[ -1 ] ) ) % 16 ];
+        if( candidate.length == length && std::memcmp( candidate.text, begin, length ) == 0 )
+        {
+          return candidate.id;
+        }
+        return token_id::identifier;
+      }
+
+      /// Keeps the longest match, preferring the earlier one on ties, like the lexer generated from the token definitions
+      struct longest_match
+      {
+        void consider( const char* const match_end, const token_id::token_id match_id )
+        {
+          if( match_end != nullptr && ( end == nullptr || match_end > end ) )
+          {
+            end = match_end;
+            id = match_id;
+          }
+        }
+
+        const char* end = nullptr;
+        token_id::token_id id = token_id::whitespace;
+      };
+    }
+
+    scanner::scanner( const char* const begin, const char* const end )
+      : _begin( begin )
+      , _current( begin )
+      , _end( end )
+    {
+    }
+
+    bool scanner::next( scanned_token& out_token )
+    {
+      if( _current == _end )
+      {
+        return false;
+      }
+      const char c = *_current;
+      longest_match match;
+      // candidates in the order of the token definitions
+      if( whitespace_class::contains( c ) )
+      {
+        match.consider( skip_while< whitespace_class >( _current + 1, _end ), token_id::whitespace );
+      }
+      else if( digit_class::contains( c ) )
+      {
+        match.consider( match_decimal( _current, _end ), token_id::decimal_integer );
+        match.consider( match_prefixed( _current, _end, 'x', &is_hex_character ), token_id::hexadecimal_integer );
+        match.consider( match_prefixed( _current, _end, 'b', &is_binary_digit ), token_id::binary_integer );
+        match.consider( skip_while< word_class >( _current + 1, _end ), token_id::identifier );
+      }
+      else if( word_class::contains( c ) )
+      {
+        const char* const word_end = skip_while< word_class >( _current + 1, _end );
+        match.consider( word_end, classify_word( _current, word_end ) );
+      }
+      else if( c == '"' )
+      {
+        match.consider( match_string( _current, _end ), token_id::string );
+      }
+      else if( is_operator_character( c ) )
+      {
+        match.consider( match_comment( _current, _end ), token_id::comment );
+        switch( c )
+        {
+        case '.':
+          match.consider( _current + 1, token_id::dot );
+          break;
+        case '=':
+          match.consider( _current + 1, token_id::equals );
+          break;
+        case '-':
+          if( _end - _current >= 2 && _current[ 1 ] == '>' )
+          {
+            match.consider( _current + 2, token_id::arrow_right );
+          }
+          break;
+        default:
+          break;
+        }
+        const char* operator_end = _current + 1;
+        while( operator_end != _end && is_operator_character( *operator_end ) )
+        {
+          ++operator_end;
+        }
+        match.consider( operator_end, token_id::operator_identifier );
+      }
+      else
+      {
+        switch( c )
+        {
+        case ':':
+          match.consider( _current + 1, token_id::colon );
+          break;
+        case ';':
+          match.consider( _current + 1, token_id::semicolon );
+          break;
+        case ',':
+          match.consider( _current + 1, token_id::comma );
+          break;
+        case '`':
+          match.consider( _current + 1, token_id::backtick );
+          break;
+        case '(':
+          match.consider( _current + 1, token_id::paren_open );
+          break;
+        case ')':
+          match.consider( _current + 1, token_id::paren_close );
+          break;
+        case '{':
+          match.consider( _current + 1, token_id::brace_open );
+          break;
+        case '}':
+          match.consider( _current + 1, token_id::brace_close );
+          break;
+        case '[':
+          match.consider( _current + 1, token_id::square_bracket_open );
+          break;
+        case ']':
+          match.consider( _current + 1, token_id::square_bracket_close );
+          break;
+        default:
+          break;
+        }
+      }
+      if( match.end == nullptr )
+      {
+        return false;
+      }
+      out_token = { match.id, offset(), static_cast< std::size_t >( match.end - _begin ) };
+      _current = match.end;
+      return true;
+    }
+
+    bool scan( const char* const begin, const char* const end, std::vector< scanned_token >& out_tokens )
+    {
+      scanner tokens( begin, end );
+      scanned_token token;
+      while( tokens.next( token ) )
+      {
+        out_tokens.push_back( token );
+      }
+      return tokens.at_end();
+    }
+
+    const file_position& position_tracker::advance( const std::size_t offset )
+    {
+      const char* const target = _begin + offset;
+      while( _current < target )
+      {
+        if( *_current == '\n' )
+        {
+          _position.line += 1;
+          _position.column = 0;
+        }
+        ++_current;
+        // don't count continuation bytes
+        if( ( *_current & 0b1100'0000 ) != 0b1000'0000 )
+        {
+          _position.column += 1;
+        }
+      }
+      return _position;
+    }
+  }
+}
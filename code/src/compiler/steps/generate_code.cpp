@@ -27,12 +27,91 @@ namespace perseus
         stack_size -= bytes;
       }
 
+      /// writes an opcode, remembering it so it can be fused with the next one
+      void emit( const opcode op )
+      {
+        last_address = static_cast< instruction_pointer::value_type >( code.size() );
+        last_opcode = op;
+        code.push< opcode >( op );
+      }
+
+      /// marks the current address as a jump target; the instructions before and after it must not be fused
+      void label()
+      {
+        last_opcode = opcode::opcode_end;
+      }
+
+      /// whether the previous instruction is the given one and may be fused with the next one
+      bool follows( const opcode op ) const
+      {
+        return last_opcode == op;
+      }
+
+      /// removes the previous instruction, so a superinstruction can replace it
+      void remove_last()
+      {
+        assert( last_opcode != opcode::opcode_end );
+        code.resize( last_address );
+        last_opcode = opcode::opcode_end;
+      }
+
       const function_manager::function_pointer& function;
       /// counting from above the return address of the current function
       std::uint32_t stack_size;
       code_segment& code;
+      /// the last instruction written with emit(), or opcode_end if it can't be fused (any more)
+      opcode last_opcode = opcode::opcode_end;
+      /// address of last_opcode
+      instruction_pointer::value_type last_address = 0;
     };
 
+    /// the superinstruction combining the given comparison with a relative_jump_if_false, or opcode_end if there is none
+    static opcode get_compare_and_branch( const opcode comparison )
+    {
+      switch( comparison )
+      {
+      case opcode::equals_i32:
+        return opcode::equals_i32_jump_if_false;
+      case opcode::not_equals_i32:
+        return opcode::not_equals_i32_jump_if_false;
+      case opcode::less_than_i32:
+        return opcode::less_than_i32_jump_if_false;
+      case opcode::less_than_or_equals_i32:
+        return opcode::less_than_or_equals_i32_jump_if_false;
+      case opcode::greater_than_i32:
+        return opcode::greater_than_i32_jump_if_false;
+      case opcode::greater_than_or_equals_i32:
+        return opcode::greater_than_or_equals_i32_jump_if_false;
+      default:
+        return opcode::opcode_end;
+      }
+    }
+
+    /// writes a relative_jump_if_false, fused with the preceding comparison if possible; the offset must be written afterwards
+    static void emit_jump_if_false( context& c )
+    {
+      const opcode fused = get_compare_and_branch( c.last_opcode );
+      if( fused != opcode::opcode_end )
+      {
+        c.remove_last();
+        // same stack effect as both instructions, so c.stack_size is already right once the caller pops the condition
+        c.emit( fused );
+      }
+      else
+      {
+        c.emit( opcode::relative_jump_if_false );
+      }
+    }
+
+    /// writes the end of a function returning a value, storing it below the arguments and popping everything else
+    static void emit_return_value( context& c, const std::uint32_t return_size, const std::uint32_t pop_size, const std::uint32_t argument_size )
+    {
+      c.emit( opcode::store_pop_return );
+      c.code.push< std::uint32_t >( return_size );
+      c.code.push< std::uint32_t >( pop_size );
+      c.code.push< std::uint32_t >( argument_size );
+    }
+
     template< typename T >
     struct value_placeholder
     {
@@ -69,13 +148,13 @@ namespace perseus
       }
       void operator()( const std::int32_t& constant ) const
       {
-        c.code.push< opcode >( opcode::push_32 );
+        c.emit( opcode::push_32 );
         c.code.push< std::int32_t >( constant );
         c.push( sizeof( std::int32_t ) );
       }
       void operator()( const bool& constant ) const
       {
-        c.code.push< opcode >( opcode::push_8 );
+        c.emit( opcode::push_8 );
         c.code.push< std::uint8_t >( constant );
         c.push( sizeof( std::uint8_t ) );
       }
@@ -85,8 +164,15 @@ namespace perseus
       void operator()( const ast::clean::local_variable_reference& ref ) const
       {
         auto size = get_size( type );
-        c.code.push< opcode >( opcode::relative_load_stack );
-        c.code.push< std::uint32_t >( size );
+        if( size == sizeof( std::int32_t ) )
+        {
+          c.emit( opcode::load_local_32 );
+        }
+        else
+        {
+          c.emit( opcode::relative_load_stack );
+          c.code.push< std::uint32_t >( size );
+        }
         c.code.push< std::int32_t >( ref.offset );
         c.push( size );
       }
@@ -102,7 +188,7 @@ namespace perseus
         // evaluate condition
         generate_code( exp.condition, c );
         // conditional jump
-        c.code.push< opcode >( opcode::relative_jump_if_false );
+        emit_jump_if_false( c );
         auto else_offset_placeholder = write_placeholder< int32_t >( c.code );
         auto else_jump_address = c.code.size();
         c.pop( 1 );
@@ -116,7 +202,7 @@ namespace perseus
         int32_t end_jump_address{};
         if( has_else )
         {
-          c.code.push< opcode >( opcode::relative_jump );
+          c.emit( opcode::relative_jump );
           end_offset_placeholder = write_placeholder< int32_t >( c.code );
           end_jump_address = c.code.size();
         }
@@ -124,6 +210,7 @@ namespace perseus
         //    else expression
         // else label
         replace_placeholder< int32_t >( c.code, else_offset_placeholder, static_cast< int32_t >( c.code.size() - else_jump_address ) );
+        c.label();
         if( has_else )
         {
           c.stack_size = pre_then_stack_size; // due to the jump, the then result is not pushed onto the stack at this point
@@ -131,6 +218,7 @@ namespace perseus
 
           //    past-else label
           replace_placeholder< int32_t >( c.code, end_offset_placeholder, static_cast< int32_t >( c.code.size() - end_jump_address ) );
+          c.label();
         }
       }
 
@@ -141,10 +229,11 @@ namespace perseus
         assert( exp.condition.type == type_id::bool_ );
 
         auto start_address = c.code.size();
+        c.label();
         //    loop condition
         generate_code( exp.condition, c );
         // conditional jump
-        c.code.push< opcode >( opcode::relative_jump_if_false );
+        emit_jump_if_false( c );
         auto end_offset_placeholder = write_placeholder< int32_t >( c.code );
         auto end_jump_address = c.code.size();
         c.pop( 1 );
@@ -155,17 +244,18 @@ namespace perseus
         auto body_result_size = get_size( exp.body.type );
         if( body_result_size > 0 )
         {
-          c.code.push< opcode >( opcode::pop );
+          c.emit( opcode::pop );
           c.code.push< std::uint32_t >( body_result_size );
           c.pop( body_result_size );
         }
         // jump back to condition
-        c.code.push< opcode >( opcode::relative_jump );
+        c.emit( opcode::relative_jump );
         // the extra int32 size is of the address that's being pushed
         c.code.push< std::int32_t >( -static_cast< std::int32_t >( c.code.size() + sizeof( std::int32_t ) - start_address ) );
 
         // end label
         replace_placeholder< int32_t >( c.code, end_offset_placeholder, static_cast< int32_t >( c.code.size() - end_jump_address ) );
+        c.label();
       }
 
       //    Return
@@ -175,24 +265,23 @@ namespace perseus
         // calculate return value
         generate_code( exp.value, c );
 
-        // store return value
         auto return_size = get_size( exp.value.type );
         auto argument_size = c.function->first.parameters_size();
         if( return_size > 0 )
         {
-          c.code.push< opcode >( opcode::relative_store_stack );
-          c.code.push< std::uint32_t >( return_size );
-          c.code.push< std::int32_t >( -static_cast< int32_t >( return_size + argument_size + sizeof( instruction_pointer::value_type ) + c.stack_size ) );
+          // store return value, pop everything and return
+          emit_return_value( c, return_size, c.stack_size, argument_size );
+          return;
         }
 
         // pop everything
         if( c.stack_size > 0 )
         {
-          c.code.push< opcode >( opcode::pop );
+          c.emit( opcode::pop );
           c.code.push< std::uint32_t >( c.stack_size );
         }
         // return
-        c.code.push< opcode >( opcode::return_ );
+        c.emit( opcode::return_ );
         c.code.push< std::uint32_t >( argument_size );
       }
 
@@ -213,11 +302,11 @@ namespace perseus
             {
               auto local_variables_size = pre_expression_stack_size - pre_block_stack_size;
               // store result
-              c.code.push< opcode >( opcode::relative_store_stack );
+              c.emit( opcode::relative_store_stack );
               c.code.push< std::uint32_t >( return_size );
               c.code.push< std::int32_t >( -static_cast< std::int32_t >( local_variables_size + return_size ) );
               // clean up local variables
-              c.code.push< opcode >( opcode::pop );
+              c.emit( opcode::pop );
               c.code.push< std::uint32_t >( local_variables_size );
               c.pop( local_variables_size );
             }
@@ -228,7 +317,7 @@ namespace perseus
             if( return_size != 0 )
             {
               assert( c.stack_size > pre_expression_stack_size );
-              c.code.push< opcode >( opcode::pop );
+              c.emit( opcode::pop );
               c.code.push< std::uint32_t >( return_size );
               c.stack_size = pre_expression_stack_size;
             }
@@ -244,7 +333,7 @@ namespace perseus
             if( c.stack_size != pre_block_stack_size )
             {
               assert( c.stack_size > pre_block_stack_size );
-              c.code.push< opcode >( opcode::pop );
+              c.emit( opcode::pop );
               c.code.push< std::uint32_t >( c.stack_size - pre_block_stack_size );
               c.stack_size = pre_block_stack_size;
             }
@@ -278,7 +367,7 @@ namespace perseus
         auto return_size = get_size( exp.function->second.return_type );
         if( return_size > 0 && !exp.function->second.has_opcode() )
         {
-          c.code.push< opcode >( opcode::reserve );
+          c.emit( opcode::reserve );
           c.code.push< std::uint32_t >( return_size );
           c.push( return_size );
         }
@@ -292,12 +381,24 @@ namespace perseus
         opcode op;
         if( exp.function->second.get_opcode( op ) )
         {
-          c.code.push< opcode >( op );
+          if( ( op == opcode::add_i32 || op == opcode::subtract_i32 ) && c.follows( opcode::push_32 ) )
+          {
+            // fuse with the constant second operand
+            const std::int32_t constant = instruction_pointer( c.code, static_cast< instruction_pointer::value_type >( c.code.size() - sizeof( std::int32_t ) ) ).read< std::int32_t >();
+            c.remove_last();
+            c.emit( opcode::add_immediate_i32 );
+            // negated in unsigned arithmetic, which can't overflow
+            c.code.push< std::uint32_t >( op == opcode::add_i32 ? std::uint32_t( constant ) : 0u - std::uint32_t( constant ) );
+          }
+          else
+          {
+            c.emit( op );
+          }
           c.stack_size = post_call_stack_size + return_size;
         }
         else
         {
-          c.code.push< opcode >( opcode::call );
+          c.emit( opcode::call );
           exp.function->second.write_address( c.code );
           c.stack_size = post_call_stack_size;
         }
@@ -316,6 +417,7 @@ namespace perseus
     {
       // we now know this functions' address; make it known
       c.function->second.set_address( c.code.size(), c.code );
+      c.label();
 
       const type_id return_type = c.function->second.return_type;
       assert( function.body.type == return_type );
@@ -330,17 +432,12 @@ namespace perseus
       if( return_size > 0 )
       {
         // stack: <return memory> <parameters> <return address> <result>
-        c.code.push< opcode >( opcode::relative_store_stack );
-        c.code.push< std::uint32_t >( return_size );
-        c.code.push< std::int32_t >( -static_cast< std::int32_t >( 2 * return_size + argument_size + sizeof( instruction_pointer::value_type ) ) );
-        // stack: <result> <parameters> <return address> <result>
-        c.code.push< opcode >( opcode::pop );
-        c.code.push< std::uint32_t>( get_size( return_type ) );
-        // stack: <result> <parameters> <return address>
+        emit_return_value( c, return_size, return_size, argument_size );
+        // stack: <result>
+        return;
       }
-      c.code.push< opcode >( opcode::return_ );
+      c.emit( opcode::return_ );
       c.code.push< std::uint32_t >( argument_size );
-      // stack: <result>
     }
 
     void generate_code( const ast::clean::file& ast, code_segment& out_code )
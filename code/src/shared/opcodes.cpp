@@ -1,11 +1,83 @@
 #include "shared/opcodes.hpp"
 
+#include <cstddef>
 #include <type_traits>
 
 namespace perseus
 {
   namespace detail
   {
+    namespace
+    {
+      /// indexed by opcode
+      const char* const opcode_names[] = {
+        "no_operation",
+        "exit",
+        "syscall",
+        "low_level_break",
+        "absolute_coroutine",
+        "indirect_coroutine",
+        "resume_coroutine",
+        "resume_pushing_everything",
+        "coroutine_state",
+        "delete_coroutine",
+        "coroutine_return",
+        "yield",
+        "push_coroutine_identifier",
+        "push_8",
+        "push_32",
+        "reserve",
+        "pop",
+        "absolute_load_current_stack",
+        "absolute_store_current_stack",
+        "absolute_load_stack",
+        "absolute_store_stack",
+        "relative_load_stack",
+        "relative_store_stack",
+        "push_stack_size",
+        "absolute_jump",
+        "relative_jump",
+        "relative_jump_if_false",
+        "indirect_jump",
+        "call",
+        "indirect_call",
+        "return_",
+        "and_b",
+        "or_b",
+        "equals_b",
+        "not_equals_b",
+        "negate_b",
+        "add_i32",
+        "subtract_i32",
+        "multiply_i32",
+        "divide_i32",
+        "equals_i32",
+        "not_equals_i32",
+        "less_than_i32",
+        "less_than_or_equals_i32",
+        "greater_than_i32",
+        "greater_than_or_equals_i32",
+        "negate_i32",
+        "modulo_i32",
+        "load_local_32",
+        "add_immediate_i32",
+        "equals_i32_jump_if_false",
+        "not_equals_i32_jump_if_false",
+        "less_than_i32_jump_if_false",
+        "less_than_or_equals_i32_jump_if_false",
+        "greater_than_i32_jump_if_false",
+        "greater_than_or_equals_i32_jump_if_false",
+        "store_pop_return",
+      };
+      static_assert( sizeof( opcode_names ) / sizeof( *opcode_names ) == static_cast< std::size_t >( opcode::opcode_end ), "every opcode needs a name" );
+    }
+
+    const char* get_name( const opcode code )
+    {
+      const auto index = static_cast< std::underlying_type_t< opcode > >( code );
+      return index < static_cast< std::underlying_type_t< opcode > >( opcode::opcode_end ) ? opcode_names[ index ] : "opcode_end";
+    }
+
     std::ostream& operator<<( std::ostream& stream, const opcode code )
     {
       stream << "opcode(" << static_cast< std::underlying_type_t< opcode > >( code ) << ')';
@@ -0,0 +1,219 @@
+#include "vm/actor_system.hpp"
+
+#include <exception>
+#include <string>
+#include <utility>
+
+namespace perseus
+{
+  namespace detail
+  {
+    constexpr std::size_t actor_system::default_max_actors;
+
+    actor_system::actor_system( const std::size_t threads, const std::size_t max_actors )
+      : _actors( new std::atomic< actor* >[ max_actors ] )
+      , _max_actors( max_actors )
+    {
+      const std::size_t count = std::max< std::size_t >( threads, 1 );
+      _threads.reserve( count );
+      try
+      {
+        for( std::size_t i = 0; i < count; ++i )
+        {
+          _threads.emplace_back( &actor_system::work, this );
+        }
+      }
+      catch( ... )
+      {
+        stop();
+        throw;
+      }
+    }
+
+    actor_system::~actor_system()
+    {
+      wait_until_idle();
+      stop();
+    }
+
+    actor_system::actor_handle actor_system::spawn( code_segment&& code, const instruction_pointer::value_type start_address, stack&& parameters, std::vector< syscall >&& syscalls, const dispatch_engine engine )
+    {
+      actor* a;
+      actor_handle handle;
+      {
+        std::lock_guard< std::mutex > lock( _spawn_mutex );
+        const std::size_t index = _actor_count.load();
+        if( index == _max_actors )
+        {
+          throw too_many_actors( "Exceeded limit of " + std::to_string( _max_actors ) + " actors." );
+        }
+        std::unique_ptr< actor > owned( new actor( static_cast< actor_id >( index ), start_address, std::move( parameters ) ) );
+        a = owned.get();
+        std::vector< syscall > all_syscalls = actor_syscalls( *a );
+        for( syscall& s : syscalls )
+        {
+          all_syscalls.push_back( std::move( s ) );
+        }
+        a->proc.reset( new processor( std::move( code ), std::move( all_syscalls ), engine ) );
+        handle.id = a->id;
+        handle.result = a->result.get_future();
+        _owned_actors.push_back( std::move( owned ) );
+        _actors[ index ].store( a );
+        _actor_count.store( index + 1 );
+      }
+      schedule( *a );
+      return handle;
+    }
+
+    void actor_system::send( const actor_id recipient, stack&& message )
+    {
+      actor* const a = find( recipient );
+      if( !a )
+      {
+        throw invalid_actor_identifier( "Invalid actor identifier used for sending!" );
+      }
+      deliver( *a, std::move( message ) );
+    }
+
+    void actor_system::wait_until_idle()
+    {
+      std::unique_lock< std::mutex > lock( _mutex );
+      _idle.wait( lock, [ this ](){ return _busy == 0; } );
+    }
+
+    std::vector< syscall > actor_system::actor_syscalls( actor& a )
+    {
+      std::vector< syscall > result( first_user_syscall );
+      result[ send_syscall ] = [ this ]( stack& st )
+      {
+        const actor_id recipient = st.pop< actor_id >();
+        const std::uint32_t size = st.pop< std::uint32_t >();
+        actor* const to = find( recipient );
+        if( !to )
+        {
+          throw invalid_actor_identifier( "Invalid actor identifier used for sending!" );
+        }
+        stack message;
+        message.transfer( st, size );
+        deliver( *to, std::move( message ) );
+      };
+      result[ receive_syscall ] = [ &a ]( stack& st )
+      {
+        stack message;
+        if( !a.messages.pop( message ) )
+        {
+          // leaves the stack unchanged, so receiving is retried once the actor is resumed
+          throw would_block( "Empty mailbox" );
+        }
+        st.append( message );
+        st.push< std::uint32_t >( static_cast< std::uint32_t >( message.size() ) );
+      };
+      result[ self_syscall ] = [ &a ]( stack& st )
+      {
+        st.push< actor_id >( a.id );
+      };
+      return result;
+    }
+
+    actor_system::actor* actor_system::find( const actor_id id ) const
+    {
+      return id < _actor_count.load() ? _actors[ id ].load() : nullptr;
+    }
+
+    void actor_system::deliver( actor& a, stack&& message )
+    {
+      a.messages.push( std::move( message ) );
+      // the message is visible to the receiver before this, so either it sees the message or we see it parked
+      if( a.state.exchange( actor_state::notified ) == actor_state::parked )
+      {
+        schedule( a );
+      }
+    }
+
+    void actor_system::schedule( actor& a )
+    {
+      {
+        std::lock_guard< std::mutex > lock( _mutex );
+        _runnable.push_back( &a );
+        ++_busy;
+      }
+      _work_available.notify_one();
+    }
+
+    void actor_system::run( actor& a )
+    {
+      // messages sent from now on are seen by receive, or make parking fail
+      a.state.store( actor_state::running );
+      try
+      {
+        stack result;
+        bool finished;
+        if( a.started )
+        {
+          finished = a.proc->try_resume( result );
+        }
+        else
+        {
+          a.started = true;
+          finished = a.proc->try_execute( a.start_address, std::move( a.parameters ), result );
+        }
+        if( !finished )
+        {
+          actor_state expected = actor_state::running;
+          if( !a.state.compare_exchange_strong( expected, actor_state::parked ) )
+          {
+            // a message arrived in the meantime
+            schedule( a );
+          }
+          // once parked, the actor may already be running elsewhere, so it mustn't be touched anymore
+          return;
+        }
+        a.result.set_value( std::move( result ) );
+      }
+      catch( ... )
+      {
+        a.result.set_exception( std::current_exception() );
+      }
+      a.proc.reset();
+    }
+
+    void actor_system::work()
+    {
+      std::unique_lock< std::mutex > lock( _mutex );
+      while( true )
+      {
+        _work_available.wait( lock, [ this ](){ return _stopping || !_runnable.empty(); } );
+        if( _runnable.empty() )
+        {
+          return;
+        }
+        actor& a = *_runnable.front();
+        _runnable.pop_front();
+        lock.unlock();
+        run( a );
+        lock.lock();
+        --_busy;
+        if( _busy == 0 )
+        {
+          _idle.notify_all();
+        }
+      }
+    }
+
+    void actor_system::stop()
+    {
+      {
+        std::lock_guard< std::mutex > lock( _mutex );
+        _stopping = true;
+      }
+      _work_available.notify_all();
+      for( std::thread& t : _threads )
+      {
+        if( t.joinable() )
+        {
+          t.join();
+        }
+      }
+    }
+  }
+}
@@ -1,77 +1,145 @@
 #include "vm/coroutine_manager.hpp"
 
 #include <cassert>
-#include <climits>
 #include <string>
 
 namespace perseus
 {
   namespace detail
   {
+    constexpr unsigned coroutine_manager::index_bits;
+    constexpr coroutine::identifier coroutine_manager::max_coroutines;
+    constexpr coroutine::identifier coroutine_manager::chunk_size;
+    constexpr coroutine::identifier coroutine_manager::max_generation;
+    constexpr coroutine::identifier coroutine_manager::no_slot;
+
     coroutine& coroutine_manager::new_coroutine( const code_segment& code, const instruction_pointer::value_type start_address, stack&& initial_stack )
     {
-      coroutine::identifier index = _next_index;
-      // reuse indices of deleted coroutines, if any
-      if( _free_indices.empty() )
+      coroutine::identifier index = _first_free;
+      // reuse slots of deleted coroutines, if any
+      if( index == no_slot )
       {
         // if a user actually manages to create this many coroutines he's doing something wrong.
-        if( _next_index == std::numeric_limits< coroutine::identifier >::max() )
+        if( _used_slots == _capacity )
+        {
+          throw too_many_coroutines( "Exceeded limit of " + std::to_string( _capacity ) + " simultaneous coroutines." );
+        }
+        if( _used_slots == _chunks.size() * chunk_size )
+        {
+          _chunks.emplace_back( new slot[ chunk_size ] );
+        }
+        index = _used_slots;
+      }
+      slot& s = get_slot( index );
+      assert( !s.occupied );
+      // an initial stack with memory of its own can be used as is
+      if( initial_stack.capacity() == 0 || initial_stack.backend() != _stacks.backend() )
+      {
+        stack st = _stacks.acquire( initial_stack.size() );
+        if( st.capacity() != 0 || st.backend() != initial_stack.backend() )
         {
-          throw too_many_coroutines( "Exceeded limit of " + std::to_string( std::numeric_limits< coroutine::identifier >::max() ) + " simultaneous coroutines." );
+          st.append( initial_stack );
+          initial_stack = std::move( st );
+        }
+      }
+      // pooled memory may have been clean for another coroutine
+      initial_stack.mark_all_dirty();
+      new( &s.storage ) coroutine( s.generation << index_bits | ( _first_index + index ), code, start_address, std::move( initial_stack ) );
+      s.occupied = true;
+      // only commit to the slot once nothing can throw anymore
+      if( index == _first_free )
+      {
+        _first_free = s.next_free;
+        if( _first_free == no_slot )
+        {
+          _last_free = no_slot;
         }
-        _next_index += 1;
       }
       else
       {
-        index = _free_indices.back();
-        _free_indices.pop_back();
+        ++_used_slots;
       }
-      auto result = _coroutines.emplace( std::make_pair( index, coroutine( index, code, start_address, std::move( initial_stack ) ) ) );
-      assert( result.second );
-      return result.first->second;
+      ++_size;
+      return s.get();
     }
 
     void coroutine_manager::delete_coroutine( const coroutine::identifier index )
     {
-      auto iter = _coroutines.find( index );
-      if( iter == _coroutines.end() )
+      slot* const s = find( index );
+      if( !s )
       {
         throw invalid_coroutine_identifer( "Invalid coroutine identifier used for deletion!" );
       }
-      if( iter->second.current_state == coroutine::state::live )
+      if( s->get().current_state == coroutine::state::live )
       {
         throw deleting_live_coroutine( "Trying to delete live coroutine!" );
       }
-      _free_indices.push_back( iter->second.index );
-      _coroutines.erase( iter );
+      release( ( index & ( max_coroutines - 1 ) ) - _first_index, *s );
     }
 
     coroutine& coroutine_manager::get_coroutine( const coroutine::identifier index )
     {
-      auto iter = _coroutines.find( index );
-      if( iter == _coroutines.end() )
+      slot* const s = find( index );
+      if( !s )
       {
-        throw invalid_coroutine_identifer( "Invalid coroutine identifier used for deletion!" );
+        throw invalid_coroutine_identifer( "Invalid coroutine identifier used!" );
       }
-      return iter->second;
+      return s->get();
     }
 
     const coroutine& coroutine_manager::get_coroutine( const coroutine::identifier index ) const
     {
-      auto iter = _coroutines.find( index );
-      if( iter == _coroutines.end() )
+      slot* const s = find( index );
+      if( !s )
       {
-        throw invalid_coroutine_identifer( "Invalid coroutine identifier used for deletion!" );
+        throw invalid_coroutine_identifer( "Invalid coroutine identifier used!" );
       }
-      return iter->second;
+      return s->get();
     }
 
     void coroutine_manager::clear()
     {
       // this is only called by opcode::exit and its variants, so we don't check if any coroutines are still live.
-      _coroutines.clear();
-      _free_indices.clear();
-      _next_index = FIRST_INDEX;
+      for( coroutine::identifier index = 0; index < _used_slots && _size > 0; ++index )
+      {
+        slot& s = get_slot( index );
+        if( s.occupied )
+        {
+          release( index, s );
+        }
+      }
+    }
+
+    coroutine_manager::slot* coroutine_manager::find( const coroutine::identifier id ) const
+    {
+      // indices below _first_index wrap around to ones beyond any slot
+      const coroutine::identifier index = ( id & ( max_coroutines - 1 ) ) - _first_index;
+      if( index >= _used_slots )
+      {
+        return nullptr;
+      }
+      slot& s = get_slot( index );
+      return s.occupied && s.generation == id >> index_bits ? &s : nullptr;
+    }
+
+    void coroutine_manager::release( const coroutine::identifier index, slot& s )
+    {
+      _stacks.release( std::move( s.get().stack ) );
+      s.get().~coroutine();
+      s.occupied = false;
+      --_size;
+      // identifiers of this slot become valid again after max_generation + 1 reuses; the slot is still reused so it doesn't leak
+      s.generation = ( s.generation + 1 ) & max_generation;
+      s.next_free = no_slot;
+      if( _last_free == no_slot )
+      {
+        _first_free = index;
+      }
+      else
+      {
+        get_slot( _last_free ).next_free = index;
+      }
+      _last_free = index;
     }
   }
 }
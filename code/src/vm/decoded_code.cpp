@@ -0,0 +1,210 @@
+#include "vm/decoded_code.hpp"
+
+#include <limits>
+
+namespace perseus
+{
+  namespace detail
+  {
+    namespace
+    {
+      /// Index of the internal_handler::invalid_jump_target instruction, which the constructor creates first
+      constexpr std::uint32_t invalid_jump_target_index = 0;
+
+      /// Marks constant jump targets outside the code before they're resolved
+      constexpr std::uint32_t invalid_address = ~std::uint32_t( 0 );
+
+      /// Calculates the target address of a relative jump, or invalid_address
+      std::uint32_t relative_target( const instruction_pointer::value_type next_address, const std::int32_t offset, const std::size_t code_size )
+      {
+        const std::int64_t target = static_cast< std::int64_t >( next_address ) + offset;
+        return target < 0 || static_cast< std::uint64_t >( target ) >= code_size ? invalid_address : static_cast< std::uint32_t >( target );
+      }
+
+      /**
+      @brief Decodes a single instruction, moving the instruction pointer past it.
+
+      Constant jump targets are stored as addresses in `target`, they are resolved afterwards.
+      @throws code_segmentation_fault if the instruction is cut off by the end of the code
+      */
+      decoded_instruction decode( instruction_pointer& ip, const std::size_t code_size )
+      {
+        const opcode code = ip.read< opcode >();
+        decoded_instruction result{ get_handler( code ), 0, 0, 0 };
+        switch( code )
+        {
+        case opcode::syscall:
+        case opcode::absolute_coroutine:
+        case opcode::resume_coroutine:
+        case opcode::coroutine_return:
+        case opcode::yield:
+        case opcode::reserve:
+        case opcode::pop:
+        case opcode::absolute_load_current_stack:
+        case opcode::absolute_store_current_stack:
+        case opcode::absolute_load_stack:
+        case opcode::absolute_store_stack:
+        case opcode::return_:
+          result.operand = ip.read< std::uint32_t >();
+          break;
+        case opcode::push_8:
+          result.operand = static_cast< unsigned char >( ip.read< char >() );
+          break;
+        case opcode::push_32:
+        case opcode::add_immediate_i32:
+          result.operand = static_cast< std::uint32_t >( ip.read< std::int32_t >() );
+          break;
+        case opcode::relative_load_stack:
+        case opcode::relative_store_stack:
+          result.operand = ip.read< std::uint32_t >();
+          result.offset = ip.read< std::int32_t >();
+          break;
+        case opcode::load_local_32:
+          result.offset = ip.read< std::int32_t >();
+          break;
+        case opcode::store_pop_return:
+        {
+          // decoded like the relative_store_stack it starts with, with the argument size in target
+          result.operand = ip.read< std::uint32_t >();
+          const std::uint32_t pop_size = ip.read< std::uint32_t >();
+          result.target = ip.read< std::uint32_t >();
+          const std::int64_t offset = -( std::int64_t( result.operand ) + pop_size + sizeof( instruction_pointer::value_type ) + result.target );
+          if( offset < std::numeric_limits< std::int32_t >::min() )
+          {
+            result = { get_handler( internal_handler::invalid_instruction ), static_cast< std::uint32_t >( code ), 0, 0 };
+          }
+          else
+          {
+            result.offset = static_cast< std::int32_t >( offset );
+          }
+          break;
+        }
+        case opcode::absolute_jump:
+        {
+          const std::uint32_t target = ip.read< std::uint32_t >();
+          result.target = target < code_size ? target : invalid_address;
+          break;
+        }
+        case opcode::relative_jump:
+        case opcode::relative_jump_if_false:
+        case opcode::equals_i32_jump_if_false:
+        case opcode::not_equals_i32_jump_if_false:
+        case opcode::less_than_i32_jump_if_false:
+        case opcode::less_than_or_equals_i32_jump_if_false:
+        case opcode::greater_than_i32_jump_if_false:
+        case opcode::greater_than_or_equals_i32_jump_if_false:
+          result.offset = ip.read< std::int32_t >();
+          result.target = relative_target( ip.value(), result.offset, code_size );
+          break;
+        case opcode::call:
+        {
+          const std::uint32_t target = ip.read< std::uint32_t >();
+          result.target = target < code_size ? target : invalid_address;
+          result.operand = ip.value();
+          break;
+        }
+        case opcode::indirect_call:
+          result.operand = ip.value();
+          break;
+        default:
+          if( code >= opcode::opcode_end )
+          {
+            result.handler = get_handler( internal_handler::invalid_instruction );
+            result.operand = static_cast< std::uint32_t >( code );
+          }
+          break;
+        }
+        return result;
+      }
+
+      /// Whether the instruction's target still needs to be resolved
+      bool has_constant_target( const decoded_instruction& instruction )
+      {
+        switch( static_cast< opcode >( instruction.handler ) )
+        {
+        case opcode::absolute_jump:
+        case opcode::relative_jump:
+        case opcode::relative_jump_if_false:
+        case opcode::equals_i32_jump_if_false:
+        case opcode::not_equals_i32_jump_if_false:
+        case opcode::less_than_i32_jump_if_false:
+        case opcode::less_than_or_equals_i32_jump_if_false:
+        case opcode::greater_than_i32_jump_if_false:
+        case opcode::greater_than_or_equals_i32_jump_if_false:
+        case opcode::call:
+          return true;
+        default:
+          return false;
+        }
+      }
+    }
+
+    constexpr std::uint32_t decoded_code::no_instruction;
+
+    decoded_code::decoded_code( const code_segment& code )
+      : _index_of( code.size(), no_instruction )
+    {
+      append( { get_handler( internal_handler::invalid_jump_target ), 0, 0, 0 }, static_cast< instruction_pointer::value_type >( code.size() ) );
+      decode_run( code, 0 );
+      // resolving may decode further runs, which get resolved in turn as the loop reaches them
+      for( std::size_t i = 0; i < _instructions.size(); ++i )
+      {
+        if( !has_constant_target( _instructions[ i ] ) )
+        {
+          continue;
+        }
+        const std::uint32_t address = _instructions[ i ].target;
+        std::uint32_t index;
+        if( address == invalid_address )
+        {
+          index = invalid_jump_target_index;
+        }
+        else if( _index_of[ address ] != no_instruction )
+        {
+          index = _index_of[ address ];
+        }
+        else
+        {
+          index = decode_run( code, address );
+        }
+        _instructions[ i ].target = index;
+      }
+    }
+
+    std::uint32_t decoded_code::decode_run( const code_segment& code, instruction_pointer::value_type address )
+    {
+      const std::uint32_t first = static_cast< std::uint32_t >( _instructions.size() );
+      while( true )
+      {
+        if( address >= code.size() )
+        {
+          append( { get_handler( internal_handler::end_of_code ), 0, 0, 0 }, address );
+          return first;
+        }
+        if( _index_of[ address ] != no_instruction )
+        {
+          append( { get_handler( internal_handler::fall_through ), 0, 0, _index_of[ address ] }, address );
+          return first;
+        }
+        _index_of[ address ] = static_cast< std::uint32_t >( _instructions.size() );
+        instruction_pointer ip( code, address );
+        try
+        {
+          append( decode( ip, code.size() ), address );
+          address = ip.value();
+        }
+        catch( code_segmentation_fault& )
+        {
+          append( { get_handler( internal_handler::truncated_instruction ), 0, 0, 0 }, address );
+          address = static_cast< instruction_pointer::value_type >( code.size() );
+        }
+      }
+    }
+
+    void decoded_code::append( const decoded_instruction& instruction, const instruction_pointer::value_type address )
+    {
+      _instructions.push_back( instruction );
+      _addresses.push_back( address );
+    }
+  }
+}
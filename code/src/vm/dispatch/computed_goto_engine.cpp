@@ -0,0 +1,86 @@
+#include "instructions.inl"
+
+namespace perseus
+{
+  namespace detail
+  {
+#ifdef PERSEUS_HAS_COMPUTED_GOTO
+    namespace
+    {
+      template< bool checked, typename instrumentation >
+      void run( execution_state& s, instrumentation& instr )
+      {
+        // label addresses are only available inside this function, so the table can't be static data
+        void* labels[ handler_count ];
+#define PERSEUS_LABEL( name ) labels[ get_handler( opcode::name ) ] = &&handle_##name;
+        PERSEUS_FOR_EACH_INSTRUCTION( PERSEUS_LABEL )
+#undef PERSEUS_LABEL
+#define PERSEUS_LABEL( name ) labels[ get_handler( internal_handler::name ) ] = &&handle_internal_##name;
+        PERSEUS_FOR_EACH_INTERNAL_HANDLER( PERSEUS_LABEL )
+#undef PERSEUS_LABEL
+        labels[ get_handler( opcode::exit ) ] = &&handle_exit;
+        labels[ get_handler( internal_handler::leave_engine ) ] = &&handle_leave_engine;
+
+        const decoded_instruction* ip = s.resume_position();
+        try
+        {
+          // every instruction ends with its own copy of this, which gives each its own branch history; decoding only produces valid handlers, so there's no bounds check
+#define PERSEUS_DISPATCH() \
+          { \
+            instr.on_instruction( static_cast< opcode >( ip->handler ) ); \
+            goto *labels[ ip->handler ]; \
+          }
+
+          PERSEUS_DISPATCH();
+
+#define PERSEUS_HANDLER( name ) \
+        handle_##name: \
+          execute< checked >( instruction< opcode::name >(), s, ip ); \
+          PERSEUS_DISPATCH();
+          PERSEUS_FOR_EACH_INSTRUCTION( PERSEUS_HANDLER )
+#undef PERSEUS_HANDLER
+#define PERSEUS_HANDLER( name ) \
+        handle_internal_##name: \
+          execute< checked >( internal< internal_handler::name >(), s, ip ); \
+          PERSEUS_DISPATCH();
+          PERSEUS_FOR_EACH_INTERNAL_HANDLER( PERSEUS_HANDLER )
+#undef PERSEUS_HANDLER
+#undef PERSEUS_DISPATCH
+
+        handle_exit:
+          execute< checked >( instruction< opcode::exit >(), s, ip );
+          return;
+        handle_leave_engine:
+          return;
+        }
+        catch( ... )
+        {
+          s.save_position( ip );
+          throw;
+        }
+      }
+    }
+#endif
+
+    template< typename instrumentation >
+    void run_computed_goto_engine( execution_state& s, instrumentation& instr )
+    {
+#ifdef PERSEUS_HAS_COMPUTED_GOTO
+      if( s.checked )
+      {
+        run< true >( s, instr );
+      }
+      else
+      {
+        run< false >( s, instr );
+      }
+#else
+      run_switch_engine( s, instr );
+#endif
+    }
+
+    template void run_computed_goto_engine< no_instrumentation >( execution_state&, no_instrumentation& );
+    template void run_computed_goto_engine< instruction_counter >( execution_state&, instruction_counter& );
+    template void run_computed_goto_engine< opcode_statistics >( execution_state&, opcode_statistics& );
+  }
+}
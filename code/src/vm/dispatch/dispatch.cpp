@@ -0,0 +1,114 @@
+#include "vm/dispatch.hpp"
+#include "vm/jit_compiler.hpp"
+#include "vm/profiler.hpp"
+#include "vm/opcode_statistics.hpp"
+
+#include <algorithm>
+
+namespace perseus
+{
+  namespace detail
+  {
+    constexpr std::uint64_t execution_budget::clock_interval;
+
+    namespace
+    {
+      /// the countdown for the given number of instructions left
+      std::uint64_t next_countdown( const std::uint64_t instructions, const std::chrono::steady_clock::time_point deadline, const profiler* profile )
+      {
+        std::uint64_t result = instructions;
+        if( deadline != std::chrono::steady_clock::time_point::max() )
+        {
+          result = std::min( result, execution_budget::clock_interval );
+        }
+        if( profile )
+        {
+          result = std::min( result, profile->interval() );
+        }
+        return result;
+      }
+    }
+
+    void execution_state::set_budget( const execution_budget& budget )
+    {
+      if( budget.time == std::chrono::steady_clock::duration::max() )
+      {
+        deadline = std::chrono::steady_clock::time_point::max();
+      }
+      else
+      {
+        const std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+        deadline = budget.time >= std::chrono::steady_clock::time_point::max() - now ? std::chrono::steady_clock::time_point::max() : now + budget.time;
+      }
+      countdown = next_countdown( budget.instructions, deadline, profile );
+      instructions_left = budget.instructions - countdown;
+    }
+
+    bool execution_state::recharge( const std::uint64_t cost, const decoded_instruction* next, const std::size_t cached_bytes )
+    {
+      if( statistics )
+      {
+        statistics->discard_sample();
+      }
+      if( profile )
+      {
+        profile->sample( program, next, co->stack, co->stack.size() + cached_bytes );
+      }
+      const std::uint64_t left = instructions_left + countdown;
+      if( left < cost || ( deadline != std::chrono::steady_clock::time_point::max() && std::chrono::steady_clock::now() >= deadline ) )
+      {
+        return false;
+      }
+      countdown = next_countdown( left - cost, deadline, profile );
+      instructions_left = left - cost - countdown;
+      return true;
+    }
+
+    bool is_native( const dispatch_engine engine )
+    {
+      switch( engine )
+      {
+      case dispatch_engine::switch_:
+      case dispatch_engine::top_of_stack:
+        return true;
+      case dispatch_engine::computed_goto:
+#ifdef PERSEUS_HAS_COMPUTED_GOTO
+        return true;
+#else
+        return false;
+#endif
+      case dispatch_engine::tail_call:
+#ifdef PERSEUS_MUSTTAIL
+        return true;
+#else
+        return false;
+#endif
+      case dispatch_engine::jit:
+#ifdef PERSEUS_HAS_JIT
+        return true;
+#else
+        return false;
+#endif
+      }
+      return false;
+    }
+
+    const char* get_name( const dispatch_engine engine )
+    {
+      switch( engine )
+      {
+      case dispatch_engine::switch_:
+        return "switch";
+      case dispatch_engine::computed_goto:
+        return "computed_goto";
+      case dispatch_engine::tail_call:
+        return "tail_call";
+      case dispatch_engine::top_of_stack:
+        return "top_of_stack";
+      case dispatch_engine::jit:
+        return "jit";
+      }
+      return "unknown";
+    }
+  }
+}
@@ -0,0 +1,847 @@
+/**
+@file
+
+Definitions of the instructions, shared by the dispatch engines in this directory.
+
+Every engine includes this file and only adds the code that gets from one instruction to the next. Each instruction is an always-inlined overload of @ref execute, so the engines end up with the same machine code per instruction as a hand-written switch would.
+
+Instructions operate on the @ref decoded_code; they find their parameters in the @ref decoded_instruction and move the position on themselves, which for most is just `++ip`.
+
+Every instruction comes in a checked and an unchecked variant. The unchecked one leaves out the stack checks the @ref verification proved unnecessary.
+*/
+
+#include "vm/dispatch.hpp"
+#include "vm/exceptions.hpp"
+#include "vm/opcode_statistics.hpp"
+
+#include <utility>
+#include <string>
+#include <type_traits>
+#include <cstdint>
+#include <algorithm>
+#include <iterator>
+#include <functional>
+
+#ifdef _MSC_VER
+# include <Windows.h>
+# define sys_debug_break() DebugBreak()
+#else
+# ifdef __GNUC__
+// TODO: does this always work on gcc? Maybe let cmake find out and generate a configuration file.
+#   include <csignal>
+#   define sys_debug_break() std::raise(SIGTRAP)
+# else
+// the best we can do?
+#   include <iostream>
+#   define sys_debug_break() std::cerr << "please break here" << std::endl;
+# endif
+#endif
+
+#if defined( __GNUC__ )
+# define PERSEUS_ALWAYS_INLINE inline __attribute__(( always_inline ))
+#elif defined( _MSC_VER )
+# define PERSEUS_ALWAYS_INLINE __forceinline
+#else
+# define PERSEUS_ALWAYS_INLINE inline
+#endif
+
+/**
+@brief Invokes `X( name )` for every opcode with a definition in this file.
+
+opcode::exit is missing since it ends execution, which every engine handles on its own.
+*/
+#define PERSEUS_FOR_EACH_INSTRUCTION( X ) \
+  X( no_operation ) \
+  X( syscall ) \
+  X( low_level_break ) \
+  X( absolute_coroutine ) \
+  X( indirect_coroutine ) \
+  X( resume_coroutine ) \
+  X( resume_pushing_everything ) \
+  X( coroutine_state ) \
+  X( delete_coroutine ) \
+  X( coroutine_return ) \
+  X( yield ) \
+  X( push_coroutine_identifier ) \
+  X( push_8 ) \
+  X( push_32 ) \
+  X( reserve ) \
+  X( pop ) \
+  X( absolute_load_current_stack ) \
+  X( absolute_store_current_stack ) \
+  X( absolute_load_stack ) \
+  X( absolute_store_stack ) \
+  X( relative_load_stack ) \
+  X( relative_store_stack ) \
+  X( push_stack_size ) \
+  X( absolute_jump ) \
+  X( relative_jump ) \
+  X( relative_jump_if_false ) \
+  X( indirect_jump ) \
+  X( call ) \
+  X( indirect_call ) \
+  X( return_ ) \
+  X( and_b ) \
+  X( or_b ) \
+  X( equals_b ) \
+  X( not_equals_b ) \
+  X( negate_b ) \
+  X( add_i32 ) \
+  X( subtract_i32 ) \
+  X( multiply_i32 ) \
+  X( divide_i32 ) \
+  X( equals_i32 ) \
+  X( not_equals_i32 ) \
+  X( less_than_i32 ) \
+  X( less_than_or_equals_i32 ) \
+  X( greater_than_i32 ) \
+  X( greater_than_or_equals_i32 ) \
+  X( negate_i32 ) \
+  X( modulo_i32 ) \
+  X( load_local_32 ) \
+  X( add_immediate_i32 ) \
+  X( equals_i32_jump_if_false ) \
+  X( not_equals_i32_jump_if_false ) \
+  X( less_than_i32_jump_if_false ) \
+  X( less_than_or_equals_i32_jump_if_false ) \
+  X( greater_than_i32_jump_if_false ) \
+  X( greater_than_or_equals_i32_jump_if_false ) \
+  X( store_pop_return )
+
+/**
+@brief Invokes `X( name )` for every @ref internal_handler.
+
+internal_handler::leave_engine is missing since it ends execution like opcode::exit.
+*/
+#define PERSEUS_FOR_EACH_INTERNAL_HANDLER( X ) \
+  X( fall_through ) \
+  X( end_of_code ) \
+  X( truncated_instruction ) \
+  X( invalid_instruction ) \
+  X( invalid_jump_target )
+
+namespace perseus
+{
+  namespace detail
+  {
+    namespace
+    {
+      /// Tag type selecting the overload of execute() for an opcode
+      template< opcode code >
+      using instruction = std::integral_constant< opcode, code >;
+
+      /// Tag type selecting the overload of execute() for an internal_handler
+      template< internal_handler handler >
+      using internal = std::integral_constant< internal_handler, handler >;
+
+      /**
+      @brief Where the unchecked engines go when they have to continue in the checked ones.
+
+      Not part of any decoded_code; the position to continue at is saved in the active coroutine beforehand.
+      */
+      const decoded_instruction leave_engine_instruction{ get_handler( internal_handler::leave_engine ), 0, 0, 0 };
+
+      /*
+      The instructions are overloads of the form
+
+      template< bool checked >
+      void execute( instruction< code >, execution_state& s, const decoded_instruction*& ip );
+
+      @tparam checked whether to perform the checks a verification makes unnecessary
+      @param s the execution state
+      @param ip the instruction to execute; afterwards the next one to execute, or nullptr if the engine has to return.
+      */
+
+      //    Helpers
+
+      /// pops a value, checking for underflow unless the code has been verified
+      template< typename T, bool checked >
+      PERSEUS_ALWAYS_INLINE T pop( stack& st )
+      {
+        return checked ? st.pop< T >() : st.pop_unchecked< T >();
+      }
+
+      /// discards bytes, checking for underflow unless the code has been verified
+      template< bool checked >
+      PERSEUS_ALWAYS_INLINE void discard( stack& st, const stack::size_type size )
+      {
+        if( checked )
+        {
+          st.discard( size );
+        }
+        else
+        {
+          st.resize( st.size() - size );
+        }
+      }
+
+      /// charges instructions to the budget, see execution_budget, before continuing at next; false if it ran out
+      PERSEUS_ALWAYS_INLINE bool charge( execution_state& s, const std::uint64_t cost, const decoded_instruction* next, const std::size_t cached_bytes = 0 )
+      {
+        if( s.countdown > cost )
+        {
+          s.countdown -= cost;
+          return true;
+        }
+        return s.recharge( cost, next, cached_bytes );
+      }
+
+      /// suspends the execution since the budget ran out; it continues at the given instruction once resumed
+      PERSEUS_ALWAYS_INLINE void preempt( execution_state& s, const decoded_instruction*& ip, const decoded_instruction* next )
+      {
+        s.save_position( next );
+        s.suspended = true;
+        s.preempted = true;
+        ip = &leave_engine_instruction;
+      }
+
+      /// continues at the given instruction, charging backward jumps to the budget; cached_bytes as in execution_state::recharge()
+      PERSEUS_ALWAYS_INLINE void jump( execution_state& s, const decoded_instruction*& ip, const decoded_instruction* target, const std::size_t cached_bytes = 0 )
+      {
+        if( target <= ip && !charge( s, static_cast< std::uint64_t >( ip - target ) + 1, target, cached_bytes ) )
+        {
+          preempt( s, ip, target );
+          return;
+        }
+        ip = target;
+      }
+
+      /// continues at the called function, charging the call to the budget
+      PERSEUS_ALWAYS_INLINE void enter_function( execution_state& s, const decoded_instruction*& ip, const decoded_instruction* target )
+      {
+        if( !charge( s, 1, target ) )
+        {
+          preempt( s, ip, target );
+          return;
+        }
+        ip = target;
+      }
+
+      /// pops two operands and pushes the result of the given operation on them
+      template< bool checked, typename operand, typename result, typename operation >
+      PERSEUS_ALWAYS_INLINE void binary_operation( stack& st, operation op )
+      {
+        const operand op2 = pop< operand, checked >( st ), op1 = pop< operand, checked >( st );
+        st.push< result >( op( op1, op2 ) );
+      }
+
+      /// like binary_operation, but throws divide_by_zero if the second operand is 0
+      template< bool checked, typename operand, typename operation >
+      PERSEUS_ALWAYS_INLINE void division_operation( stack& st, operation op )
+      {
+        const operand op2 = pop< operand, checked >( st ), op1 = pop< operand, checked >( st );
+        if( op2 == 0 )
+        {
+          throw divide_by_zero( "divide by zero" );
+        }
+        st.push< operand >( op( op1, op2 ) );
+      }
+
+      /// pops two operands and jumps to the instruction's target unless the given comparison of them holds
+      template< bool checked, typename operand, typename comparison >
+      PERSEUS_ALWAYS_INLINE void compare_and_branch( execution_state& s, const decoded_instruction*& ip, comparison compare )
+      {
+        stack& st = s.co->stack;
+        const operand op2 = pop< operand, checked >( st ), op1 = pop< operand, checked >( st );
+        if( !compare( op1, op2 ) )
+        {
+          jump( s, ip, s.instructions + ip->target );
+        }
+        else
+        {
+          ++ip;
+        }
+      }
+
+      /// implementation of the opcodes creating coroutines
+      template< bool checked, opcode code >
+      PERSEUS_ALWAYS_INLINE void create_coroutine( execution_state& s, const decoded_instruction*& ip )
+      {
+        coroutine& co = *s.co;
+        const coroutine::identifier id = s.coroutines.new_coroutine(
+          s.code,
+          code == opcode::absolute_coroutine ? ip->operand : pop< instruction_pointer::value_type, checked >( co.stack )
+        ).index;
+        co.stack.push< coroutine::identifier >( id );
+        ++ip;
+      }
+
+      /// implementation of the opcodes resuming coroutines
+      template< bool checked, opcode code >
+      PERSEUS_ALWAYS_INLINE void resume_coroutine( execution_state& s, const decoded_instruction*& ip )
+      {
+        coroutine& co = *s.co;
+        coroutine& co_to_resume = s.coroutines.get_coroutine( pop< coroutine::identifier, checked >( co.stack ) );
+        if( co_to_resume.current_state == coroutine::state::live )
+        {
+          throw resuming_live_coroutine( "Trying to resume a live coroutine!" );
+        }
+        if( co_to_resume.current_state == coroutine::state::dead )
+        {
+          throw resuming_dead_coroutine( "Trying to resume a dead coroutine!" );
+        }
+        co_to_resume.stack.transfer( co.stack, code == opcode::resume_coroutine ? ip->operand : co.stack.size() );
+        co_to_resume.current_state = coroutine::state::live;
+        ip = s.enter( co_to_resume, ip + 1 );
+      }
+
+      /// implementation of the opcodes leaving coroutines
+      template< bool checked, opcode code >
+      PERSEUS_ALWAYS_INLINE void leave_coroutine( execution_state& s, const decoded_instruction*& ip )
+      {
+        // is this the root coroutine? can't leave that one without exit.
+        if( s.active_coroutines.size() == 1 )
+        {
+          throw no_coroutine( std::string( "Trying to " ) + ( code == opcode::yield ? "yield" : "return" ) + " from last coroutine!" );
+        }
+        coroutine& co = *s.co;
+        co.current_state = code == opcode::yield ? coroutine::state::suspended : coroutine::state::dead;
+        const std::uint32_t size = ip->operand;
+        ip = s.leave( ip + 1 );
+        s.co->stack.transfer( co.stack, size );
+      }
+
+      /// implementation of the load opcodes
+      template< bool checked, opcode code >
+      PERSEUS_ALWAYS_INLINE void load_stack( execution_state& s, const decoded_instruction*& ip )
+      {
+        coroutine& co = *s.co;
+        const std::uint32_t size = ip->operand;
+        // note: co.stack.size() would have to be from_co.stack.size(), but in the case of relative_load_stack from_co = co
+        const std::uint32_t address = code == opcode::relative_load_stack ? ip->offset + co.stack.size() : pop< std::uint32_t, checked >( co.stack );
+        const coroutine& from_co = code == opcode::absolute_load_stack ? s.coroutines.get_coroutine( pop< std::uint32_t, checked >( co.stack ) ) : co;
+        // verified code can't access relative addresses out of bounds; relative addresses below 0 wrap around, which the 64 bit sum catches
+        if( ( checked || code != opcode::relative_load_stack ) && std::uint64_t( address ) + size > from_co.stack.size() )
+        {
+          throw stack_segmentation_fault( "stack segmentation fault: read above top of stack" );
+        }
+        // from_co may be co, whose data moves if it grows; append() takes care of that
+        co.stack.append( from_co.stack.data() + address, size );
+        ++ip;
+      }
+
+      /// implementation of the store opcodes
+      template< bool checked, opcode code >
+      PERSEUS_ALWAYS_INLINE void store_stack( execution_state& s, const decoded_instruction*& ip )
+      {
+        coroutine& co = *s.co;
+        const std::uint32_t size = ip->operand;
+        // as above: co.stack.size() should be to_co.stack.size(), but for relative_store_stack to_co = co
+        const std::uint32_t address = code == opcode::relative_store_stack ? ip->offset + co.stack.size() : pop< std::uint32_t, checked >( co.stack );
+        coroutine& to_co = code == opcode::absolute_store_stack ? s.coroutines.get_coroutine( pop< std::uint32_t, checked >( co.stack ) ) : co;
+        if( ( checked || code != opcode::relative_store_stack ) && std::uint64_t( address ) + size > to_co.stack.size() )
+        {
+          throw stack_segmentation_fault( "stack segmentation fault: write above top of stack" );
+        }
+        std::copy( co.stack.end() - size, co.stack.end(), to_co.stack.begin() + address );
+        to_co.stack.mark_dirty( address, size );
+        ++ip;
+      }
+
+      //    Instructions
+
+      template< bool checked >
+      PERSEUS_ALWAYS_INLINE void execute( instruction< opcode::no_operation >, execution_state&, const decoded_instruction*& ip )
+      {
+        ++ip;
+      }
+
+      /// @note Sets execution_state::finished; the engine must stop afterwards.
+      template< bool checked >
+      PERSEUS_ALWAYS_INLINE void execute( instruction< opcode::exit >, execution_state& s, const decoded_instruction*& ip )
+      {
+        if( s.active_coroutines.size() > 1 )
+        {
+          throw exit_in_coroutine( "opcode::exit in coroutine!" );
+        }
+        coroutine& co = *s.co;
+        s.result = std::move( co.stack );
+        co.current_state = coroutine::state::dead;
+        s.coroutines.delete_coroutine( co.index );
+        s.finished = true;
+        ip = nullptr;
+      }
+
+      template< bool checked >
+      PERSEUS_ALWAYS_INLINE void execute( instruction< opcode::syscall >, execution_state& s, const decoded_instruction*& ip )
+      {
+        const std::uint32_t index = ip->operand;
+        if( index >= s.syscalls.size() )
+        {
+          throw invalid_syscall( "Invalid syscall!" );
+        }
+        stack& st = s.co->stack;
+        const stack::size_type size = st.size();
+        try
+        {
+          s.syscalls[ index ]( st );
+        }
+        catch( const would_block& )
+        {
+          // caught right here, so suspending doesn't unwind the engine; the syscall runs again on resumption
+          s.save_position( ip );
+          s.suspended = true;
+          ip = &leave_engine_instruction;
+          return;
+        }
+        ++ip;
+        // the verification assumes syscalls leave the stack size unchanged; if they don't, the rest is up to the checked engine
+        if( !checked && st.size() != size )
+        {
+          s.save_position( ip );
+          ip = &leave_engine_instruction;
+        }
+      }
+
+      template< bool checked >
+      PERSEUS_ALWAYS_INLINE void execute( instruction< opcode::low_level_break >, execution_state&, const decoded_instruction*& ip )
+      {
+        sys_debug_break();
+        ++ip;
+      }
+
+      //    Coroutines
+
+      template< bool checked >
+      PERSEUS_ALWAYS_INLINE void execute( instruction< opcode::absolute_coroutine >, execution_state& s, const decoded_instruction*& ip )
+      {
+        create_coroutine< checked, opcode::absolute_coroutine >( s, ip );
+      }
+
+      template< bool checked >
+      PERSEUS_ALWAYS_INLINE void execute( instruction< opcode::indirect_coroutine >, execution_state& s, const decoded_instruction*& ip )
+      {
+        create_coroutine< checked, opcode::indirect_coroutine >( s, ip );
+      }
+
+      template< bool checked >
+      PERSEUS_ALWAYS_INLINE void execute( instruction< opcode::resume_coroutine >, execution_state& s, const decoded_instruction*& ip )
+      {
+        resume_coroutine< checked, opcode::resume_coroutine >( s, ip );
+      }
+
+      template< bool checked >
+      PERSEUS_ALWAYS_INLINE void execute( instruction< opcode::resume_pushing_everything >, execution_state& s, const decoded_instruction*& ip )
+      {
+        resume_coroutine< checked, opcode::resume_pushing_everything >( s, ip );
+      }
+
+      template< bool checked >
+      PERSEUS_ALWAYS_INLINE void execute( instruction< opcode::coroutine_state >, execution_state& s, const decoded_instruction*& ip )
+      {
+        stack& st = s.co->stack;
+        st.push< coroutine::state >( s.coroutines.get_coroutine( pop< coroutine::identifier, checked >( st ) ).current_state );
+        ++ip;
+      }
+
+      template< bool checked >
+      PERSEUS_ALWAYS_INLINE void execute( instruction< opcode::delete_coroutine >, execution_state& s, const decoded_instruction*& ip )
+      {
+        s.coroutines.delete_coroutine( pop< coroutine::identifier, checked >( s.co->stack ) );
+        ++ip;
+      }
+
+      template< bool checked >
+      PERSEUS_ALWAYS_INLINE void execute( instruction< opcode::coroutine_return >, execution_state& s, const decoded_instruction*& ip )
+      {
+        leave_coroutine< checked, opcode::coroutine_return >( s, ip );
+      }
+
+      template< bool checked >
+      PERSEUS_ALWAYS_INLINE void execute( instruction< opcode::yield >, execution_state& s, const decoded_instruction*& ip )
+      {
+        leave_coroutine< checked, opcode::yield >( s, ip );
+      }
+
+      template< bool checked >
+      PERSEUS_ALWAYS_INLINE void execute( instruction< opcode::push_coroutine_identifier >, execution_state& s, const decoded_instruction*& ip )
+      {
+        s.co->stack.push< coroutine::identifier >( s.co->index );
+        ++ip;
+      }
+
+      //    Push/Pop
+
+      template< bool checked >
+      PERSEUS_ALWAYS_INLINE void execute( instruction< opcode::push_8 >, execution_state& s, const decoded_instruction*& ip )
+      {
+        s.co->stack.push< char >( static_cast< char >( ip->operand ) );
+        ++ip;
+      }
+
+      template< bool checked >
+      PERSEUS_ALWAYS_INLINE void execute( instruction< opcode::push_32 >, execution_state& s, const decoded_instruction*& ip )
+      {
+        s.co->stack.push< std::int32_t >( static_cast< std::int32_t >( ip->operand ) );
+        ++ip;
+      }
+
+      template< bool checked >
+      PERSEUS_ALWAYS_INLINE void execute( instruction< opcode::reserve >, execution_state& s, const decoded_instruction*& ip )
+      {
+        stack& st = s.co->stack;
+        st.resize( st.size() + ip->operand );
+        ++ip;
+      }
+
+      template< bool checked >
+      PERSEUS_ALWAYS_INLINE void execute( instruction< opcode::pop >, execution_state& s, const decoded_instruction*& ip )
+      {
+        discard< checked >( s.co->stack, ip->operand );
+        ++ip;
+      }
+
+      //    Load/Store
+
+      template< bool checked >
+      PERSEUS_ALWAYS_INLINE void execute( instruction< opcode::absolute_load_current_stack >, execution_state& s, const decoded_instruction*& ip )
+      {
+        load_stack< checked, opcode::absolute_load_current_stack >( s, ip );
+      }
+
+      template< bool checked >
+      PERSEUS_ALWAYS_INLINE void execute( instruction< opcode::absolute_load_stack >, execution_state& s, const decoded_instruction*& ip )
+      {
+        load_stack< checked, opcode::absolute_load_stack >( s, ip );
+      }
+
+      template< bool checked >
+      PERSEUS_ALWAYS_INLINE void execute( instruction< opcode::relative_load_stack >, execution_state& s, const decoded_instruction*& ip )
+      {
+        load_stack< checked, opcode::relative_load_stack >( s, ip );
+      }
+
+      template< bool checked >
+      PERSEUS_ALWAYS_INLINE void execute( instruction< opcode::absolute_store_current_stack >, execution_state& s, const decoded_instruction*& ip )
+      {
+        store_stack< checked, opcode::absolute_store_current_stack >( s, ip );
+      }
+
+      template< bool checked >
+      PERSEUS_ALWAYS_INLINE void execute( instruction< opcode::absolute_store_stack >, execution_state& s, const decoded_instruction*& ip )
+      {
+        store_stack< checked, opcode::absolute_store_stack >( s, ip );
+      }
+
+      template< bool checked >
+      PERSEUS_ALWAYS_INLINE void execute( instruction< opcode::relative_store_stack >, execution_state& s, const decoded_instruction*& ip )
+      {
+        store_stack< checked, opcode::relative_store_stack >( s, ip );
+      }
+
+      template< bool checked >
+      PERSEUS_ALWAYS_INLINE void execute( instruction< opcode::push_stack_size >, execution_state& s, const decoded_instruction*& ip )
+      {
+        stack& st = s.co->stack;
+        st.push< std::uint32_t >( st.size() );
+        ++ip;
+      }
+
+      //    Jumps/Calls
+
+      template< bool checked >
+      PERSEUS_ALWAYS_INLINE void execute( instruction< opcode::absolute_jump >, execution_state& s, const decoded_instruction*& ip )
+      {
+        jump( s, ip, s.instructions + ip->target );
+      }
+
+      template< bool checked >
+      PERSEUS_ALWAYS_INLINE void execute( instruction< opcode::relative_jump >, execution_state& s, const decoded_instruction*& ip )
+      {
+        jump( s, ip, s.instructions + ip->target );
+      }
+
+      template< bool checked >
+      PERSEUS_ALWAYS_INLINE void execute( instruction< opcode::relative_jump_if_false >, execution_state& s, const decoded_instruction*& ip )
+      {
+        if( !pop< std::uint8_t, checked >( s.co->stack ) )
+        {
+          jump( s, ip, s.instructions + ip->target );
+        }
+        else
+        {
+          ++ip;
+        }
+      }
+
+      template< bool checked >
+      PERSEUS_ALWAYS_INLINE void execute( instruction< opcode::indirect_jump >, execution_state& s, const decoded_instruction*& ip )
+      {
+        jump( s, ip, s.program.at( pop< std::uint32_t, checked >( s.co->stack ) ) );
+      }
+
+      template< bool checked >
+      PERSEUS_ALWAYS_INLINE void execute( instruction< opcode::call >, execution_state& s, const decoded_instruction*& ip )
+      {
+        // operand is the return address
+        s.co->stack.push< std::uint32_t >( ip->operand );
+        enter_function( s, ip, s.instructions + ip->target );
+      }
+
+      template< bool checked >
+      PERSEUS_ALWAYS_INLINE void execute( instruction< opcode::indirect_call >, execution_state& s, const decoded_instruction*& ip )
+      {
+        stack& st = s.co->stack;
+        const std::uint32_t target_address = pop< std::uint32_t, checked >( st );
+        // operand is the return address
+        st.push< std::uint32_t >( ip->operand );
+        enter_function( s, ip, s.program.at( target_address ) );
+      }
+
+      template< bool checked >
+      PERSEUS_ALWAYS_INLINE void execute( instruction< opcode::return_ >, execution_state& s, const decoded_instruction*& ip )
+      {
+        stack& st = s.co->stack;
+        const std::uint32_t return_address = pop< std::uint32_t, checked >( st );
+        // discard parameters
+        discard< checked >( st, ip->operand );
+        ip = s.program.at( return_address );
+      }
+
+      //    Boolean operations
+
+      template< bool checked >
+      PERSEUS_ALWAYS_INLINE void execute( instruction< opcode::and_b >, execution_state& s, const decoded_instruction*& ip )
+      {
+        binary_operation< checked, std::uint8_t, std::uint8_t >( s.co->stack, std::logical_and< std::uint8_t >() );
+        ++ip;
+      }
+
+      template< bool checked >
+      PERSEUS_ALWAYS_INLINE void execute( instruction< opcode::or_b >, execution_state& s, const decoded_instruction*& ip )
+      {
+        binary_operation< checked, std::uint8_t, std::uint8_t >( s.co->stack, std::logical_or< std::uint8_t >() );
+        ++ip;
+      }
+
+      template< bool checked >
+      PERSEUS_ALWAYS_INLINE void execute( instruction< opcode::equals_b >, execution_state& s, const decoded_instruction*& ip )
+      {
+        binary_operation< checked, std::uint8_t, std::uint8_t >( s.co->stack, std::equal_to< std::uint8_t >() );
+        ++ip;
+      }
+
+      template< bool checked >
+      PERSEUS_ALWAYS_INLINE void execute( instruction< opcode::not_equals_b >, execution_state& s, const decoded_instruction*& ip )
+      {
+        binary_operation< checked, std::uint8_t, std::uint8_t >( s.co->stack, std::not_equal_to< std::uint8_t >() );
+        ++ip;
+      }
+
+      template< bool checked >
+      PERSEUS_ALWAYS_INLINE void execute( instruction< opcode::negate_b >, execution_state& s, const decoded_instruction*& ip )
+      {
+        stack& st = s.co->stack;
+        st.push< std::uint8_t >( !pop< std::uint8_t, checked >( st ) );
+        ++ip;
+      }
+
+      //    32 bit integer operations
+
+      template< bool checked >
+      PERSEUS_ALWAYS_INLINE void execute( instruction< opcode::add_i32 >, execution_state& s, const decoded_instruction*& ip )
+      {
+        binary_operation< checked, std::int32_t, std::int32_t >( s.co->stack, std::plus< std::int32_t >() );
+        ++ip;
+      }
+
+      template< bool checked >
+      PERSEUS_ALWAYS_INLINE void execute( instruction< opcode::subtract_i32 >, execution_state& s, const decoded_instruction*& ip )
+      {
+        binary_operation< checked, std::int32_t, std::int32_t >( s.co->stack, std::minus< std::int32_t >() );
+        ++ip;
+      }
+
+      template< bool checked >
+      PERSEUS_ALWAYS_INLINE void execute( instruction< opcode::multiply_i32 >, execution_state& s, const decoded_instruction*& ip )
+      {
+        binary_operation< checked, std::int32_t, std::int32_t >( s.co->stack, std::multiplies< std::int32_t >() );
+        ++ip;
+      }
+
+      template< bool checked >
+      PERSEUS_ALWAYS_INLINE void execute( instruction< opcode::divide_i32 >, execution_state& s, const decoded_instruction*& ip )
+      {
+        division_operation< checked, std::int32_t >( s.co->stack, std::divides< std::int32_t >() );
+        ++ip;
+      }
+
+      template< bool checked >
+      PERSEUS_ALWAYS_INLINE void execute( instruction< opcode::equals_i32 >, execution_state& s, const decoded_instruction*& ip )
+      {
+        binary_operation< checked, std::int32_t, std::uint8_t >( s.co->stack, std::equal_to< std::int32_t >() );
+        ++ip;
+      }
+
+      template< bool checked >
+      PERSEUS_ALWAYS_INLINE void execute( instruction< opcode::not_equals_i32 >, execution_state& s, const decoded_instruction*& ip )
+      {
+        binary_operation< checked, std::int32_t, std::uint8_t >( s.co->stack, std::not_equal_to< std::int32_t >() );
+        ++ip;
+      }
+
+      template< bool checked >
+      PERSEUS_ALWAYS_INLINE void execute( instruction< opcode::less_than_i32 >, execution_state& s, const decoded_instruction*& ip )
+      {
+        binary_operation< checked, std::int32_t, std::uint8_t >( s.co->stack, std::less< std::int32_t >() );
+        ++ip;
+      }
+
+      template< bool checked >
+      PERSEUS_ALWAYS_INLINE void execute( instruction< opcode::less_than_or_equals_i32 >, execution_state& s, const decoded_instruction*& ip )
+      {
+        binary_operation< checked, std::int32_t, std::uint8_t >( s.co->stack, std::less_equal< std::int32_t >() );
+        ++ip;
+      }
+
+      template< bool checked >
+      PERSEUS_ALWAYS_INLINE void execute( instruction< opcode::greater_than_i32 >, execution_state& s, const decoded_instruction*& ip )
+      {
+        binary_operation< checked, std::int32_t, std::uint8_t >( s.co->stack, std::greater< std::int32_t >() );
+        ++ip;
+      }
+
+      template< bool checked >
+      PERSEUS_ALWAYS_INLINE void execute( instruction< opcode::greater_than_or_equals_i32 >, execution_state& s, const decoded_instruction*& ip )
+      {
+        binary_operation< checked, std::int32_t, std::uint8_t >( s.co->stack, std::greater_equal< std::int32_t >() );
+        ++ip;
+      }
+
+      template< bool checked >
+      PERSEUS_ALWAYS_INLINE void execute( instruction< opcode::negate_i32 >, execution_state& s, const decoded_instruction*& ip )
+      {
+        stack& st = s.co->stack;
+        st.push< std::int32_t >( -pop< std::int32_t, checked >( st ) );
+        ++ip;
+      }
+
+      template< bool checked >
+      PERSEUS_ALWAYS_INLINE void execute( instruction< opcode::modulo_i32 >, execution_state& s, const decoded_instruction*& ip )
+      {
+        division_operation< checked, std::int32_t >( s.co->stack, std::modulus< std::int32_t >() );
+        ++ip;
+      }
+
+      //    Superinstructions
+
+      template< bool checked >
+      PERSEUS_ALWAYS_INLINE void execute( instruction< opcode::load_local_32 >, execution_state& s, const decoded_instruction*& ip )
+      {
+        stack& st = s.co->stack;
+        const std::uint32_t address = ip->offset + st.size();
+        if( checked && std::uint64_t( address ) + sizeof( std::int32_t ) > st.size() )
+        {
+          throw stack_segmentation_fault( "stack segmentation fault: read above top of stack" );
+        }
+        const std::int32_t value = *reinterpret_cast< const std::int32_t* >( st.data() + address );
+        st.push< std::int32_t >( value );
+        ++ip;
+      }
+
+      template< bool checked >
+      PERSEUS_ALWAYS_INLINE void execute( instruction< opcode::add_immediate_i32 >, execution_state& s, const decoded_instruction*& ip )
+      {
+        stack& st = s.co->stack;
+        // unsigned, so overflow wraps around
+        st.push< std::uint32_t >( pop< std::uint32_t, checked >( st ) + ip->operand );
+        ++ip;
+      }
+
+      template< bool checked >
+      PERSEUS_ALWAYS_INLINE void execute( instruction< opcode::equals_i32_jump_if_false >, execution_state& s, const decoded_instruction*& ip )
+      {
+        compare_and_branch< checked, std::int32_t >( s, ip, std::equal_to< std::int32_t >() );
+      }
+
+      template< bool checked >
+      PERSEUS_ALWAYS_INLINE void execute( instruction< opcode::not_equals_i32_jump_if_false >, execution_state& s, const decoded_instruction*& ip )
+      {
+        compare_and_branch< checked, std::int32_t >( s, ip, std::not_equal_to< std::int32_t >() );
+      }
+
+      template< bool checked >
+      PERSEUS_ALWAYS_INLINE void execute( instruction< opcode::less_than_i32_jump_if_false >, execution_state& s, const decoded_instruction*& ip )
+      {
+        compare_and_branch< checked, std::int32_t >( s, ip, std::less< std::int32_t >() );
+      }
+
+      template< bool checked >
+      PERSEUS_ALWAYS_INLINE void execute( instruction< opcode::less_than_or_equals_i32_jump_if_false >, execution_state& s, const decoded_instruction*& ip )
+      {
+        compare_and_branch< checked, std::int32_t >( s, ip, std::less_equal< std::int32_t >() );
+      }
+
+      template< bool checked >
+      PERSEUS_ALWAYS_INLINE void execute( instruction< opcode::greater_than_i32_jump_if_false >, execution_state& s, const decoded_instruction*& ip )
+      {
+        compare_and_branch< checked, std::int32_t >( s, ip, std::greater< std::int32_t >() );
+      }
+
+      template< bool checked >
+      PERSEUS_ALWAYS_INLINE void execute( instruction< opcode::greater_than_or_equals_i32_jump_if_false >, execution_state& s, const decoded_instruction*& ip )
+      {
+        compare_and_branch< checked, std::int32_t >( s, ip, std::greater_equal< std::int32_t >() );
+      }
+
+      template< bool checked >
+      PERSEUS_ALWAYS_INLINE void execute( instruction< opcode::store_pop_return >, execution_state& s, const decoded_instruction*& ip )
+      {
+        stack& st = s.co->stack;
+        const std::uint32_t size = ip->operand;
+        // offset and target are those of the relative_store_stack and the return_
+        const std::uint32_t address = ip->offset + st.size();
+        // everything else is above the stored value, so this check covers the whole stack access
+        if( checked && std::uint64_t( address ) + size > st.size() )
+        {
+          throw stack_segmentation_fault( "stack segmentation fault: write above top of stack" );
+        }
+        std::copy( st.end() - size, st.end(), st.begin() + address );
+        st.mark_dirty( address, size );
+        // stack: <result> <arguments> <return address> <popped data>
+        const std::uint32_t return_address = *reinterpret_cast< const std::uint32_t* >( st.data() + address + size + ip->target );
+        st.resize( address + size );
+        ip = s.program.at( return_address );
+      }
+
+      //    Internal handlers
+
+      template< bool checked >
+      PERSEUS_ALWAYS_INLINE void execute( internal< internal_handler::fall_through >, execution_state& s, const decoded_instruction*& ip )
+      {
+        jump( s, ip, s.instructions + ip->target );
+      }
+
+      template< bool checked >
+      PERSEUS_ALWAYS_INLINE void execute( internal< internal_handler::end_of_code >, execution_state&, const decoded_instruction*& )
+      {
+        throw code_segmentation_fault( "instruction_pointer read past end of code_segment!" );
+      }
+
+      template< bool checked >
+      PERSEUS_ALWAYS_INLINE void execute( internal< internal_handler::truncated_instruction >, execution_state&, const decoded_instruction*& )
+      {
+        throw code_segmentation_fault( "instruction_pointer read past end of code_segment!" );
+      }
+
+      template< bool checked >
+      PERSEUS_ALWAYS_INLINE void execute( internal< internal_handler::invalid_instruction >, execution_state&, const decoded_instruction*& ip )
+      {
+        throw invalid_opcode( "Invalid opcode " + std::to_string( ip->operand ) );
+      }
+
+      template< bool checked >
+      PERSEUS_ALWAYS_INLINE void execute( internal< internal_handler::invalid_jump_target >, execution_state&, const decoded_instruction*& )
+      {
+        throw code_segmentation_fault( "Moved instruction_pointer outside of code_segment!" );
+      }
+
+      /// @note The engine must return afterwards, without execution_state::finished set.
+      template< bool checked >
+      PERSEUS_ALWAYS_INLINE void execute( internal< internal_handler::leave_engine >, execution_state&, const decoded_instruction*& ip )
+      {
+        ip = nullptr;
+      }
+    }
+  }
+}
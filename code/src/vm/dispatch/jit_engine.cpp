@@ -0,0 +1,104 @@
+#include "instructions.inl"
+
+#include "vm/jit_compiler.hpp"
+
+/**
+@file
+
+The switch engine, reporting every call to the @ref jit_compiler and running the called function natively once it has been compiled. Native code returns here when it returns to code that isn't native, or when it reaches an instruction it can't execute, which the interpreter then executes instead.
+*/
+
+namespace perseus
+{
+  namespace detail
+  {
+    namespace
+    {
+      /// Any instruction but call executes as usual
+      template< bool checked, typename tag >
+      PERSEUS_ALWAYS_INLINE void execute( tag, jit_compiler&, execution_state& s, const decoded_instruction*& ip )
+      {
+        execute< checked >( tag(), s, ip );
+      }
+
+      template< bool checked >
+      PERSEUS_ALWAYS_INLINE void execute( instruction< opcode::call >, jit_compiler& jit, execution_state& s, const decoded_instruction*& ip )
+      {
+        const jit_compiler::native_function function = jit.on_call( s.program, ip->target );
+        if( !function )
+        {
+          execute< checked >( instruction< opcode::call >(), s, ip );
+          return;
+        }
+        stack& st = s.co->stack;
+        // operand is the return address
+        st.push< std::uint32_t >( ip->operand );
+        if( !charge( s, 1, s.instructions + ip->target ) )
+        {
+          preempt( s, ip, s.instructions + ip->target );
+          return;
+        }
+        ip = s.program.at( jit.run( function, st, s.countdown ) );
+      }
+
+      template< bool checked, typename instrumentation >
+      void run( execution_state& s, instrumentation& instr )
+      {
+        jit_compiler& jit = *s.jit;
+        const decoded_instruction* ip = s.resume_position();
+        try
+        {
+          while( true )
+          {
+            instr.on_instruction( static_cast< opcode >( ip->handler ) );
+            switch( ip->handler )
+            {
+#define PERSEUS_CASE( name ) \
+            case get_handler( opcode::name ): \
+              execute< checked >( instruction< opcode::name >(), jit, s, ip ); \
+              break;
+              PERSEUS_FOR_EACH_INSTRUCTION( PERSEUS_CASE )
+#undef PERSEUS_CASE
+#define PERSEUS_CASE( name ) \
+            case get_handler( internal_handler::name ): \
+              execute< checked >( internal< internal_handler::name >(), s, ip ); \
+              break;
+              PERSEUS_FOR_EACH_INTERNAL_HANDLER( PERSEUS_CASE )
+#undef PERSEUS_CASE
+            case get_handler( opcode::exit ):
+              execute< checked >( instruction< opcode::exit >(), s, ip );
+              return;
+            case get_handler( internal_handler::leave_engine ):
+              return;
+            default:
+              // decoding only produces valid handlers
+              throw std::logic_error( "invalid decoded instruction" );
+            }
+          }
+        }
+        catch( ... )
+        {
+          s.save_position( ip );
+          throw;
+        }
+      }
+    }
+
+    template< typename instrumentation >
+    void run_jit_engine( execution_state& s, instrumentation& instr )
+    {
+      if( s.checked )
+      {
+        run< true >( s, instr );
+      }
+      else
+      {
+        run< false >( s, instr );
+      }
+    }
+
+    template void run_jit_engine< no_instrumentation >( execution_state&, no_instrumentation& );
+    template void run_jit_engine< instruction_counter >( execution_state&, instruction_counter& );
+    template void run_jit_engine< opcode_statistics >( execution_state&, opcode_statistics& );
+  }
+}
@@ -0,0 +1,68 @@
+#include "instructions.inl"
+
+namespace perseus
+{
+  namespace detail
+  {
+    namespace
+    {
+      template< bool checked, typename instrumentation >
+      void run( execution_state& s, instrumentation& instr )
+      {
+        const decoded_instruction* ip = s.resume_position();
+        try
+        {
+          while( true )
+          {
+            instr.on_instruction( static_cast< opcode >( ip->handler ) );
+            switch( ip->handler )
+            {
+#define PERSEUS_CASE( name ) \
+            case get_handler( opcode::name ): \
+              execute< checked >( instruction< opcode::name >(), s, ip ); \
+              break;
+              PERSEUS_FOR_EACH_INSTRUCTION( PERSEUS_CASE )
+#undef PERSEUS_CASE
+#define PERSEUS_CASE( name ) \
+            case get_handler( internal_handler::name ): \
+              execute< checked >( internal< internal_handler::name >(), s, ip ); \
+              break;
+              PERSEUS_FOR_EACH_INTERNAL_HANDLER( PERSEUS_CASE )
+#undef PERSEUS_CASE
+            case get_handler( opcode::exit ):
+              execute< checked >( instruction< opcode::exit >(), s, ip );
+              return;
+            case get_handler( internal_handler::leave_engine ):
+              return;
+            default:
+              // decoding only produces valid handlers
+              throw std::logic_error( "invalid decoded instruction" );
+            }
+          }
+        }
+        catch( ... )
+        {
+          s.save_position( ip );
+          throw;
+        }
+      }
+    }
+
+    template< typename instrumentation >
+    void run_switch_engine( execution_state& s, instrumentation& instr )
+    {
+      if( s.checked )
+      {
+        run< true >( s, instr );
+      }
+      else
+      {
+        run< false >( s, instr );
+      }
+    }
+
+    template void run_switch_engine< no_instrumentation >( execution_state&, no_instrumentation& );
+    template void run_switch_engine< instruction_counter >( execution_state&, instruction_counter& );
+    template void run_switch_engine< opcode_statistics >( execution_state&, opcode_statistics& );
+  }
+}
@@ -0,0 +1,125 @@
+#include "instructions.inl"
+
+namespace perseus
+{
+  namespace detail
+  {
+    namespace
+    {
+      /// Implementation of an instruction in the tail call engine; returns the next instruction to the trampoline, or nullptr once the engine has to return.
+      template< typename instrumentation >
+      using tail_call_handler = const decoded_instruction* ( * )( execution_state&, const decoded_instruction*, instrumentation& );
+
+      /// Dispatch table of the tail call engine
+      template< typename instrumentation >
+      struct tail_call_handler_table
+      {
+        tail_call_handler< instrumentation > entries[ handler_count ];
+      };
+
+      template< bool checked, typename instrumentation >
+      constexpr tail_call_handler_table< instrumentation > create_tail_call_handlers();
+
+      template< bool checked, typename instrumentation >
+      constexpr tail_call_handler_table< instrumentation > tail_call_handlers = create_tail_call_handlers< checked, instrumentation >();
+
+      /// Returns the handler of the given instruction
+      template< bool checked, typename instrumentation >
+      PERSEUS_ALWAYS_INLINE tail_call_handler< instrumentation > get_tail_call_handler( const decoded_instruction* ip, instrumentation& instr )
+      {
+        instr.on_instruction( static_cast< opcode >( ip->handler ) );
+        // decoding only produces valid handlers
+        return tail_call_handlers< checked, instrumentation >.entries[ ip->handler ];
+      }
+
+      /**
+      @brief Executes an instruction, then the next one.
+
+      With guaranteed tail calls, the whole execution is one chain of jumps between these functions that only returns after opcode::exit.
+      Otherwise every handler returns the next instruction to the trampoline in run_tail_call_engine(); the compiler may still turn some of those calls into jumps, but without a guarantee an unbroken chain could overflow the native stack.
+      @tparam tag the instruction tag selecting the overload of execute()
+      */
+      template< bool checked, typename instrumentation, typename tag >
+      const decoded_instruction* handle( execution_state& s, const decoded_instruction* ip, instrumentation& instr )
+      {
+#ifdef PERSEUS_MUSTTAIL
+        // there's no frame to catch exceptions in, so the position has to be stored for them
+        s.position = ip;
+#endif
+        execute< checked >( tag(), s, ip );
+#ifdef PERSEUS_MUSTTAIL
+        if( ip )
+        {
+          PERSEUS_MUSTTAIL return get_tail_call_handler< checked >( ip, instr )( s, ip, instr );
+        }
+#else
+        // the trampoline does the instrumentation
+        static_cast< void >( instr );
+#endif
+        return ip;
+      }
+
+      template< bool checked, typename instrumentation >
+      constexpr tail_call_handler_table< instrumentation > create_tail_call_handlers()
+      {
+        tail_call_handler_table< instrumentation > result{};
+#define PERSEUS_ENTRY( name ) result.entries[ get_handler( opcode::name ) ] = &handle< checked, instrumentation, instruction< opcode::name > >;
+        PERSEUS_FOR_EACH_INSTRUCTION( PERSEUS_ENTRY )
+#undef PERSEUS_ENTRY
+#define PERSEUS_ENTRY( name ) result.entries[ get_handler( internal_handler::name ) ] = &handle< checked, instrumentation, internal< internal_handler::name > >;
+        PERSEUS_FOR_EACH_INTERNAL_HANDLER( PERSEUS_ENTRY )
+#undef PERSEUS_ENTRY
+        result.entries[ get_handler( opcode::exit ) ] = &handle< checked, instrumentation, instruction< opcode::exit > >;
+        result.entries[ get_handler( internal_handler::leave_engine ) ] = &handle< checked, instrumentation, internal< internal_handler::leave_engine > >;
+        return result;
+      }
+
+      template< bool checked, typename instrumentation >
+      void run( execution_state& s, instrumentation& instr )
+      {
+        const decoded_instruction* ip = s.resume_position();
+#ifdef PERSEUS_MUSTTAIL
+        try
+        {
+          get_tail_call_handler< checked >( ip, instr )( s, ip, instr );
+        }
+        catch( ... )
+        {
+          s.save_position( s.position );
+          throw;
+        }
+#else
+        try
+        {
+          do
+          {
+            ip = get_tail_call_handler< checked >( ip, instr )( s, ip, instr );
+          } while( ip );
+        }
+        catch( ... )
+        {
+          s.save_position( ip );
+          throw;
+        }
+#endif
+      }
+    }
+
+    template< typename instrumentation >
+    void run_tail_call_engine( execution_state& s, instrumentation& instr )
+    {
+      if( s.checked )
+      {
+        run< true >( s, instr );
+      }
+      else
+      {
+        run< false >( s, instr );
+      }
+    }
+
+    template void run_tail_call_engine< no_instrumentation >( execution_state&, no_instrumentation& );
+    template void run_tail_call_engine< instruction_counter >( execution_state&, instruction_counter& );
+    template void run_tail_call_engine< opcode_statistics >( execution_state&, opcode_statistics& );
+  }
+}
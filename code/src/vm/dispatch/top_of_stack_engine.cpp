@@ -0,0 +1,460 @@
+#include "instructions.inl"
+
+/**
+@file
+
+The switch engine with top of stack caching: up to two i32 values that would be on top of the active coroutine's stack are kept in local variables instead, which the compiler keeps in registers. The i32 arithmetic, constants, 4 byte local loads and stores, reserving and popping 4 bytes, returning a single i32 and comparing jumps work on those, so e.g. an add_i32 of two cached values doesn't touch the stack at all, and a loop made of such instructions never writes its temporaries to the stack.
+
+Every other instruction expects the whole stack in memory, so the cache is flushed before it runs, as it is when an exception leaves the engine. Flushing costs about as much as the pushes the switch engine would have done, so the engine only pays off for code that mostly stays within the cached instructions. A call flushes the cache together with its return address; even so, call heavy code runs slower than in the switch engine, since keeping the cache costs a branch on its size in most instructions.
+*/
+
+namespace perseus
+{
+  namespace detail
+  {
+    namespace
+    {
+      /// The i32 values cached above the top of the stack in memory
+      struct top_of_stack_cache
+      {
+        /// the topmost value, if size > 0
+        std::int32_t top;
+        /// the value below top, if size == 2
+        std::int32_t second;
+        /// number of cached values
+        unsigned int size;
+      };
+
+      /// both cached values in stack order, so they can be flushed with a single push
+      struct cached_pair
+      {
+        std::int32_t second;
+        std::int32_t top;
+      };
+
+      /// moves all cached values onto the stack
+      PERSEUS_ALWAYS_INLINE void flush( top_of_stack_cache& cache, stack& st )
+      {
+        if( cache.size == 2 )
+        {
+          st.push( cached_pair{ cache.second, cache.top } );
+        }
+        else if( cache.size == 1 )
+        {
+          st.push< std::int32_t >( cache.top );
+        }
+        cache.size = 0;
+      }
+
+      /// size of the cached values, which are part of the stack as far as samples are concerned
+      PERSEUS_ALWAYS_INLINE std::size_t cached_bytes( const top_of_stack_cache& cache )
+      {
+        return cache.size * sizeof( std::int32_t );
+      }
+
+      /// caches a new top value, moving the lowest cached one onto the stack if the cache is full
+      PERSEUS_ALWAYS_INLINE void push( top_of_stack_cache& cache, stack& st, const std::int32_t value )
+      {
+        if( cache.size == 2 )
+        {
+          st.push< std::int32_t >( cache.second );
+        }
+        cache.second = cache.top;
+        cache.top = value;
+        cache.size = cache.size == 0 ? 1 : 2;
+      }
+
+      /// removes the top value, from the cache if possible
+      template< bool checked >
+      PERSEUS_ALWAYS_INLINE std::int32_t pop( top_of_stack_cache& cache, stack& st )
+      {
+        if( cache.size == 0 )
+        {
+          return pop< std::int32_t, checked >( st );
+        }
+        const std::int32_t value = cache.top;
+        cache.top = cache.second;
+        --cache.size;
+        return value;
+      }
+
+      template< bool checked, typename operation >
+      PERSEUS_ALWAYS_INLINE void binary_operation( top_of_stack_cache& cache, stack& st, operation op )
+      {
+        const std::int32_t op2 = pop< checked >( cache, st ), op1 = pop< checked >( cache, st );
+        push( cache, st, op( op1, op2 ) );
+      }
+
+      template< bool checked, typename operation >
+      PERSEUS_ALWAYS_INLINE void division_operation( top_of_stack_cache& cache, stack& st, operation op )
+      {
+        const std::int32_t op2 = pop< checked >( cache, st ), op1 = pop< checked >( cache, st );
+        if( op2 == 0 )
+        {
+          throw divide_by_zero( "divide by zero" );
+        }
+        push( cache, st, op( op1, op2 ) );
+      }
+
+      /// pushes the i32 at the given offset from the top of the stack, like load_local_32
+      template< bool checked, opcode code >
+      PERSEUS_ALWAYS_INLINE void load_local( top_of_stack_cache& cache, execution_state& s, const decoded_instruction*& ip )
+      {
+        stack& st = s.co->stack;
+        // the cached values count towards the stack size
+        const std::uint32_t size = static_cast< std::uint32_t >( st.size() + cache.size * sizeof( std::int32_t ) );
+        const std::uint32_t address = ip->offset + size;
+        if( checked && std::uint64_t( address ) + sizeof( std::int32_t ) > size )
+        {
+          throw stack_segmentation_fault( "stack segmentation fault: read above top of stack" );
+        }
+        if( address + sizeof( std::int32_t ) <= st.size() )
+        {
+          push( cache, st, *reinterpret_cast< const std::int32_t* >( st.data() + address ) );
+        }
+        else if( address == size - sizeof( std::int32_t ) )
+        {
+          push( cache, st, cache.top );
+        }
+        else if( cache.size == 2 && address == st.size() )
+        {
+          push( cache, st, cache.second );
+        }
+        else
+        {
+          // straddles the cached values
+          flush( cache, st );
+          execute< checked >( instruction< code >(), s, ip );
+          return;
+        }
+        ++ip;
+      }
+
+      template< bool checked, typename comparison >
+      PERSEUS_ALWAYS_INLINE void compare_and_branch( top_of_stack_cache& cache, execution_state& s, const decoded_instruction*& ip, comparison compare )
+      {
+        stack& st = s.co->stack;
+        const std::int32_t op2 = pop< checked >( cache, st ), op1 = pop< checked >( cache, st );
+        if( !compare( op1, op2 ) )
+        {
+          jump( s, ip, s.instructions + ip->target, cached_bytes( cache ) );
+        }
+        else
+        {
+          ++ip;
+        }
+      }
+
+      /*
+      The instructions with a cache are overloads of the form
+
+      template< bool checked >
+      void execute( instruction< code >, top_of_stack_cache& cache, execution_state& s, const decoded_instruction*& ip );
+
+      Any instruction without such an overload flushes the cache and runs as usual.
+      */
+
+      template< bool checked, opcode code >
+      PERSEUS_ALWAYS_INLINE void execute( instruction< code >, top_of_stack_cache& cache, execution_state& s, const decoded_instruction*& ip )
+      {
+        flush( cache, s.co->stack );
+        execute< checked >( instruction< code >(), s, ip );
+      }
+
+      template< bool checked, internal_handler handler >
+      PERSEUS_ALWAYS_INLINE void execute( internal< handler >, top_of_stack_cache& cache, execution_state& s, const decoded_instruction*& ip )
+      {
+        flush( cache, s.co->stack );
+        execute< checked >( internal< handler >(), s, ip );
+      }
+
+      //    Instructions not touching the stack keep the cache
+
+      template< bool checked >
+      PERSEUS_ALWAYS_INLINE void execute( instruction< opcode::no_operation >, top_of_stack_cache&, execution_state& s, const decoded_instruction*& ip )
+      {
+        execute< checked >( instruction< opcode::no_operation >(), s, ip );
+      }
+
+      template< bool checked >
+      PERSEUS_ALWAYS_INLINE void execute( instruction< opcode::absolute_jump >, top_of_stack_cache& cache, execution_state& s, const decoded_instruction*& ip )
+      {
+        jump( s, ip, s.instructions + ip->target, cached_bytes( cache ) );
+      }
+
+      template< bool checked >
+      PERSEUS_ALWAYS_INLINE void execute( instruction< opcode::relative_jump >, top_of_stack_cache& cache, execution_state& s, const decoded_instruction*& ip )
+      {
+        jump( s, ip, s.instructions + ip->target, cached_bytes( cache ) );
+      }
+
+      template< bool checked >
+      PERSEUS_ALWAYS_INLINE void execute( internal< internal_handler::fall_through >, top_of_stack_cache& cache, execution_state& s, const decoded_instruction*& ip )
+      {
+        jump( s, ip, s.instructions + ip->target, cached_bytes( cache ) );
+      }
+
+      //    Instructions working on the cache
+
+      template< bool checked >
+      PERSEUS_ALWAYS_INLINE void execute( instruction< opcode::reserve >, top_of_stack_cache& cache, execution_state& s, const decoded_instruction*& ip )
+      {
+        if( ip->operand != sizeof( std::int32_t ) )
+        {
+          flush( cache, s.co->stack );
+          execute< checked >( instruction< opcode::reserve >(), s, ip );
+          return;
+        }
+        push( cache, s.co->stack, 0 );
+        ++ip;
+      }
+
+      template< bool checked >
+      PERSEUS_ALWAYS_INLINE void execute( instruction< opcode::call >, top_of_stack_cache& cache, execution_state& s, const decoded_instruction*& ip )
+      {
+        stack& st = s.co->stack;
+        // the return address goes through the cache, so it's flushed along with the cached values; operand is the return address
+        push( cache, st, static_cast< std::int32_t >( ip->operand ) );
+        flush( cache, st );
+        enter_function( s, ip, s.instructions + ip->target );
+      }
+
+      template< bool checked >
+      PERSEUS_ALWAYS_INLINE void execute( instruction< opcode::store_pop_return >, top_of_stack_cache& cache, execution_state& s, const decoded_instruction*& ip )
+      {
+        stack& st = s.co->stack;
+        const std::uint32_t size = static_cast< std::uint32_t >( st.size() + cache.size * sizeof( std::int32_t ) );
+        const std::uint32_t address = ip->offset + size;
+        // the common case of returning the only cached value, with the return address in memory
+        if( ip->operand != sizeof( std::int32_t ) || cache.size != 1 || std::uint64_t( address ) + sizeof( std::int32_t ) + ip->target + sizeof( std::uint32_t ) > st.size() )
+        {
+          flush( cache, st );
+          execute< checked >( instruction< opcode::store_pop_return >(), s, ip );
+          return;
+        }
+        *reinterpret_cast< std::int32_t* >( st.data() + address ) = cache.top;
+        st.mark_dirty( address, sizeof( std::int32_t ) );
+        const std::uint32_t return_address = *reinterpret_cast< const std::uint32_t* >( st.data() + address + sizeof( std::int32_t ) + ip->target );
+        st.resize( address + sizeof( std::int32_t ) );
+        cache.size = 0;
+        ip = s.program.at( return_address );
+      }
+
+      template< bool checked >
+      PERSEUS_ALWAYS_INLINE void execute( instruction< opcode::push_32 >, top_of_stack_cache& cache, execution_state& s, const decoded_instruction*& ip )
+      {
+        push( cache, s.co->stack, static_cast< std::int32_t >( ip->operand ) );
+        ++ip;
+      }
+
+      template< bool checked >
+      PERSEUS_ALWAYS_INLINE void execute( instruction< opcode::load_local_32 >, top_of_stack_cache& cache, execution_state& s, const decoded_instruction*& ip )
+      {
+        load_local< checked, opcode::load_local_32 >( cache, s, ip );
+      }
+
+      template< bool checked >
+      PERSEUS_ALWAYS_INLINE void execute( instruction< opcode::relative_load_stack >, top_of_stack_cache& cache, execution_state& s, const decoded_instruction*& ip )
+      {
+        if( ip->operand != sizeof( std::int32_t ) )
+        {
+          flush( cache, s.co->stack );
+          execute< checked >( instruction< opcode::relative_load_stack >(), s, ip );
+          return;
+        }
+        load_local< checked, opcode::relative_load_stack >( cache, s, ip );
+      }
+
+      template< bool checked >
+      PERSEUS_ALWAYS_INLINE void execute( instruction< opcode::relative_store_stack >, top_of_stack_cache& cache, execution_state& s, const decoded_instruction*& ip )
+      {
+        stack& st = s.co->stack;
+        const std::uint32_t size = static_cast< std::uint32_t >( st.size() + cache.size * sizeof( std::int32_t ) );
+        const std::uint32_t address = ip->offset + size;
+        // the common case of storing the cached top below the cache; anything else works on the stack in memory
+        if( ip->operand != sizeof( std::int32_t ) || cache.size == 0 || std::uint64_t( address ) + sizeof( std::int32_t ) > st.size() )
+        {
+          flush( cache, st );
+          execute< checked >( instruction< opcode::relative_store_stack >(), s, ip );
+          return;
+        }
+        *reinterpret_cast< std::int32_t* >( st.data() + address ) = cache.top;
+        st.mark_dirty( address, sizeof( std::int32_t ) );
+        ++ip;
+      }
+
+      template< bool checked >
+      PERSEUS_ALWAYS_INLINE void execute( instruction< opcode::pop >, top_of_stack_cache& cache, execution_state& s, const decoded_instruction*& ip )
+      {
+        // whole cached values can be dropped
+        if( ip->operand == sizeof( std::int32_t ) && cache.size > 0 )
+        {
+          cache.top = cache.second;
+          --cache.size;
+        }
+        else if( ip->operand == 2 * sizeof( std::int32_t ) && cache.size == 2 )
+        {
+          cache.size = 0;
+        }
+        else
+        {
+          flush( cache, s.co->stack );
+          execute< checked >( instruction< opcode::pop >(), s, ip );
+          return;
+        }
+        ++ip;
+      }
+
+      template< bool checked >
+      PERSEUS_ALWAYS_INLINE void execute( instruction< opcode::add_i32 >, top_of_stack_cache& cache, execution_state& s, const decoded_instruction*& ip )
+      {
+        binary_operation< checked >( cache, s.co->stack, std::plus< std::int32_t >() );
+        ++ip;
+      }
+
+      template< bool checked >
+      PERSEUS_ALWAYS_INLINE void execute( instruction< opcode::subtract_i32 >, top_of_stack_cache& cache, execution_state& s, const decoded_instruction*& ip )
+      {
+        binary_operation< checked >( cache, s.co->stack, std::minus< std::int32_t >() );
+        ++ip;
+      }
+
+      template< bool checked >
+      PERSEUS_ALWAYS_INLINE void execute( instruction< opcode::multiply_i32 >, top_of_stack_cache& cache, execution_state& s, const decoded_instruction*& ip )
+      {
+        binary_operation< checked >( cache, s.co->stack, std::multiplies< std::int32_t >() );
+        ++ip;
+      }
+
+      template< bool checked >
+      PERSEUS_ALWAYS_INLINE void execute( instruction< opcode::divide_i32 >, top_of_stack_cache& cache, execution_state& s, const decoded_instruction*& ip )
+      {
+        division_operation< checked >( cache, s.co->stack, std::divides< std::int32_t >() );
+        ++ip;
+      }
+
+      template< bool checked >
+      PERSEUS_ALWAYS_INLINE void execute( instruction< opcode::modulo_i32 >, top_of_stack_cache& cache, execution_state& s, const decoded_instruction*& ip )
+      {
+        division_operation< checked >( cache, s.co->stack, std::modulus< std::int32_t >() );
+        ++ip;
+      }
+
+      template< bool checked >
+      PERSEUS_ALWAYS_INLINE void execute( instruction< opcode::negate_i32 >, top_of_stack_cache& cache, execution_state& s, const decoded_instruction*& ip )
+      {
+        stack& st = s.co->stack;
+        push( cache, st, -pop< checked >( cache, st ) );
+        ++ip;
+      }
+
+      template< bool checked >
+      PERSEUS_ALWAYS_INLINE void execute( instruction< opcode::add_immediate_i32 >, top_of_stack_cache& cache, execution_state& s, const decoded_instruction*& ip )
+      {
+        stack& st = s.co->stack;
+        // unsigned, so overflow wraps around
+        push( cache, st, static_cast< std::int32_t >( static_cast< std::uint32_t >( pop< checked >( cache, st ) ) + ip->operand ) );
+        ++ip;
+      }
+
+      template< bool checked >
+      PERSEUS_ALWAYS_INLINE void execute( instruction< opcode::equals_i32_jump_if_false >, top_of_stack_cache& cache, execution_state& s, const decoded_instruction*& ip )
+      {
+        compare_and_branch< checked >( cache, s, ip, std::equal_to< std::int32_t >() );
+      }
+
+      template< bool checked >
+      PERSEUS_ALWAYS_INLINE void execute( instruction< opcode::not_equals_i32_jump_if_false >, top_of_stack_cache& cache, execution_state& s, const decoded_instruction*& ip )
+      {
+        compare_and_branch< checked >( cache, s, ip, std::not_equal_to< std::int32_t >() );
+      }
+
+      template< bool checked >
+      PERSEUS_ALWAYS_INLINE void execute( instruction< opcode::less_than_i32_jump_if_false >, top_of_stack_cache& cache, execution_state& s, const decoded_instruction*& ip )
+      {
+        compare_and_branch< checked >( cache, s, ip, std::less< std::int32_t >() );
+      }
+
+      template< bool checked >
+      PERSEUS_ALWAYS_INLINE void execute( instruction< opcode::less_than_or_equals_i32_jump_if_false >, top_of_stack_cache& cache, execution_state& s, const decoded_instruction*& ip )
+      {
+        compare_and_branch< checked >( cache, s, ip, std::less_equal< std::int32_t >() );
+      }
+
+      template< bool checked >
+      PERSEUS_ALWAYS_INLINE void execute( instruction< opcode::greater_than_i32_jump_if_false >, top_of_stack_cache& cache, execution_state& s, const decoded_instruction*& ip )
+      {
+        compare_and_branch< checked >( cache, s, ip, std::greater< std::int32_t >() );
+      }
+
+      template< bool checked >
+      PERSEUS_ALWAYS_INLINE void execute( instruction< opcode::greater_than_or_equals_i32_jump_if_false >, top_of_stack_cache& cache, execution_state& s, const decoded_instruction*& ip )
+      {
+        compare_and_branch< checked >( cache, s, ip, std::greater_equal< std::int32_t >() );
+      }
+
+      template< bool checked, typename instrumentation >
+      void run( execution_state& s, instrumentation& instr )
+      {
+        const decoded_instruction* ip = s.resume_position();
+        top_of_stack_cache cache{ 0, 0, 0 };
+        try
+        {
+          while( true )
+          {
+            instr.on_instruction( static_cast< opcode >( ip->handler ) );
+            switch( ip->handler )
+            {
+#define PERSEUS_CASE( name ) \
+            case get_handler( opcode::name ): \
+              execute< checked >( instruction< opcode::name >(), cache, s, ip ); \
+              break;
+              PERSEUS_FOR_EACH_INSTRUCTION( PERSEUS_CASE )
+#undef PERSEUS_CASE
+#define PERSEUS_CASE( name ) \
+            case get_handler( internal_handler::name ): \
+              execute< checked >( internal< internal_handler::name >(), cache, s, ip ); \
+              break;
+              PERSEUS_FOR_EACH_INTERNAL_HANDLER( PERSEUS_CASE )
+#undef PERSEUS_CASE
+            case get_handler( opcode::exit ):
+              execute< checked >( instruction< opcode::exit >(), cache, s, ip );
+              return;
+            case get_handler( internal_handler::leave_engine ):
+              // syscalls flushed the cache, but jumps running out of budget keep it
+              flush( cache, s.co->stack );
+              return;
+            default:
+              // decoding only produces valid handlers
+              throw std::logic_error( "invalid decoded instruction" );
+            }
+          }
+        }
+        catch( ... )
+        {
+          // the cache belongs to the active coroutine, whose stack has to be complete
+          flush( cache, s.co->stack );
+          s.save_position( ip );
+          throw;
+        }
+      }
+    }
+
+    template< typename instrumentation >
+    void run_top_of_stack_engine( execution_state& s, instrumentation& instr )
+    {
+      if( s.checked )
+      {
+        run< true >( s, instr );
+      }
+      else
+      {
+        run< false >( s, instr );
+      }
+    }
+
+    template void run_top_of_stack_engine< no_instrumentation >( execution_state&, no_instrumentation& );
+    template void run_top_of_stack_engine< instruction_counter >( execution_state&, instruction_counter& );
+    template void run_top_of_stack_engine< opcode_statistics >( execution_state&, opcode_statistics& );
+  }
+}
@@ -0,0 +1,263 @@
+#include "vm/event_loop.hpp"
+#include "vm/exceptions.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <cerrno>
+#include <exception>
+#include <iterator>
+#include <limits>
+#include <system_error>
+#include <utility>
+
+#include <sys/epoll.h>
+#include <unistd.h>
+
+namespace perseus
+{
+  namespace detail
+  {
+    namespace
+    {
+      /// how many epoll events to handle per wait
+      constexpr int max_events = 64;
+      /// so the number of bytes transferred fits the i32 result
+      constexpr std::uint32_t max_transfer = std::numeric_limits< std::int32_t >::max();
+    }
+
+    event_loop::event_loop()
+      : _epoll( epoll_create1( EPOLL_CLOEXEC ) )
+    {
+      if( _epoll < 0 )
+      {
+        throw std::system_error( errno, std::system_category(), "epoll_create1" );
+      }
+    }
+
+    event_loop::~event_loop()
+    {
+      close( _epoll );
+    }
+
+    std::future< stack > event_loop::spawn( processor& proc, const instruction_pointer::value_type start_address, stack&& parameters )
+    {
+      _tasks.emplace_back( proc, start_address, std::move( parameters ) );
+      const std::list< task >::iterator t = std::prev( _tasks.end() );
+      try
+      {
+        _ready.push_back( t );
+      }
+      catch( ... )
+      {
+        _tasks.erase( t );
+        throw;
+      }
+      return t->result.get_future();
+    }
+
+    void event_loop::run()
+    {
+      while( run_once() )
+      {
+      }
+    }
+
+    bool event_loop::run_once( const int timeout_milliseconds )
+    {
+      run_ready();
+      if( _tasks.empty() )
+      {
+        return false;
+      }
+      epoll_event events[ max_events ];
+      const int count = epoll_wait( _epoll, events, max_events, _ready.empty() ? timeout_milliseconds : 0 );
+      if( count < 0 && errno != EINTR )
+      {
+        throw std::system_error( errno, std::system_category(), "epoll_wait" );
+      }
+      for( int i = 0; i < count; ++i )
+      {
+        wake( events[ i ].data.fd, events[ i ].events );
+      }
+      run_ready();
+      return !_tasks.empty();
+    }
+
+    void event_loop::await( const int file_descriptor, const readiness what )
+    {
+      if( !_running )
+      {
+        throw invalid_suspension_state( "Awaiting a file descriptor outside of an execution!" );
+      }
+      const auto inserted = _waiting.emplace( file_descriptor, waiters() );
+      waiters& w = inserted.first->second;
+      std::deque< std::list< task >::iterator >& queue = what == readiness::readable ? w.readers : w.writers;
+      queue.push_back( _current );
+      try
+      {
+        update( file_descriptor, w, !inserted.second );
+      }
+      catch( const std::system_error& e )
+      {
+        queue.pop_back();
+        if( inserted.second )
+        {
+          _waiting.erase( inserted.first );
+        }
+        if( e.code() != std::errc::operation_not_permitted )
+        {
+          throw;
+        }
+        // epoll doesn't support regular files, which are always ready anyway
+        _ready.push_back( _current );
+      }
+      _awaiting = true;
+      throw would_block( "Waiting for file descriptor" );
+    }
+
+    syscall event_loop::read_syscall()
+    {
+      return [ this ]( stack& st )
+      {
+        const std::int32_t file_descriptor = st.pop< std::int32_t >();
+        const std::uint32_t size = st.pop< std::uint32_t >();
+        const stack::size_type previous_size = st.size();
+        st.resize( previous_size + size );
+        ssize_t count;
+        do
+        {
+          count = read( file_descriptor, st.data() + previous_size, std::min( size, max_transfer ) );
+        } while( count < 0 && errno == EINTR );
+        const int error = errno;
+        if( count < 0 && ( error == EAGAIN || error == EWOULDBLOCK ) )
+        {
+          st.resize( previous_size );
+          st.push< std::uint32_t >( size );
+          st.push< std::int32_t >( file_descriptor );
+          await( file_descriptor, readiness::readable );
+        }
+        st.resize( previous_size + std::max< ssize_t >( count, 0 ) );
+        st.push< std::int32_t >( static_cast< std::int32_t >( count < 0 ? -error : count ) );
+      };
+    }
+
+    syscall event_loop::write_syscall()
+    {
+      return [ this ]( stack& st )
+      {
+        const std::int32_t file_descriptor = st.pop< std::int32_t >();
+        const std::uint32_t size = st.pop< std::uint32_t >();
+        if( st.size() < size )
+        {
+          st.push< std::uint32_t >( size );
+          st.push< std::int32_t >( file_descriptor );
+          throw stack_underflow( "Stack underflow" );
+        }
+        ssize_t count;
+        do
+        {
+          count = write( file_descriptor, st.data() + st.size() - size, std::min( size, max_transfer ) );
+        } while( count < 0 && errno == EINTR );
+        const int error = errno;
+        if( count < 0 && ( error == EAGAIN || error == EWOULDBLOCK ) )
+        {
+          st.push< std::uint32_t >( size );
+          st.push< std::int32_t >( file_descriptor );
+          await( file_descriptor, readiness::writable );
+        }
+        st.discard( size );
+        st.push< std::int32_t >( static_cast< std::int32_t >( count < 0 ? -error : count ) );
+      };
+    }
+
+    void event_loop::run( const std::list< task >::iterator t )
+    {
+      _current = t;
+      _running = true;
+      _awaiting = false;
+      try
+      {
+        stack result;
+        bool finished;
+        if( t->started )
+        {
+          finished = t->proc.try_resume( result, _slice );
+        }
+        else
+        {
+          t->started = true;
+          finished = t->proc.try_execute( t->start_address, std::move( t->parameters ), result, _slice );
+        }
+        _running = false;
+        if( !finished )
+        {
+          // preempted or suspended by something other than await(), so just retry later
+          if( !_awaiting )
+          {
+            _ready.push_back( t );
+          }
+          return;
+        }
+        t->result.set_value( std::move( result ) );
+      }
+      catch( ... )
+      {
+        _running = false;
+        t->result.set_exception( std::current_exception() );
+      }
+      _tasks.erase( t );
+    }
+
+    void event_loop::run_ready()
+    {
+      // tasks that get ready again in the meantime wait for the next round, so they can't starve the others
+      for( std::size_t count = _ready.size(); count > 0; --count )
+      {
+        const std::list< task >::iterator t = _ready.front();
+        _ready.pop_front();
+        run( t );
+      }
+    }
+
+    void event_loop::wake( const int file_descriptor, const std::uint32_t events )
+    {
+      const auto found = _waiting.find( file_descriptor );
+      if( found == _waiting.end() )
+      {
+        return;
+      }
+      waiters& w = found->second;
+      // errors and hangups are reported to readers and writers alike, when they retry
+      const std::uint32_t failure = EPOLLERR | EPOLLHUP;
+      if( events & ( EPOLLIN | failure ) )
+      {
+        _ready.insert( _ready.end(), w.readers.begin(), w.readers.end() );
+        w.readers.clear();
+      }
+      if( events & ( EPOLLOUT | failure ) )
+      {
+        _ready.insert( _ready.end(), w.writers.begin(), w.writers.end() );
+        w.writers.clear();
+      }
+      update( file_descriptor, w, true );
+    }
+
+    void event_loop::update( const int file_descriptor, waiters& w, const bool registered )
+    {
+      epoll_event event{};
+      event.events = ( w.readers.empty() ? 0u : std::uint32_t( EPOLLIN ) ) | ( w.writers.empty() ? 0u : std::uint32_t( EPOLLOUT ) );
+      event.data.fd = file_descriptor;
+      if( event.events == 0 )
+      {
+        // the file descriptor may have been closed already, which unregisters it anyway
+        epoll_ctl( _epoll, EPOLL_CTL_DEL, file_descriptor, &event );
+        _waiting.erase( file_descriptor );
+        return;
+      }
+      if( epoll_ctl( _epoll, registered ? EPOLL_CTL_MOD : EPOLL_CTL_ADD, file_descriptor, &event ) != 0 )
+      {
+        throw std::system_error( errno, std::system_category(), "epoll_ctl" );
+      }
+    }
+  }
+}
@@ -0,0 +1,47 @@
+#include "vm/file_mapping.hpp"
+
+#include <cerrno>
+#include <system_error>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace perseus
+{
+  namespace detail
+  {
+    file::~file()
+    {
+      if( descriptor >= 0 )
+      {
+        close( descriptor );
+      }
+    }
+
+    std::size_t file::size() const
+    {
+      struct stat info;
+      if( fstat( descriptor, &info ) != 0 )
+      {
+        throw std::system_error( errno, std::system_category(), "fstat" );
+      }
+      return static_cast< std::size_t >( info.st_size );
+    }
+
+    file_mapping::file_mapping( const int descriptor, const std::size_t size )
+      : data( mmap( nullptr, size, PROT_READ, MAP_PRIVATE, descriptor, 0 ) )
+      , size( size )
+    {
+      if( data == MAP_FAILED )
+      {
+        throw std::system_error( errno, std::system_category(), "mmap" );
+      }
+    }
+
+    file_mapping::~file_mapping()
+    {
+      munmap( data, size );
+    }
+  }
+}
@@ -0,0 +1,139 @@
+#include "vm/image.hpp"
+#include "vm/snapshot.hpp"
+#include "vm/exceptions.hpp"
+#include "vm/file_mapping.hpp"
+
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+#include <system_error>
+
+#include <fcntl.h>
+
+namespace perseus
+{
+  namespace detail
+  {
+    namespace
+    {
+      [[noreturn]] void truncated()
+      {
+        throw invalid_image( "Truncated program image!" );
+      }
+
+      /// appends a symbol and its name
+      void add_symbol( std::vector< image::symbol >& symbols, std::string& names, const std::uint32_t address, const std::string& name )
+      {
+        symbols.push_back( { address, static_cast< std::uint32_t >( names.size() ), static_cast< std::uint32_t >( name.size() ) } );
+        names += name;
+      }
+
+      /// the name of a symbol, checking that it's inside the names
+      std::string symbol_name( const image::symbol& record, const char* const names, const std::uint64_t names_size )
+      {
+        if( std::uint64_t( record.name_offset ) + record.name_size > names_size )
+        {
+          truncated();
+        }
+        return std::string( names + record.name_offset, record.name_size );
+      }
+    }
+
+    void save_image( const std::string& path, const program_image& program )
+    {
+      std::vector< image::symbol > symbols;
+      std::string names;
+      for( const std::string& name : program.syscalls )
+      {
+        add_symbol( symbols, names, 0, name );
+      }
+      for( const auto& function : program.functions )
+      {
+        add_symbol( symbols, names, function.first, function.second );
+      }
+
+      image::header header{};
+      std::memcpy( header.magic, image::magic, sizeof( header.magic ) );
+      header.version = image::version;
+      header.entry_point = program.entry_point;
+      header.syscalls = static_cast< std::uint32_t >( program.syscalls.size() );
+      header.functions = static_cast< std::uint32_t >( program.functions.size() );
+      header.names_offset = sizeof( header ) + symbols.size() * sizeof( image::symbol );
+      header.names_size = names.size();
+      header.code_offset = header.names_offset + header.names_size;
+      header.code_size = program.code.size();
+      header.code_hash = snapshot::code_hash( program.code );
+
+      std::ofstream out( path, std::ios::binary | std::ios::trunc );
+      out.write( reinterpret_cast< const char* >( &header ), sizeof( header ) );
+      out.write( reinterpret_cast< const char* >( symbols.data() ), symbols.size() * sizeof( image::symbol ) );
+      out.write( names.data(), names.size() );
+      out.write( program.code.data(), program.code.size() );
+      out.close();
+      if( !out )
+      {
+        throw std::system_error( std::make_error_code( std::errc::io_error ), "Failed to write program image " + path );
+      }
+    }
+
+    program_image load_image( const std::string& path )
+    {
+      const file f( open( path.c_str(), O_RDONLY | O_CLOEXEC ) );
+      if( f.descriptor < 0 )
+      {
+        throw std::system_error( errno, std::system_category(), "open" );
+      }
+      const std::uint64_t file_size = f.size();
+      if( file_size < sizeof( image::header ) )
+      {
+        truncated();
+      }
+      const file_mapping mapping( f.descriptor, static_cast< std::size_t >( file_size ) );
+      const char* const data = static_cast< const char* >( mapping.data );
+
+      image::header header;
+      std::memcpy( &header, data, sizeof( header ) );
+      if( std::memcmp( header.magic, image::magic, sizeof( header.magic ) ) != 0 || header.version != image::version )
+      {
+        throw invalid_image( "Not a program image, or one of an unsupported version!" );
+      }
+      const std::uint64_t symbols_size = ( std::uint64_t( header.syscalls ) + header.functions ) * sizeof( image::symbol );
+      if( sizeof( header ) + symbols_size > header.names_offset
+        || header.names_offset > file_size || header.names_size > file_size - header.names_offset
+        || header.code_offset > file_size || header.code_size > file_size - header.code_offset )
+      {
+        truncated();
+      }
+
+      program_image result;
+      result.code.assign( data + header.code_offset, data + header.code_offset + header.code_size );
+      if( snapshot::code_hash( result.code ) != header.code_hash )
+      {
+        throw invalid_image( "Corrupt program image!" );
+      }
+      if( header.entry_point >= result.code.size() )
+      {
+        throw invalid_image( "Program image entry point outside its code!" );
+      }
+      result.entry_point = header.entry_point;
+
+      const char* const names = data + header.names_offset;
+      const char* position = data + sizeof( header );
+      result.syscalls.reserve( header.syscalls );
+      for( std::uint32_t i = 0; i < header.syscalls + header.functions; ++i, position += sizeof( image::symbol ) )
+      {
+        image::symbol record;
+        std::memcpy( &record, position, sizeof( record ) );
+        if( i < header.syscalls )
+        {
+          result.syscalls.push_back( symbol_name( record, names, header.names_size ) );
+        }
+        else
+        {
+          result.functions.emplace( record.address, symbol_name( record, names, header.names_size ) );
+        }
+      }
+      return result;
+    }
+  }
+}
@@ -0,0 +1,917 @@
+#include "vm/jit_compiler.hpp"
+
+#include <vector>
+#include <initializer_list>
+#include <iterator>
+#include <limits>
+#include <algorithm>
+#include <cstring>
+#include <cstddef>
+
+#ifdef PERSEUS_HAS_JIT
+# include <sys/mman.h>
+#endif
+
+/**
+@file
+
+Native code keeps the stack in registers: r12 holds the stack's data pointer, r13 its size and r14 the size it may grow to, i.e. the size of the window run() makes available. rbx points to the native_context, whose countdown backward jumps and calls decrease. rax, rcx and rdx are temporaries. Stack accesses address [r12 + r13 + offset], relative to the top of the stack like the relative loads and stores.
+
+Native functions return the bytecode address at which execution continues in rax. If bit 32 is set, they didn't reach a return instruction but bailed out, and the interpreter has to continue at that address; native callers then bail out as well.
+*/
+
+namespace perseus
+{
+  namespace detail
+  {
+    namespace
+    {
+      /// Number of bytes native code may push onto the stack; deeper native code returns to the interpreter, whose stack can grow as needed.
+      constexpr std::size_t stack_window = 1024;
+
+      /// The state passed to native code by run(), and returned by it
+      struct native_context
+      {
+        char* data;
+        std::uint64_t size;
+        std::uint64_t limit;
+        /// see execution_state::countdown
+        std::uint64_t countdown;
+      };
+
+      static_assert( offsetof( native_context, data ) == 0 && offsetof( native_context, size ) == 8 && offsetof( native_context, limit ) == 16, "the trampoline depends on the layout of native_context" );
+      static_assert( offsetof( native_context, countdown ) == 24, "native code depends on the layout of native_context" );
+
+      /// Signature of the trampoline: it runs a native function on the given context
+      typedef std::uint64_t( *trampoline_function )( native_context*, jit_compiler::native_function );
+
+#ifdef PERSEUS_HAS_JIT
+      /// Flag in the result of native code: execution continues in the interpreter
+      constexpr std::uint64_t bail_flag = std::uint64_t( 1 ) << 32;
+      /// Larger loads, stores and reservations are left to the interpreter
+      constexpr std::uint32_t max_native_copy_size = 64;
+      /// Largest stack size difference native code can check for or apply in one instruction
+      constexpr std::int64_t max_immediate = std::numeric_limits< std::int32_t >::max();
+      /// Marks unbound labels and instructions without label
+      constexpr std::size_t no_label = ~std::size_t( 0 );
+      /// Marks the absence of a successor instruction
+      constexpr std::uint32_t nowhere = ~std::uint32_t( 0 );
+
+      /// Calls native code, saving the callee-saved registers it uses
+      const std::uint8_t trampoline_code[] = {
+        0x53, // push rbx
+        0x41, 0x54, // push r12
+        0x41, 0x55, // push r13
+        0x41, 0x56, // push r14
+        0x41, 0x57, // push r15 (keeps the machine stack aligned)
+        0x48, 0x89, 0xFB, // mov rbx, rdi
+        0x4C, 0x8B, 0x27, // mov r12, [rdi]
+        0x4C, 0x8B, 0x6F, 0x08, // mov r13, [rdi + 8]
+        0x4C, 0x8B, 0x77, 0x10, // mov r14, [rdi + 16]
+        0xFF, 0xD6, // call rsi
+        0x4C, 0x89, 0x6B, 0x08, // mov [rbx + 8], r13
+        0x41, 0x5F, // pop r15
+        0x41, 0x5E, // pop r14
+        0x41, 0x5D, // pop r13
+        0x41, 0x5C, // pop r12
+        0x5B, // pop rbx
+        0xC3 // ret
+      };
+
+      /// x86 condition codes, as used by jcc and setcc
+      enum class condition : std::uint8_t
+      {
+        below = 0x2,
+        equal = 0x4,
+        not_equal = 0x5,
+        below_or_equal = 0x6,
+        above = 0x7,
+        less = 0xC,
+        greater_or_equal = 0xD,
+        less_or_equal = 0xE,
+        greater = 0xF
+      };
+
+      /// The condition that holds iff the given one doesn't
+      condition inverse( const condition cc )
+      {
+        return static_cast< condition >( static_cast< std::uint8_t >( cc ) ^ 1 );
+      }
+
+      /// Register numbers, as encoded in instructions
+      enum reg : std::uint8_t
+      {
+        rax = 0,
+        rcx = 1,
+        rdx = 2,
+        r13 = 13
+      };
+
+      /// Writes machine code, resolving jumps to labels
+      class assembler
+      {
+      public:
+        typedef std::size_t label;
+
+        label new_label()
+        {
+          _labels.push_back( no_label );
+          return _labels.size() - 1;
+        }
+
+        void bind( const label l )
+        {
+          _labels[ l ] = _code.size();
+        }
+
+        std::size_t position( const label l ) const
+        {
+          return _labels[ l ];
+        }
+
+        void bytes( std::initializer_list< std::uint8_t > values )
+        {
+          _code.insert( _code.end(), values );
+        }
+
+        void imm32( const std::uint32_t value )
+        {
+          for( int i = 0; i < 4; ++i )
+          {
+            _code.push_back( static_cast< std::uint8_t >( value >> ( 8 * i ) ) );
+          }
+        }
+
+        void imm64( const std::uint64_t value )
+        {
+          imm32( static_cast< std::uint32_t >( value ) );
+          imm32( static_cast< std::uint32_t >( value >> 32 ) );
+        }
+
+        /// jmp to the label
+        void jump( const label target )
+        {
+          bytes( { 0xE9 } );
+          fixup( target );
+        }
+
+        /// jcc to the label
+        void jump( const condition cc, const label target )
+        {
+          bytes( { 0x0F, static_cast< std::uint8_t >( 0x80 | static_cast< std::uint8_t >( cc ) ) } );
+          fixup( target );
+        }
+
+        /// setcc into the low byte of the given register
+        void set( const condition cc, const reg r )
+        {
+          bytes( { 0x0F, static_cast< std::uint8_t >( 0x90 | static_cast< std::uint8_t >( cc ) ), static_cast< std::uint8_t >( 0xC0 | r ) } );
+        }
+
+        /**
+        @brief An instruction whose r/m operand is on the stack, at `[r12 + r13 + offset]`
+        @param wide whether to use 64 bit operands
+        @param op the opcode bytes
+        @param r the register operand, or the opcode extension
+        @param offset offset relative to the top of the stack
+        */
+        void stack_operand( const bool wide, std::initializer_list< std::uint8_t > op, const std::uint8_t r, const std::int32_t offset )
+        {
+          // REX with B (r12 base) and X (r13 index)
+          _code.push_back( static_cast< std::uint8_t >( 0x43 | ( wide ? 0x08 : 0 ) | ( r & 8 ? 0x04 : 0 ) ) );
+          _code.insert( _code.end(), op );
+          // mod = disp32, r/m = SIB; SIB: scale 1, index r13, base r12
+          bytes( { static_cast< std::uint8_t >( 0x84 | ( r & 7 ) << 3 ), 0x2C } );
+          imm32( static_cast< std::uint32_t >( offset ) );
+        }
+
+        /// The finished code, with all jumps resolved
+        std::vector< std::uint8_t > finish()
+        {
+          for( const auto& f : _fixups )
+          {
+            const std::int64_t distance = std::int64_t( _labels[ f.second ] ) - std::int64_t( f.first + 4 );
+            const std::uint32_t value = static_cast< std::uint32_t >( distance );
+            for( int i = 0; i < 4; ++i )
+            {
+              _code[ f.first + i ] = static_cast< std::uint8_t >( value >> ( 8 * i ) );
+            }
+          }
+          return std::move( _code );
+        }
+
+      private:
+        /// a rel32 to the given label
+        void fixup( const label target )
+        {
+          _fixups.emplace_back( _code.size(), target );
+          imm32( 0 );
+        }
+
+        std::vector< std::uint8_t > _code;
+        /// position of each label
+        std::vector< std::size_t > _labels;
+        /// positions of rel32 values, with their target labels
+        std::vector< std::pair< std::size_t, label > > _fixups;
+      };
+
+      /// Translates one function, i.e. everything reachable from its entry without calls, into machine code
+      class function_compiler
+      {
+      public:
+        function_compiler( const decoded_code& program, const jit_compiler::native_function* functions )
+          : _program( program )
+          , _functions( functions )
+          , _instruction_labels( program.size(), no_label )
+          , _bail_labels( program.size(), no_label )
+        {
+        }
+
+        /**
+        @brief Compiles the function starting at the given instruction index.
+        @param out_code the machine code
+        @param out_entry position of the function's entry point in out_code
+        @returns false if the function can't be compiled, e.g. because it reaches an internal handler
+        */
+        bool compile( const std::uint32_t entry, std::vector< std::uint8_t >& out_code, std::size_t& out_entry )
+        {
+          // find all instructions reachable within the function
+          std::vector< bool > reachable( _program.size(), false );
+          std::vector< std::uint32_t > pending{ entry };
+          reachable[ entry ] = true;
+          while( !pending.empty() )
+          {
+            const std::uint32_t index = pending.back();
+            pending.pop_back();
+            const decoded_instruction& instr = _program.data()[ index ];
+            if( instr.handler >= get_handler( opcode::opcode_end ) && instr.handler != get_handler( internal_handler::fall_through ) )
+            {
+              return false;
+            }
+            const flow f = analyze( index );
+            if( index == entry && !f.native )
+            {
+              return false;
+            }
+            for( const std::uint32_t successor : { f.next, f.branch } )
+            {
+              if( successor != nowhere && !reachable[ successor ] )
+              {
+                reachable[ successor ] = true;
+                pending.push_back( successor );
+              }
+            }
+          }
+
+          // emit them in order, so sequential code needs no jumps
+          _propagate = _asm.new_label();
+          for( std::uint32_t index = 0; index < _program.size(); ++index )
+          {
+            if( !reachable[ index ] )
+            {
+              continue;
+            }
+            _asm.bind( instruction_label( index ) );
+            const flow f = analyze( index );
+            if( f.native )
+            {
+              emit( index );
+            }
+            else
+            {
+              _asm.jump( bail( index ) );
+            }
+            if( f.next != nowhere && !( f.next == index + 1 && index + 1 < _program.size() && reachable[ index + 1 ] ) )
+            {
+              _asm.jump( instruction_label( f.next ) );
+            }
+          }
+
+          // returning to the interpreter
+          for( std::uint32_t index = 0; index < _program.size(); ++index )
+          {
+            if( _bail_labels[ index ] != no_label )
+            {
+              _asm.bind( _bail_labels[ index ] );
+              _asm.bytes( { 0x48, 0xB8 } ); // mov rax, imm64
+              _asm.imm64( bail_flag | _program.address_of( _program.data() + index ) );
+              _asm.bytes( { 0xC3 } ); // ret
+            }
+          }
+          _asm.bind( _propagate );
+          _asm.bytes( {
+            0x48, 0x0F, 0xBA, 0xE8, 0x20, // bts rax, 32
+            0xC3 // ret
+          } );
+
+          out_entry = _asm.position( _instruction_labels[ entry ] );
+          out_code = _asm.finish();
+          return true;
+        }
+
+      private:
+        /// How control leaves an instruction
+        struct flow
+        {
+          /// whether the instruction is compiled, as opposed to handed to the interpreter
+          bool native;
+          /// index of the instruction following once the native code is done, or nowhere
+          std::uint32_t next;
+          /// index of the instruction a conditional branch leads to, or nowhere
+          std::uint32_t branch;
+        };
+
+        /// Whether a relative access of the given size at the given offset stays below the top of the stack, and is small enough to compile
+        static bool is_native_access( const std::uint32_t size, const std::int32_t offset )
+        {
+          return size <= max_native_copy_size && offset < 0 && offset > std::numeric_limits< std::int32_t >::min() && std::int64_t( offset ) + size <= 0;
+        }
+
+        flow analyze( const std::uint32_t index ) const
+        {
+          const decoded_instruction& instr = _program.data()[ index ];
+          const flow sequential{ true, index + 1, nowhere };
+          const flow bail{ false, nowhere, nowhere };
+          const flow leave{ true, nowhere, nowhere };
+          switch( instr.handler )
+          {
+          case get_handler( opcode::no_operation ):
+          case get_handler( opcode::push_8 ):
+          case get_handler( opcode::push_32 ):
+          case get_handler( opcode::push_stack_size ):
+          case get_handler( opcode::and_b ):
+          case get_handler( opcode::or_b ):
+          case get_handler( opcode::equals_b ):
+          case get_handler( opcode::not_equals_b ):
+          case get_handler( opcode::negate_b ):
+          case get_handler( opcode::add_i32 ):
+          case get_handler( opcode::subtract_i32 ):
+          case get_handler( opcode::multiply_i32 ):
+          case get_handler( opcode::divide_i32 ):
+          case get_handler( opcode::modulo_i32 ):
+          case get_handler( opcode::equals_i32 ):
+          case get_handler( opcode::not_equals_i32 ):
+          case get_handler( opcode::less_than_i32 ):
+          case get_handler( opcode::less_than_or_equals_i32 ):
+          case get_handler( opcode::greater_than_i32 ):
+          case get_handler( opcode::greater_than_or_equals_i32 ):
+          case get_handler( opcode::negate_i32 ):
+          case get_handler( opcode::add_immediate_i32 ):
+            return sequential;
+          case get_handler( opcode::reserve ):
+            return instr.operand <= max_native_copy_size ? sequential : bail;
+          case get_handler( opcode::pop ):
+            return instr.operand <= max_immediate ? sequential : bail;
+          case get_handler( opcode::relative_load_stack ):
+          case get_handler( opcode::relative_store_stack ):
+            return is_native_access( instr.operand, instr.offset ) ? sequential : bail;
+          case get_handler( opcode::load_local_32 ):
+            return is_native_access( sizeof( std::int32_t ), instr.offset ) ? sequential : bail;
+          case get_handler( opcode::absolute_jump ):
+          case get_handler( opcode::relative_jump ):
+          case get_handler( internal_handler::fall_through ):
+            return { true, instr.target, nowhere };
+          case get_handler( opcode::relative_jump_if_false ):
+          case get_handler( opcode::equals_i32_jump_if_false ):
+          case get_handler( opcode::not_equals_i32_jump_if_false ):
+          case get_handler( opcode::less_than_i32_jump_if_false ):
+          case get_handler( opcode::less_than_or_equals_i32_jump_if_false ):
+          case get_handler( opcode::greater_than_i32_jump_if_false ):
+          case get_handler( opcode::greater_than_or_equals_i32_jump_if_false ):
+            return { true, index + 1, instr.target };
+          case get_handler( opcode::call ):
+            // native code continues after the call if the callee returns to the return address
+            try
+            {
+              return { true, static_cast< std::uint32_t >( _program.at( instr.operand ) - _program.data() ), nowhere };
+            }
+            catch( const code_segmentation_fault& )
+            {
+              return bail;
+            }
+          case get_handler( opcode::return_ ):
+            return instr.operand <= max_immediate - sizeof( std::uint32_t ) ? leave : bail;
+          case get_handler( opcode::store_pop_return ):
+            // the offset always leaves room for the result and the return address, see decoded_code
+            return instr.operand <= max_native_copy_size && instr.offset > std::numeric_limits< std::int32_t >::min() ? leave : bail;
+          default:
+            // exit, syscalls, coroutines, absolute stack accesses and indirect control flow
+            return bail;
+          }
+        }
+
+        //    Labels
+
+        assembler::label instruction_label( const std::uint32_t index )
+        {
+          if( _instruction_labels[ index ] == no_label )
+          {
+            _instruction_labels[ index ] = _asm.new_label();
+          }
+          return _instruction_labels[ index ];
+        }
+
+        /// where to jump to hand the instruction at the given index to the interpreter
+        assembler::label bail( const std::uint32_t index )
+        {
+          if( _bail_labels[ index ] == no_label )
+          {
+            _bail_labels[ index ] = _asm.new_label();
+          }
+          return _bail_labels[ index ];
+        }
+
+        //    Stack helpers
+
+        /// bails unless the stack holds at least the given number of bytes
+        void check_size( const std::uint32_t index, const std::uint32_t bytes )
+        {
+          _asm.bytes( { 0x49, 0x81, 0xFD } ); // cmp r13, imm32
+          _asm.imm32( bytes );
+          _asm.jump( condition::below, bail( index ) );
+        }
+
+        /// bails unless the given number of bytes can be pushed within the window
+        void check_space( const std::uint32_t index, const std::uint32_t bytes )
+        {
+          _asm.bytes( { 0x49, 0x8D, 0x85 } ); // lea rax, [r13 + imm32]
+          _asm.imm32( bytes );
+          _asm.bytes( { 0x4C, 0x39, 0xF0 } ); // cmp rax, r14
+          _asm.jump( condition::above, bail( index ) );
+        }
+
+        /// changes the stack size by the given number of bytes
+        void resize( const std::int64_t delta )
+        {
+          if( delta > 0 )
+          {
+            _asm.bytes( { 0x49, 0x81, 0xC5 } ); // add r13, imm32
+            _asm.imm32( static_cast< std::uint32_t >( delta ) );
+          }
+          else if( delta < 0 )
+          {
+            _asm.bytes( { 0x49, 0x81, 0xED } ); // sub r13, imm32
+            _asm.imm32( static_cast< std::uint32_t >( -delta ) );
+          }
+        }
+
+        void load32( const reg r, const std::int32_t offset )
+        {
+          _asm.stack_operand( false, { 0x8B }, r, offset );
+        }
+
+        void store32( const reg r, const std::int32_t offset )
+        {
+          _asm.stack_operand( false, { 0x89 }, r, offset );
+        }
+
+        void load8( const reg r, const std::int32_t offset )
+        {
+          _asm.stack_operand( false, { 0x0F, 0xB6 }, r, offset ); // movzx
+        }
+
+        void store8( const reg r, const std::int32_t offset )
+        {
+          _asm.stack_operand( false, { 0x88 }, r, offset );
+        }
+
+        /// copies front to back, like std::copy, so the destination may overlap the source from below
+        void copy( const std::int32_t from, const std::int32_t to, const std::int32_t size )
+        {
+          std::int32_t done = 0;
+          for( ; size - done >= 8; done += 8 )
+          {
+            _asm.stack_operand( true, { 0x8B }, rax, from + done );
+            _asm.stack_operand( true, { 0x89 }, rax, to + done );
+          }
+          for( ; size - done >= 4; done += 4 )
+          {
+            load32( rax, from + done );
+            store32( rax, to + done );
+          }
+          for( ; done < size; ++done )
+          {
+            _asm.stack_operand( false, { 0x8A }, rax, from + done );
+            store8( rax, to + done );
+          }
+        }
+
+        /// zeroes the given number of bytes above the top of the stack
+        void zero( const std::int32_t size )
+        {
+          _asm.bytes( { 0x31, 0xC0 } ); // xor eax, eax
+          std::int32_t done = 0;
+          for( ; size - done >= 8; done += 8 )
+          {
+            _asm.stack_operand( true, { 0x89 }, rax, done );
+          }
+          for( ; done < size; ++done )
+          {
+            store8( rax, done );
+          }
+        }
+
+        //    Instructions
+
+        /// pops two i32, pushing the given operation of them; op2 is the instruction taking a stack operand
+        void binary_operation( const std::uint32_t index, std::initializer_list< std::uint8_t > op2 )
+        {
+          check_size( index, 8 );
+          load32( rax, -8 );
+          _asm.stack_operand( false, op2, rax, -4 );
+          store32( rax, -8 );
+          resize( -4 );
+        }
+
+        /// pops two i32, pushing the quotient or the remainder
+        void division_operation( const std::uint32_t index, const bool remainder )
+        {
+          check_size( index, 8 );
+          load32( rcx, -4 );
+          _asm.bytes( { 0x85, 0xC9 } ); // test ecx, ecx
+          _asm.jump( condition::equal, bail( index ) );
+          load32( rax, -8 );
+          // INT_MIN / -1 traps; leave it to the interpreter
+          const assembler::label no_overflow = _asm.new_label();
+          _asm.bytes( { 0x83, 0xF9, 0xFF } ); // cmp ecx, -1
+          _asm.jump( condition::not_equal, no_overflow );
+          _asm.bytes( { 0x3D } ); // cmp eax, imm32
+          _asm.imm32( 0x80000000u );
+          _asm.jump( condition::equal, bail( index ) );
+          _asm.bind( no_overflow );
+          _asm.bytes( {
+            0x99, // cdq
+            0xF7, 0xF9 // idiv ecx
+          } );
+          store32( remainder ? rdx : rax, -8 );
+          resize( -4 );
+        }
+
+        /// pops two i32, pushing whether the given condition holds for them
+        void comparison( const std::uint32_t index, const condition cc )
+        {
+          check_size( index, 8 );
+          load32( rax, -8 );
+          _asm.stack_operand( false, { 0x3B }, rax, -4 ); // cmp eax, [op2]
+          _asm.set( cc, rax );
+          store8( rax, -8 );
+          resize( -7 );
+        }
+
+        /**
+        @brief Charges instructions to the countdown, like the interpreter's charge().
+        @param index where the interpreter continues if the countdown doesn't cover them
+        */
+        void charge( const std::uint32_t index, const std::uint32_t cost )
+        {
+          _asm.bytes( { 0x48, 0x81, 0x7B, 0x18 } ); // cmp qword [rbx + 24], imm32
+          _asm.imm32( cost );
+          _asm.jump( condition::below_or_equal, bail( index ) );
+          _asm.bytes( { 0x48, 0x81, 0x6B, 0x18 } ); // sub qword [rbx + 24], imm32
+          _asm.imm32( cost );
+        }
+
+        /// jumps to the target of the instruction at the given index if the given condition holds, charging backward jumps
+        void branch( const std::uint32_t index, const condition cc )
+        {
+          const std::uint32_t target = _program.data()[ index ].target;
+          if( target > index )
+          {
+            _asm.jump( cc, instruction_label( target ) );
+            return;
+          }
+          const assembler::label not_taken = _asm.new_label();
+          _asm.jump( inverse( cc ), not_taken );
+          charge( target, index - target + 1 );
+          _asm.jump( instruction_label( target ) );
+          _asm.bind( not_taken );
+        }
+
+        /// pops two i32, jumping to the target unless the given condition holds for them
+        void compare_and_branch( const std::uint32_t index, const condition cc )
+        {
+          check_size( index, 8 );
+          load32( rax, -8 );
+          load32( rcx, -4 );
+          resize( -8 );
+          _asm.bytes( { 0x39, 0xC8 } ); // cmp eax, ecx
+          branch( index, inverse( cc ) );
+        }
+
+        /// pops two bools into al and cl, pushing al afterwards
+        template< typename operation >
+        void boolean_operation( const std::uint32_t index, operation op )
+        {
+          check_size( index, 2 );
+          load8( rax, -2 );
+          load8( rcx, -1 );
+          op();
+          store8( rax, -2 );
+          resize( -1 );
+        }
+
+        void emit( const std::uint32_t index )
+        {
+          const decoded_instruction& instr = _program.data()[ index ];
+          switch( instr.handler )
+          {
+          case get_handler( opcode::push_8 ):
+            check_space( index, 1 );
+            _asm.stack_operand( false, { 0xC6 }, 0, 0 );
+            _asm.bytes( { static_cast< std::uint8_t >( instr.operand ) } );
+            resize( 1 );
+            break;
+          case get_handler( opcode::push_32 ):
+            check_space( index, 4 );
+            _asm.stack_operand( false, { 0xC7 }, 0, 0 );
+            _asm.imm32( instr.operand );
+            resize( 4 );
+            break;
+          case get_handler( opcode::push_stack_size ):
+            check_space( index, 4 );
+            _asm.stack_operand( false, { 0x89 }, r13, 0 );
+            resize( 4 );
+            break;
+          case get_handler( opcode::reserve ):
+            check_space( index, instr.operand );
+            zero( instr.operand );
+            resize( instr.operand );
+            break;
+          case get_handler( opcode::pop ):
+            check_size( index, instr.operand );
+            resize( -std::int64_t( instr.operand ) );
+            break;
+          case get_handler( opcode::relative_load_stack ):
+          case get_handler( opcode::load_local_32 ):
+          {
+            const std::int32_t size = instr.handler == get_handler( opcode::load_local_32 ) ? sizeof( std::int32_t ) : instr.operand;
+            check_size( index, -instr.offset );
+            check_space( index, size );
+            copy( instr.offset, 0, size );
+            resize( size );
+            break;
+          }
+          case get_handler( opcode::relative_store_stack ):
+            check_size( index, -instr.offset );
+            copy( -std::int32_t( instr.operand ), instr.offset, instr.operand );
+            break;
+          case get_handler( opcode::relative_jump_if_false ):
+            check_size( index, 1 );
+            load8( rax, -1 );
+            resize( -1 );
+            _asm.bytes( { 0x85, 0xC0 } ); // test eax, eax
+            branch( index, condition::equal );
+            break;
+          case get_handler( opcode::absolute_jump ):
+          case get_handler( opcode::relative_jump ):
+          case get_handler( internal_handler::fall_through ):
+            // the jump itself is the layout's
+            if( instr.target <= index )
+            {
+              charge( instr.target, index - instr.target + 1 );
+            }
+            break;
+          case get_handler( opcode::call ):
+            check_space( index, 4 );
+            charge( index, 1 );
+            _asm.bytes( { 0x48, 0xB8 } ); // mov rax, imm64
+            _asm.imm64( reinterpret_cast< std::uintptr_t >( _functions + instr.target ) );
+            _asm.bytes( {
+              0x48, 0x8B, 0x00, // mov rax, [rax]
+              0x48, 0x85, 0xC0 // test rax, rax
+            } );
+            // the interpreter calls functions which aren't compiled (yet)
+            _asm.jump( condition::equal, bail( index ) );
+            _asm.stack_operand( false, { 0xC7 }, 0, 0 );
+            _asm.imm32( instr.operand );
+            resize( 4 );
+            _asm.bytes( {
+              0xFF, 0xD0, // call rax
+              0xB9 // mov ecx, imm32
+            } );
+            _asm.imm32( instr.operand );
+            _asm.bytes( { 0x48, 0x39, 0xC8 } ); // cmp rax, rcx
+            _asm.jump( condition::not_equal, _propagate );
+            break;
+          case get_handler( opcode::return_ ):
+            check_size( index, sizeof( std::uint32_t ) + instr.operand );
+            load32( rax, -4 );
+            resize( -std::int64_t( sizeof( std::uint32_t ) + instr.operand ) );
+            _asm.bytes( { 0xC3 } ); // ret
+            break;
+          case get_handler( opcode::store_pop_return ):
+          {
+            // stack: <result> <arguments> <return address> <popped data> <result>
+            const std::int64_t result_end = std::int64_t( instr.offset ) + instr.operand;
+            check_size( index, -instr.offset );
+            copy( -std::int32_t( instr.operand ), instr.offset, instr.operand );
+            load32( rax, static_cast< std::int32_t >( result_end + instr.target ) );
+            resize( result_end );
+            _asm.bytes( { 0xC3 } ); // ret
+            break;
+          }
+          case get_handler( opcode::and_b ):
+            boolean_operation( index, [ this ]{
+              _asm.bytes( { 0x85, 0xC0 } ); // test eax, eax
+              _asm.set( condition::not_equal, rax );
+              _asm.bytes( { 0x85, 0xC9 } ); // test ecx, ecx
+              _asm.set( condition::not_equal, rcx );
+              _asm.bytes( { 0x21, 0xC8 } ); // and eax, ecx
+            } );
+            break;
+          case get_handler( opcode::or_b ):
+            boolean_operation( index, [ this ]{
+              _asm.bytes( { 0x09, 0xC8 } ); // or eax, ecx
+              _asm.set( condition::not_equal, rax );
+            } );
+            break;
+          case get_handler( opcode::equals_b ):
+          case get_handler( opcode::not_equals_b ):
+          {
+            const condition cc = instr.handler == get_handler( opcode::equals_b ) ? condition::equal : condition::not_equal;
+            boolean_operation( index, [ this, cc ]{
+              _asm.bytes( { 0x39, 0xC8 } ); // cmp eax, ecx
+              _asm.set( cc, rax );
+            } );
+            break;
+          }
+          case get_handler( opcode::negate_b ):
+            check_size( index, 1 );
+            load8( rax, -1 );
+            _asm.bytes( { 0x85, 0xC0 } ); // test eax, eax
+            _asm.set( condition::equal, rax );
+            store8( rax, -1 );
+            break;
+          case get_handler( opcode::add_i32 ):
+            binary_operation( index, { 0x03 } );
+            break;
+          case get_handler( opcode::subtract_i32 ):
+            binary_operation( index, { 0x2B } );
+            break;
+          case get_handler( opcode::multiply_i32 ):
+            binary_operation( index, { 0x0F, 0xAF } );
+            break;
+          case get_handler( opcode::divide_i32 ):
+            division_operation( index, false );
+            break;
+          case get_handler( opcode::modulo_i32 ):
+            division_operation( index, true );
+            break;
+          case get_handler( opcode::equals_i32 ):
+            comparison( index, condition::equal );
+            break;
+          case get_handler( opcode::not_equals_i32 ):
+            comparison( index, condition::not_equal );
+            break;
+          case get_handler( opcode::less_than_i32 ):
+            comparison( index, condition::less );
+            break;
+          case get_handler( opcode::less_than_or_equals_i32 ):
+            comparison( index, condition::less_or_equal );
+            break;
+          case get_handler( opcode::greater_than_i32 ):
+            comparison( index, condition::greater );
+            break;
+          case get_handler( opcode::greater_than_or_equals_i32 ):
+            comparison( index, condition::greater_or_equal );
+            break;
+          case get_handler( opcode::negate_i32 ):
+            check_size( index, 4 );
+            _asm.stack_operand( false, { 0xF7 }, 3, -4 ); // neg
+            break;
+          case get_handler( opcode::add_immediate_i32 ):
+            check_size( index, 4 );
+            _asm.stack_operand( false, { 0x81 }, 0, -4 ); // add imm32
+            _asm.imm32( instr.operand );
+            break;
+          case get_handler( opcode::equals_i32_jump_if_false ):
+            compare_and_branch( index, condition::equal );
+            break;
+          case get_handler( opcode::not_equals_i32_jump_if_false ):
+            compare_and_branch( index, condition::not_equal );
+            break;
+          case get_handler( opcode::less_than_i32_jump_if_false ):
+            compare_and_branch( index, condition::less );
+            break;
+          case get_handler( opcode::less_than_or_equals_i32_jump_if_false ):
+            compare_and_branch( index, condition::less_or_equal );
+            break;
+          case get_handler( opcode::greater_than_i32_jump_if_false ):
+            compare_and_branch( index, condition::greater );
+            break;
+          case get_handler( opcode::greater_than_or_equals_i32_jump_if_false ):
+            compare_and_branch( index, condition::greater_or_equal );
+            break;
+          default:
+            // no_operation and jumps, whose effect is the layout
+            break;
+          }
+        }
+
+        const decoded_code& _program;
+        const jit_compiler::native_function* _functions;
+        assembler _asm;
+        std::vector< assembler::label > _instruction_labels;
+        std::vector< assembler::label > _bail_labels;
+        /// returns to the caller with the bail flag set
+        assembler::label _propagate = no_label;
+      };
+#endif
+    }
+
+    jit_compiler::jit_compiler( const std::size_t program_size, const std::uint32_t hot_call_count )
+      : _hot_call_count( hot_call_count )
+      , _call_counts( program_size, 0 )
+      , _functions( new native_function[ program_size ]() )
+    {
+#ifdef PERSEUS_HAS_JIT
+      _trampoline = load( std::vector< std::uint8_t >( std::begin( trampoline_code ), std::end( trampoline_code ) ) );
+#endif
+    }
+
+    jit_compiler::~jit_compiler()
+    {
+#ifdef PERSEUS_HAS_JIT
+      for( const auto& memory : _memory )
+      {
+        munmap( memory.first, memory.second );
+      }
+#endif
+    }
+
+    jit_compiler::native_function jit_compiler::on_call( const decoded_code& program, const std::uint32_t index )
+    {
+      native_function function = _functions[ index ];
+      if( !function && _call_counts[ index ] < _hot_call_count && ++_call_counts[ index ] == _hot_call_count )
+      {
+        compile( program, index );
+        function = _functions[ index ];
+      }
+      return function;
+    }
+
+    instruction_pointer::value_type jit_compiler::run( const native_function function, stack& st, std::uint64_t& countdown ) const
+    {
+      const std::size_t size = st.size();
+      // stacks with fixed capacity may not have room for the whole window
+      const std::size_t window = std::min( stack_window, st.max_size() - size );
+      st.resize( size + window );
+      native_context context{ st.data(), size, size + window, countdown };
+      const std::uint64_t result = reinterpret_cast< trampoline_function >( const_cast< void* >( _trampoline ) )( &context, function );
+      countdown = context.countdown;
+      st.resize( context.size );
+      // which of its relative stores reached below the window isn't tracked
+      st.mark_dirty( 0, size );
+      return static_cast< instruction_pointer::value_type >( result );
+    }
+
+    void jit_compiler::compile( const decoded_code& program, const std::uint32_t index )
+    {
+#ifdef PERSEUS_HAS_JIT
+      if( !_trampoline )
+      {
+        return;
+      }
+      std::vector< std::uint8_t > machine_code;
+      std::size_t entry;
+      if( !function_compiler( program, _functions.get() ).compile( index, machine_code, entry ) )
+      {
+        return;
+      }
+      const std::uint8_t* memory = static_cast< const std::uint8_t* >( load( machine_code ) );
+      if( memory )
+      {
+        _functions[ index ] = memory + entry;
+        ++_compiled_functions;
+      }
+#else
+      static_cast< void >( program );
+      static_cast< void >( index );
+#endif
+    }
+
+    const void* jit_compiler::load( const std::vector< std::uint8_t >& machine_code )
+    {
+#ifdef PERSEUS_HAS_JIT
+      // so registering the memory can't fail once it's mapped
+      _memory.reserve( _memory.size() + 1 );
+      void* memory = mmap( nullptr, machine_code.size(), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0 );
+      if( memory == MAP_FAILED )
+      {
+        return nullptr;
+      }
+      std::memcpy( memory, machine_code.data(), machine_code.size() );
+      if( mprotect( memory, machine_code.size(), PROT_READ | PROT_EXEC ) != 0 )
+      {
+        munmap( memory, machine_code.size() );
+        return nullptr;
+      }
+      _memory.emplace_back( memory, machine_code.size() );
+      return memory;
+#else
+      static_cast< void >( machine_code );
+      return nullptr;
+#endif
+    }
+  }
+}
@@ -0,0 +1,48 @@
+#include "vm/mailbox.hpp"
+
+#include <utility>
+
+namespace perseus
+{
+  namespace detail
+  {
+    mailbox::mailbox()
+      : _head( new node )
+      , _tail( _head.load() )
+    {
+    }
+
+    mailbox::~mailbox()
+    {
+      while( _tail )
+      {
+        node* const next = _tail->next.load();
+        delete _tail;
+        _tail = next;
+      }
+    }
+
+    void mailbox::push( stack&& message )
+    {
+      node* const n = new node;
+      n->message = std::move( message );
+      node* const previous = _head.exchange( n );
+      // the receiver can't see the message before this
+      previous->next.store( n );
+    }
+
+    bool mailbox::pop( stack& out )
+    {
+      node* const next = _tail->next.load();
+      if( !next )
+      {
+        return false;
+      }
+      out = std::move( next->message );
+      delete _tail;
+      // next becomes the stub
+      _tail = next;
+      return true;
+    }
+  }
+}
@@ -0,0 +1,126 @@
+#include "vm/migration.hpp"
+#include "vm/snapshot.hpp"
+#include "vm/processor.hpp"
+#include "vm/exceptions.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <limits>
+#include <utility>
+
+namespace perseus
+{
+  namespace detail
+  {
+    namespace
+    {
+      /// offsets of the header fields
+      enum field_offset : std::size_t
+      {
+        magic_offset = 0,
+        version_offset = 4,
+        byte_order_offset = 8,
+        code_hash_offset = 12,
+        code_size_offset = 20,
+        instruction_pointer_offset = 28,
+        stack_size_offset = 32
+      };
+      static_assert( stack_size_offset + 8 == migration::header_size, "header fields must fill the header" );
+
+      template< typename T >
+      void write_little_endian( char* out, T value )
+      {
+        for( std::size_t i = 0; i < sizeof( T ); ++i )
+        {
+          out[ i ] = static_cast< char >( value & 0xff );
+          value >>= 8;
+        }
+      }
+
+      template< typename T >
+      T read_little_endian( const char* in )
+      {
+        T value = 0;
+        for( std::size_t i = sizeof( T ); i > 0; --i )
+        {
+          value = static_cast< T >( value << 8 ) | static_cast< unsigned char >( in[ i - 1 ] );
+        }
+        return value;
+      }
+    }
+
+    namespace migration
+    {
+      byte_order native_byte_order()
+      {
+        const std::uint16_t probe = 1;
+        unsigned char first;
+        std::memcpy( &first, &probe, 1 );
+        return first == 1 ? little_endian : big_endian;
+      }
+
+      std::size_t stream_size( const char* header )
+      {
+        if( std::memcmp( header + magic_offset, magic, sizeof( magic ) ) != 0 || read_little_endian< std::uint32_t >( header + version_offset ) != version )
+        {
+          throw invalid_migration( "Not a serialized coroutine, or one of an unsupported version!" );
+        }
+        const std::uint64_t stack_size = read_little_endian< std::uint64_t >( header + stack_size_offset );
+        if( stack_size > std::numeric_limits< std::size_t >::max() - header_size )
+        {
+          throw invalid_migration( "Serialized coroutine too big!" );
+        }
+        return header_size + static_cast< std::size_t >( stack_size );
+      }
+    }
+
+    std::vector< char > processor::save_coroutine( const coroutine::identifier id ) const
+    {
+      const coroutine& co = _coroutine_manager.get_coroutine( id );
+      if( co.current_state != coroutine::state::suspended || std::find( _suspension.chain.begin(), _suspension.chain.end(), &co ) != _suspension.chain.end() )
+      {
+        throw migrating_unsuspended_coroutine( "Trying to serialize a coroutine that isn't suspended!" );
+      }
+      std::vector< char > result( migration::header_size + co.stack.size() );
+      char* const header = result.data();
+      std::memcpy( header + magic_offset, migration::magic, sizeof( migration::magic ) );
+      write_little_endian< std::uint32_t >( header + version_offset, migration::version );
+      header[ byte_order_offset ] = static_cast< char >( migration::native_byte_order() );
+      write_little_endian< std::uint64_t >( header + code_hash_offset, snapshot::code_hash( _code ) );
+      write_little_endian< std::uint64_t >( header + code_size_offset, _code.size() );
+      write_little_endian< std::uint32_t >( header + instruction_pointer_offset, co.instruction_pointer );
+      write_little_endian< std::uint64_t >( header + stack_size_offset, co.stack.size() );
+      if( !co.stack.empty() )
+      {
+        std::memcpy( header + migration::header_size, co.stack.data(), co.stack.size() );
+      }
+      return result;
+    }
+
+    coroutine::identifier processor::restore_coroutine( const char* data, const std::size_t size )
+    {
+      if( size < migration::header_size || migration::stream_size( data ) != size )
+      {
+        throw invalid_migration( "Incomplete serialized coroutine!" );
+      }
+      if( static_cast< unsigned char >( data[ byte_order_offset ] ) != migration::native_byte_order() )
+      {
+        throw invalid_migration( "Coroutine serialized on a machine of different byte order!" );
+      }
+      if( read_little_endian< std::uint64_t >( data + code_hash_offset ) != snapshot::code_hash( _code )
+        || read_little_endian< std::uint64_t >( data + code_size_offset ) != _code.size() )
+      {
+        throw invalid_migration( "Coroutine of different code!" );
+      }
+      const instruction_pointer::value_type address = read_little_endian< std::uint32_t >( data + instruction_pointer_offset );
+      if( address > _code.size() )
+      {
+        throw invalid_migration( "Corrupt serialized coroutine!" );
+      }
+      const stack::size_type stack_size = size - migration::header_size;
+      stack st = _coroutine_manager.stacks().acquire( stack_size );
+      st.append( data + migration::header_size, stack_size );
+      return _coroutine_manager.new_coroutine( _code, address, std::move( st ) ).index;
+    }
+  }
+}
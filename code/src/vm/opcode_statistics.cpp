@@ -0,0 +1,160 @@
+#include "vm/opcode_statistics.hpp"
+
+#include <algorithm>
+#include <iomanip>
+#include <vector>
+
+namespace perseus
+{
+  namespace detail
+  {
+    constexpr std::size_t opcode_statistics::histogram_size;
+    constexpr std::uint32_t opcode_statistics::default_sample_interval;
+    constexpr std::uint32_t opcode_statistics::untimed;
+
+    namespace
+    {
+      const char* get_handler_name( const std::uint32_t handler )
+      {
+        if( handler < get_handler( opcode::opcode_end ) )
+        {
+          return get_name( static_cast< opcode >( handler ) );
+        }
+        switch( static_cast< internal_handler >( handler ) )
+        {
+        case internal_handler::fall_through:
+          return "(fall_through)";
+        case internal_handler::end_of_code:
+          return "(end_of_code)";
+        case internal_handler::truncated_instruction:
+          return "(truncated_instruction)";
+        case internal_handler::invalid_instruction:
+          return "(invalid_instruction)";
+        case internal_handler::invalid_jump_target:
+          return "(invalid_jump_target)";
+        case internal_handler::leave_engine:
+          return "(leave_engine)";
+        default:
+          return "(invalid)";
+        }
+      }
+
+      double share( const double part, const double total )
+      {
+        return total > 0 ? 100 * part / total : 0;
+      }
+    }
+
+    double opcode_statistics::handler_statistics::mean_ticks() const
+    {
+      return samples > 0 ? static_cast< double >( sampled_ticks ) / samples : 0;
+    }
+
+    double opcode_statistics::handler_statistics::estimated_ticks() const
+    {
+      return mean_ticks() * executions;
+    }
+
+    std::uint64_t opcode_statistics::handler_statistics::percentile( const double fraction ) const
+    {
+      std::uint64_t seen = 0;
+      std::size_t bucket = 0;
+      for( ; bucket + 1 < histogram_size; ++bucket )
+      {
+        seen += histogram[ bucket ];
+        if( seen >= fraction * samples )
+        {
+          break;
+        }
+      }
+      return std::uint64_t( 2 ) << bucket;
+    }
+
+    opcode_statistics::opcode_statistics( const std::uint32_t sample_interval )
+      : _sample_interval( std::max< std::uint32_t >( sample_interval, 1 ) )
+      , _countdown( _sample_interval )
+    {
+    }
+
+    void opcode_statistics::record( const std::uint64_t ticks )
+    {
+      handler_statistics& timed = _handlers[ _timed ];
+      ++timed.samples;
+      timed.sampled_ticks += ticks;
+      std::size_t bucket = 0;
+      while( bucket + 1 < histogram_size && ( ticks >> ( bucket + 1 ) ) != 0 )
+      {
+        ++bucket;
+      }
+      ++timed.histogram[ bucket ];
+      _timed = untimed;
+    }
+
+    std::uint64_t opcode_statistics::instructions() const
+    {
+      std::uint64_t result = 0;
+      for( const handler_statistics& handler : _handlers )
+      {
+        result += handler.executions;
+      }
+      return result;
+    }
+
+    void opcode_statistics::clear()
+    {
+      _handlers.fill( handler_statistics() );
+      _countdown = _sample_interval;
+      _timed = untimed;
+    }
+
+    void opcode_statistics::write_table( std::ostream& out ) const
+    {
+      std::vector< std::uint32_t > executed;
+      double total_ticks = 0;
+      for( std::uint32_t handler = 0; handler < handler_count; ++handler )
+      {
+        if( _handlers[ handler ].executions > 0 )
+        {
+          executed.push_back( handler );
+          total_ticks += _handlers[ handler ].estimated_ticks();
+        }
+      }
+      std::stable_sort( executed.begin(), executed.end(), [ this ]( const std::uint32_t lhs, const std::uint32_t rhs )
+      {
+        const handler_statistics& l = _handlers[ lhs ];
+        const handler_statistics& r = _handlers[ rhs ];
+        return l.estimated_ticks() > r.estimated_ticks() || ( l.estimated_ticks() == r.estimated_ticks() && l.executions > r.executions );
+      } );
+      const double total_executions = static_cast< double >( instructions() );
+
+      const std::ios::fmtflags flags = out.flags();
+      const std::streamsize precision = out.precision();
+      out << std::left << std::setw( 44 ) << "handler" << std::right
+        << std::setw( 14 ) << "executions" << std::setw( 8 ) << "%"
+        << std::setw( 12 ) << "mean ticks" << std::setw( 8 ) << "time %"
+        << std::setw( 10 ) << "p50 <" << std::setw( 10 ) << "p90 <" << '\n';
+      out << std::fixed << std::setprecision( 1 );
+      for( const std::uint32_t handler : executed )
+      {
+        const handler_statistics& statistics = _handlers[ handler ];
+        out << std::left << std::setw( 44 ) << get_handler_name( handler ) << std::right
+          << std::setw( 14 ) << statistics.executions
+          << std::setw( 8 ) << share( static_cast< double >( statistics.executions ), total_executions );
+        if( statistics.samples > 0 )
+        {
+          out << std::setw( 12 ) << statistics.mean_ticks()
+            << std::setw( 8 ) << share( statistics.estimated_ticks(), total_ticks )
+            << std::setw( 10 ) << statistics.percentile( 0.5 )
+            << std::setw( 10 ) << statistics.percentile( 0.9 );
+        }
+        else
+        {
+          out << std::setw( 12 ) << "-" << std::setw( 8 ) << "-" << std::setw( 10 ) << "-" << std::setw( 10 ) << "-";
+        }
+        out << '\n';
+      }
+      out.flags( flags );
+      out.precision( precision );
+    }
+  }
+}
@@ -1,335 +1,198 @@
 #include "vm/processor.hpp"
 
 #include <utility>
-#include <string>
-#include <type_traits>
-#include <cstdint>
-#include <algorithm>
-#include <iterator>
-
-#ifdef _MSC_VER
-# include <Windows.h>
-# define sys_debug_break() DebugBreak()
-#else
-# ifdef __GNUC__
-// TODO: does this always work on gcc? Maybe let cmake find out and generate a configuration file.
-#   include <csignal>
-#   define sys_debug_break() std::raise(SIGTRAP)
-# else
-// the best we can do?
-#   include <iostream>
-#   define sys_debug_break() std::cerr << "please break here" << std::endl;
-# endif
-#endif
 
 namespace perseus
 {
   namespace detail
   {
-    processor::processor( code_segment&& code, std::vector< syscall >&& syscalls )
-      : _code( std::move( code ) )
-      , _syscalls( std::move( syscalls ) )
-    {
-    }
-
-    stack processor::execute( const instruction_pointer::value_type start_address, stack&& parameters )
+    namespace
     {
-      std::vector< coroutine* > active_coroutines{ &_coroutine_manager.new_coroutine( _code, start_address, std::move( parameters ) ) };
-      while( true )
+      template< typename instrumentation >
+      void run_engine( const dispatch_engine engine, execution_state& state, instrumentation& instr )
       {
-        coroutine& co = *active_coroutines.back();
-        instruction_pointer& ip = co.instruction_pointer;
-        const opcode instruction = ip.read< opcode >();
-        switch( instruction )
-        {
-        case opcode::no_operation:
-          break;
-        case opcode::exit:
-        {
-          if( active_coroutines.size() > 1 )
-          {
-            throw exit_in_coroutine( "opcode::exit in coroutine!" );
-          }
-          stack result = std::move( co.stack );
-          co.current_state = coroutine::state::dead;
-          _coroutine_manager.delete_coroutine( co.index );
-          return result;
-        }
-        case opcode::syscall:
-        {
-          const std::uint32_t index = ip.read< std::uint32_t >();
-          if( index >= _syscalls.size() )
-          {
-            throw invalid_syscall( "Invalid syscall!" );
-          }
-          _syscalls[ index ]( co.stack );
-          break;
-        }
-        case opcode::low_level_break:
-        {
-          sys_debug_break();
-          break;
-        }
-
-        //    Coroutines
-        case opcode::absolute_coroutine:
-        case opcode::indirect_coroutine:
+        switch( engine )
         {
-          const coroutine::identifier id = _coroutine_manager.new_coroutine(
-            _code,
-            instruction == opcode::absolute_coroutine ? ip.read< instruction_pointer::value_type >() : co.stack.pop< instruction_pointer::value_type >()
-          ).index;
-          co.stack.push< coroutine::identifier >( id );
+        case dispatch_engine::computed_goto:
+          run_computed_goto_engine( state, instr );
           break;
-        }
-        case opcode::resume_coroutine:
-        case opcode::resume_pushing_everything:
-        {
-          coroutine& co_to_resume = _coroutine_manager.get_coroutine( co.stack.pop< coroutine::identifier >() );
-          if( co_to_resume.current_state == coroutine::state::live )
-          {
-            throw resuming_live_coroutine( "Trying to resume a live coroutine!" );
-          }
-          if( co_to_resume.current_state == coroutine::state::dead )
-          {
-            throw resuming_dead_coroutine( "Trying to resume a dead coroutine!" );
-          }
-          co_to_resume.stack.append( instruction == opcode::resume_coroutine ? co.stack.split( ip.read< std::uint32_t >() ) : std::move( co.stack ) );
-          co_to_resume.current_state = coroutine::state::live;
-          active_coroutines.push_back( &co_to_resume );
+        case dispatch_engine::tail_call:
+          run_tail_call_engine( state, instr );
           break;
-        }
-        case opcode::coroutine_state:
-          co.stack.push< coroutine::state >( _coroutine_manager.get_coroutine( co.stack.pop < coroutine::identifier >() ).current_state );
+        case dispatch_engine::top_of_stack:
+          run_top_of_stack_engine( state, instr );
           break;
-        case opcode::delete_coroutine:
-          _coroutine_manager.delete_coroutine( co.stack.pop< coroutine::identifier >() );
+        case dispatch_engine::jit:
+          run_jit_engine( state, instr );
           break;
-        case opcode::coroutine_return:
-        case opcode::yield:
-        {
-          // is this the root coroutine? can't leave that one without exit.
-          if( active_coroutines.size() == 1 )
-          {
-            throw no_coroutine( std::string( "Trying to " ) + ( instruction == opcode::yield ? "yield" : "return" ) + " from last coroutine!" );
-          }
-          co.current_state = instruction == opcode::yield ? coroutine::state::suspended : coroutine::state::dead;
-          active_coroutines.pop_back();
-          coroutine& previous_co = *active_coroutines.back();
-          previous_co.stack.append( co.stack.split( ip.read< std::uint32_t >() ) );
+        case dispatch_engine::switch_:
+        default:
+          run_switch_engine( state, instr );
           break;
         }
-        case opcode::push_coroutine_identifier:
-          co.stack.push< coroutine::identifier >( co.index );
-          break;
+      }
 
-        //    Push/Pop
-        case opcode::push_8:
-          co.stack.push< char >( ip.read< char >() );
-          break;
-        case opcode::push_32:
-          co.stack.push< std::int32_t >( ip.read< std::int32_t >() );
-          break;
-        case opcode::reserve:
-          co.stack.resize( co.stack.size() + ip.read< std::uint32_t >() );
-          break;
-        case opcode::pop:
-          co.stack.discard( ip.read< std::uint32_t >() );
-          break;
+      /// the instrumentation, if it's opcode_statistics, for execution_state::statistics
+      opcode_statistics* as_statistics( opcode_statistics& instr )
+      {
+        return &instr;
+      }
 
-        //    Load/Store
-        case opcode::absolute_load_current_stack:
-        case opcode::absolute_load_stack:
-        case opcode::relative_load_stack:
-        {
-          const std::uint32_t size = ip.read< std::uint32_t >();
-          // FIXME: does not catch underflow errors
-          // note: co.stack.size() would have to be from_co.stack.size(), but in the case of relative_load_stack from_co = co
-          const std::uint32_t address = instruction == opcode::relative_load_stack ? ip.read< std::int32_t >() + co.stack.size() : co.stack.pop< std::uint32_t >();
-          const coroutine& from_co = instruction == opcode::absolute_load_stack ? _coroutine_manager.get_coroutine( co.stack.pop< std::uint32_t >() ) : co;
-          if( address + size > from_co.stack.size() )
-          {
-            throw stack_segmentation_fault( "stack segmentation fault: read above top of stack" );
-          }
-          // ensure there are no iterator-invalidating reallocations during copying
-          co.stack.reserve( co.stack.size() + size );
-          std::copy( from_co.stack.begin() + address, from_co.stack.begin() + address + size, std::back_inserter( co.stack ) );
-          break;
-        }
-        case opcode::absolute_store_current_stack:
-        case opcode::absolute_store_stack:
-        case opcode::relative_store_stack:
-        {
-          const std::uint32_t size = ip.read< std::uint32_t >();
-          // FIXME: does not catch underflow errors
-          // as above: co.stack.size() should be to_co.stack.size(), but for relative_store_stack to_co = co
-          const std::uint32_t address = instruction == opcode::relative_store_stack ? ip.read< std::int32_t >() + co.stack.size() : co.stack.pop< std::uint32_t >();
-          coroutine& to_co = instruction == opcode::absolute_store_stack ? _coroutine_manager.get_coroutine( co.stack.pop< std::uint32_t >() ) : co;
-          if( address + size > to_co.stack.size() )
-          {
-            throw stack_segmentation_fault( "stack segmentation fault: write above top of stack" );
-          }
-          std::copy( co.stack.end() - size, co.stack.end(), to_co.stack.begin() + address );
-          break;
-        }
-        case opcode::push_stack_size:
-          co.stack.push< std::uint32_t >( co.stack.size() );
-          break;
+      template< typename instrumentation >
+      opcode_statistics* as_statistics( instrumentation& )
+      {
+        return nullptr;
+      }
+    }
 
-        //    Jumps/Calls
-        case opcode::absolute_jump:
-          ip = ip.read< std::uint32_t >();
-          break;
-        case opcode::relative_jump:
-          ip += ip.read< std::int32_t >();
-          break;
-        case opcode::relative_jump_if_false:
-        {
-          std::int32_t offset = ip.read< std::int32_t >();
-          if( !co.stack.pop< std::uint8_t >() )
-          {
-            ip += offset;
-          }
-          break;
-        }
-        case opcode::indirect_jump:
-          ip = co.stack.pop< std::uint32_t >();
-          break;
-        case opcode::call:
-        {
-          const std::uint32_t target_address = ip.read< std::uint32_t >();
-          co.stack.push< std::uint32_t >( ip.value() );
-          ip = target_address;
-          break;
-        }
-        case opcode::indirect_call:
-        {
-          const std::uint32_t target_address = co.stack.pop< std::uint32_t >();
-          co.stack.push< std::uint32_t >( ip.value() );
-          ip = target_address;
-          break;
-        }
-        case opcode::return_:
-        {
-          const std::uint32_t return_address = co.stack.pop< std::uint32_t >();
-          // discard parameters
-          co.stack.discard( ip.read< std::uint32_t >() );
-          ip = return_address;
-          break;
-        }
+    processor::processor( code_segment&& code, std::vector< syscall >&& syscalls, const dispatch_engine engine, const bool verify, const stack_backend backend )
+      : _code( std::move( code ) )
+      , _program( _code )
+      , _verification( verify ? verification( _program ) : verification() )
+      , _coroutine_manager( backend )
+      , _syscalls( std::move( syscalls ) )
+      , _engine( engine )
+      , _jit( engine == dispatch_engine::jit ? new jit_compiler( _program.size() ) : nullptr )
+    {
+    }
 
-        //    Boolean operations
-        case opcode::and_b:
-        {
-          const std::uint8_t op2 = co.stack.pop< std::uint8_t >(), op1 = co.stack.pop< std::uint8_t >();
-          co.stack.push< std::uint8_t >( op1 && op2 );
-          break;
-        }
-        case opcode::or_b:
-        {
-          const std::uint8_t op2 = co.stack.pop< std::uint8_t >(), op1 = co.stack.pop< std::uint8_t >();
-          co.stack.push< std::uint8_t >( op1 || op2 );
-          break;
-        }
-        case opcode::equals_b:
-        {
-          const std::uint8_t op2 = co.stack.pop< std::uint8_t >(), op1 = co.stack.pop< std::uint8_t >();
-          co.stack.push< std::uint8_t >( op1 == op2 );
-          break;
-        }
-        case opcode::not_equals_b:
-        {
-          const std::uint8_t op2 = co.stack.pop< std::uint8_t >(), op1 = co.stack.pop< std::uint8_t >();
-          co.stack.push< std::uint8_t >( op1 != op2 );
-          break;
-        }
-        case opcode::negate_b:
-          co.stack.push< std::uint8_t >( !co.stack.pop< std::uint8_t >() );
-          break;
+    stack processor::execute( const instruction_pointer::value_type start_address, stack&& parameters )
+    {
+      no_instrumentation instr;
+      return execute( start_address, std::move( parameters ), instr );
+    }
 
-        //    32 bit integer operations
-        case opcode::add_i32:
-        {
-          const std::int32_t op2 = co.stack.pop< std::int32_t >(), op1 = co.stack.pop< std::int32_t >();
-          co.stack.push< std::int32_t >( op1 + op2 );
-          break;
-        }
-        case opcode::subtract_i32:
-        {
-          const std::int32_t op2 = co.stack.pop< std::int32_t >(), op1 = co.stack.pop< std::int32_t >();
-          co.stack.push< std::int32_t >( op1 - op2 );
-          break;
-        }
-        case opcode::multiply_i32:
-        {
-          const std::int32_t op2 = co.stack.pop< std::int32_t >(), op1 = co.stack.pop< std::int32_t >();
-          co.stack.push< std::int32_t >( op1 * op2 );
-          break;
-        }
-        case opcode::divide_i32:
-        {
-          const std::int32_t op2 = co.stack.pop< std::int32_t >(), op1 = co.stack.pop< std::int32_t >();
-          if( op2 == 0 )
-          {
-            throw divide_by_zero( "divide by zero" );
-          }
-          co.stack.push< std::int32_t >( op1 / op2 );
-          break;
-        }
-        case opcode::equals_i32:
-        {
-          const std::int32_t op2 = co.stack.pop< std::int32_t >(), op1 = co.stack.pop< std::int32_t >();
-          co.stack.push< std::uint8_t >( op1 == op2 );
-          break;
-        }
-        case opcode::not_equals_i32:
-        {
-          const std::int32_t op2 = co.stack.pop< std::int32_t >(), op1 = co.stack.pop< std::int32_t >();
-          co.stack.push< std::uint8_t >( op1 != op2 );
-          break;
-        }
-        case opcode::less_than_i32:
-        {
-          const std::int32_t op2 = co.stack.pop< std::int32_t >(), op1 = co.stack.pop< std::int32_t >();
-          co.stack.push< std::uint8_t >( op1 < op2 );
-          break;
-        }
-        case opcode::less_than_or_equals_i32:
-        {
-          const std::int32_t op2 = co.stack.pop< std::int32_t >(), op1 = co.stack.pop< std::int32_t >();
-          co.stack.push< std::uint8_t >( op1 <= op2 );
-          break;
-        }
-        case opcode::greater_than_i32:
-        {
-          const std::int32_t op2 = co.stack.pop< std::int32_t >(), op1 = co.stack.pop< std::int32_t >();
-          co.stack.push< std::uint8_t >( op1 > op2 );
-          break;
-        }
-        case opcode::greater_than_or_equals_i32:
-        {
-          const std::int32_t op2 = co.stack.pop< std::int32_t >(), op1 = co.stack.pop< std::int32_t >();
-          co.stack.push< std::uint8_t >( op1 >= op2 );
-          break;
-        }
-        case opcode::negate_i32:
-          co.stack.push< std::int32_t >( -co.stack.pop< std::int32_t >() );
-          break;
-        case opcode::modulo_i32:
-        {
-          const std::int32_t op2 = co.stack.pop< std::int32_t >(), op1 = co.stack.pop< std::int32_t >();
-          if( op2 == 0 )
-          {
-            throw divide_by_zero( "divide by zero" );
-          }
-          co.stack.push< std::int32_t >( op1 % op2 );
-          break;
-        }
+    template< typename instrumentation >
+    stack processor::execute( const instruction_pointer::value_type start_address, stack&& parameters, instrumentation& instr )
+    {
+      execution_state state = start( _coroutine_manager, start_address, std::move( parameters ) );
+      stack result;
+      if( !run( state, instr, &_suspension, result ) )
+      {
+        throw_suspended();
+      }
+      return result;
+    }
 
-        default:
-          throw invalid_opcode( "Invalid opcode " + std::to_string( static_cast< std::underlying_type_t< opcode > >( instruction ) ) );
+    stack processor::execute( const instruction_pointer::value_type start_address, stack&& parameters, const execution_budget budget )
+    {
+      stack result;
+      if( !try_execute( start_address, std::move( parameters ), result, budget ) )
+      {
+        throw_suspended();
+      }
+      return result;
+    }
+
+    bool processor::try_execute( const instruction_pointer::value_type start_address, stack&& parameters, stack& result, const execution_budget budget )
+    {
+      execution_state state = start( _coroutine_manager, start_address, std::move( parameters ) );
+      state.set_budget( budget );
+      no_instrumentation instr;
+      return run( state, instr, &_suspension, result );
+    }
+
+    stack processor::resume( const execution_budget budget )
+    {
+      stack result;
+      if( !try_resume( result, budget ) )
+      {
+        throw_suspended();
+      }
+      return result;
+    }
+
+    bool processor::try_resume( stack& result, const execution_budget budget )
+    {
+      if( !is_suspended() )
+      {
+        throw invalid_suspension_state( "No suspended execution to resume!" );
+      }
+      execution_state state( _code, _program, _coroutine_manager, _syscalls, std::move( _suspension.chain ) );
+      _suspension.chain.clear();
+      state.checked = _suspension.checked;
+      state.jit = _jit.get();
+      state.profile = _profiling ? _profiler.get() : nullptr;
+      state.set_budget( budget );
+      no_instrumentation instr;
+      return run( state, instr, &_suspension, result );
+    }
+
+    void processor::start_profiling( const std::uint64_t interval )
+    {
+      _profiler.reset( new profiler( _program, interval, _function_names ) );
+      _profiling = true;
+    }
+
+    void processor::throw_suspended() const
+    {
+      if( _suspension.preempted )
+      {
+        throw budget_exhausted( "Execution preempted" );
+      }
+      throw would_block( "Execution suspended" );
+    }
+
+    stack processor::execute( coroutine_manager& coroutines, const instruction_pointer::value_type start_address, stack&& parameters ) const
+    {
+      execution_state state = start( coroutines, start_address, std::move( parameters ) );
+      // neither is thread-safe
+      state.jit = nullptr;
+      state.profile = nullptr;
+      state.set_budget( execution_budget() );
+      no_instrumentation instr;
+      stack result;
+      if( !run( state, instr, nullptr, result ) )
+      {
+        throw would_block( "Execution can't be suspended" );
+      }
+      return result;
+    }
+
+    execution_state processor::start( coroutine_manager& coroutines, const instruction_pointer::value_type start_address, stack&& parameters ) const
+    {
+      if( &coroutines == &_coroutine_manager && is_suspended() )
+      {
+        throw invalid_suspension_state( "Can't start a new execution while one is suspended!" );
+      }
+      const bool verified = _verification.is_verified( start_address, parameters.size() );
+      execution_state state( _code, _program, coroutines, _syscalls, coroutines.new_coroutine( _code, start_address, std::move( parameters ) ) );
+      state.checked = !verified;
+      state.jit = _jit.get();
+      state.profile = _profiling ? _profiler.get() : nullptr;
+      state.set_budget( execution_budget() );
+      return state;
+    }
+
+    template< typename instrumentation >
+    bool processor::run( execution_state& state, instrumentation& instr, suspension* suspended, stack& result ) const
+    {
+      state.statistics = as_statistics( instr );
+      // the JIT engine needs a JIT
+      const dispatch_engine engine = _engine == dispatch_engine::jit && !state.jit ? dispatch_engine::switch_ : _engine;
+      run_engine( engine, state, instr );
+      if( !state.finished && !state.suspended )
+      {
+        // the unchecked instructions encountered something the verification didn't account for
+        state.checked = true;
+        run_engine( engine, state, instr );
+      }
+      if( state.suspended )
+      {
+        if( suspended )
+        {
+          suspended->chain = std::move( state.active_coroutines );
+          suspended->checked = state.checked;
+          suspended->preempted = state.preempted;
         }
+        return false;
       }
+      result = std::move( state.result );
+      return true;
     }
+
+    template stack processor::execute< no_instrumentation >( const instruction_pointer::value_type, stack&&, no_instrumentation& );
+    template stack processor::execute< instruction_counter >( const instruction_pointer::value_type, stack&&, instruction_counter& );
+    template stack processor::execute< opcode_statistics >( const instruction_pointer::value_type, stack&&, opcode_statistics& );
   }
 }
@@ -0,0 +1,99 @@
+#include "vm/profiler.hpp"
+#include "vm/exceptions.hpp"
+
+#include <cstring>
+#include <ios>
+#include <utility>
+
+namespace perseus
+{
+  namespace detail
+  {
+    constexpr instruction_pointer::value_type profiler::unknown_caller;
+    constexpr std::size_t profiler::max_depth;
+
+    profiler::profiler( const decoded_code& program, const std::uint64_t interval, function_names names )
+      : _interval( interval > 0 ? interval : 1 )
+      , _layout( program )
+      , _names( std::move( names ) )
+    {
+    }
+
+    void profiler::sample( const decoded_code& program, const decoded_instruction* position, const stack& st, const std::size_t stack_size )
+    {
+      _frames.clear();
+      std::uint32_t index = static_cast< std::uint32_t >( position - program.data() );
+      // the stack size at the current position of each frame
+      std::size_t size = stack_size;
+      bool complete = false;
+      while( _frames.size() < max_depth )
+      {
+        std::uint32_t function;
+        std::int64_t depth;
+        if( !_layout.get_frame( index, function, depth ) || depth < 0 || static_cast< std::uint64_t >( depth ) > size )
+        {
+          break;
+        }
+        _frames.push_back( program.address_of( program.data() + function ) );
+        std::uint32_t argument_size;
+        if( !_layout.get_argument_size( function, argument_size ) )
+        {
+          // the outermost function
+          complete = true;
+          break;
+        }
+        // stack: [caller's frame] [arguments] [return address] [depth bytes]
+        const std::size_t start = size - static_cast< std::size_t >( depth );
+        if( start < sizeof( instruction_pointer::value_type ) + argument_size || start > st.size() )
+        {
+          break;
+        }
+        instruction_pointer::value_type return_address;
+        std::memcpy( &return_address, st.data() + start - sizeof( return_address ), sizeof( return_address ) );
+        try
+        {
+          index = static_cast< std::uint32_t >( program.at( return_address ) - program.data() );
+        }
+        catch( code_segmentation_fault& )
+        {
+          break;
+        }
+        // the caller continues once the arguments are popped
+        size = start - sizeof( return_address ) - argument_size;
+      }
+      if( !complete )
+      {
+        _frames.push_back( unknown_caller );
+      }
+      ++_profile[ std::vector< instruction_pointer::value_type >( _frames.rbegin(), _frames.rend() ) ];
+      ++_samples;
+    }
+
+    void profiler::write_collapsed( std::ostream& out ) const
+    {
+      for( const auto& entry : _profile )
+      {
+        const char* separator = "";
+        for( const instruction_pointer::value_type function : entry.first )
+        {
+          out << separator;
+          separator = ";";
+          const auto name = _names.find( function );
+          if( function == unknown_caller )
+          {
+            out << "[unknown]";
+          }
+          else if( name != _names.end() )
+          {
+            out << name->second;
+          }
+          else
+          {
+            out << "0x" << std::hex << function << std::dec;
+          }
+        }
+        out << ' ' << entry.second << '\n';
+      }
+    }
+  }
+}
@@ -0,0 +1,144 @@
+#include "vm/scheduler.hpp"
+
+#include <exception>
+#include <utility>
+
+namespace perseus
+{
+  namespace detail
+  {
+    namespace
+    {
+      /// the scheduler whose worker the current thread is, if any
+      thread_local const scheduler* current_scheduler = nullptr;
+      /// the index of the current thread's worker in current_scheduler
+      thread_local std::size_t current_worker = 0;
+    }
+
+    scheduler::scheduler( const processor& proc, const std::size_t threads )
+      : _processor( proc )
+    {
+      const std::size_t count = std::max< std::size_t >( threads, 1 );
+      _workers.reserve( count );
+      // disjoint slot indices keep identifiers from being valid on another worker
+      const coroutine::identifier share = coroutine::identifier( coroutine_manager::max_coroutines / count );
+      for( std::size_t i = 0; i < count; ++i )
+      {
+        _workers.emplace_back( new worker( proc.backend(), coroutine::identifier( i ) * share, share ) );
+      }
+      try
+      {
+        for( std::size_t i = 0; i < count; ++i )
+        {
+          _workers[ i ]->thread = std::thread( &scheduler::work, this, i );
+        }
+      }
+      catch( ... )
+      {
+        stop();
+        throw;
+      }
+    }
+
+    scheduler::~scheduler()
+    {
+      stop();
+    }
+
+    void scheduler::stop()
+    {
+      {
+        std::lock_guard< std::mutex > lock( _idle_mutex );
+        _stopping = true;
+      }
+      _wake.notify_all();
+      for( std::unique_ptr< worker >& w : _workers )
+      {
+        if( w->thread.joinable() )
+        {
+          w->thread.join();
+        }
+      }
+    }
+
+    std::future< stack > scheduler::submit( const instruction_pointer::value_type start_address, stack&& parameters )
+    {
+      const std::size_t index = current_scheduler == this ? current_worker : _next_worker++ % _workers.size();
+      worker& w = *_workers[ index ];
+      std::future< stack > result;
+      {
+        std::lock_guard< std::mutex > lock( w.mutex );
+        w.tasks.push_back( task{ start_address, std::move( parameters ), std::promise< stack >() } );
+        result = w.tasks.back().result.get_future();
+      }
+      ++_queued;
+      {
+        // a worker about to sleep has either seen the new count or is already waiting
+        std::lock_guard< std::mutex > lock( _idle_mutex );
+      }
+      _wake.notify_one();
+      return result;
+    }
+
+    bool scheduler::take( const std::size_t index, task& out )
+    {
+      {
+        worker& own = *_workers[ index ];
+        std::lock_guard< std::mutex > lock( own.mutex );
+        if( !own.tasks.empty() )
+        {
+          out = std::move( own.tasks.back() );
+          own.tasks.pop_back();
+          --_queued;
+          return true;
+        }
+      }
+      for( std::size_t offset = 1; offset < _workers.size(); ++offset )
+      {
+        worker& victim = *_workers[ ( index + offset ) % _workers.size() ];
+        std::lock_guard< std::mutex > lock( victim.mutex );
+        if( !victim.tasks.empty() )
+        {
+          out = std::move( victim.tasks.front() );
+          victim.tasks.pop_front();
+          --_queued;
+          ++_steals;
+          return true;
+        }
+      }
+      return false;
+    }
+
+    void scheduler::work( const std::size_t index )
+    {
+      current_scheduler = this;
+      current_worker = index;
+      worker& self = *_workers[ index ];
+      task t{ 0, stack(), std::promise< stack >() };
+      while( true )
+      {
+        if( take( index, t ) )
+        {
+          try
+          {
+            t.result.set_value( _processor.execute( self.coroutines, t.start_address, std::move( t.parameters ) ) );
+          }
+          catch( ... )
+          {
+            t.result.set_exception( std::current_exception() );
+          }
+          // the task's coroutines must not be visible to the next one
+          self.coroutines.clear();
+          continue;
+        }
+        std::unique_lock< std::mutex > lock( _idle_mutex );
+        if( _stopping && _queued == 0 )
+        {
+          break;
+        }
+        _wake.wait( lock, [ this ](){ return _stopping || _queued != 0; } );
+      }
+      current_scheduler = nullptr;
+    }
+  }
+}
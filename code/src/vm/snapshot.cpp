@@ -0,0 +1,587 @@
+#include "vm/snapshot.hpp"
+#include "vm/processor.hpp"
+#include "vm/exceptions.hpp"
+#include "vm/file_mapping.hpp"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <sstream>
+#include <system_error>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace perseus
+{
+  namespace detail
+  {
+    namespace snapshot
+    {
+      std::uint64_t code_hash( const code_segment& code )
+      {
+        std::uint64_t hash = 14695981039346656037ull;
+        for( const char c : code )
+        {
+          hash ^= static_cast< unsigned char >( c );
+          hash *= 1099511628211ull;
+        }
+        return hash;
+      }
+    }
+
+    namespace
+    {
+      std::uint64_t page_size()
+      {
+        return static_cast< std::uint64_t >( sysconf( _SC_PAGESIZE ) );
+      }
+
+      std::uint64_t round_up( const std::uint64_t value, const std::uint64_t page )
+      {
+        return ( value + page - 1 ) / page * page;
+      }
+
+      void write_all( const int descriptor, const char* data, std::size_t size, std::uint64_t offset )
+      {
+        while( size > 0 )
+        {
+          const ssize_t written = pwrite( descriptor, data, size, static_cast< off_t >( offset ) );
+          if( written < 0 )
+          {
+            if( errno == EINTR )
+            {
+              continue;
+            }
+            throw std::system_error( errno, std::system_category(), "pwrite" );
+          }
+          data += written;
+          size -= written;
+          offset += written;
+        }
+      }
+
+      /**
+      @brief A temporary file next to the given path that replace() renames to it, or that's removed on destruction.
+
+      The file at the path stays intact until the replacement is complete, so a failed or interrupted save doesn't lose the previous one. Stacks restored from it may still be mapping it, too; they keep the old file alive until they're gone.
+      */
+      class replacement_file
+      {
+      public:
+        explicit replacement_file( const std::string& path )
+          : _path( path )
+          , _temporary( temporary_path( path ) )
+          , _file( open( _temporary.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0666 ) )
+        {
+          if( _file.descriptor < 0 )
+          {
+            throw std::system_error( errno, std::system_category(), "open" );
+          }
+        }
+
+        ~replacement_file()
+        {
+          if( !_replaced )
+          {
+            unlink( _temporary.c_str() );
+          }
+        }
+
+        int descriptor() const
+        {
+          return _file.descriptor;
+        }
+
+        void replace()
+        {
+          if( std::rename( _temporary.c_str(), _path.c_str() ) != 0 )
+          {
+            throw std::system_error( errno, std::system_category(), "rename" );
+          }
+          _replaced = true;
+        }
+
+      private:
+        static std::string temporary_path( const std::string& path )
+        {
+          std::random_device random;
+          std::ostringstream result;
+          result << path << ".tmp" << std::hex << random() << random();
+          return result.str();
+        }
+
+        const std::string _path;
+        const std::string _temporary;
+        const file _file;
+        bool _replaced = false;
+      };
+
+      [[noreturn]] void corrupt()
+      {
+        throw invalid_snapshot( "Corrupt snapshot!" );
+      }
+
+      /// a random, non-zero header::checkpoint
+      std::uint64_t new_checkpoint()
+      {
+        std::random_device random;
+        std::uint64_t result = 0;
+        while( result == 0 )
+        {
+          result = std::uint64_t( random() ) << 32 | random();
+        }
+        return result;
+      }
+
+      /**
+      @brief Reads and checks the header, the slot records and the chain, which snapshots and deltas share
+      @param magic snapshot::magic or snapshot::delta_magic
+      @returns the header
+      */
+      snapshot::header read_tables( const char* data, const std::uint64_t file_size, const char* magic, const code_segment& code, std::vector< snapshot::slot >& slots, std::vector< coroutine::identifier >& chain )
+      {
+        if( file_size < sizeof( snapshot::header ) )
+        {
+          throw invalid_snapshot( "Truncated snapshot!" );
+        }
+        snapshot::header header;
+        std::memcpy( &header, data, sizeof( header ) );
+        if( std::memcmp( header.magic, magic, sizeof( header.magic ) ) != 0 || header.version != snapshot::version )
+        {
+          throw invalid_snapshot( "Not a snapshot, or one of an unsupported version!" );
+        }
+        if( header.code_hash != snapshot::code_hash( code ) || header.code_size != code.size() )
+        {
+          throw invalid_snapshot( "Snapshot of different code!" );
+        }
+        if( header.used_slots > coroutine_manager::max_coroutines || header.coroutines > header.used_slots || header.chain_length > header.coroutines )
+        {
+          corrupt();
+        }
+        const std::uint64_t chain_offset = sizeof( snapshot::header ) + std::uint64_t( header.used_slots ) * sizeof( snapshot::slot );
+        if( chain_offset + std::uint64_t( header.chain_length ) * sizeof( coroutine::identifier ) > file_size )
+        {
+          throw invalid_snapshot( "Truncated snapshot!" );
+        }
+        slots.resize( header.used_slots );
+        if( !slots.empty() )
+        {
+          std::memcpy( slots.data(), data + sizeof( snapshot::header ), slots.size() * sizeof( snapshot::slot ) );
+        }
+        for( const snapshot::slot& record : slots )
+        {
+          if( record.occupied && ( record.state > static_cast< std::uint8_t >( coroutine::state::dead ) || record.instruction_pointer > code.size() || record.stack_offset > file_size ) )
+          {
+            corrupt();
+          }
+        }
+        chain.resize( header.chain_length );
+        if( !chain.empty() )
+        {
+          std::memcpy( chain.data(), data + chain_offset, chain.size() * sizeof( coroutine::identifier ) );
+        }
+        return header;
+      }
+
+      /// applies the changed ranges of a stack in a delta, starting at the given offset
+      void apply_ranges( stack& st, const char* data, const std::uint64_t file_size, std::uint64_t offset )
+      {
+        std::uint64_t count;
+        if( file_size - offset < sizeof( count ) )
+        {
+          throw invalid_snapshot( "Truncated snapshot!" );
+        }
+        std::memcpy( &count, data + offset, sizeof( count ) );
+        offset += sizeof( count );
+        if( count > ( file_size - offset ) / sizeof( snapshot::range ) )
+        {
+          throw invalid_snapshot( "Truncated snapshot!" );
+        }
+        std::uint64_t bytes = offset + count * sizeof( snapshot::range );
+        for( std::uint64_t i = 0; i < count; ++i )
+        {
+          snapshot::range r;
+          std::memcpy( &r, data + offset + i * sizeof( r ), sizeof( r ) );
+          if( r.offset > st.size() || r.size > st.size() - r.offset )
+          {
+            corrupt();
+          }
+          if( r.size > file_size - bytes )
+          {
+            throw invalid_snapshot( "Truncated snapshot!" );
+          }
+          std::memcpy( st.data() + r.offset, data + bytes, static_cast< std::size_t >( r.size ) );
+          bytes += r.size;
+        }
+      }
+    }
+
+    snapshot::header processor::snapshot_tables( std::vector< snapshot::slot >& slots ) const
+    {
+      const coroutine_manager& manager = _coroutine_manager;
+      snapshot::header header{};
+      header.version = snapshot::version;
+      header.code_hash = snapshot::code_hash( _code );
+      header.code_size = _code.size();
+      header.used_slots = manager._used_slots;
+      header.coroutines = manager._size;
+      header.first_free = manager._first_free;
+      header.last_free = manager._last_free;
+      header.chain_length = static_cast< std::uint32_t >( _suspension.chain.size() );
+      header.checked = _suspension.checked;
+      header.preempted = _suspension.preempted;
+
+      slots.assign( manager._used_slots, snapshot::slot{} );
+      for( coroutine::identifier index = 0; index < manager._used_slots; ++index )
+      {
+        coroutine_manager::slot& s = manager.get_slot( index );
+        snapshot::slot& record = slots[ index ];
+        record.generation = s.generation;
+        record.next_free = s.next_free;
+        record.occupied = s.occupied;
+        if( s.occupied )
+        {
+          const coroutine& co = s.get();
+          record.state = static_cast< std::uint8_t >( co.current_state );
+          record.instruction_pointer = co.instruction_pointer;
+          record.stack_size = co.stack.size();
+        }
+      }
+      return header;
+    }
+
+    void processor::start_checkpoint( const std::uint64_t checkpoint )
+    {
+      for( coroutine::identifier index = 0; index < _coroutine_manager._used_slots; ++index )
+      {
+        coroutine_manager::slot& s = _coroutine_manager.get_slot( index );
+        if( s.occupied )
+        {
+          s.get().stack.clear_dirty();
+        }
+      }
+      _checkpoint = checkpoint;
+    }
+
+    void processor::save_snapshot( const std::string& path )
+    {
+      const coroutine_manager& manager = _coroutine_manager;
+      const std::uint64_t page = page_size();
+
+      std::vector< snapshot::slot > slots;
+      snapshot::header header = snapshot_tables( slots );
+      std::memcpy( header.magic, snapshot::magic, sizeof( header.magic ) );
+      header.page_size = static_cast< std::uint32_t >( page );
+      header.checkpoint = new_checkpoint();
+
+      // small stacks are packed behind the table and the chain, big ones get whole pages
+      const std::uint64_t table_size = sizeof( snapshot::header ) + slots.size() * sizeof( snapshot::slot ) + _suspension.chain.size() * sizeof( coroutine::identifier );
+      std::uint64_t packed_size = table_size;
+      for( snapshot::slot& record : slots )
+      {
+        if( record.occupied && record.stack_size < page )
+        {
+          record.stack_offset = packed_size;
+          packed_size += record.stack_size;
+        }
+      }
+      std::uint64_t file_size = round_up( packed_size, page );
+      for( snapshot::slot& record : slots )
+      {
+        if( record.occupied && record.stack_size >= page )
+        {
+          record.stack_offset = file_size;
+          file_size += round_up( record.stack_size, page );
+        }
+      }
+
+      std::vector< char > packed( packed_size );
+      char* out = packed.data();
+      std::memcpy( out, &header, sizeof( header ) );
+      out += sizeof( header );
+      if( !slots.empty() )
+      {
+        std::memcpy( out, slots.data(), slots.size() * sizeof( snapshot::slot ) );
+        out += slots.size() * sizeof( snapshot::slot );
+      }
+      for( const coroutine* co : _suspension.chain )
+      {
+        std::memcpy( out, &co->index, sizeof( coroutine::identifier ) );
+        out += sizeof( coroutine::identifier );
+      }
+      for( coroutine::identifier index = 0; index < manager._used_slots; ++index )
+      {
+        const snapshot::slot& record = slots[ index ];
+        if( record.occupied && record.stack_size > 0 && record.stack_size < page )
+        {
+          std::memcpy( packed.data() + record.stack_offset, manager.get_slot( index ).get().stack.data(), record.stack_size );
+        }
+      }
+
+      replacement_file f( path );
+      write_all( f.descriptor(), packed.data(), packed.size(), 0 );
+      for( coroutine::identifier index = 0; index < manager._used_slots; ++index )
+      {
+        const snapshot::slot& record = slots[ index ];
+        if( record.occupied && record.stack_size >= page )
+        {
+          write_all( f.descriptor(), manager.get_slot( index ).get().stack.data(), record.stack_size, record.stack_offset );
+        }
+      }
+      // the padding after the last big stack, so its last page can be mapped
+      if( ftruncate( f.descriptor(), static_cast< off_t >( file_size ) ) != 0 )
+      {
+        throw std::system_error( errno, std::system_category(), "ftruncate" );
+      }
+      f.replace();
+      start_checkpoint( header.checkpoint );
+    }
+
+    void processor::save_delta( const std::string& path )
+    {
+      if( _checkpoint == 0 )
+      {
+        throw no_base_snapshot( "No snapshot to save the changes of!" );
+      }
+      const coroutine_manager& manager = _coroutine_manager;
+
+      std::vector< snapshot::slot > slots;
+      snapshot::header header = snapshot_tables( slots );
+      std::memcpy( header.magic, snapshot::delta_magic, sizeof( header.magic ) );
+      header.page_size = static_cast< std::uint32_t >( stack::dirty_page_size );
+      header.checkpoint = new_checkpoint();
+      header.previous = _checkpoint;
+
+      // each stack's ranges, followed by their bytes, behind the table and the chain
+      std::vector< std::vector< std::pair< stack::size_type, stack::size_type > > > ranges( slots.size() );
+      std::uint64_t file_size = sizeof( snapshot::header ) + slots.size() * sizeof( snapshot::slot ) + _suspension.chain.size() * sizeof( coroutine::identifier );
+      for( coroutine::identifier index = 0; index < manager._used_slots; ++index )
+      {
+        snapshot::slot& record = slots[ index ];
+        if( !record.occupied )
+        {
+          continue;
+        }
+        ranges[ index ] = manager.get_slot( index ).get().stack.dirty_ranges();
+        record.stack_offset = file_size;
+        file_size += sizeof( std::uint64_t ) + ranges[ index ].size() * sizeof( snapshot::range );
+        for( const auto& r : ranges[ index ] )
+        {
+          file_size += r.second;
+        }
+      }
+
+      std::vector< char > contents( file_size );
+      char* out = contents.data();
+      std::memcpy( out, &header, sizeof( header ) );
+      out += sizeof( header );
+      if( !slots.empty() )
+      {
+        std::memcpy( out, slots.data(), slots.size() * sizeof( snapshot::slot ) );
+        out += slots.size() * sizeof( snapshot::slot );
+      }
+      for( const coroutine* co : _suspension.chain )
+      {
+        std::memcpy( out, &co->index, sizeof( coroutine::identifier ) );
+        out += sizeof( coroutine::identifier );
+      }
+      for( coroutine::identifier index = 0; index < manager._used_slots; ++index )
+      {
+        if( !slots[ index ].occupied )
+        {
+          continue;
+        }
+        const std::uint64_t count = ranges[ index ].size();
+        std::memcpy( out, &count, sizeof( count ) );
+        out += sizeof( count );
+        for( const auto& r : ranges[ index ] )
+        {
+          const snapshot::range record{ r.first, r.second };
+          std::memcpy( out, &record, sizeof( record ) );
+          out += sizeof( record );
+        }
+        const stack& st = manager.get_slot( index ).get().stack;
+        for( const auto& r : ranges[ index ] )
+        {
+          std::memcpy( out, st.data() + r.first, r.second );
+          out += r.second;
+        }
+      }
+
+      replacement_file f( path );
+      write_all( f.descriptor(), contents.data(), contents.size(), 0 );
+      f.replace();
+      start_checkpoint( header.checkpoint );
+    }
+
+    void processor::restore_snapshot( const std::string& path, const std::vector< std::string >& deltas )
+    {
+      // built on the side, so this processor stays unchanged if anything goes wrong
+      coroutine_manager restored( backend() );
+      std::vector< snapshot::slot > slots;
+      std::vector< coroutine::identifier > chain_ids;
+      // one per slot, empty for free ones
+      std::vector< stack > stacks;
+      snapshot::header header;
+      {
+        const file f( open( path.c_str(), O_RDONLY | O_CLOEXEC ) );
+        if( f.descriptor < 0 )
+        {
+          throw std::system_error( errno, std::system_category(), "open" );
+        }
+        const std::uint64_t file_size = f.size();
+        if( file_size < sizeof( snapshot::header ) )
+        {
+          throw invalid_snapshot( "Truncated snapshot!" );
+        }
+        const file_mapping mapping( f.descriptor, static_cast< std::size_t >( file_size ) );
+        const char* const data = static_cast< const char* >( mapping.data );
+        header = read_tables( data, file_size, snapshot::magic, _code, slots, chain_ids );
+
+        const std::uint64_t page = page_size();
+        const bool map_stacks = backend() == stack_backend::reserved;
+        stacks.resize( slots.size() );
+        for( std::size_t index = 0; index < slots.size(); ++index )
+        {
+          const snapshot::slot& record = slots[ index ];
+          if( !record.occupied )
+          {
+            continue;
+          }
+          if( record.stack_size > file_size - record.stack_offset )
+          {
+            corrupt();
+          }
+          stack& st = stacks[ index ];
+          if( map_stacks && record.stack_size >= page && record.stack_offset % page == 0 && round_up( record.stack_offset + record.stack_size, page ) <= file_size )
+          {
+            st = stack( f.descriptor, record.stack_offset, static_cast< stack::size_type >( record.stack_size ) );
+          }
+          else
+          {
+            st = restored._stacks.acquire( static_cast< stack::size_type >( record.stack_size ) );
+            st.append( data + record.stack_offset, static_cast< stack::size_type >( record.stack_size ) );
+          }
+        }
+      }
+
+      for( const std::string& delta_path : deltas )
+      {
+        const file f( open( delta_path.c_str(), O_RDONLY | O_CLOEXEC ) );
+        if( f.descriptor < 0 )
+        {
+          throw std::system_error( errno, std::system_category(), "open" );
+        }
+        const std::uint64_t file_size = f.size();
+        if( file_size < sizeof( snapshot::header ) )
+        {
+          throw invalid_snapshot( "Truncated snapshot!" );
+        }
+        const file_mapping mapping( f.descriptor, static_cast< std::size_t >( file_size ) );
+        const char* const data = static_cast< const char* >( mapping.data );
+        std::vector< snapshot::slot > delta_slots;
+        const snapshot::header delta_header = read_tables( data, file_size, snapshot::delta_magic, _code, delta_slots, chain_ids );
+        if( delta_header.previous != header.checkpoint )
+        {
+          throw invalid_snapshot( "Delta doesn't follow the previous file!" );
+        }
+        std::vector< stack > delta_stacks( delta_slots.size() );
+        for( std::size_t index = 0; index < delta_slots.size(); ++index )
+        {
+          const snapshot::slot& record = delta_slots[ index ];
+          if( !record.occupied )
+          {
+            continue;
+          }
+          // coroutines created since have all of their stack in the delta, so whatever was in the slot before is fine
+          stack& st = delta_stacks[ index ];
+          st = index < stacks.size() && slots[ index ].occupied ? std::move( stacks[ index ] ) : restored._stacks.acquire( static_cast< stack::size_type >( record.stack_size ) );
+          st.resize( static_cast< stack::size_type >( record.stack_size ) );
+          apply_ranges( st, data, file_size, record.stack_offset );
+        }
+        header = delta_header;
+        slots = std::move( delta_slots );
+        stacks = std::move( delta_stacks );
+      }
+
+      const coroutine::identifier chunks = ( header.used_slots + coroutine_manager::chunk_size - 1 ) / coroutine_manager::chunk_size;
+      restored._chunks.reserve( chunks );
+      for( coroutine::identifier chunk = 0; chunk < chunks; ++chunk )
+      {
+        restored._chunks.emplace_back( new coroutine_manager::slot[ coroutine_manager::chunk_size ] );
+      }
+      restored._used_slots = header.used_slots;
+      for( coroutine::identifier index = 0; index < header.used_slots; ++index )
+      {
+        const snapshot::slot& record = slots[ index ];
+        if( record.generation > coroutine_manager::max_generation )
+        {
+          corrupt();
+        }
+        coroutine_manager::slot& s = restored.get_slot( index );
+        s.generation = record.generation;
+        s.next_free = record.next_free;
+        if( !record.occupied )
+        {
+          continue;
+        }
+        new( &s.storage ) coroutine( record.generation << coroutine_manager::index_bits | ( restored._first_index + index ), _code, record.instruction_pointer, std::move( stacks[ index ] ) );
+        s.occupied = true;
+        ++restored._size;
+        s.get().current_state = static_cast< coroutine::state >( record.state );
+      }
+      if( restored._size != header.coroutines )
+      {
+        corrupt();
+      }
+
+      // the free list must only contain free slots, once each
+      coroutine::identifier last = coroutine_manager::no_slot;
+      coroutine::identifier steps = 0;
+      for( coroutine::identifier index = header.first_free; index != coroutine_manager::no_slot; index = restored.get_slot( index ).next_free )
+      {
+        if( index >= header.used_slots || ++steps > header.used_slots )
+        {
+          corrupt();
+        }
+        const coroutine_manager::slot& s = restored.get_slot( index );
+        if( s.occupied )
+        {
+          corrupt();
+        }
+        last = index;
+      }
+      if( last != header.last_free )
+      {
+        corrupt();
+      }
+      restored._first_free = header.first_free;
+      restored._last_free = header.last_free;
+
+      std::vector< coroutine* > chain;
+      chain.reserve( chain_ids.size() );
+      for( const coroutine::identifier id : chain_ids )
+      {
+        coroutine_manager::slot* const s = restored.find( id );
+        if( !s || s->get().current_state == coroutine::state::dead )
+        {
+          corrupt();
+        }
+        chain.push_back( &s->get() );
+      }
+
+      // the pool stays
+      std::swap( restored._stacks, _coroutine_manager._stacks );
+      _coroutine_manager = std::move( restored );
+      _suspension.chain = std::move( chain );
+      // the file's stacks haven't been verified, so an execution that was running unchecked mustn't continue that way
+      _suspension.checked = true;
+      _suspension.preempted = header.preempted != 0;
+      start_checkpoint( header.checkpoint );
+    }
+  }
+}
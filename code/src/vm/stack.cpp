@@ -1,21 +1,163 @@
 #include "vm/stack.hpp"
 
 #include <utility>
+#include <algorithm>
+#include <functional>
+#include <limits>
+#include <new>
+#include <cstdlib>
+#include <cerrno>
+#include <system_error>
+
+#if defined( __unix__ ) || defined( __APPLE__ )
+# include <sys/mman.h>
+# include <unistd.h>
+/// Defined if reserved stacks are mapped with a guard page
+# define PERSEUS_HAS_MMAP_STACKS
+#endif
 
 namespace perseus
 {
+  namespace
+  {
+    /// Smallest capacity of heap stacks, so the first few pushes don't all reallocate
+    constexpr stack::size_type min_heap_capacity = 64;
+
+#ifdef PERSEUS_HAS_MMAP_STACKS
+    stack::size_type page_size()
+    {
+      static const stack::size_type size = static_cast< stack::size_type >( sysconf( _SC_PAGESIZE ) );
+      return size;
+    }
+#endif
+  }
+
+  constexpr stack::size_type stack::default_reserved_capacity;
+  constexpr stack::size_type stack::dirty_page_size;
+
+  stack::stack( const stack_backend backend, const size_type reserved_capacity )
+    : _backend( backend )
+  {
+    if( backend != stack_backend::reserved )
+    {
+      return;
+    }
+#ifdef PERSEUS_HAS_MMAP_STACKS
+    const size_type page = page_size();
+    const size_type capacity = std::max( ( reserved_capacity + page - 1 ) / page * page, page );
+    // MAP_NORESERVE: nothing is committed until it's written to
+    void* memory = mmap( nullptr, capacity + page, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0 );
+    if( memory == MAP_FAILED )
+    {
+      throw std::bad_alloc();
+    }
+    char* const data = static_cast< char* >( memory );
+    if( mprotect( data + capacity, page, PROT_NONE ) != 0 )
+    {
+      munmap( memory, capacity + page );
+      throw std::bad_alloc();
+    }
+    _data = data;
+    _capacity = capacity;
+#else
+    _data = static_cast< char* >( std::malloc( reserved_capacity ) );
+    if( !_data && reserved_capacity > 0 )
+    {
+      throw std::bad_alloc();
+    }
+    _capacity = reserved_capacity;
+#endif
+  }
+
+  stack::stack( const int file_descriptor, const std::uint64_t offset, const size_type size, const size_type reserved_capacity )
+    : stack( stack_backend::reserved, std::max( reserved_capacity, size ) )
+  {
+#ifdef PERSEUS_HAS_MMAP_STACKS
+    const size_type page = page_size();
+    const size_type mapped_size = ( size + page - 1 ) / page * page;
+    // replaces the start of the reservation, leaving the rest and the guard page as they are
+    if( mapped_size > 0 && mmap( _data, mapped_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, file_descriptor, static_cast< off_t >( offset ) ) == MAP_FAILED )
+    {
+      throw std::system_error( errno, std::system_category(), "mmap" );
+    }
+    _size = size;
+    _mapped_from_file = mapped_size > 0;
+#else
+    throw std::system_error( std::make_error_code( std::errc::function_not_supported ), "mmap" );
+#endif
+  }
+
+  stack::~stack()
+  {
+    release();
+  }
 
   stack::stack( stack&& rhs )
-    : std::vector< char >( std::move( rhs ) )
+    : _data( rhs._data )
+    , _size( rhs._size )
+    , _capacity( rhs._capacity )
+    , _backend( rhs._backend )
+    , _clean_size( rhs._clean_size )
+    , _dirty_pages( std::move( rhs._dirty_pages ) )
+    , _mapped_from_file( rhs._mapped_from_file )
   {
+    rhs._data = nullptr;
+    rhs._size = rhs._capacity = rhs._clean_size = 0;
+    rhs._backend = stack_backend::heap;
+    rhs._dirty_pages.clear();
+    rhs._mapped_from_file = false;
   }
 
   stack& stack::operator=( stack&& rhs )
   {
-    std::vector< char >::operator=( std::move( rhs ) );
+    if( this != &rhs )
+    {
+      release();
+      _data = rhs._data;
+      _size = rhs._size;
+      _capacity = rhs._capacity;
+      _backend = rhs._backend;
+      _clean_size = rhs._clean_size;
+      _dirty_pages = std::move( rhs._dirty_pages );
+      _mapped_from_file = rhs._mapped_from_file;
+      rhs._data = nullptr;
+      rhs._size = rhs._capacity = rhs._clean_size = 0;
+      rhs._backend = stack_backend::heap;
+      rhs._dirty_pages.clear();
+      rhs._mapped_from_file = false;
+    }
     return *this;
   }
 
+  bool stack::clear_and_decommit( const size_type keep ) noexcept
+  {
+    clear();
+#ifdef PERSEUS_HAS_MMAP_STACKS
+    if( _backend != stack_backend::reserved )
+    {
+      return true;
+    }
+    const size_type page = page_size();
+    // pages mapped from a file would keep using it, and MADV_DONTNEED would only reload them from there
+    const size_type offset = _mapped_from_file ? 0 : ( std::min( keep, _capacity ) + page - 1 ) / page * page;
+    if( offset == _capacity )
+    {
+      return true;
+    }
+    if( mmap( _data + offset, _capacity - offset, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_FIXED, -1, 0 ) == MAP_FAILED )
+    {
+      return false;
+    }
+    _mapped_from_file = false;
+#endif
+    return true;
+  }
+
+  stack::size_type stack::max_size() const
+  {
+    return _backend == stack_backend::reserved ? _capacity : std::numeric_limits< size_type >::max();
+  }
+
   stack& stack::discard( size_type bytes )
   {
     if( size() < bytes )
@@ -37,14 +179,134 @@ namespace perseus
 
   stack& stack::append( const stack& other )
   {
-    insert( end(), other.begin(), other.end() );
+    return append( other.data(), other.size() );
+  }
+
+  stack& stack::append( const_pointer bytes, const size_type size )
+  {
+    if( _capacity - _size < size )
+    {
+      // growing moves heap stacks, including the bytes if they're from this one
+      const std::less< const_pointer > less;
+      const bool own = _data && !less( bytes, _data ) && less( bytes, _data + _size );
+      const size_type offset = own ? bytes - _data : 0;
+      grow( _size + size );
+      if( own )
+      {
+        bytes = _data + offset;
+      }
+    }
+    if( size > 0 )
+    {
+      touch_top();
+      std::memcpy( _data + _size, bytes, size );
+    }
+    _size += size;
+    return *this;
+  }
+
+  stack& stack::transfer( stack& other, const size_type size )
+  {
+    if( other.size() < size )
+    {
+      throw stack_underflow( "Stack underflow" );
+    }
+    append( other.end() - size, size );
+    other._size -= size;
     return *this;
   }
 
   stack::stack( stack& other, const size_type size )
-    // could generally use std::make_move_iterator, but char doesn't have a faster move constructor (obviously)
-    : std::vector<char>( other.end() - size, other.end() )
   {
+    append( other.end() - size, size );
     other.resize( other.size() - size );
   }
+
+  std::vector< std::pair< stack::size_type, stack::size_type > > stack::dirty_ranges() const
+  {
+    std::vector< std::pair< size_type, size_type > > result;
+    const auto add = [ &result ]( const size_type begin, const size_type end )
+    {
+      if( !result.empty() && result.back().first + result.back().second == begin )
+      {
+        result.back().second = end - result.back().first;
+      }
+      else
+      {
+        result.emplace_back( begin, end - begin );
+      }
+    };
+    // everything from the page containing the watermark up changed
+    const size_type tail = std::min( _clean_size, _size ) / dirty_page_size * dirty_page_size;
+    for( size_type page = 0; page * dirty_page_size < tail && page / 64 < _dirty_pages.size(); ++page )
+    {
+      const std::uint64_t word = _dirty_pages[ page / 64 ];
+      if( word == 0 )
+      {
+        page |= 63;
+        continue;
+      }
+      if( word >> page % 64 & 1 )
+      {
+        add( page * dirty_page_size, ( page + 1 ) * dirty_page_size );
+      }
+    }
+    if( tail < _size )
+    {
+      add( tail, _size );
+    }
+    return result;
+  }
+
+  void stack::mark_pages_dirty( const size_type offset, const size_type size )
+  {
+    // a write reaching the watermark just lowers it
+    if( size >= _clean_size - offset )
+    {
+      _clean_size = offset;
+      return;
+    }
+    const size_type first = offset / dirty_page_size;
+    const size_type last = ( offset + size - 1 ) / dirty_page_size;
+    if( _dirty_pages.size() <= last / 64 )
+    {
+      _dirty_pages.resize( last / 64 + 1 );
+    }
+    for( size_type page = first; page <= last; ++page )
+    {
+      _dirty_pages[ page / 64 ] |= std::uint64_t( 1 ) << page % 64;
+    }
+  }
+
+  void stack::grow( const size_type required_capacity )
+  {
+    if( _backend == stack_backend::reserved )
+    {
+      throw stack_overflow( "Stack overflow" );
+    }
+    const size_type capacity = std::max( { required_capacity, 2 * _capacity, min_heap_capacity } );
+    char* const data = static_cast< char* >( std::realloc( _data, capacity ) );
+    if( !data )
+    {
+      throw std::bad_alloc();
+    }
+    _data = data;
+    _capacity = capacity;
+  }
+
+  void stack::release()
+  {
+    if( !_data )
+    {
+      return;
+    }
+#ifdef PERSEUS_HAS_MMAP_STACKS
+    if( _backend == stack_backend::reserved )
+    {
+      munmap( _data, _capacity + page_size() );
+      return;
+    }
+#endif
+    std::free( _data );
+  }
 }
@@ -0,0 +1,137 @@
+#include "vm/stack_pool.hpp"
+
+#include <new>
+#include <utility>
+
+namespace perseus
+{
+  namespace detail
+  {
+    constexpr std::size_t stack_pool::bucket_count;
+
+    stack stack_pool::acquire( const stack::size_type min_capacity )
+    {
+      std::size_t index = bucket_index( min_capacity );
+      std::uint64_t candidates = _occupied_buckets >> index;
+      while( candidates != 0 )
+      {
+        // skip to the next non-empty bucket
+        while( ( candidates & 1 ) == 0 )
+        {
+          candidates >>= 1;
+          ++index;
+        }
+        std::vector< stack >& bucket = _buckets[ index ];
+        // only the first bucket can contain stacks that are too small
+        if( bucket.back().capacity() >= min_capacity )
+        {
+          stack result = std::move( bucket.back() );
+          bucket.pop_back();
+          if( bucket.empty() )
+          {
+            _occupied_buckets &= ~( std::uint64_t( 1 ) << index );
+          }
+          --_statistics.pooled;
+          ++_statistics.hits;
+          return result;
+        }
+        candidates >>= 1;
+        ++index;
+      }
+      ++_statistics.misses;
+      if( _backend == stack_backend::heap && min_capacity == 0 )
+      {
+        // the common case of coroutines created by opcodes, which start empty; don't allocate yet
+        return stack();
+      }
+      stack result( _backend );
+      result.reserve( min_capacity );
+      return result;
+    }
+
+    void stack_pool::release( stack&& st ) noexcept
+    {
+      // moved-from stacks, e.g. the result of opcode::exit, have nothing worth keeping
+      if( st.capacity() == 0 )
+      {
+        return;
+      }
+      const std::size_t index = bucket_index( st.capacity() );
+      std::vector< stack >& bucket = _buckets[ index ];
+      if( st.backend() != _backend
+        || bucket.size() >= _limits.max_stacks_per_bucket
+        || ( st.backend() == stack_backend::heap && st.capacity() > _limits.max_capacity ) )
+      {
+        ++_statistics.discarded;
+        return;
+      }
+      // a reserved stack would otherwise keep every page it ever used
+      if( !st.clear_and_decommit( _limits.max_capacity ) )
+      {
+        ++_statistics.discarded;
+        return;
+      }
+      try
+      {
+        bucket.push_back( std::move( st ) );
+      }
+      catch( const std::bad_alloc& )
+      {
+        // not pooling it is fine, too
+        ++_statistics.discarded;
+        return;
+      }
+      _occupied_buckets |= std::uint64_t( 1 ) << index;
+      ++_statistics.pooled;
+    }
+
+    void stack_pool::clear() noexcept
+    {
+      for( std::vector< stack >& bucket : _buckets )
+      {
+        bucket.clear();
+      }
+      _occupied_buckets = 0;
+      _statistics.pooled = 0;
+    }
+
+    void stack_pool::set_limits( const limits& new_limits ) noexcept
+    {
+      _limits = new_limits;
+      for( std::size_t index = 0; index < bucket_count; ++index )
+      {
+        std::vector< stack >& bucket = _buckets[ index ];
+        for( std::size_t i = 0; i < bucket.size(); )
+        {
+          if( i >= _limits.max_stacks_per_bucket
+            || ( _backend == stack_backend::heap && bucket[ i ].capacity() > _limits.max_capacity )
+            || !bucket[ i ].clear_and_decommit( _limits.max_capacity ) )
+          {
+            bucket.erase( bucket.begin() + i );
+            --_statistics.pooled;
+            ++_statistics.discarded;
+          }
+          else
+          {
+            ++i;
+          }
+        }
+        if( bucket.empty() )
+        {
+          _occupied_buckets &= ~( std::uint64_t( 1 ) << index );
+        }
+      }
+    }
+
+    std::size_t stack_pool::bucket_index( stack::size_type capacity )
+    {
+      std::size_t index = 0;
+      while( capacity != 0 && index < bucket_count - 1 )
+      {
+        capacity >>= 1;
+        ++index;
+      }
+      return index;
+    }
+  }
+}
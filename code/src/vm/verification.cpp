@@ -0,0 +1,495 @@
+#include "vm/verification.hpp"
+
+#include <vector>
+#include <algorithm>
+#include <limits>
+#include <cstdint>
+
+namespace perseus
+{
+  namespace detail
+  {
+    namespace
+    {
+      /// Give up on code that needs more analysis rounds than this, e.g. recursion moving further down the stack with every call.
+      constexpr unsigned int max_rounds = 64;
+      /// Functions requiring more stack than this are not verified.
+      constexpr std::int64_t max_required_stack_size = std::numeric_limits< std::uint32_t >::max();
+
+      /// What is known about a function
+      struct function_summary
+      {
+        /// Whether the function is verified (so far)
+        bool valid = true;
+        /// How many bytes below its start the function accesses
+        std::int64_t required_stack_size = 0;
+        /// Whether the function has been seen returning
+        bool returns = false;
+        /// The argument size popped when returning
+        std::uint32_t argument_size = 0;
+
+        bool operator!=( const function_summary& rhs ) const
+        {
+          return valid != rhs.valid || required_stack_size != rhs.required_stack_size || returns != rhs.returns || argument_size != rhs.argument_size;
+        }
+      };
+
+      typedef std::unordered_map< std::uint32_t, function_summary > summary_map;
+
+      /// Bytes popped and pushed by an instruction with a fixed stack effect
+      struct stack_effect
+      {
+        std::int64_t pops;
+        std::int64_t pushes;
+      };
+
+      /// Retrieves the stack effect of instructions that just continue with the next one; returns false for any other instruction.
+      bool get_sequential_effect( const decoded_instruction& instruction, stack_effect& out_effect )
+      {
+        const std::int64_t operand = instruction.operand;
+        switch( static_cast< opcode >( instruction.handler ) )
+        {
+        case opcode::no_operation:
+        case opcode::low_level_break:
+        case opcode::syscall:
+          out_effect = { 0, 0 };
+          return true;
+        case opcode::absolute_coroutine:
+        case opcode::push_coroutine_identifier:
+        case opcode::push_stack_size:
+        case opcode::push_32:
+          out_effect = { 0, 4 };
+          return true;
+        case opcode::indirect_coroutine:
+        case opcode::negate_i32:
+        case opcode::add_immediate_i32:
+          out_effect = { 4, 4 };
+          return true;
+        case opcode::coroutine_state:
+          out_effect = { 4, 1 };
+          return true;
+        case opcode::delete_coroutine:
+          out_effect = { 4, 0 };
+          return true;
+        case opcode::push_8:
+          out_effect = { 0, 1 };
+          return true;
+        case opcode::reserve:
+          out_effect = { 0, operand };
+          return true;
+        case opcode::pop:
+          out_effect = { operand, 0 };
+          return true;
+        case opcode::absolute_load_current_stack:
+          out_effect = { 4, operand };
+          return true;
+        case opcode::absolute_load_stack:
+          out_effect = { 8, operand };
+          return true;
+        case opcode::and_b:
+        case opcode::or_b:
+        case opcode::equals_b:
+        case opcode::not_equals_b:
+          out_effect = { 2, 1 };
+          return true;
+        case opcode::negate_b:
+          out_effect = { 1, 1 };
+          return true;
+        case opcode::add_i32:
+        case opcode::subtract_i32:
+        case opcode::multiply_i32:
+        case opcode::divide_i32:
+        case opcode::modulo_i32:
+          out_effect = { 8, 4 };
+          return true;
+        case opcode::equals_i32:
+        case opcode::not_equals_i32:
+        case opcode::less_than_i32:
+        case opcode::less_than_or_equals_i32:
+        case opcode::greater_than_i32:
+        case opcode::greater_than_or_equals_i32:
+          out_effect = { 8, 1 };
+          return true;
+        default:
+          return false;
+        }
+      }
+
+      /// Abstract interpretation of a single function, based on the current summaries of the functions it calls.
+      class function_analysis
+      {
+      public:
+        function_analysis( const decoded_code& program, summary_map& summaries )
+          : _program( program )
+          , _summaries( summaries )
+        {
+        }
+
+        /// relative stack size at each instruction reached by the last analyze()
+        const std::unordered_map< std::uint32_t, std::int64_t >& depths() const
+        {
+          return _depths;
+        }
+
+        function_summary analyze( const std::uint32_t entry )
+        {
+          reach( entry, 0 );
+          while( _result.valid && !_pending.empty() )
+          {
+            const std::uint32_t index = _pending.back();
+            _pending.pop_back();
+            step( index, _depths[ index ] );
+          }
+          // there's only a return address to overwrite if the function returns
+          if( _result.required_stack_size > max_required_stack_size || ( _result.returns && _overwrites_return_address ) )
+          {
+            _result.valid = false;
+          }
+          return _result;
+        }
+
+      private:
+        /// Records that the given instruction is reached with the given relative stack size
+        void reach( const std::uint32_t index, const std::int64_t depth )
+        {
+          const auto inserted = _depths.emplace( index, depth );
+          if( inserted.second )
+          {
+            _pending.push_back( index );
+          }
+          else if( inserted.first->second != depth )
+          {
+            // inconsistent stack size
+            _result.valid = false;
+          }
+        }
+
+        /// Pops the given number of bytes
+        void pop( std::int64_t& depth, const std::int64_t bytes )
+        {
+          depth -= bytes;
+          access( depth );
+        }
+
+        /// Records an access to the given relative stack address
+        void access( const std::int64_t address )
+        {
+          _result.required_stack_size = std::max( _result.required_stack_size, -address );
+        }
+
+        /// Index of the instruction at the given address, or false if there is none
+        bool get_index( const instruction_pointer::value_type address, std::uint32_t& out_index )
+        {
+          try
+          {
+            out_index = static_cast< std::uint32_t >( _program.at( address ) - _program.data() );
+            return true;
+          }
+          catch( code_segmentation_fault& )
+          {
+            return false;
+          }
+        }
+
+        /// Records a relative access of the given size; returns false, invalidating the function, if it's not below the top of the stack
+        bool relative_access( const std::int64_t depth, const std::int32_t offset, const std::int64_t size )
+        {
+          if( offset + size > 0 )
+          {
+            _result.valid = false;
+            return false;
+          }
+          access( depth + offset );
+          return true;
+        }
+
+        /// Records a relative store of the top of the stack, as in relative_store_stack; returns false if it's invalid
+        bool store( const std::int64_t depth, const decoded_instruction& instruction )
+        {
+          const std::int64_t size = instruction.operand;
+          if( !relative_access( depth, instruction.offset, size ) )
+          {
+            return false;
+          }
+          // the source is the top of the stack
+          access( depth - size );
+          const std::int64_t address = depth + instruction.offset;
+          if( address < 0 && address + size > -static_cast< std::int64_t >( sizeof( instruction_pointer::value_type ) ) )
+          {
+            _overwrites_return_address = true;
+          }
+          return true;
+        }
+
+        /// Records a return with the return address on top of the stack (i.e. at depth 0)
+        void return_( const std::uint32_t argument_size )
+        {
+          if( _result.returns && _result.argument_size != argument_size )
+          {
+            _result.valid = false;
+            return;
+          }
+          _result.returns = true;
+          _result.argument_size = argument_size;
+          std::int64_t depth = 0;
+          pop( depth, sizeof( instruction_pointer::value_type ) + argument_size );
+        }
+
+        void step( const std::uint32_t index, std::int64_t depth )
+        {
+          const decoded_instruction& instruction = _program.data()[ index ];
+          stack_effect effect;
+          if( get_sequential_effect( instruction, effect ) )
+          {
+            pop( depth, effect.pops );
+            reach( index + 1, depth + effect.pushes );
+            return;
+          }
+          if( instruction.handler == get_handler( internal_handler::fall_through ) )
+          {
+            reach( instruction.target, depth );
+            return;
+          }
+          switch( static_cast< opcode >( instruction.handler ) )
+          {
+          case opcode::relative_load_stack:
+          case opcode::load_local_32:
+          {
+            const std::int64_t size = instruction.handler == get_handler( opcode::load_local_32 ) ? sizeof( std::int32_t ) : instruction.operand;
+            if( !relative_access( depth, instruction.offset, size ) )
+            {
+              return;
+            }
+            reach( index + 1, depth + size );
+            return;
+          }
+          case opcode::relative_store_stack:
+            if( store( depth, instruction ) )
+            {
+              reach( index + 1, depth );
+            }
+            return;
+          case opcode::store_pop_return:
+          {
+            // the pop size the decoder folded into the offset must leave the return address on top
+            const std::int64_t pop_size = -static_cast< std::int64_t >( instruction.offset ) - instruction.operand - sizeof( instruction_pointer::value_type ) - instruction.target;
+            if( depth != pop_size )
+            {
+              _result.valid = false;
+              return;
+            }
+            if( store( depth, instruction ) )
+            {
+              return_( instruction.target );
+            }
+            return;
+          }
+          case opcode::absolute_jump:
+          case opcode::relative_jump:
+            reach( instruction.target, depth );
+            return;
+          case opcode::relative_jump_if_false:
+            pop( depth, 1 );
+            reach( instruction.target, depth );
+            reach( index + 1, depth );
+            return;
+          case opcode::equals_i32_jump_if_false:
+          case opcode::not_equals_i32_jump_if_false:
+          case opcode::less_than_i32_jump_if_false:
+          case opcode::less_than_or_equals_i32_jump_if_false:
+          case opcode::greater_than_i32_jump_if_false:
+          case opcode::greater_than_or_equals_i32_jump_if_false:
+            pop( depth, 2 * sizeof( std::int32_t ) );
+            reach( instruction.target, depth );
+            reach( index + 1, depth );
+            return;
+          case opcode::call:
+          {
+            const function_summary& callee = _summaries[ instruction.target ];
+            if( !callee.valid )
+            {
+              _result.valid = false;
+              return;
+            }
+            // the callee's start is above the return address
+            const std::int64_t callee_depth = depth + sizeof( instruction_pointer::value_type );
+            access( callee_depth - callee.required_stack_size );
+            // otherwise the continuation is unreachable, at least for now
+            if( callee.returns )
+            {
+              std::uint32_t continuation;
+              if( !get_index( instruction.operand, continuation ) )
+              {
+                _result.valid = false;
+                return;
+              }
+              pop( depth, callee.argument_size );
+              reach( continuation, depth );
+            }
+            return;
+          }
+          case opcode::return_:
+            if( depth != 0 )
+            {
+              _result.valid = false;
+              return;
+            }
+            return_( instruction.operand );
+            return;
+          case opcode::exit:
+            return;
+          default:
+            // anything else is unpredictable or fails
+            _result.valid = false;
+            return;
+          }
+        }
+
+      private:
+        const decoded_code& _program;
+        summary_map& _summaries;
+        function_summary _result;
+        /// whether a relative store writes to where the return address is
+        bool _overwrites_return_address = false;
+        /// relative stack size at each reached instruction
+        std::unordered_map< std::uint32_t, std::int64_t > _depths;
+        /// reached instructions that have yet to be analyzed
+        std::vector< std::uint32_t > _pending;
+      };
+
+      /**
+      @brief Summarizes every function of the program, i.e. address 0 and every call target.
+      @param out_functions receives the index of each function's first instruction
+      @returns false if the analysis doesn't settle, in which case nothing is verified
+      */
+      bool summarize( const decoded_code& program, summary_map& out_summaries, std::vector< std::uint32_t >& out_functions )
+      {
+        const auto add_function = [ & ]( const std::uint32_t index )
+        {
+          if( out_summaries.emplace( index, function_summary() ).second )
+          {
+            out_functions.push_back( index );
+          }
+        };
+        try
+        {
+          add_function( static_cast< std::uint32_t >( program.at( 0 ) - program.data() ) );
+        }
+        catch( code_segmentation_fault& )
+        {
+          // empty code
+        }
+        for( std::size_t i = 0; i < program.size(); ++i )
+        {
+          if( program.data()[ i ].handler == get_handler( opcode::call ) )
+          {
+            add_function( program.data()[ i ].target );
+          }
+        }
+
+        // starting with optimistic summaries, analyze until nothing changes any more
+        bool changed = true;
+        for( unsigned int round = 0; changed; ++round )
+        {
+          if( round == max_rounds )
+          {
+            return false;
+          }
+          changed = false;
+          for( const std::uint32_t function : out_functions )
+          {
+            const function_summary summary = function_analysis( program, out_summaries ).analyze( function );
+            if( summary != out_summaries[ function ] )
+            {
+              out_summaries[ function ] = summary;
+              changed = true;
+            }
+          }
+        }
+        return true;
+      }
+    }
+
+    verification::verification( const decoded_code& program )
+    {
+      summary_map summaries;
+      std::vector< std::uint32_t > functions;
+      if( !summarize( program, summaries, functions ) )
+      {
+        return;
+      }
+      for( const std::uint32_t function : functions )
+      {
+        const function_summary& summary = summaries[ function ];
+        if( summary.valid && !summary.returns )
+        {
+          _required_stack_sizes.emplace( program.address_of( program.data() + function ), static_cast< std::size_t >( summary.required_stack_size ) );
+        }
+      }
+    }
+
+    constexpr std::uint32_t frame_layout::unknown;
+
+    frame_layout::frame_layout( const decoded_code& program )
+      : _frames( program.size(), frame{ unknown, 0 } )
+    {
+      summary_map summaries;
+      std::vector< std::uint32_t > functions;
+      if( !summarize( program, summaries, functions ) )
+      {
+        return;
+      }
+      // instructions shared by several functions are ambiguous
+      std::vector< bool > shared( program.size(), false );
+      for( const std::uint32_t function : functions )
+      {
+        const function_summary& summary = summaries[ function ];
+        if( !summary.valid )
+        {
+          continue;
+        }
+        if( summary.returns )
+        {
+          _argument_sizes.emplace( function, summary.argument_size );
+        }
+        function_analysis analysis( program, summaries );
+        analysis.analyze( function );
+        for( const auto& depth : analysis.depths() )
+        {
+          frame& f = _frames[ depth.first ];
+          if( f.function != unknown || shared[ depth.first ] )
+          {
+            f.function = unknown;
+            shared[ depth.first ] = true;
+          }
+          else
+          {
+            f = frame{ function, depth.second };
+          }
+        }
+      }
+    }
+
+    bool frame_layout::get_frame( const std::uint32_t index, std::uint32_t& out_function, std::int64_t& out_depth ) const
+    {
+      if( index >= _frames.size() || _frames[ index ].function == unknown )
+      {
+        return false;
+      }
+      out_function = _frames[ index ].function;
+      out_depth = _frames[ index ].depth;
+      return true;
+    }
+
+    bool frame_layout::get_argument_size( const std::uint32_t function, std::uint32_t& out_argument_size ) const
+    {
+      const auto it = _argument_sizes.find( function );
+      if( it == _argument_sizes.end() )
+      {
+        return false;
+      }
+      out_argument_size = it->second;
+      return true;
+    }
+  }
+}
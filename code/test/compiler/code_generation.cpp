@@ -0,0 +1,206 @@
+#include "../temporary_file.hpp"
+
+#include "compiler/compiler.hpp"
+#include "compiler/exceptions.hpp"
+#include "vm/processor.hpp"
+#include "vm/stack.hpp"
+#include "vm/image.hpp"
+#include "vm/exceptions.hpp"
+
+#include <sstream>
+#include <fstream>
+#include <functional>
+#include <string>
+#include <cstdint>
+#include <system_error>
+
+#include <boost/test/unit_test.hpp>
+
+/**
+@file
+
+Runs compiled programs, whose code makes use of the superinstructions.
+*/
+
+using namespace std::string_literals;
+
+/// compiles and runs the given source, returning the i32 result of main()
+static std::int32_t run( const std::string& source )
+{
+  perseus::compiler compiler;
+  std::istringstream stream( source );
+  compiler.parse( stream, "<test>"s );
+  perseus::detail::processor proc = compiler.link();
+  // main's result is reserved before calling it
+  BOOST_CHECK( proc.is_verified( 0, 0 ) );
+  perseus::stack result = proc.execute();
+  const std::int32_t value = result.pop< std::int32_t >();
+  BOOST_CHECK_EQUAL( result.size(), 0 );
+  return value;
+}
+
+BOOST_AUTO_TEST_SUITE( compiler )
+
+BOOST_AUTO_TEST_SUITE( code_generation )
+
+BOOST_AUTO_TEST_CASE( fused_sequences )
+{
+  BOOST_TEST_MESSAGE( "locals, constant additions, comparisons in conditions and returns" );
+  BOOST_CHECK_EQUAL( run(
+    "function fib( x : i32 ) -> i32\n"
+    "  if x <= 1\n"
+    "    x\n"
+    "  else\n"
+    "    ( fib( x - 1 ) ) + ( fib( x - 2 ) )\n"
+    "function main() -> i32\n"
+    "  ( fib( 10 ) ) + 3\n"
+    ), 58 );
+  BOOST_CHECK_EQUAL( run(
+    "function greatest_common_divisor( a : i32, b : i32 ) -> i32\n"
+    "  if b > a\n"
+    "    greatest_common_divisor( b, a )\n"
+    "  else\n"
+    "  {\n"
+    "    let remainder = a % b;\n"
+    "    if remainder == 0\n"
+    "      b\n"
+    "    else\n"
+    "      greatest_common_divisor( b, remainder )\n"
+    "  }\n"
+    "function main() -> i32\n"
+    "  greatest_common_divisor( 42, 35 )\n"
+    ), 7 );
+}
+
+BOOST_AUTO_TEST_CASE( jump_targets )
+{
+  BOOST_TEST_MESSAGE( "instructions on both sides of a jump target are not fused" );
+  const std::string pick =
+    "function pick( a : i32, b : i32 ) -> i32\n"
+    "  if ( if a < 0 b < 0 else a < b )\n"
+    "    1\n"
+    "  else\n"
+    "    2\n";
+  BOOST_CHECK_EQUAL( run( pick + "function main() -> i32\n  pick( -1, -2 )\n" ), 1 );
+  BOOST_CHECK_EQUAL( run( pick + "function main() -> i32\n  pick( -1, 2 )\n" ), 2 );
+  BOOST_CHECK_EQUAL( run( pick + "function main() -> i32\n  pick( 1, 2 )\n" ), 1 );
+  BOOST_CHECK_EQUAL( run( pick + "function main() -> i32\n  pick( 2, 1 )\n" ), 2 );
+  BOOST_CHECK_EQUAL( run(
+    "function main() -> i32\n"
+    "  40 + ( if true 1 else 2 )\n"
+    ), 41 );
+}
+
+BOOST_AUTO_TEST_CASE( profile_names )
+{
+  BOOST_TEST_MESSAGE( "profiles of compiled programs name the functions by their signatures" );
+  perseus::compiler compiler;
+  std::istringstream stream(
+    "function fib( x : i32 ) -> i32\n"
+    "  if x <= 1\n"
+    "    x\n"
+    "  else\n"
+    "    ( fib( x - 1 ) ) + ( fib( x - 2 ) )\n"
+    "function main() -> i32\n"
+    "  fib( 15 )\n"
+    );
+  compiler.parse( stream, "<test>"s );
+  perseus::detail::processor proc = compiler.link();
+  proc.start_profiling( 10 );
+  BOOST_CHECK_EQUAL( proc.execute().pop< std::int32_t >(), 610 );
+  std::ostringstream profile;
+  proc.profile()->write_collapsed( profile );
+  BOOST_CHECK_NE( profile.str().find( ";main();fib(i32);fib(i32)" ), std::string::npos );
+  BOOST_CHECK_EQUAL( profile.str().find( "[unknown]" ), std::string::npos );
+}
+
+BOOST_AUTO_TEST_CASE( images )
+{
+  BOOST_TEST_MESSAGE( "compiled programs saved to images run like linked ones, with their builtins and function names" );
+  const temporary_file file;
+  {
+    perseus::compiler compiler;
+    std::istringstream stream(
+      "function fib( x : i32 ) -> i32\n"
+      "  if x <= 1\n"
+      "    x\n"
+      "  else\n"
+      "    ( fib( x - 1 ) ) + ( fib( x - 2 ) )\n"
+      "function main() -> i32\n"
+      "  fib( 15 )\n"
+      );
+    compiler.parse( stream, "<test>"s );
+    compiler.link_image( file.path );
+  }
+  const perseus::detail::program_image program = perseus::detail::load_image( file.path );
+  BOOST_CHECK_EQUAL( program.syscalls.size(), 2u );
+  BOOST_CHECK_EQUAL( program.syscalls.front(), "print(i32)" );
+
+  perseus::detail::instruction_pointer::value_type entry_point;
+  perseus::detail::processor proc = perseus::compiler::load_image( file.path, entry_point );
+  proc.start_profiling( 10 );
+  BOOST_CHECK_EQUAL( proc.execute( entry_point ).pop< std::int32_t >(), 610 );
+  std::ostringstream profile;
+  proc.profile()->write_collapsed( profile );
+  BOOST_CHECK_NE( profile.str().find( ";main();fib(i32);fib(i32)" ), std::string::npos );
+
+  perseus::detail::program_image unknown = program;
+  unknown.syscalls.back() = "launch(i32)";
+  perseus::detail::save_image( file.path, unknown );
+  BOOST_CHECK_THROW( perseus::compiler::load_image( file.path, entry_point ), perseus::invalid_image );
+}
+
+BOOST_AUTO_TEST_CASE( source_buffers )
+{
+  BOOST_TEST_MESSAGE( "sources parsed from buffers and mapped files compile like those parsed from streams" );
+  const std::string source =
+    "\xEF\xBB\xBF// with a byte order mark\n"
+    "function fib( x : i32 ) -> i32\n"
+    "  if x <= 1\n"
+    "    x\n"
+    "  else\n"
+    "    ( fib( x - 1 ) ) + ( fib( x - 2 ) )\n"
+    "function main() -> i32\n"
+    "  fib( 15 )\n";
+  const temporary_file file;
+  {
+    std::ofstream out( file.path );
+    out << source;
+  }
+
+  const auto compile = []( const std::function< void( perseus::compiler& ) >& parse )
+  {
+    perseus::compiler compiler;
+    parse( compiler );
+    const temporary_file image;
+    compiler.link_image( image.path );
+    return perseus::detail::load_image( image.path ).code;
+  };
+  const perseus::detail::code_segment expected = compile( [ & ]( perseus::compiler& compiler )
+  {
+    std::istringstream stream( source );
+    compiler.parse( stream, "<test>"s );
+  } );
+  const perseus::detail::code_segment from_buffer = compile( [ & ]( perseus::compiler& compiler )
+  {
+    compiler.parse( source.data(), source.size(), "<test>"s );
+  } );
+  const perseus::detail::code_segment from_file = compile( [ & ]( perseus::compiler& compiler )
+  {
+    compiler.parse_file( file.path );
+  } );
+  BOOST_CHECK_EQUAL_COLLECTIONS( from_buffer.begin(), from_buffer.end(), expected.begin(), expected.end() );
+  BOOST_CHECK_EQUAL_COLLECTIONS( from_file.begin(), from_file.end(), expected.begin(), expected.end() );
+
+  perseus::compiler compiler;
+  BOOST_CHECK_THROW( compiler.parse_file( file.path + ".missing" ), std::system_error );
+  {
+    std::ofstream empty( file.path, std::ios::trunc );
+  }
+  // empty files can't be mapped, but are still parsed
+  BOOST_CHECK_THROW( compiler.parse_file( file.path ), perseus::syntax_error );
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,127 @@
+#include "../temporary_file.hpp"
+
+#include "compiler/compiler.hpp"
+#include "compiler/compilation_cache.hpp"
+#include "compiler/exceptions.hpp"
+#include "vm/processor.hpp"
+#include "vm/stack.hpp"
+
+#include <cstdint>
+#include <cstdio>
+#include <stdexcept>
+#include <sstream>
+#include <string>
+
+#include <boost/test/unit_test.hpp>
+
+/**
+@file
+
+Checks compiling with a cache of compiled programs.
+*/
+
+using namespace std::string_literals;
+using cache_statistics = perseus::detail::compilation_cache::statistics;
+
+static const std::string fib_source =
+  "function fib( x : i32 ) -> i32\n"
+  "  if x <= 1\n"
+  "    x\n"
+  "  else\n"
+  "    ( fib( x - 1 ) ) + ( fib( x - 2 ) )\n"
+  "function main() -> i32\n"
+  "  fib( 15 )\n";
+
+/// compiles the given source using a cache in the given directory, returning the result of main() and the cache statistics
+static std::int32_t run_cached( const std::string& directory, const std::string& source, cache_statistics& out_statistics )
+{
+  perseus::compiler compiler;
+  compiler.set_cache_directory( directory );
+  std::istringstream stream( source );
+  compiler.parse( stream, "<test>"s );
+  perseus::detail::processor proc = compiler.link();
+  BOOST_REQUIRE( compiler.cache_statistics() );
+  out_statistics = *compiler.cache_statistics();
+  return proc.execute().pop< std::int32_t >();
+}
+
+BOOST_AUTO_TEST_SUITE( compiler )
+
+BOOST_AUTO_TEST_SUITE( compilation_cache )
+
+BOOST_AUTO_TEST_CASE( hits_and_misses )
+{
+  BOOST_TEST_MESSAGE( "the first compilation of a source fills the cache, later ones use it" );
+  const temporary_directory directory;
+  cache_statistics statistics;
+  BOOST_CHECK_EQUAL( run_cached( directory.path, fib_source, statistics ), 610 );
+  BOOST_CHECK_EQUAL( statistics.hits, 0u );
+  BOOST_CHECK_EQUAL( statistics.misses, 1u );
+  BOOST_CHECK_EQUAL( statistics.stores, 1u );
+  BOOST_CHECK_EQUAL( directory.files(), 1u );
+
+  BOOST_CHECK_EQUAL( run_cached( directory.path, fib_source, statistics ), 610 );
+  BOOST_CHECK_EQUAL( statistics.hits, 1u );
+  BOOST_CHECK_EQUAL( statistics.misses, 0u );
+  BOOST_CHECK_EQUAL( statistics.stores, 0u );
+
+  // a different source
+  BOOST_CHECK_EQUAL( run_cached( directory.path, fib_source + "\n", statistics ), 610 );
+  BOOST_CHECK_EQUAL( statistics.misses, 1u );
+  BOOST_CHECK_EQUAL( directory.files(), 2u );
+}
+
+BOOST_AUTO_TEST_CASE( keys )
+{
+  BOOST_TEST_MESSAGE( "keys depend on the sources' contents and boundaries" );
+  const std::string key = perseus::detail::compilation_cache::get_key( { "ab", "c" } );
+  BOOST_CHECK_EQUAL( key.size(), 32u );
+  BOOST_CHECK_EQUAL( key, perseus::detail::compilation_cache::get_key( { "ab", "c" } ) );
+  BOOST_CHECK_NE( key, perseus::detail::compilation_cache::get_key( { "a", "bc" } ) );
+  BOOST_CHECK_NE( key, perseus::detail::compilation_cache::get_key( { "abc" } ) );
+  BOOST_CHECK_NE( key, perseus::detail::compilation_cache::get_key( { "c", "ab" } ) );
+}
+
+BOOST_AUTO_TEST_CASE( failures )
+{
+  BOOST_TEST_MESSAGE( "damaged entries are replaced, unwritable caches are only counted, syntax errors surface in link()" );
+  const temporary_directory directory;
+  const std::string entry = directory.path + "/" + perseus::detail::compilation_cache::get_key( { fib_source } ) + ".img";
+  std::FILE* const f = std::fopen( entry.c_str(), "wb" );
+  BOOST_REQUIRE( f );
+  std::fputs( "not an image", f );
+  std::fclose( f );
+  cache_statistics statistics;
+  BOOST_CHECK_EQUAL( run_cached( directory.path, fib_source, statistics ), 610 );
+  BOOST_CHECK_EQUAL( statistics.misses, 1u );
+  BOOST_CHECK_EQUAL( statistics.stores, 1u );
+  BOOST_CHECK_EQUAL( run_cached( directory.path, fib_source, statistics ), 610 );
+  BOOST_CHECK_EQUAL( statistics.hits, 1u );
+
+  BOOST_CHECK_EQUAL( run_cached( directory.path + "/missing", fib_source, statistics ), 610 );
+  BOOST_CHECK_EQUAL( statistics.failed_stores, 1u );
+  // no temporary files are left behind
+  BOOST_CHECK_EQUAL( directory.files(), 1u );
+
+  perseus::compiler compiler;
+  compiler.set_cache_directory( directory.path );
+  std::istringstream stream( "function main( -> i32\n" );
+  BOOST_CHECK_NO_THROW( compiler.parse( stream, "<test>"s ) );
+  // a syntax_error or the grammar's expectation_failure
+  BOOST_CHECK_THROW( compiler.link(), std::runtime_error );
+}
+
+BOOST_AUTO_TEST_CASE( late_cache )
+{
+  BOOST_TEST_MESSAGE( "sources parsed without a cache can't be cached" );
+  const temporary_directory directory;
+  perseus::compiler compiler;
+  std::istringstream stream( fib_source );
+  compiler.parse( stream, "<test>"s );
+  BOOST_CHECK_THROW( compiler.set_cache_directory( directory.path ), std::logic_error );
+  BOOST_CHECK( !compiler.cache_statistics() );
+}
+
+BOOST_AUTO_TEST_SUITE_END() // compilation_cache
+
+BOOST_AUTO_TEST_SUITE_END() // compiler
@@ -3,6 +3,7 @@
 #include <boost/test/unit_test.hpp>
 
 #include <sstream>
+#include <string>
 
 BOOST_AUTO_TEST_SUITE( compiler )
 
@@ -52,6 +53,47 @@ BOOST_AUTO_TEST_CASE( position_iterator )
   BOOST_CHECK( it == end );
 }
 
+BOOST_AUTO_TEST_CASE( buffer_position_iterator )
+{
+  using perseus::detail::file_position;
+  using perseus::detail::enhanced_istream_iterator;
+  using perseus::detail::enhanced_iterators;
+
+  const std::string source{ u8"\u00E4b\nc" };
+  enhanced_istream_iterator begin, end;
+  std::tie( begin, end ) = enhanced_iterators( source.data(), source.data() + source.size() );
+
+  auto it = begin;
+  BOOST_REQUIRE( it != end );
+  BOOST_CHECK_EQUAL( it.get_position(), file_position( 1, 1 ) );
+  BOOST_CHECK_EQUAL( *it, u8"\u00E4"[ 0 ] );
+
+  ++it;
+  BOOST_REQUIRE( it != end );
+  BOOST_CHECK_EQUAL( it.get_position(), file_position( 1, 1 ) );
+
+  ++it;
+  auto it2 = it;
+  ++it;
+  BOOST_REQUIRE( it != end );
+  BOOST_CHECK_EQUAL( it.get_position(), file_position( 1, 3 ) );
+  BOOST_CHECK_EQUAL( *it, '\n' );
+  BOOST_CHECK( it2 != it );
+  BOOST_CHECK_EQUAL( it2.get_position(), file_position( 1, 2 ) );
+  BOOST_CHECK_EQUAL( *it2, 'b' );
+
+  ++it;
+  BOOST_REQUIRE( it != end );
+  BOOST_CHECK_EQUAL( it.get_position(), file_position( 2, 1 ) );
+  BOOST_CHECK_EQUAL( *it, 'c' );
+
+  ++it;
+  BOOST_CHECK( it == end );
+  // default constructed iterators are the end of any input
+  BOOST_CHECK( it == enhanced_istream_iterator{} );
+  BOOST_CHECK( begin != enhanced_istream_iterator{} );
+}
+
 BOOST_AUTO_TEST_CASE( position_iterator_bom )
 {
   using perseus::detail::file_position;
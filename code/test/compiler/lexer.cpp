@@ -8,6 +8,7 @@
 #include <sstream>
 #include <vector>
 
+template< typename Definitions = perseus::detail::token_definitions >
 static bool tokenize( const std::string& source, std::vector< perseus::detail::token >& out_tokens )
 {
   std::stringstream stream( source );
@@ -18,7 +19,7 @@ static bool tokenize( const std::string& source, std::vector< perseus::detail::t
   return boost::spirit::lex::tokenize(
     begin,
     end,
-    perseus::detail::token_definitions{},
+    Definitions{},
     [ &out_tokens ]( const perseus::detail::token& t )
   {
     out_tokens.push_back( t );
@@ -65,6 +66,39 @@ BOOST_AUTO_TEST_CASE( longest_match_if )
   BOOST_CHECK_EQUAL( result.at( 2 ).id(), perseus::detail::token_id::if_ );
 }
 
+BOOST_AUTO_TEST_CASE( static_tables )
+{
+  // the generated tables must tokenize exactly like a DFA built from the current definitions
+  const std::vector< std::string > sources{
+    u8R"(// a c\u00D6mment
+function main() -> i32
+{
+  let mutable x : i32 = 0x1F'ff + 0b10'01 * 1'000;
+  while x < 10 { x = x + 1; };
+  if true x else ( -x ) /* comment
+spanning lines */
+})",
+    R"(impure function print( s : string ) -> void "esc\"aped\n" `op` [ a.b, c ] ->->= <=> @#$ ~^ \\ returning elsewhere_)",
+    // an unterminated string and comment
+    R"(let x = 1; " unterminated)",
+    R"(x ?? y /* unterminated)",
+    ""
+  };
+  for( const std::string& source : sources )
+  {
+    std::vector< perseus::detail::token > expected, actual;
+    const bool expected_success = tokenize< perseus::detail::basic_token_definitions< perseus::detail::dynamic_lexer > >( source, expected );
+    const bool actual_success = tokenize( source, actual );
+    BOOST_CHECK_EQUAL( actual_success, expected_success );
+    BOOST_REQUIRE_EQUAL( actual.size(), expected.size() );
+    for( std::size_t i = 0; i < actual.size(); ++i )
+    {
+      BOOST_CHECK_EQUAL( actual[ i ].id(), expected[ i ].id() );
+      BOOST_CHECK_EQUAL( std::string( actual[ i ].value().begin(), actual[ i ].value().end() ), std::string( expected[ i ].value().begin(), expected[ i ].value().end() ) );
+    }
+  }
+}
+
 BOOST_AUTO_TEST_SUITE_END()
 
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,153 @@
+#include "compiler/scanner.hpp"
+#include "compiler/token_definitions.hpp"
+
+#include <boost/test/unit_test.hpp>
+
+#include <boost/spirit/home/lex/tokenize_and_parse.hpp>
+
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+/**
+@file
+
+Checks that the scanner produces the same tokens as the token definitions, on typical programs, edge cases and random inputs.
+*/
+
+/// Scans the source with both lexers and checks that the results match
+static void check_same_tokens( const std::string& source )
+{
+  BOOST_TEST_CONTEXT( "source: " << source )
+  {
+    std::vector< perseus::detail::token > expected;
+    std::stringstream stream( source );
+    perseus::detail::enhanced_istream_iterator begin, end;
+    std::tie( begin, end ) = perseus::detail::enhanced_iterators( stream );
+    const bool expected_success = boost::spirit::lex::tokenize( begin, end, perseus::detail::token_definitions{}, [ &expected ]( const perseus::detail::token& t )
+    {
+      expected.push_back( t );
+      return true;
+    } );
+
+    std::vector< perseus::detail::scanned_token > actual;
+    const bool actual_success = perseus::detail::scan( source.data(), source.data() + source.size(), actual );
+
+    BOOST_CHECK_EQUAL( actual_success, expected_success );
+    BOOST_REQUIRE_EQUAL( actual.size(), expected.size() );
+    perseus::detail::position_tracker positions( source.data() );
+    for( std::size_t i = 0; i < actual.size(); ++i )
+    {
+      BOOST_CHECK_EQUAL( actual[ i ].id, expected[ i ].id() );
+      BOOST_CHECK_EQUAL( source.substr( actual[ i ].begin, actual[ i ].end - actual[ i ].begin ), std::string( expected[ i ].value().begin(), expected[ i ].value().end() ) );
+      BOOST_CHECK_EQUAL( positions.advance( actual[ i ].begin ), expected[ i ].value().begin().get_position() );
+    }
+  }
+}
+
+BOOST_AUTO_TEST_SUITE( compiler )
+
+BOOST_AUTO_TEST_SUITE( scanner )
+
+BOOST_AUTO_TEST_CASE( programs )
+{
+  check_same_tokens(
+    "function fib( x : i32 ) -> i32\n"
+    "  if x <= 1\n"
+    "    x\n"
+    "  else\n"
+    "    ( fib( x - 1 ) ) + ( fib( x - 2 ) )\n"
+    "function main() -> i32\n"
+    "  ( fib( 10 ) ) + 3\n"
+    );
+  check_same_tokens(
+    "function greatest_common_divisor( a : i32, b : i32 ) -> i32\n"
+    "  if b > a\n"
+    "    greatest_common_divisor( b, a )\n"
+    "  else\n"
+    "  {\n"
+    "    let remainder = a % b;\n"
+    "    if remainder == 0\n"
+    "      b\n"
+    "    else\n"
+    "      greatest_common_divisor( b, remainder )\n"
+    "  }\n"
+    );
+  check_same_tokens( u8R"(// a c\u00D6mment
+impure function count() -> void
+{
+  let mutable i : i32 = 0x1F'ff + 0b10'01 * 1'000;
+  /* a long comment, with * and / and "quotes" */
+  while i < 10 { i = i + 1; };
+  if true print( "esc\"aped\n\t\\ \u00D6" ) else `op`( -i, [ a.b ] );
+  return false
+})" );
+}
+
+BOOST_AUTO_TEST_CASE( edge_cases )
+{
+  const std::vector< std::string > sources{
+    "",
+    " \t\v\f\r\n ",
+    // keywords must be whole words, and only lower case
+    "if iffy elsewhere return_ TRUE False lets functions mutable impure let while",
+    // longest match between numbers and identifiers
+    "0 00 0x 0x1F 0xg 0x1F_x 0b 0b102 0b1'0 1'000 1'' 1'a 123abc 0X0 0B1 9'9'9",
+    // longest match between comments, operators and the punctuation they start with
+    "/**/ /**/+ /*/ */ /* a **/ //",
+    "// line comment\n//\n/**/. .. = == -> ->> - -- ::;,",
+    "/* a ** b */ /* ***/ /* * / */",
+    // strings
+    R"("" "\"" "\\" "\q" "a)",
+    "\"line\nbreak\"",
+    // no token matches
+    "let x = 1; # $ \x01",
+    "a \x7f b",
+    "\xC3\x96",
+    "/* unterminated",
+    "x ?? y /* unterminated *",
+    "\"unterminated",
+    "\"unterminated escape\\",
+  };
+  for( const std::string& source : sources )
+  {
+    check_same_tokens( source );
+  }
+}
+
+BOOST_AUTO_TEST_CASE( long_runs )
+{
+  // runs longer than the scanner's blocks, ending at each position inside one
+  for( std::size_t length = 1; length < 80; ++length )
+  {
+    check_same_tokens( std::string( length, ' ' ) + "x" + std::string( length, 'y' ) + "+" + std::string( length, '1' ) + "// " + std::string( length, '-' ) + "\n" );
+    check_same_tokens( "/*" + std::string( length, '*' ) + "/ \"" + std::string( length, 'z' ) + "\\n\"" );
+  }
+}
+
+BOOST_AUTO_TEST_CASE( random_inputs )
+{
+  // fragments that are likely to form tricky combinations
+  const std::vector< std::string > fragments{
+    " ", "\n", "\t", "/", "*", "\"", "\\", "'", "0", "1", "9", "x", "X", "b", "_", "a", "Z",
+    "if", "else", "let", "function", "->", "-", ">", "=", ".", ":", ";", ",", "`", "(", ")", "{", "}", "[", "]",
+    "+", "!", "~", "//", "/*", "*/", "0x", "0b", "n", "\xC3\x96"
+  };
+  std::mt19937 random( 12345 );
+  std::uniform_int_distribution< std::size_t > fragment( 0, fragments.size() - 1 );
+  std::uniform_int_distribution< std::size_t > length( 0, 40 );
+  for( int i = 0; i < 2000; ++i )
+  {
+    std::string source;
+    for( std::size_t j = length( random ); j > 0; --j )
+    {
+      source += fragments[ fragment( random ) ];
+    }
+    check_same_tokens( source );
+  }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
+BOOST_AUTO_TEST_SUITE_END()
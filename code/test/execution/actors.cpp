@@ -0,0 +1,193 @@
+#include "../write_code_segment.hpp"
+
+#include "vm/processor.hpp"
+#include "vm/actor_system.hpp"
+#include "vm/stack.hpp"
+#include "vm/exceptions.hpp"
+
+#include <utility>
+#include <cstdint>
+#include <future>
+#include <vector>
+
+#include <boost/test/unit_test.hpp>
+
+/**
+@file
+
+Checks suspending executions, and actors exchanging messages.
+*/
+
+using perseus::detail::processor;
+using perseus::detail::actor_system;
+using perseus::detail::opcode;
+
+BOOST_AUTO_TEST_SUITE( vm )
+
+BOOST_AUTO_TEST_SUITE( execution )
+
+BOOST_AUTO_TEST_SUITE( actors )
+
+static perseus::stack i32( const std::int32_t value )
+{
+  perseus::stack result;
+  result.push< std::int32_t >( value );
+  return result;
+}
+
+/// receives the given number of i32 messages and exits with their sum
+static perseus::detail::code_segment sum_code( const std::int32_t count )
+{
+  perseus::detail::code_segment code = create_code_segment( opcode::push_32, std::int32_t( 0 ) );
+  for( std::int32_t i = 0; i < count; ++i )
+  {
+    code.push( opcode::syscall );
+    code.push< std::uint32_t >( actor_system::receive_syscall );
+    code.push( opcode::pop );
+    code.push< std::uint32_t >( 4 );
+    code.push( opcode::add_i32 );
+  }
+  code.push( opcode::exit );
+  return code;
+}
+
+BOOST_AUTO_TEST_CASE( suspend_resume )
+{
+  BOOST_TEST_MESSAGE( "suspending execution in a syscall and resuming it" );
+  auto code = create_code_segment(
+    opcode::push_32, std::int32_t( 1 ),
+    opcode::syscall, std::uint32_t( 0 ),
+    opcode::add_i32,
+    opcode::exit
+    );
+  int attempts = 0;
+  processor proc( std::move( code ), {
+    [ &attempts ]( perseus::stack& st )
+    {
+      if( ++attempts < 3 )
+      {
+        throw perseus::would_block( "not yet" );
+      }
+      st.push< std::int32_t >( 42 );
+    }
+  } );
+  BOOST_CHECK( !proc.is_suspended() );
+  BOOST_CHECK_THROW( proc.resume(), perseus::invalid_suspension_state );
+  BOOST_CHECK_THROW( proc.execute(), perseus::would_block );
+  BOOST_CHECK( proc.is_suspended() );
+  BOOST_CHECK_THROW( proc.execute(), perseus::invalid_suspension_state );
+  BOOST_CHECK_THROW( proc.resume(), perseus::would_block );
+  perseus::stack result = proc.resume();
+  BOOST_CHECK( !proc.is_suspended() );
+  BOOST_CHECK_EQUAL( attempts, 3 );
+  BOOST_REQUIRE_EQUAL( result.size(), 4u );
+  BOOST_CHECK_EQUAL( result.pop< std::int32_t >(), 43 );
+}
+
+BOOST_AUTO_TEST_CASE( receive )
+{
+  BOOST_TEST_MESSAGE( "an actor waiting for messages from the host" );
+  actor_system system( 2 );
+  actor_system::actor_handle handle = system.spawn( sum_code( 3 ) );
+  system.send( handle.id, i32( 1 ) );
+  // now it's definitely parked
+  system.wait_until_idle();
+  BOOST_CHECK( handle.result.wait_for( std::chrono::seconds( 0 ) ) == std::future_status::timeout );
+  system.send( handle.id, i32( 2 ) );
+  system.send( handle.id, i32( 3 ) );
+  perseus::stack result = handle.result.get();
+  BOOST_REQUIRE_EQUAL( result.size(), 4u );
+  BOOST_CHECK_EQUAL( result.pop< std::int32_t >(), 6 );
+  BOOST_CHECK_THROW( system.send( 1, i32( 0 ) ), perseus::invalid_actor_identifier );
+}
+
+BOOST_AUTO_TEST_CASE( many_actors )
+{
+  BOOST_TEST_MESSAGE( "many actors on few threads" );
+  actor_system system( 3 );
+  std::vector< actor_system::actor_handle > handles;
+  for( int i = 0; i < 1000; ++i )
+  {
+    handles.push_back( system.spawn( sum_code( 2 ) ) );
+  }
+  for( int round = 0; round < 2; ++round )
+  {
+    for( std::size_t i = 0; i < handles.size(); ++i )
+    {
+      system.send( handles[ i ].id, i32( static_cast< std::int32_t >( i ) ) );
+    }
+  }
+  for( std::size_t i = 0; i < handles.size(); ++i )
+  {
+    BOOST_CHECK_EQUAL( handles[ i ].result.get().pop< std::int32_t >(), 2 * static_cast< std::int32_t >( i ) );
+  }
+}
+
+BOOST_AUTO_TEST_CASE( ping_pong )
+{
+  BOOST_TEST_MESSAGE( "actors messaging each other" );
+  actor_system system( 2 );
+  // replies to [value] [sender] with [value + 1]
+  auto pong = create_code_segment(
+    label( "loop" ),
+    opcode::syscall, std::uint32_t( actor_system::receive_syscall ),
+    opcode::pop, std::uint32_t( 4 ),
+    opcode::relative_load_stack, std::uint32_t( 4 ), std::int32_t( -8 ),
+    opcode::push_32, std::int32_t( 1 ),
+    opcode::add_i32,
+    opcode::push_32, std::uint32_t( 4 ),
+    opcode::relative_load_stack, std::uint32_t( 4 ), std::int32_t( -12 ),
+    opcode::syscall, std::uint32_t( actor_system::send_syscall ),
+    opcode::pop, std::uint32_t( 8 ),
+    opcode::relative_jump, label_reference_offset( "loop" )
+    );
+  // sends [n] [self] to the ponger and receives the reply, twice
+  perseus::detail::code_segment ping;
+  for( std::int32_t n = 1; n <= 2; ++n )
+  {
+    ping.push( opcode::push_32 );
+    ping.push< std::int32_t >( n );
+    ping.push( opcode::syscall );
+    ping.push< std::uint32_t >( actor_system::self_syscall );
+    ping.push( opcode::push_32 );
+    ping.push< std::uint32_t >( 8 );
+    ping.push( opcode::relative_load_stack );
+    ping.push< std::uint32_t >( 4 );
+    ping.push< std::int32_t >( -16 - 4 * ( n - 1 ) );
+    ping.push( opcode::syscall );
+    ping.push< std::uint32_t >( actor_system::send_syscall );
+    ping.push( opcode::syscall );
+    ping.push< std::uint32_t >( actor_system::receive_syscall );
+    ping.push( opcode::pop );
+    ping.push< std::uint32_t >( 4 );
+  }
+  ping.push( opcode::exit );
+
+  const actor_system::actor_id ponger = system.spawn( std::move( pong ) ).id;
+  perseus::stack parameters;
+  parameters.push< actor_system::actor_id >( ponger );
+  perseus::stack result = system.spawn( std::move( ping ), 0, std::move( parameters ) ).result.get();
+  BOOST_REQUIRE_EQUAL( result.size(), 12u );
+  BOOST_CHECK_EQUAL( result.pop< std::int32_t >(), 3 );
+  BOOST_CHECK_EQUAL( result.pop< std::int32_t >(), 2 );
+  BOOST_CHECK_EQUAL( result.pop< actor_system::actor_id >(), ponger );
+}
+
+BOOST_AUTO_TEST_CASE( invalid_recipient )
+{
+  BOOST_TEST_MESSAGE( "sending to a nonexistent actor" );
+  actor_system system( 1 );
+  auto code = create_code_segment(
+    opcode::push_32, std::uint32_t( 0 ),
+    opcode::push_32, std::uint32_t( 42 ),
+    opcode::syscall, std::uint32_t( actor_system::send_syscall ),
+    opcode::exit
+    );
+  BOOST_CHECK_THROW( system.spawn( std::move( code ) ).result.get(), perseus::invalid_actor_identifier );
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
+BOOST_AUTO_TEST_SUITE_END()
+
+BOOST_AUTO_TEST_SUITE_END()
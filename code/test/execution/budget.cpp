@@ -0,0 +1,166 @@
+#include "../write_code_segment.hpp"
+
+#include "vm/processor.hpp"
+#include "vm/stack.hpp"
+#include "vm/exceptions.hpp"
+#include "vm/jit_compiler.hpp"
+
+#include <chrono>
+#include <cstdint>
+#include <utility>
+
+#include <boost/test/unit_test.hpp>
+
+/**
+@file
+
+Checks executions getting preempted once their budget runs out, and continuing where they left off.
+*/
+
+using perseus::detail::processor;
+using perseus::detail::opcode;
+using perseus::detail::dispatch_engine;
+using perseus::detail::execution_budget;
+
+/// enough calls to compile any called function
+static const unsigned int hot_runs = 2 * perseus::detail::jit_compiler::default_hot_call_count;
+
+/// a loop that never ends
+static perseus::detail::code_segment endless_code()
+{
+  return create_code_segment(
+    label( "loop" ),
+    opcode::push_32, std::int32_t( 1 ),
+    opcode::pop, std::uint32_t( 4 ),
+    opcode::relative_jump, label_reference_offset( "loop" )
+    );
+}
+
+/// calls a function summing 1 to n in a loop; expects [0] [n], leaves [sum] [0]
+static perseus::detail::code_segment sum_code()
+{
+  return create_code_segment(
+    opcode::call, label_reference( "sum" ),
+    opcode::exit,
+
+    label( "sum" ),
+    // stack: [-12: sum] [-8: n] [-4: return address]
+    opcode::load_local_32, std::int32_t( -8 ),
+    opcode::push_32, std::int32_t( 0 ),
+    opcode::greater_than_i32_jump_if_false, label_reference_offset( "end" ),
+    opcode::load_local_32, std::int32_t( -12 ),
+    opcode::load_local_32, std::int32_t( -12 ),
+    opcode::add_i32,
+    opcode::relative_store_stack, std::uint32_t( 4 ), std::int32_t( -16 ),
+    opcode::pop, std::uint32_t( 4 ),
+    opcode::load_local_32, std::int32_t( -8 ),
+    opcode::add_immediate_i32, std::int32_t( -1 ),
+    opcode::relative_store_stack, std::uint32_t( 4 ), std::int32_t( -12 ),
+    opcode::pop, std::uint32_t( 4 ),
+    opcode::relative_jump, label_reference_offset( "sum" ),
+    label( "end" ),
+    opcode::return_, std::uint32_t( 0 )
+    );
+}
+
+static perseus::stack sum_arguments( const std::int32_t n )
+{
+  perseus::stack result;
+  result.push< std::int32_t >( 0 );
+  result.push< std::int32_t >( n );
+  return result;
+}
+
+BOOST_AUTO_TEST_SUITE( vm )
+
+BOOST_AUTO_TEST_SUITE( execution )
+
+BOOST_AUTO_TEST_SUITE( budget )
+
+BOOST_AUTO_TEST_CASE( endless_loop )
+{
+  BOOST_TEST_MESSAGE( "an endless loop gets preempted, and can be resumed" );
+  for( dispatch_engine engine : dispatch_engines )
+  {
+    BOOST_TEST_MESSAGE( perseus::detail::get_name( engine ) );
+    processor proc( endless_code(), {}, engine );
+    BOOST_CHECK_THROW( proc.execute( 0, perseus::stack(), execution_budget{ 1000 } ), perseus::budget_exhausted );
+    BOOST_CHECK( proc.is_suspended() );
+    BOOST_CHECK( proc.is_preempted() );
+    BOOST_CHECK_THROW( proc.resume( execution_budget{ 1000 } ), perseus::budget_exhausted );
+    BOOST_CHECK( proc.is_preempted() );
+
+    perseus::stack result;
+    BOOST_CHECK( !proc.try_resume( result, execution_budget{ 0 } ) );
+    BOOST_CHECK( proc.is_preempted() );
+  }
+}
+
+BOOST_AUTO_TEST_CASE( time_limit )
+{
+  BOOST_TEST_MESSAGE( "an endless loop gets preempted once its time is up" );
+  for( dispatch_engine engine : dispatch_engines )
+  {
+    BOOST_TEST_MESSAGE( perseus::detail::get_name( engine ) );
+    processor proc( endless_code(), {}, engine );
+    execution_budget budget;
+    budget.time = std::chrono::milliseconds( 10 );
+    const auto start = std::chrono::steady_clock::now();
+    perseus::stack result;
+    BOOST_CHECK( !proc.try_execute( 0, perseus::stack(), result, budget ) );
+    BOOST_CHECK( std::chrono::steady_clock::now() - start >= budget.time );
+    BOOST_CHECK( proc.is_preempted() );
+  }
+}
+
+BOOST_AUTO_TEST_CASE( sliced_execution )
+{
+  BOOST_TEST_MESSAGE( "an execution split into many slices computes what an uninterrupted one does" );
+  for( dispatch_engine engine : dispatch_engines )
+  {
+    BOOST_TEST_MESSAGE( perseus::detail::get_name( engine ) );
+    processor proc( sum_code(), {}, engine );
+    // compiled functions run out of budget in the middle of native code, too
+    for( unsigned int run = 0; run < hot_runs; ++run )
+    {
+      unsigned int slices = 1;
+      perseus::stack result;
+      bool finished = proc.try_execute( 0, sum_arguments( 1000 ), result, execution_budget{ 1000 } );
+      while( !finished )
+      {
+        BOOST_REQUIRE( proc.is_preempted() );
+        ++slices;
+        finished = proc.try_resume( result, execution_budget{ 1000 } );
+      }
+      BOOST_CHECK( !proc.is_suspended() );
+      BOOST_CHECK_GT( slices, 5u );
+      BOOST_REQUIRE_EQUAL( result.size(), 8u );
+      BOOST_CHECK_EQUAL( result.pop< std::int32_t >(), 0 );
+      BOOST_CHECK_EQUAL( result.pop< std::int32_t >(), 500500 );
+    }
+#ifdef PERSEUS_HAS_JIT
+    if( engine == dispatch_engine::jit )
+    {
+      BOOST_CHECK_EQUAL( proc.jit()->compiled_functions(), 1u );
+    }
+#endif
+  }
+}
+
+BOOST_AUTO_TEST_CASE( unlimited )
+{
+  BOOST_TEST_MESSAGE( "a preempted execution can be finished without a budget" );
+  processor proc( sum_code() );
+  BOOST_CHECK_THROW( proc.execute( 0, sum_arguments( 1000 ), execution_budget{ 100 } ), perseus::budget_exhausted );
+  perseus::stack result = proc.resume();
+  BOOST_CHECK( !proc.is_suspended() );
+  BOOST_CHECK( !proc.is_preempted() );
+  result.pop< std::int32_t >();
+  BOOST_CHECK_EQUAL( result.pop< std::int32_t >(), 500500 );
+}
+
+BOOST_AUTO_TEST_SUITE_END() // budget
+
+BOOST_AUTO_TEST_SUITE_END() // execution
+
+BOOST_AUTO_TEST_SUITE_END() // vm
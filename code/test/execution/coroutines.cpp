@@ -1,11 +1,14 @@
 #include "../write_code_segment.hpp"
 
 #include "vm/processor.hpp"
+#include "vm/coroutine_manager.hpp"
 #include "vm/stack.hpp"
 #include "vm/exceptions.hpp"
 
 #include <utility>
 #include <cstdint>
+#include <vector>
+#include <set>
 
 #include <boost/test/unit_test.hpp>
 
@@ -69,7 +72,145 @@ BOOST_AUTO_TEST_CASE( create_delete )
   BOOST_CHECK( !proc.has_coroutines() );
 }
 
-// TODO invalid identifier
+BOOST_AUTO_TEST_CASE( stale_identifier )
+{
+  BOOST_TEST_MESSAGE( "using the identifier of a deleted coroutine whose slot has been reused" );
+  auto code = create_code_segment(
+    opcode::absolute_coroutine, std::uint32_t( 0 ),
+    opcode::relative_load_stack, std::uint32_t( 4 ), std::int32_t( -4 ),
+    opcode::delete_coroutine,
+    opcode::absolute_coroutine, std::uint32_t( 0 ),
+    opcode::pop, std::uint32_t( 4 ),
+    opcode::delete_coroutine,
+    opcode::exit
+    );
+  processor proc( std::move( code ) );
+  BOOST_CHECK_THROW( proc.execute(), perseus::invalid_coroutine_identifer );
+}
+
+BOOST_AUTO_TEST_CASE( manager )
+{
+  BOOST_TEST_MESSAGE( "creating, looking up and deleting many coroutines" );
+  using perseus::detail::coroutine_manager;
+  const auto code = create_code_segment( opcode::exit );
+  coroutine_manager manager;
+  std::vector< identifier > ids;
+  for( int i = 0; i < 1000; ++i )
+  {
+    ids.push_back( manager.new_coroutine( code, 0 ).index );
+  }
+  const perseus::detail::coroutine* const first = &manager.get_coroutine( ids.front() );
+  // every other one
+  for( std::size_t i = 0; i < ids.size(); i += 2 )
+  {
+    manager.delete_coroutine( ids[ i ] );
+  }
+  BOOST_CHECK_THROW( manager.delete_coroutine( ids[ 0 ] ), perseus::invalid_coroutine_identifer );
+  std::set< identifier > live;
+  for( std::size_t i = 1; i < ids.size(); i += 2 )
+  {
+    BOOST_CHECK_EQUAL( manager.get_coroutine( ids[ i ] ).index, ids[ i ] );
+    live.insert( ids[ i ] );
+  }
+  // the freed slots get reused with new identifiers
+  for( int i = 0; i < 500; ++i )
+  {
+    const identifier id = manager.new_coroutine( code, 0 ).index;
+    BOOST_CHECK_LT( id % coroutine_manager::max_coroutines, 1000u );
+    BOOST_CHECK( live.insert( id ).second );
+  }
+  // coroutines don't move
+  BOOST_CHECK_EQUAL( &manager.get_coroutine( ids[ 0 ] + coroutine_manager::max_coroutines ), first );
+  for( std::size_t i = 0; i < ids.size(); i += 2 )
+  {
+    BOOST_CHECK_THROW( manager.get_coroutine( ids[ i ] ), perseus::invalid_coroutine_identifer );
+  }
+  BOOST_CHECK_THROW( manager.get_coroutine( 1000 ), perseus::invalid_coroutine_identifer );
+  manager.clear();
+  BOOST_CHECK( manager.empty() );
+  for( identifier id : live )
+  {
+    BOOST_CHECK_THROW( manager.get_coroutine( id ), perseus::invalid_coroutine_identifer );
+  }
+}
+
+BOOST_AUTO_TEST_CASE( generation_wrap )
+{
+  BOOST_TEST_MESSAGE( "a slot's generation wraps around instead of the slot running out" );
+  using perseus::detail::coroutine_manager;
+  const auto code = create_code_segment( opcode::exit );
+  coroutine_manager manager;
+  const identifier first = manager.new_coroutine( code, 0 ).index;
+  const identifier generations = identifier( 1 ) << ( 32 - coroutine_manager::index_bits );
+  identifier id = first;
+  for( identifier i = 0; i < generations; ++i )
+  {
+    manager.delete_coroutine( id );
+    BOOST_CHECK_THROW( manager.get_coroutine( id ), perseus::invalid_coroutine_identifer );
+    id = manager.new_coroutine( code, 0 ).index;
+    BOOST_REQUIRE_EQUAL( id % coroutine_manager::max_coroutines, 0u );
+  }
+  // the price: the very first identifier is valid again
+  BOOST_CHECK_EQUAL( id, first );
+  BOOST_CHECK_EQUAL( manager.get_coroutine( first ).index, id );
+}
+
+BOOST_AUTO_TEST_CASE( ping_pong )
+{
+  BOOST_TEST_MESSAGE( "passing values back and forth between coroutines" );
+  auto code = create_code_segment(
+    // stack: [coroutine]
+    opcode::absolute_coroutine, label_reference( "pong" ),
+    opcode::push_32, std::int32_t( 40 ),
+    // stack: [coroutine] [40] [coroutine]
+    opcode::relative_load_stack, std::uint32_t( 4 ), std::int32_t( -8 ),
+    opcode::resume_coroutine, std::uint32_t( 4 ),
+    // stack: [coroutine] [41] [coroutine]
+    opcode::relative_load_stack, std::uint32_t( 4 ), std::int32_t( -8 ),
+    opcode::resume_coroutine, std::uint32_t( 4 ),
+    // stack: [coroutine] [42] [coroutine]
+    opcode::relative_load_stack, std::uint32_t( 4 ), std::int32_t( -8 ),
+    opcode::coroutine_state,
+    opcode::exit,
+
+    label( "pong" ),
+    opcode::push_32, std::int32_t( 1 ),
+    opcode::add_i32,
+    opcode::yield, std::uint32_t( 4 ),
+    opcode::relative_jump, label_reference_offset( "pong" )
+    );
+  processor proc( std::move( code ) );
+  stack result = proc.execute();
+  BOOST_REQUIRE_EQUAL( result.size(), sizeof( perseus::detail::coroutine::state ) + 4 + sizeof( identifier ) );
+  BOOST_CHECK( result.pop< perseus::detail::coroutine::state >() == perseus::detail::coroutine::state::suspended );
+  BOOST_CHECK_EQUAL( result.pop< std::int32_t >(), 42 );
+}
+
+BOOST_AUTO_TEST_CASE( stack_recycling )
+{
+  BOOST_TEST_MESSAGE( "deleted coroutines' stacks get reused" );
+  auto code = create_code_segment(
+    opcode::absolute_coroutine, label_reference( "coroutine" ),
+    opcode::relative_load_stack, std::uint32_t( 4 ), std::int32_t( -4 ),
+    opcode::resume_coroutine, std::uint32_t( 0 ),
+    opcode::delete_coroutine,
+    opcode::exit,
+
+    label( "coroutine" ),
+    opcode::reserve, std::uint32_t( 100 ),
+    opcode::yield, std::uint32_t( 0 )
+    );
+  processor proc( std::move( code ) );
+  proc.execute();
+  const std::uint64_t misses = proc.stacks().get_statistics().misses;
+  BOOST_CHECK_EQUAL( proc.stacks().get_statistics().pooled, 1u );
+  proc.execute();
+  proc.execute();
+  // the root coroutine takes the pooled stack and returns it as the result, so the other one needs a new one
+  BOOST_CHECK_EQUAL( proc.stacks().get_statistics().misses, misses + 2 );
+  BOOST_CHECK_EQUAL( proc.stacks().get_statistics().hits, 2u );
+  BOOST_CHECK_EQUAL( proc.stacks().get_statistics().pooled, 1u );
+}
 
 // TODO resume/yield/return
 
@@ -0,0 +1,88 @@
+#include "../write_code_segment.hpp"
+
+#include "vm/processor.hpp"
+#include "vm/decoded_code.hpp"
+#include "vm/stack.hpp"
+#include "vm/exceptions.hpp"
+
+#include <utility>
+#include <cstdint>
+
+#include <boost/test/unit_test.hpp>
+
+/**
+@file
+
+Checks the translation of bytecode into decoded instructions.
+*/
+
+using perseus::detail::processor;
+using perseus::detail::opcode;
+using perseus::detail::decoded_code;
+using perseus::detail::get_handler;
+
+BOOST_AUTO_TEST_SUITE( vm )
+
+BOOST_AUTO_TEST_SUITE( execution )
+
+BOOST_AUTO_TEST_SUITE( decoding )
+
+BOOST_AUTO_TEST_CASE( addresses )
+{
+  BOOST_TEST_MESSAGE( "mapping between bytecode addresses and decoded instructions" );
+  auto code = create_code_segment(
+    opcode::push_32, std::int32_t( 1 ), // 0
+    opcode::call, label_reference( "function" ), // 5
+    opcode::exit, // 10
+    label( "function" ),
+    opcode::return_, std::uint32_t( 0 ) // 11
+    );
+  decoded_code program( code );
+  const perseus::detail::decoded_instruction* call = program.at( 5 );
+  BOOST_CHECK_EQUAL( call->handler, get_handler( opcode::call ) );
+  // the return address is stored in the instruction, the target already resolved
+  BOOST_CHECK_EQUAL( call->operand, 10u );
+  BOOST_CHECK_EQUAL( program.address_of( program.data() + call->target ), 11u );
+  BOOST_CHECK_EQUAL( program.address_of( program.at( 10 ) ), 10u );
+  BOOST_CHECK_THROW( program.at( 1 ), perseus::code_segmentation_fault );
+  BOOST_CHECK_THROW( program.at( 16 ), perseus::code_segmentation_fault );
+}
+
+BOOST_AUTO_TEST_CASE( jump_into_instruction )
+{
+  BOOST_TEST_MESSAGE( "jumping into the parameter of a previous instruction" );
+  // the parameter of push_32 doubles as "push_8 7; exit"
+  auto code = create_code_segment(
+    opcode::absolute_jump, std::uint32_t( 6 ),
+    opcode::push_32, opcode::push_8, char( 7 ), opcode::exit, opcode::no_operation
+    );
+  perseus::stack result = processor( perseus::detail::code_segment( code ) ).execute();
+  BOOST_CHECK_EQUAL( result.size(), 1 );
+  BOOST_CHECK_EQUAL( result.pop< char >(), 7 );
+
+  // constant jump targets get decoded, arbitrary addresses don't
+  BOOST_CHECK_EQUAL( processor( perseus::detail::code_segment( code ) ).execute( 8 ).size(), 0 );
+  BOOST_CHECK_THROW( processor( perseus::detail::code_segment( code ) ).execute( 7 ), perseus::code_segmentation_fault );
+}
+
+BOOST_AUTO_TEST_CASE( invalid_code )
+{
+  BOOST_TEST_MESSAGE( "invalid code only fails once executed" );
+  // truncated parameter, invalid opcode and jump outside the code; none of them are reached
+  auto code = create_code_segment(
+    opcode::exit,
+    opcode::absolute_jump, std::uint32_t( 100 ),
+    opcode::opcode_end,
+    opcode::push_32, char( 0 )
+    );
+  BOOST_CHECK_EQUAL( processor( perseus::detail::code_segment( code ) ).execute().size(), 0 );
+  BOOST_CHECK_THROW( processor( perseus::detail::code_segment( code ) ).execute( 1 ), perseus::code_segmentation_fault );
+  BOOST_CHECK_THROW( processor( perseus::detail::code_segment( code ) ).execute( 6 ), perseus::invalid_opcode );
+  BOOST_CHECK_THROW( processor( perseus::detail::code_segment( code ) ).execute( 7 ), perseus::code_segmentation_fault );
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
+BOOST_AUTO_TEST_SUITE_END()
+
+BOOST_AUTO_TEST_SUITE_END()
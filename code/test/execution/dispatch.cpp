@@ -0,0 +1,226 @@
+#include "../write_code_segment.hpp"
+
+#include "vm/processor.hpp"
+#include "vm/stack.hpp"
+#include "vm/exceptions.hpp"
+
+#include <utility>
+#include <cstdint>
+#include <sstream>
+#include <string>
+
+#include <boost/test/unit_test.hpp>
+
+/**
+@file
+
+Checks that all dispatch engines behave identically.
+*/
+
+using perseus::detail::processor;
+using perseus::detail::opcode;
+using perseus::detail::dispatch_engine;
+
+BOOST_AUTO_TEST_SUITE( vm )
+
+BOOST_AUTO_TEST_SUITE( execution )
+
+BOOST_AUTO_TEST_SUITE( dispatch )
+
+BOOST_AUTO_TEST_CASE( loop )
+{
+  BOOST_TEST_MESSAGE( "summing 1 to 100 in a loop" );
+  auto code = create_code_segment(
+    label( "loop" ),
+    // stack: [-8: sum] [-4: n]
+    opcode::relative_load_stack, std::uint32_t( 4 ), std::int32_t( -4 ),
+    opcode::push_32, std::int32_t( 0 ),
+    opcode::greater_than_i32,
+    opcode::relative_jump_if_false, label_reference_offset( "end" ),
+    opcode::relative_load_stack, std::uint32_t( 8 ), std::int32_t( -8 ),
+    opcode::add_i32,
+    opcode::relative_store_stack, std::uint32_t( 4 ), std::int32_t( -12 ),
+    opcode::pop, std::uint32_t( 4 ),
+    opcode::relative_load_stack, std::uint32_t( 4 ), std::int32_t( -4 ),
+    opcode::push_32, std::int32_t( 1 ),
+    opcode::subtract_i32,
+    opcode::relative_store_stack, std::uint32_t( 4 ), std::int32_t( -8 ),
+    opcode::pop, std::uint32_t( 4 ),
+    opcode::relative_jump, label_reference_offset( "loop" ),
+    label( "end" ),
+    opcode::pop, std::uint32_t( 4 ),
+    opcode::exit
+    );
+  for( dispatch_engine engine : dispatch_engines )
+  {
+    BOOST_TEST_MESSAGE( perseus::detail::get_name( engine ) );
+    perseus::stack input;
+    input.push< std::int32_t >( 0 );
+    input.push< std::int32_t >( 100 );
+    perseus::stack result = processor( perseus::detail::code_segment( code ), {}, engine ).execute( 0, std::move( input ) );
+    BOOST_CHECK_EQUAL( result.pop< std::int32_t >(), 5050 );
+    BOOST_CHECK_EQUAL( result.size(), 0 );
+  }
+}
+
+BOOST_AUTO_TEST_CASE( coroutine_switch )
+{
+  BOOST_TEST_MESSAGE( "resuming a coroutine that yields back" );
+  auto code = create_code_segment(
+    opcode::absolute_coroutine, label_reference( "coroutine" ),
+    opcode::relative_load_stack, std::uint32_t( 4 ), std::int32_t( -4 ),
+    opcode::resume_coroutine, std::uint32_t( 0 ),
+    opcode::exit,
+
+    label( "coroutine" ),
+    opcode::push_32, std::int32_t( 42 ),
+    opcode::yield, std::uint32_t( 4 )
+    );
+  for( dispatch_engine engine : dispatch_engines )
+  {
+    BOOST_TEST_MESSAGE( perseus::detail::get_name( engine ) );
+    processor proc( perseus::detail::code_segment( code ), {}, engine );
+    perseus::stack result = proc.execute();
+    BOOST_CHECK_EQUAL( result.pop< std::int32_t >(), 42 );
+    BOOST_CHECK_EQUAL( result.size(), sizeof( perseus::detail::coroutine::identifier ) );
+    BOOST_CHECK( proc.has_coroutines() );
+  }
+}
+
+BOOST_AUTO_TEST_CASE( errors )
+{
+  BOOST_TEST_MESSAGE( "invalid opcodes and leaving the code segment" );
+  for( dispatch_engine engine : dispatch_engines )
+  {
+    BOOST_TEST_MESSAGE( perseus::detail::get_name( engine ) );
+    BOOST_CHECK_THROW( processor( create_code_segment( opcode::no_operation, opcode::opcode_end ), {}, engine ).execute(), perseus::invalid_opcode );
+    BOOST_CHECK_THROW( processor( create_code_segment( opcode::no_operation ), {}, engine ).execute(), perseus::code_segmentation_fault );
+  }
+}
+
+BOOST_AUTO_TEST_CASE( stack_in_registers )
+{
+  BOOST_TEST_MESSAGE( "values kept out of the stack by dispatch_engine::top_of_stack" );
+  auto code = create_code_segment(
+    opcode::push_32, std::int32_t( 1 ),
+    opcode::push_32, std::int32_t( 2 ),
+    opcode::push_32, std::int32_t( 3 ),
+    // reads a value that may be in a register
+    opcode::load_local_32, std::int32_t( -8 ),
+    opcode::load_local_32, std::int32_t( -16 ),
+    opcode::add_i32,
+    opcode::multiply_i32,
+    // stack: 1 2 9
+    opcode::relative_load_stack, std::uint32_t( 4 ), std::int32_t( -12 ),
+    opcode::subtract_i32,
+    // stack: 1 2 8
+    opcode::load_local_32, std::int32_t( -4 ),
+    opcode::add_i32,
+    opcode::reserve, std::uint32_t( 4 ),
+    opcode::push_32, std::int32_t( 5 ),
+    // writes below the values that may be in registers
+    opcode::relative_store_stack, std::uint32_t( 4 ), std::int32_t( -20 ),
+    opcode::pop, std::uint32_t( 8 ),
+    // stack: 5 2 16
+    opcode::syscall, std::uint32_t( 0 ),
+    opcode::exit
+    );
+  for( dispatch_engine engine : dispatch_engines )
+  {
+    BOOST_TEST_MESSAGE( perseus::detail::get_name( engine ) );
+    for( bool verify : { false, true } )
+    {
+      processor proc( perseus::detail::code_segment( code ), { []( perseus::stack& st ){ st.push< std::uint32_t >( static_cast< std::uint32_t >( st.size() ) ); } }, engine, verify );
+      perseus::stack result = proc.execute();
+      BOOST_CHECK_EQUAL( result.pop< std::uint32_t >(), 12u );
+      BOOST_CHECK_EQUAL( result.pop< std::int32_t >(), 16 );
+      BOOST_CHECK_EQUAL( result.pop< std::int32_t >(), 2 );
+      BOOST_CHECK_EQUAL( result.pop< std::int32_t >(), 5 );
+      BOOST_CHECK_EQUAL( result.size(), 0 );
+    }
+  }
+}
+
+BOOST_AUTO_TEST_CASE( count_instructions )
+{
+  BOOST_TEST_MESSAGE( "counting executed instructions" );
+  auto code = create_code_segment(
+    opcode::push_32, std::int32_t( 1 ),
+    opcode::push_32, std::int32_t( 2 ),
+    opcode::add_i32,
+    opcode::exit
+    );
+  for( dispatch_engine engine : dispatch_engines )
+  {
+    BOOST_TEST_MESSAGE( perseus::detail::get_name( engine ) );
+    perseus::detail::instruction_counter counter;
+    perseus::stack result = processor( perseus::detail::code_segment( code ), {}, engine ).execute( 0, perseus::stack(), counter );
+    BOOST_CHECK_EQUAL( result.pop< std::int32_t >(), 3 );
+    BOOST_CHECK_EQUAL( counter.instructions, 4u );
+  }
+}
+
+BOOST_AUTO_TEST_CASE( opcode_statistics )
+{
+  BOOST_TEST_MESSAGE( "counting and timing executed instructions per opcode" );
+  auto code = create_code_segment(
+    opcode::push_32, std::int32_t( 100 ),
+    label( "loop" ),
+    opcode::load_local_32, std::int32_t( -4 ),
+    opcode::push_32, std::int32_t( 0 ),
+    opcode::greater_than_i32_jump_if_false, label_reference_offset( "end" ),
+    opcode::add_immediate_i32, std::int32_t( -1 ),
+    opcode::relative_jump, label_reference_offset( "loop" ),
+    label( "end" ),
+    opcode::exit
+    );
+  for( dispatch_engine engine : dispatch_engines )
+  {
+    BOOST_TEST_MESSAGE( perseus::detail::get_name( engine ) );
+    // timing every instruction
+    perseus::detail::opcode_statistics statistics( 1 );
+    perseus::stack result = processor( perseus::detail::code_segment( code ), {}, engine ).execute( 0, perseus::stack(), statistics );
+    BOOST_CHECK_EQUAL( result.pop< std::int32_t >(), 0 );
+    BOOST_CHECK_EQUAL( statistics.get( opcode::push_32 ).executions, 102u );
+    BOOST_CHECK_EQUAL( statistics.get( opcode::load_local_32 ).executions, 101u );
+    BOOST_CHECK_EQUAL( statistics.get( opcode::greater_than_i32_jump_if_false ).executions, 101u );
+    BOOST_CHECK_EQUAL( statistics.get( opcode::add_immediate_i32 ).executions, 100u );
+    BOOST_CHECK_EQUAL( statistics.get( opcode::relative_jump ).executions, 100u );
+    BOOST_CHECK_EQUAL( statistics.get( opcode::exit ).executions, 1u );
+    BOOST_CHECK_EQUAL( statistics.instructions(), 505u );
+    // exit is the only instruction without a successor to end its sample
+    BOOST_CHECK_EQUAL( statistics.get( opcode::add_immediate_i32 ).samples, 100u );
+    BOOST_CHECK_EQUAL( statistics.get( opcode::exit ).samples, 0u );
+
+    std::ostringstream table;
+    statistics.write_table( table );
+    BOOST_CHECK_NE( table.str().find( "greater_than_i32_jump_if_false" ), std::string::npos );
+    BOOST_CHECK_EQUAL( table.str().find( "add_i32" ), std::string::npos );
+
+    statistics.clear();
+    BOOST_CHECK_EQUAL( statistics.instructions(), 0u );
+
+    // profile samples are taken at the backward jumps, and must not count as their time
+    processor profiled( perseus::detail::code_segment( code ), {}, engine );
+    profiled.start_profiling( 1 );
+    profiled.execute( 0, perseus::stack(), statistics );
+    BOOST_CHECK_EQUAL( statistics.get( opcode::relative_jump ).executions, 100u );
+    BOOST_CHECK_EQUAL( statistics.get( opcode::relative_jump ).samples, 0u );
+    BOOST_CHECK_EQUAL( statistics.get( opcode::add_immediate_i32 ).samples, 100u );
+  }
+}
+
+BOOST_AUTO_TEST_CASE( opcode_names )
+{
+  BOOST_TEST_MESSAGE( "opcodes have their source names" );
+  BOOST_CHECK_EQUAL( perseus::detail::get_name( opcode::no_operation ), std::string( "no_operation" ) );
+  BOOST_CHECK_EQUAL( perseus::detail::get_name( opcode::push_32 ), std::string( "push_32" ) );
+  BOOST_CHECK_EQUAL( perseus::detail::get_name( opcode::store_pop_return ), std::string( "store_pop_return" ) );
+  BOOST_CHECK_EQUAL( perseus::detail::get_name( opcode::opcode_end ), std::string( "opcode_end" ) );
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
+BOOST_AUTO_TEST_SUITE_END()
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,273 @@
+#include "../write_code_segment.hpp"
+
+#include "vm/processor.hpp"
+#include "vm/event_loop.hpp"
+#include "vm/stack.hpp"
+#include "vm/exceptions.hpp"
+
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <future>
+#include <string>
+#include <utility>
+
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <boost/test/unit_test.hpp>
+
+/**
+@file
+
+Checks executions waiting for pipes and sockets via the event loop, while others keep running.
+*/
+
+using perseus::detail::processor;
+using perseus::detail::event_loop;
+using perseus::detail::opcode;
+
+BOOST_AUTO_TEST_SUITE( vm )
+
+BOOST_AUTO_TEST_SUITE( execution )
+
+BOOST_AUTO_TEST_SUITE( event_loop_ )
+
+/// a pair of non-blocking file descriptors, closed on destruction
+struct descriptors
+{
+  explicit descriptors( const bool socket )
+  {
+    BOOST_REQUIRE_EQUAL( socket ? socketpair( AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, fds ) : pipe2( fds, O_NONBLOCK ), 0 );
+  }
+  ~descriptors()
+  {
+    close_one( 0 );
+    close_one( 1 );
+  }
+  void close_one( const int index )
+  {
+    if( fds[ index ] >= 0 )
+    {
+      close( fds[ index ] );
+      fds[ index ] = -1;
+    }
+  }
+  int fds[ 2 ];
+};
+
+enum syscall_index : std::uint32_t
+{
+  read_syscall,
+  write_syscall
+};
+
+/// reads up to 16 bytes from the file descriptor given as parameter
+static perseus::detail::code_segment read_code()
+{
+  return create_code_segment(
+    // stack: [fd]
+    opcode::push_32, std::uint32_t( 16 ),
+    opcode::relative_load_stack, std::uint32_t( 4 ), std::int32_t( -8 ),
+    opcode::syscall, std::uint32_t( read_syscall ),
+    opcode::exit
+    );
+}
+
+/// writes "ping" to the file descriptor given as parameter, then reads up to 4 bytes from it
+static perseus::detail::code_segment ping_code()
+{
+  return create_code_segment(
+    // stack: [fd]
+    opcode::push_8, 'p',
+    opcode::push_8, 'i',
+    opcode::push_8, 'n',
+    opcode::push_8, 'g',
+    opcode::push_32, std::uint32_t( 4 ),
+    opcode::relative_load_stack, std::uint32_t( 4 ), std::int32_t( -12 ),
+    opcode::syscall, std::uint32_t( write_syscall ),
+    // stack: [fd] [written]
+    opcode::push_32, std::uint32_t( 4 ),
+    opcode::relative_load_stack, std::uint32_t( 4 ), std::int32_t( -12 ),
+    opcode::syscall, std::uint32_t( read_syscall ),
+    opcode::exit
+    );
+}
+
+/// reads up to 4 bytes from the file descriptor given as parameter and writes them back
+static perseus::detail::code_segment echo_code()
+{
+  return create_code_segment(
+    // stack: [fd]
+    opcode::push_32, std::uint32_t( 4 ),
+    opcode::relative_load_stack, std::uint32_t( 4 ), std::int32_t( -8 ),
+    opcode::syscall, std::uint32_t( read_syscall ),
+    // stack: [fd] [bytes] [read]; write as many bytes as were read
+    opcode::relative_load_stack, std::uint32_t( 4 ), std::int32_t( -12 ),
+    opcode::syscall, std::uint32_t( write_syscall ),
+    opcode::exit
+    );
+}
+
+static perseus::stack fd_parameter( const int fd )
+{
+  perseus::stack result;
+  result.push< std::int32_t >( fd );
+  return result;
+}
+
+static std::string pop_string( perseus::stack& st, const std::size_t size )
+{
+  BOOST_REQUIRE_GE( st.size(), size );
+  const std::string result( st.end() - size, st.end() );
+  st.discard( size );
+  return result;
+}
+
+BOOST_AUTO_TEST_CASE( pipe_read )
+{
+  BOOST_TEST_MESSAGE( "an execution waits for a pipe to become readable" );
+  event_loop loop;
+  descriptors pipe( false );
+  processor proc( read_code(), { loop.read_syscall(), loop.write_syscall() } );
+  std::future< perseus::stack > future = loop.spawn( proc, 0, fd_parameter( pipe.fds[ 0 ] ) );
+  BOOST_CHECK( loop.run_once( 0 ) );
+  BOOST_CHECK( proc.is_suspended() );
+  BOOST_CHECK_EQUAL( loop.pending(), 1u );
+  BOOST_CHECK( future.wait_for( std::chrono::seconds( 0 ) ) == std::future_status::timeout );
+  BOOST_REQUIRE_EQUAL( write( pipe.fds[ 1 ], "hello", 5 ), 5 );
+  loop.run();
+  BOOST_CHECK_EQUAL( loop.pending(), 0u );
+  perseus::stack result = future.get();
+  BOOST_REQUIRE_EQUAL( result.pop< std::int32_t >(), 5 );
+  BOOST_CHECK_EQUAL( pop_string( result, 5 ), "hello" );
+  BOOST_CHECK_EQUAL( result.pop< std::int32_t >(), pipe.fds[ 0 ] );
+  BOOST_CHECK( result.empty() );
+}
+
+BOOST_AUTO_TEST_CASE( end_of_file_and_errors )
+{
+  BOOST_TEST_MESSAGE( "the end of a pipe and failures are reported as results" );
+  event_loop loop;
+  descriptors pipe( false );
+  processor reader( read_code(), { loop.read_syscall(), loop.write_syscall() } );
+  std::future< perseus::stack > eof = loop.spawn( reader, 0, fd_parameter( pipe.fds[ 0 ] ) );
+  BOOST_CHECK( loop.run_once( 0 ) );
+  pipe.close_one( 1 );
+  loop.run();
+  perseus::stack result = eof.get();
+  BOOST_CHECK_EQUAL( result.pop< std::int32_t >(), 0 );
+
+  processor bad( read_code(), { loop.read_syscall(), loop.write_syscall() } );
+  std::future< perseus::stack > failure = loop.spawn( bad, 0, fd_parameter( -1 ) );
+  loop.run();
+  result = failure.get();
+  BOOST_CHECK_EQUAL( result.pop< std::int32_t >(), -EBADF );
+}
+
+BOOST_AUTO_TEST_CASE( others_keep_running )
+{
+  BOOST_TEST_MESSAGE( "executions that don't wait finish while another one waits" );
+  event_loop loop;
+  descriptors pipe( false );
+  processor waiting( read_code(), { loop.read_syscall(), loop.write_syscall() } );
+  std::future< perseus::stack > waiting_result = loop.spawn( waiting, 0, fd_parameter( pipe.fds[ 0 ] ) );
+  processor computing( create_code_segment(
+    opcode::push_32, std::int32_t( 6 ),
+    opcode::push_32, std::int32_t( 7 ),
+    opcode::multiply_i32,
+    opcode::exit
+    ) );
+  std::future< perseus::stack > computing_result = loop.spawn( computing );
+  BOOST_CHECK( loop.run_once( 0 ) );
+  BOOST_REQUIRE( computing_result.wait_for( std::chrono::seconds( 0 ) ) == std::future_status::ready );
+  BOOST_CHECK_EQUAL( computing_result.get().pop< std::int32_t >(), 42 );
+  BOOST_CHECK( waiting_result.wait_for( std::chrono::seconds( 0 ) ) == std::future_status::timeout );
+  BOOST_CHECK_EQUAL( loop.pending(), 1u );
+  pipe.close_one( 1 );
+  loop.run();
+  BOOST_CHECK_EQUAL( waiting_result.get().pop< std::int32_t >(), 0 );
+}
+
+BOOST_AUTO_TEST_CASE( socket_ping_pong )
+{
+  BOOST_TEST_MESSAGE( "two executions talk to each other through a socket pair" );
+  event_loop loop;
+  descriptors sockets( true );
+  processor echo( echo_code(), { loop.read_syscall(), loop.write_syscall() } );
+  processor ping( ping_code(), { loop.read_syscall(), loop.write_syscall() } );
+  // the echo starts first, so it has to wait
+  std::future< perseus::stack > echo_result = loop.spawn( echo, 0, fd_parameter( sockets.fds[ 1 ] ) );
+  std::future< perseus::stack > ping_result = loop.spawn( ping, 0, fd_parameter( sockets.fds[ 0 ] ) );
+  loop.run();
+  perseus::stack result = echo_result.get();
+  BOOST_CHECK_EQUAL( result.pop< std::int32_t >(), 4 );
+  result = ping_result.get();
+  BOOST_REQUIRE_EQUAL( result.pop< std::int32_t >(), 4 );
+  BOOST_CHECK_EQUAL( pop_string( result, 4 ), "ping" );
+  BOOST_CHECK_EQUAL( result.pop< std::int32_t >(), 4 );
+}
+
+BOOST_AUTO_TEST_CASE( full_pipe )
+{
+  BOOST_TEST_MESSAGE( "writing to a full pipe waits until it's drained" );
+  event_loop loop;
+  descriptors pipe( false );
+  // fill the pipe
+  const char buffer[ 4096 ] = {};
+  while( write( pipe.fds[ 1 ], buffer, sizeof( buffer ) ) > 0 )
+  {
+  }
+  processor writer( ping_code(), { loop.read_syscall(), loop.write_syscall() } );
+  std::future< perseus::stack > future = loop.spawn( writer, 0, fd_parameter( pipe.fds[ 1 ] ) );
+  BOOST_CHECK( loop.run_once( 0 ) );
+  BOOST_CHECK( future.wait_for( std::chrono::seconds( 0 ) ) == std::future_status::timeout );
+  char drain[ 4096 ];
+  while( read( pipe.fds[ 0 ], drain, sizeof( drain ) ) > 0 )
+  {
+  }
+  loop.run();
+  perseus::stack result = future.get();
+  // reading from the write end fails
+  BOOST_CHECK_EQUAL( result.pop< std::int32_t >(), -EBADF );
+  BOOST_CHECK_EQUAL( result.pop< std::int32_t >(), 4 );
+}
+
+BOOST_AUTO_TEST_CASE( await_outside_execution )
+{
+  event_loop loop;
+  BOOST_CHECK_THROW( loop.await( 0, event_loop::readiness::readable ), perseus::invalid_suspension_state );
+}
+
+BOOST_AUTO_TEST_CASE( time_slices )
+{
+  BOOST_TEST_MESSAGE( "an endless loop gets preempted so the other executions finish" );
+  event_loop loop;
+  loop.set_time_slice( perseus::detail::execution_budget{ 1000 } );
+  processor endless( create_code_segment(
+    label( "loop" ),
+    opcode::relative_jump, label_reference_offset( "loop" )
+    ) );
+  std::future< perseus::stack > endless_result = loop.spawn( endless );
+  processor computing( create_code_segment(
+    opcode::push_32, std::int32_t( 6 ),
+    opcode::push_32, std::int32_t( 7 ),
+    opcode::multiply_i32,
+    opcode::exit
+    ) );
+  std::future< perseus::stack > computing_result = loop.spawn( computing );
+  BOOST_CHECK( loop.run_once( 0 ) );
+  BOOST_REQUIRE( computing_result.wait_for( std::chrono::seconds( 0 ) ) == std::future_status::ready );
+  BOOST_CHECK_EQUAL( computing_result.get().pop< std::int32_t >(), 42 );
+  BOOST_CHECK( loop.run_once( 0 ) );
+  BOOST_CHECK( endless.is_preempted() );
+  BOOST_CHECK_EQUAL( loop.pending(), 1u );
+}
+
+BOOST_AUTO_TEST_SUITE_END() // event_loop_
+
+BOOST_AUTO_TEST_SUITE_END() // execution
+
+BOOST_AUTO_TEST_SUITE_END() // vm
@@ -0,0 +1,125 @@
+#include "../write_code_segment.hpp"
+#include "../temporary_file.hpp"
+
+#include "vm/image.hpp"
+#include "vm/processor.hpp"
+#include "vm/exceptions.hpp"
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <system_error>
+#include <utility>
+
+#include <unistd.h>
+
+#include <boost/test/unit_test.hpp>
+
+/**
+@file
+
+Checks saving programs to images and loading them again.
+*/
+
+using perseus::detail::opcode;
+using perseus::detail::program_image;
+using address = perseus::detail::instruction_pointer::value_type;
+
+/// adds its two arguments, using syscall 0 to do so
+static program_image create_program()
+{
+  program_image program;
+  address add;
+  program.code = create_code_segment(
+    opcode::no_operation,
+    label( "start" ),
+    opcode::reserve, std::uint32_t( 4 ),
+    opcode::push_32, std::int32_t( 40 ),
+    opcode::push_32, std::int32_t( 2 ),
+    opcode::call, label_reference( "add" ),
+    opcode::exit,
+
+    get_current_address( add ),
+    label( "add" ),
+    opcode::syscall, std::uint32_t( 0 ),
+    opcode::return_, std::uint32_t( 8 )
+    );
+  program.entry_point = 1;
+  program.syscalls = { "add(i32,i32)" };
+  program.functions = { { program.entry_point, "main()" }, { add, "add(i32,i32)" } };
+  return program;
+}
+
+/// the syscall the program uses
+static void add( perseus::stack& st )
+{
+  // stack: [-16: result] [-12: a] [-8: b] [-4: return address]
+  std::int32_t a, b;
+  std::memcpy( &a, st.data() + st.size() - 12, 4 );
+  std::memcpy( &b, st.data() + st.size() - 8, 4 );
+  const std::int32_t sum = a + b;
+  std::memcpy( st.data() + st.size() - 16, &sum, 4 );
+}
+
+BOOST_AUTO_TEST_SUITE( vm )
+
+BOOST_AUTO_TEST_SUITE( execution )
+
+BOOST_AUTO_TEST_SUITE( image )
+
+BOOST_AUTO_TEST_CASE( round_trip )
+{
+  BOOST_TEST_MESSAGE( "a loaded image contains what was saved, and runs like the original" );
+  const temporary_file file;
+  const program_image original = create_program();
+  perseus::detail::save_image( file.path, original );
+
+  program_image loaded = perseus::detail::load_image( file.path );
+  BOOST_CHECK( loaded.code == original.code );
+  BOOST_CHECK_EQUAL( loaded.entry_point, original.entry_point );
+  BOOST_CHECK( loaded.syscalls == original.syscalls );
+  BOOST_CHECK( loaded.functions == original.functions );
+
+  perseus::detail::processor proc( std::move( loaded.code ), { &add } );
+  perseus::stack result = proc.execute( loaded.entry_point );
+  BOOST_CHECK_EQUAL( result.pop< std::int32_t >(), 42 );
+  BOOST_CHECK_EQUAL( result.size(), 0u );
+}
+
+BOOST_AUTO_TEST_CASE( invalid_files )
+{
+  BOOST_TEST_MESSAGE( "damaged images are rejected" );
+  const temporary_file file;
+  BOOST_CHECK_THROW( perseus::detail::load_image( file.path + ".missing" ), std::system_error );
+  // empty
+  BOOST_CHECK_THROW( perseus::detail::load_image( file.path ), perseus::invalid_image );
+
+  const program_image original = create_program();
+  perseus::detail::save_image( file.path, original );
+  BOOST_REQUIRE_EQUAL( truncate( file.path.c_str(), sizeof( perseus::detail::image::header ) + 4 ), 0 );
+  BOOST_CHECK_THROW( perseus::detail::load_image( file.path ), perseus::invalid_image );
+
+  // an intact image, apart from its first byte
+  perseus::detail::save_image( file.path, original );
+  std::FILE* f = std::fopen( file.path.c_str(), "r+b" );
+  BOOST_REQUIRE( f );
+  std::fputc( 'X', f );
+  std::fclose( f );
+  BOOST_CHECK_THROW( perseus::detail::load_image( file.path ), perseus::invalid_image );
+
+  // an intact image, apart from its last byte, which is code
+  perseus::detail::save_image( file.path, original );
+  f = std::fopen( file.path.c_str(), "r+b" );
+  BOOST_REQUIRE( f );
+  std::fseek( f, -1, SEEK_END );
+  std::fputc( 0x7f, f );
+  std::fclose( f );
+  BOOST_CHECK_THROW( perseus::detail::load_image( file.path ), perseus::invalid_image );
+}
+
+BOOST_AUTO_TEST_SUITE_END() // image
+
+BOOST_AUTO_TEST_SUITE_END() // execution
+
+BOOST_AUTO_TEST_SUITE_END() // vm
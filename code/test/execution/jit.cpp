@@ -0,0 +1,276 @@
+#include "../write_code_segment.hpp"
+
+#include "vm/processor.hpp"
+#include "vm/stack.hpp"
+#include "vm/exceptions.hpp"
+#include "vm/jit_compiler.hpp"
+
+#include <utility>
+#include <cstdint>
+
+#include <boost/test/unit_test.hpp>
+
+/**
+@file
+
+Checks that compiled functions behave like interpreted ones, including where the native code hands back to the interpreter.
+*/
+
+using perseus::detail::processor;
+using perseus::detail::opcode;
+using perseus::detail::dispatch_engine;
+
+/// enough calls to compile any called function
+static const unsigned int hot_runs = 2 * perseus::detail::jit_compiler::default_hot_call_count;
+
+/// checks the number of compiled functions, where native code is supported
+static void check_compiled_functions( const processor& proc, const std::size_t expected )
+{
+#ifdef PERSEUS_HAS_JIT
+  BOOST_CHECK_EQUAL( proc.jit()->compiled_functions(), expected );
+#else
+  BOOST_CHECK_EQUAL( proc.jit()->compiled_functions(), 0u );
+  static_cast< void >( expected );
+#endif
+}
+
+/// recursive fibonacci of the given number, calling syscall 0 for each n < 2
+static perseus::detail::code_segment fibonacci_code( const std::int32_t n )
+{
+  return create_code_segment(
+    opcode::push_32, std::int32_t( 0 ),
+    opcode::push_32, n,
+    opcode::call, label_reference( "fib" ),
+    opcode::exit,
+
+    // stack: [-12: result] [-8: n] [-4: return address]
+    label( "fib" ),
+    opcode::relative_load_stack, std::uint32_t( 4 ), std::int32_t( -8 ),
+    opcode::push_32, std::int32_t( 2 ),
+    opcode::less_than_i32,
+    opcode::relative_jump_if_false, label_reference_offset( "recurse" ),
+    opcode::syscall, std::uint32_t( 0 ),
+    opcode::relative_load_stack, std::uint32_t( 4 ), std::int32_t( -8 ),
+    opcode::relative_store_stack, std::uint32_t( 4 ), std::int32_t( -16 ),
+    opcode::pop, std::uint32_t( 4 ),
+    opcode::return_, std::uint32_t( 4 ),
+
+    label( "recurse" ),
+    opcode::reserve, std::uint32_t( 4 ),
+    opcode::relative_load_stack, std::uint32_t( 4 ), std::int32_t( -12 ),
+    opcode::push_32, std::int32_t( 1 ),
+    opcode::subtract_i32,
+    opcode::call, label_reference( "fib" ),
+    opcode::reserve, std::uint32_t( 4 ),
+    opcode::relative_load_stack, std::uint32_t( 4 ), std::int32_t( -16 ),
+    opcode::push_32, std::int32_t( 2 ),
+    opcode::subtract_i32,
+    opcode::call, label_reference( "fib" ),
+    opcode::add_i32,
+    opcode::relative_store_stack, std::uint32_t( 4 ), std::int32_t( -16 ),
+    opcode::pop, std::uint32_t( 4 ),
+    opcode::return_, std::uint32_t( 4 )
+    );
+}
+
+/// calls the given function, which expects its result space and arguments as the initial stack
+static perseus::detail::code_segment call_code( perseus::detail::code_segment&& function )
+{
+  const auto create_main = []( const std::uint32_t function_address )
+  {
+    return create_code_segment(
+      opcode::call, function_address,
+      opcode::exit
+      );
+  };
+  perseus::detail::code_segment code = create_main( static_cast< std::uint32_t >( create_main( 0 ).size() ) );
+  code.insert( code.end(), function.begin(), function.end() );
+  return code;
+}
+
+/// the initial stack for call_code(): result space and two i32 arguments
+static perseus::stack arguments( const std::size_t result_size, const std::int32_t argument1, const std::int32_t argument2 )
+{
+  perseus::stack st;
+  st.resize( result_size );
+  st.push< std::int32_t >( argument1 );
+  st.push< std::int32_t >( argument2 );
+  return st;
+}
+
+/// the instructions without control flow, computing 28 bytes from a and b
+static perseus::detail::code_segment mixed_function()
+{
+  // stack: [-40: result] [-12: a] [-8: b] [-4: return address]
+  return create_code_segment(
+    opcode::relative_load_stack, std::uint32_t( 4 ), std::int32_t( -12 ),
+    opcode::relative_load_stack, std::uint32_t( 4 ), std::int32_t( -12 ),
+    opcode::divide_i32,
+    opcode::relative_load_stack, std::uint32_t( 4 ), std::int32_t( -16 ),
+    opcode::relative_load_stack, std::uint32_t( 4 ), std::int32_t( -16 ),
+    opcode::modulo_i32,
+    opcode::relative_load_stack, std::uint32_t( 4 ), std::int32_t( -20 ),
+    opcode::negate_i32,
+    opcode::load_local_32, std::int32_t( -24 ),
+    opcode::add_immediate_i32, std::int32_t( 7 ),
+    opcode::relative_load_stack, std::uint32_t( 4 ), std::int32_t( -28 ),
+    opcode::load_local_32, std::int32_t( -28 ),
+    opcode::multiply_i32,
+    opcode::relative_load_stack, std::uint32_t( 4 ), std::int32_t( -32 ),
+    opcode::relative_load_stack, std::uint32_t( 4 ), std::int32_t( -32 ),
+    opcode::less_than_or_equals_i32,
+    // 21 bytes
+    opcode::relative_load_stack, std::uint32_t( 8 ), std::int32_t( -33 ),
+    opcode::greater_than_i32,
+    opcode::relative_load_stack, std::uint32_t( 2 ), std::int32_t( -2 ),
+    opcode::and_b,
+    opcode::relative_load_stack, std::uint32_t( 2 ), std::int32_t( -3 ),
+    opcode::or_b,
+    opcode::relative_load_stack, std::uint32_t( 2 ), std::int32_t( -4 ),
+    opcode::equals_b,
+    opcode::relative_load_stack, std::uint32_t( 2 ), std::int32_t( -5 ),
+    opcode::not_equals_b,
+    opcode::negate_b,
+    // 26 bytes
+    opcode::push_8, char( -5 ),
+    opcode::push_8, char( 0 ),
+    opcode::store_pop_return, std::uint32_t( 28 ), std::uint32_t( 28 ), std::uint32_t( 8 )
+    );
+}
+
+/// sums 1 to n in a loop, ignoring its first argument
+static perseus::detail::code_segment loop_function()
+{
+  // stack: [-16: result] [-12: unused] [-8: n] [-4: return address]
+  return create_code_segment(
+    opcode::push_32, std::int32_t( 0 ),
+    opcode::relative_load_stack, std::uint32_t( 4 ), std::int32_t( -12 ),
+    // stack: [-8: sum] [-4: i]
+    label( "loop" ),
+    opcode::load_local_32, std::int32_t( -4 ),
+    opcode::push_32, std::int32_t( 0 ),
+    opcode::greater_than_i32_jump_if_false, label_reference_offset( "end" ),
+    opcode::relative_load_stack, std::uint32_t( 8 ), std::int32_t( -8 ),
+    opcode::add_i32,
+    opcode::relative_store_stack, std::uint32_t( 4 ), std::int32_t( -12 ),
+    opcode::pop, std::uint32_t( 4 ),
+    opcode::load_local_32, std::int32_t( -4 ),
+    opcode::add_immediate_i32, std::int32_t( -1 ),
+    opcode::relative_store_stack, std::uint32_t( 4 ), std::int32_t( -8 ),
+    opcode::pop, std::uint32_t( 4 ),
+    opcode::relative_jump, label_reference_offset( "loop" ),
+    label( "end" ),
+    opcode::pop, std::uint32_t( 4 ),
+    opcode::store_pop_return, std::uint32_t( 4 ), std::uint32_t( 4 ), std::uint32_t( 8 )
+    );
+}
+
+BOOST_AUTO_TEST_SUITE( vm )
+
+BOOST_AUTO_TEST_SUITE( execution )
+
+BOOST_AUTO_TEST_SUITE( jit )
+
+BOOST_AUTO_TEST_CASE( recursion )
+{
+  BOOST_TEST_MESSAGE( "a recursive function, which bails out to the interpreter for a syscall" );
+  for( bool verify : { false, true } )
+  {
+    unsigned int syscalls = 0;
+    processor proc( fibonacci_code( 15 ), { [ &syscalls ]( perseus::stack& ){ ++syscalls; } }, dispatch_engine::jit, verify );
+    perseus::stack result = proc.execute();
+    BOOST_CHECK_EQUAL( result.pop< std::int32_t >(), 610 );
+    BOOST_CHECK_EQUAL( result.size(), 0 );
+    // fib( 15 ) consists of fib( 1 ) and fib( 0 ) calls only
+    BOOST_CHECK_EQUAL( syscalls, 987u );
+    check_compiled_functions( proc, 1 );
+  }
+}
+
+BOOST_AUTO_TEST_CASE( instructions )
+{
+  BOOST_TEST_MESSAGE( "native instructions compute what the interpreted ones do" );
+  processor interpreter( call_code( mixed_function() ) );
+  processor proc( call_code( mixed_function() ), {}, dispatch_engine::jit );
+  for( unsigned int run = 0; run < hot_runs; ++run )
+  {
+    for( std::int32_t a : { -7, 0, 3, 1000, 2147483647 } )
+    {
+      for( std::int32_t b : { -3, -1, 1, 7, 1000 } )
+      {
+        const perseus::stack expected = interpreter.execute( 0, arguments( 28, a, b ) );
+        const perseus::stack actual = proc.execute( 0, arguments( 28, a, b ) );
+        BOOST_REQUIRE_EQUAL( actual.size(), 28u );
+        BOOST_CHECK( expected == actual );
+      }
+    }
+  }
+  check_compiled_functions( proc, 1 );
+}
+
+BOOST_AUTO_TEST_CASE( loop )
+{
+  processor proc( call_code( loop_function() ), {}, dispatch_engine::jit );
+  for( unsigned int run = 0; run < hot_runs; ++run )
+  {
+    perseus::stack result = proc.execute( 0, arguments( 4, 0, 100 ) );
+    BOOST_CHECK_EQUAL( result.pop< std::int32_t >(), 5050 );
+    BOOST_CHECK_EQUAL( result.size(), 0 );
+  }
+  check_compiled_functions( proc, 1 );
+}
+
+BOOST_AUTO_TEST_CASE( deep_recursion )
+{
+  BOOST_TEST_MESSAGE( "recursing deeper than native code's window of the stack" );
+  auto code = create_code_segment(
+    opcode::push_32, std::int32_t( 0 ),
+    opcode::push_32, std::int32_t( 5000 ),
+    opcode::call, label_reference( "sum" ),
+    opcode::exit,
+
+    // stack: [-12: result] [-8: n] [-4: return address]
+    label( "sum" ),
+    opcode::load_local_32, std::int32_t( -8 ),
+    opcode::push_32, std::int32_t( 0 ),
+    opcode::not_equals_i32_jump_if_false, label_reference_offset( "zero" ),
+    opcode::reserve, std::uint32_t( 4 ),
+    opcode::load_local_32, std::int32_t( -12 ),
+    opcode::add_immediate_i32, std::int32_t( -1 ),
+    opcode::call, label_reference( "sum" ),
+    opcode::load_local_32, std::int32_t( -12 ),
+    opcode::add_i32,
+    opcode::store_pop_return, std::uint32_t( 4 ), std::uint32_t( 4 ), std::uint32_t( 4 ),
+    label( "zero" ),
+    opcode::push_32, std::int32_t( 0 ),
+    opcode::store_pop_return, std::uint32_t( 4 ), std::uint32_t( 4 ), std::uint32_t( 4 )
+    );
+  processor proc( std::move( code ), {}, dispatch_engine::jit );
+  perseus::stack result = proc.execute();
+  BOOST_CHECK_EQUAL( result.pop< std::int32_t >(), 12502500 );
+  BOOST_CHECK_EQUAL( result.size(), 0 );
+  check_compiled_functions( proc, 1 );
+}
+
+BOOST_AUTO_TEST_CASE( errors )
+{
+  BOOST_TEST_MESSAGE( "errors in native code are thrown by the interpreter" );
+  for( bool verify : { false, true } )
+  {
+    processor proc( call_code( mixed_function() ), {}, dispatch_engine::jit, verify );
+    for( unsigned int run = 0; run < hot_runs; ++run )
+    {
+      proc.execute( 0, arguments( 28, 0, 1 ) );
+    }
+    check_compiled_functions( proc, 1 );
+    BOOST_CHECK_THROW( proc.execute( 0, arguments( 28, 1, 0 ) ), perseus::divide_by_zero );
+    // called without arguments
+    BOOST_CHECK_THROW( proc.execute( 0, perseus::stack() ), perseus::stack_segmentation_fault );
+  }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
+BOOST_AUTO_TEST_SUITE_END()
+
+BOOST_AUTO_TEST_SUITE_END()
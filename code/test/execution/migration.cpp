@@ -0,0 +1,229 @@
+#include "../write_code_segment.hpp"
+
+#include "vm/processor.hpp"
+#include "vm/migration.hpp"
+#include "vm/stack.hpp"
+#include "vm/exceptions.hpp"
+
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <boost/test/unit_test.hpp>
+
+/**
+@file
+
+Checks moving suspended coroutines between processors, including one in another process.
+*/
+
+using perseus::detail::processor;
+using perseus::detail::opcode;
+using address = perseus::detail::instruction_pointer::value_type;
+using identifier = perseus::detail::coroutine::identifier;
+
+BOOST_AUTO_TEST_SUITE( vm )
+
+BOOST_AUTO_TEST_SUITE( execution )
+
+BOOST_AUTO_TEST_SUITE( migration )
+
+/// a counter coroutine, and functions to advance it
+struct program
+{
+  program()
+  {
+    code = create_code_segment(
+      // leaves [counter] [3], having counted to 3
+      opcode::absolute_coroutine, label_reference( "counter" ),
+      opcode::relative_load_stack, std::uint32_t( 4 ), std::int32_t( -4 ),
+      opcode::resume_coroutine, std::uint32_t( 0 ),
+      opcode::pop, std::uint32_t( 4 ),
+      opcode::relative_load_stack, std::uint32_t( 4 ), std::int32_t( -4 ),
+      opcode::resume_coroutine, std::uint32_t( 0 ),
+      opcode::pop, std::uint32_t( 4 ),
+      opcode::relative_load_stack, std::uint32_t( 4 ), std::int32_t( -4 ),
+      opcode::resume_coroutine, std::uint32_t( 0 ),
+      opcode::exit,
+
+      // next( counter ) leaves [counter] [next value]
+      get_current_address( next ),
+      opcode::relative_load_stack, std::uint32_t( 4 ), std::int32_t( -4 ),
+      opcode::resume_coroutine, std::uint32_t( 0 ),
+      opcode::exit,
+
+      // yields 1, 2, 3, ...
+      label( "counter" ),
+      opcode::push_32, std::int32_t( 0 ),
+      label( "loop" ),
+      opcode::push_32, std::int32_t( 1 ),
+      opcode::add_i32,
+      opcode::relative_load_stack, std::uint32_t( 4 ), std::int32_t( -4 ),
+      opcode::yield, std::uint32_t( 4 ),
+      opcode::relative_jump, label_reference_offset( "loop" )
+      );
+  }
+
+  processor create_processor() const
+  {
+    perseus::detail::code_segment copy( code );
+    return processor( std::move( copy ) );
+  }
+
+  /// the next value of the counter with the given identifier
+  std::int32_t advance( processor& proc, const identifier counter ) const
+  {
+    perseus::stack parameters;
+    parameters.push< identifier >( counter );
+    perseus::stack result = proc.execute( next, std::move( parameters ) );
+    return result.pop< std::int32_t >();
+  }
+
+  perseus::detail::code_segment code;
+  address next;
+};
+
+/// a counter that has counted to 3, serialized
+static std::vector< char > counted_to_three( processor& proc )
+{
+  perseus::stack result = proc.execute();
+  BOOST_REQUIRE_EQUAL( result.pop< std::int32_t >(), 3 );
+  return proc.save_coroutine( result.pop< identifier >() );
+}
+
+static void write_all( const int descriptor, const char* data, std::size_t size )
+{
+  while( size > 0 )
+  {
+    const ssize_t written = write( descriptor, data, size );
+    if( written <= 0 )
+    {
+      _exit( 2 );
+    }
+    data += written;
+    size -= written;
+  }
+}
+
+static bool read_all( const int descriptor, char* data, std::size_t size )
+{
+  while( size > 0 )
+  {
+    const ssize_t received = read( descriptor, data, size );
+    if( received <= 0 )
+    {
+      return false;
+    }
+    data += received;
+    size -= received;
+  }
+  return true;
+}
+
+BOOST_AUTO_TEST_CASE( between_processors )
+{
+  BOOST_TEST_MESSAGE( "a coroutine continues in another processor with the same code" );
+  const program p;
+  processor source = p.create_processor();
+  const std::vector< char > data = counted_to_three( source );
+  BOOST_CHECK_EQUAL( perseus::detail::migration::stream_size( data.data() ), data.size() );
+
+  processor target = p.create_processor();
+  // occupy a slot, so the identifiers differ
+  target.execute();
+  const identifier migrated = target.restore_coroutine( data.data(), data.size() );
+  BOOST_CHECK_EQUAL( p.advance( target, migrated ), 4 );
+  BOOST_CHECK_EQUAL( p.advance( target, migrated ), 5 );
+}
+
+BOOST_AUTO_TEST_CASE( invalid_data )
+{
+  BOOST_TEST_MESSAGE( "only suspended coroutines of the same code are migrated" );
+  const program p;
+  processor source = p.create_processor();
+  std::vector< char > data = counted_to_three( source );
+
+  processor other( create_code_segment( opcode::exit ) );
+  BOOST_CHECK_THROW( other.restore_coroutine( data.data(), data.size() ), perseus::invalid_migration );
+  BOOST_CHECK( !other.has_coroutines() );
+
+  processor target = p.create_processor();
+  BOOST_CHECK_THROW( target.restore_coroutine( data.data(), data.size() - 1 ), perseus::invalid_migration );
+  BOOST_CHECK_THROW( target.restore_coroutine( data.data(), 10 ), perseus::invalid_migration );
+  data[ 0 ] = 'X';
+  BOOST_CHECK_THROW( target.restore_coroutine( data.data(), data.size() ), perseus::invalid_migration );
+  BOOST_CHECK( !target.has_coroutines() );
+
+  BOOST_CHECK_THROW( source.save_coroutine( 12345 ), perseus::invalid_coroutine_identifer );
+}
+
+BOOST_AUTO_TEST_CASE( unsuspended_coroutines )
+{
+  processor proc( create_code_segment(
+    opcode::syscall, std::uint32_t( 0 ),
+    opcode::exit
+    ), { []( perseus::stack& ){ throw perseus::would_block( "suspend" ); } } );
+  BOOST_CHECK_THROW( proc.execute(), perseus::would_block );
+  // the root coroutine of the suspended execution has the first identifier
+  BOOST_CHECK_THROW( proc.save_coroutine( 0 ), perseus::migrating_unsuspended_coroutine );
+}
+
+BOOST_AUTO_TEST_CASE( through_pipe )
+{
+  BOOST_TEST_MESSAGE( "a coroutine continues in another process" );
+  const program p;
+  int to_child[ 2 ], from_child[ 2 ];
+  BOOST_REQUIRE_EQUAL( pipe( to_child ), 0 );
+  BOOST_REQUIRE_EQUAL( pipe( from_child ), 0 );
+  const pid_t child = fork();
+  BOOST_REQUIRE_GE( child, 0 );
+  if( child == 0 )
+  {
+    // receives the coroutine, advances it once and sends back the value; no Boost.Test in here
+    close( to_child[ 1 ] );
+    close( from_child[ 0 ] );
+    std::vector< char > data( perseus::detail::migration::header_size );
+    if( !read_all( to_child[ 0 ], data.data(), data.size() ) )
+    {
+      _exit( 1 );
+    }
+    std::int32_t value = -1;
+    try
+    {
+      data.resize( perseus::detail::migration::stream_size( data.data() ) );
+      if( !read_all( to_child[ 0 ], data.data() + perseus::detail::migration::header_size, data.size() - perseus::detail::migration::header_size ) )
+      {
+        _exit( 1 );
+      }
+      processor target = p.create_processor();
+      value = p.advance( target, target.restore_coroutine( data.data(), data.size() ) );
+    }
+    catch( ... )
+    {
+    }
+    write_all( from_child[ 1 ], reinterpret_cast< const char* >( &value ), sizeof( value ) );
+    _exit( 0 );
+  }
+  close( to_child[ 0 ] );
+  close( from_child[ 1 ] );
+  processor source = p.create_processor();
+  const std::vector< char > data = counted_to_three( source );
+  write_all( to_child[ 1 ], data.data(), data.size() );
+  close( to_child[ 1 ] );
+  std::int32_t value = 0;
+  BOOST_CHECK( read_all( from_child[ 0 ], reinterpret_cast< char* >( &value ), sizeof( value ) ) );
+  close( from_child[ 0 ] );
+  int status = 0;
+  BOOST_REQUIRE_EQUAL( waitpid( child, &status, 0 ), child );
+  BOOST_CHECK( WIFEXITED( status ) && WEXITSTATUS( status ) == 0 );
+  BOOST_CHECK_EQUAL( value, 4 );
+}
+
+BOOST_AUTO_TEST_SUITE_END() // migration
+
+BOOST_AUTO_TEST_SUITE_END() // execution
+
+BOOST_AUTO_TEST_SUITE_END() // vm
@@ -0,0 +1,192 @@
+#include "../write_code_segment.hpp"
+
+#include "vm/processor.hpp"
+#include "vm/profiler.hpp"
+#include "vm/stack.hpp"
+
+#include <cstdint>
+#include <sstream>
+#include <string>
+#include <utility>
+
+#include <boost/test/unit_test.hpp>
+
+/**
+@file
+
+Checks the call stacks the profiler samples, with all dispatch engines.
+*/
+
+using perseus::detail::processor;
+using perseus::detail::opcode;
+using perseus::detail::dispatch_engine;
+using address = perseus::detail::instruction_pointer::value_type;
+
+/// main calls outer 100 times, which calls inner, which loops 10 times; the loops keep values on the stack, so frames have different sizes
+struct program
+{
+  program()
+  {
+    code = create_code_segment(
+      opcode::push_32, std::int32_t( 100 ),
+      label( "main_loop" ),
+      opcode::load_local_32, std::int32_t( -4 ),
+      opcode::push_32, std::int32_t( 0 ),
+      opcode::greater_than_i32_jump_if_false, label_reference_offset( "main_end" ),
+      opcode::reserve, std::uint32_t( 8 ),
+      opcode::call, label_reference( "outer" ),
+      opcode::add_immediate_i32, std::int32_t( -1 ),
+      opcode::relative_jump, label_reference_offset( "main_loop" ),
+      label( "main_end" ),
+      opcode::exit,
+
+      // stack: [-12: 8 unused bytes] [-4: return address]
+      get_current_address( outer ),
+      label( "outer" ),
+      opcode::push_32, std::int32_t( 10 ),
+      opcode::call, label_reference( "inner" ),
+      opcode::return_, std::uint32_t( 8 ),
+
+      // stack: [-8: n] [-4: return address]
+      get_current_address( inner ),
+      label( "inner" ),
+      opcode::push_8, char( 0 ),
+      label( "inner_loop" ),
+      opcode::load_local_32, std::int32_t( -9 ),
+      opcode::push_32, std::int32_t( 0 ),
+      opcode::greater_than_i32_jump_if_false, label_reference_offset( "inner_end" ),
+      opcode::load_local_32, std::int32_t( -9 ),
+      opcode::add_immediate_i32, std::int32_t( -1 ),
+      opcode::relative_store_stack, std::uint32_t( 4 ), std::int32_t( -13 ),
+      opcode::pop, std::uint32_t( 4 ),
+      opcode::relative_jump, label_reference_offset( "inner_loop" ),
+      label( "inner_end" ),
+      opcode::pop, std::uint32_t( 1 ),
+      opcode::return_, std::uint32_t( 4 )
+      );
+  }
+
+  processor create_processor( const dispatch_engine engine ) const
+  {
+    processor proc( perseus::detail::code_segment( code ), {}, engine );
+    proc.set_function_names( { { 0, "main" }, { outer, "outer" }, { inner, "inner" } } );
+    return proc;
+  }
+
+  perseus::detail::code_segment code;
+  address outer;
+  address inner;
+};
+
+static std::string collapsed( const processor& proc )
+{
+  BOOST_REQUIRE( proc.profile() );
+  std::ostringstream out;
+  proc.profile()->write_collapsed( out );
+  return out.str();
+}
+
+/// the number of samples with the given call stack
+static std::uint64_t samples( const std::string& profile, const std::string& call_stack )
+{
+  std::istringstream lines( profile );
+  std::string line;
+  while( std::getline( lines, line ) )
+  {
+    const std::size_t space = line.rfind( ' ' );
+    if( line.substr( 0, space ) == call_stack )
+    {
+      return std::stoull( line.substr( space + 1 ) );
+    }
+  }
+  return 0;
+}
+
+BOOST_AUTO_TEST_SUITE( vm )
+
+BOOST_AUTO_TEST_SUITE( execution )
+
+BOOST_AUTO_TEST_SUITE( profiler )
+
+BOOST_AUTO_TEST_CASE( call_stacks )
+{
+  BOOST_TEST_MESSAGE( "samples contain the whole call stack, named" );
+  const program p;
+  for( dispatch_engine engine : dispatch_engines )
+  {
+    BOOST_TEST_MESSAGE( perseus::detail::get_name( engine ) );
+    processor proc = p.create_processor( engine );
+    BOOST_CHECK( !proc.profile() );
+    proc.start_profiling( 7 );
+    proc.execute();
+    const std::string profile = collapsed( proc );
+    const std::uint64_t in_main = samples( profile, "main" );
+    const std::uint64_t in_outer = samples( profile, "main;outer" );
+    const std::uint64_t in_inner = samples( profile, "main;outer;inner" );
+    BOOST_CHECK_EQUAL( in_main + in_outer + in_inner, proc.profile()->samples() );
+    // most counted instructions are in inner's loop
+    BOOST_CHECK_GT( in_inner, in_main + in_outer );
+    BOOST_CHECK_GT( in_main, 0u );
+    BOOST_CHECK_EQUAL( profile.find( "[unknown]" ), std::string::npos );
+  }
+}
+
+BOOST_AUTO_TEST_CASE( start_and_stop )
+{
+  BOOST_TEST_MESSAGE( "samples are only taken while profiling, and starting again discards them" );
+  const program p;
+  processor proc = p.create_processor( dispatch_engine::switch_ );
+  proc.start_profiling( 100 );
+  proc.execute();
+  const std::uint64_t first = proc.profile()->samples();
+  BOOST_CHECK_GT( first, 0u );
+  proc.stop_profiling();
+  proc.execute();
+  BOOST_CHECK_EQUAL( proc.profile()->samples(), first );
+  proc.start_profiling( 1000 );
+  BOOST_CHECK_EQUAL( proc.profile()->samples(), 0u );
+  proc.execute();
+  BOOST_CHECK_LT( proc.profile()->samples(), first );
+}
+
+BOOST_AUTO_TEST_CASE( unknown_callers )
+{
+  BOOST_TEST_MESSAGE( "callers whose frame layout isn't known end the call stack" );
+  address loop;
+  processor proc( create_code_segment(
+    opcode::push_32, std::int32_t( 1000 ),
+    opcode::call, label_reference( "loop" ),
+    // the indirect jump prevents verification
+    opcode::push_32, label_reference( "end" ),
+    opcode::indirect_jump,
+    label( "end" ),
+    opcode::exit,
+
+    // counts the argument down to 0
+    get_current_address( loop ),
+    label( "loop" ),
+    opcode::load_local_32, std::int32_t( -8 ),
+    opcode::push_32, std::int32_t( 0 ),
+    opcode::greater_than_i32_jump_if_false, label_reference_offset( "loop_end" ),
+    opcode::load_local_32, std::int32_t( -8 ),
+    opcode::add_immediate_i32, std::int32_t( -1 ),
+    opcode::relative_store_stack, std::uint32_t( 4 ), std::int32_t( -12 ),
+    opcode::pop, std::uint32_t( 4 ),
+    opcode::relative_jump, label_reference_offset( "loop" ),
+    label( "loop_end" ),
+    opcode::return_, std::uint32_t( 0 )
+    ) );
+  proc.start_profiling( 10 );
+  proc.execute();
+  const std::string profile = collapsed( proc );
+  std::ostringstream call_stack;
+  call_stack << "[unknown];0x" << std::hex << loop;
+  BOOST_CHECK_GT( samples( profile, call_stack.str() ), 0u );
+  BOOST_CHECK_EQUAL( samples( profile, call_stack.str() ), proc.profile()->samples() );
+}
+
+BOOST_AUTO_TEST_SUITE_END() // profiler
+
+BOOST_AUTO_TEST_SUITE_END() // execution
+
+BOOST_AUTO_TEST_SUITE_END() // vm
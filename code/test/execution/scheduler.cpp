@@ -0,0 +1,163 @@
+#include "../write_code_segment.hpp"
+
+#include "vm/processor.hpp"
+#include "vm/scheduler.hpp"
+#include "vm/stack.hpp"
+#include "vm/exceptions.hpp"
+
+#include <utility>
+#include <cstdint>
+#include <future>
+#include <mutex>
+#include <vector>
+
+#include <boost/test/unit_test.hpp>
+
+/**
+@file
+
+Checks that tasks run by the scheduler behave like processor::execute() calls and stay isolated from each other.
+*/
+
+using perseus::detail::processor;
+using perseus::detail::scheduler;
+using perseus::detail::opcode;
+using address = perseus::detail::instruction_pointer::value_type;
+using identifier = perseus::detail::coroutine::identifier;
+
+BOOST_AUTO_TEST_SUITE( vm )
+
+BOOST_AUTO_TEST_SUITE( execution )
+
+BOOST_AUTO_TEST_SUITE( scheduler_ )
+
+/// the programs run by the tests
+struct programs
+{
+  programs()
+  {
+    code = create_code_segment(
+      // square( n )
+      get_current_address( square ),
+      opcode::relative_load_stack, std::uint32_t( 4 ), std::int32_t( -4 ),
+      opcode::multiply_i32,
+      opcode::exit,
+
+      // leaves the identifier of a new coroutine
+      get_current_address( create ),
+      opcode::absolute_coroutine, label_reference( "coroutine" ),
+      opcode::exit,
+
+      // coroutine_state( identifier )
+      get_current_address( state ),
+      opcode::coroutine_state,
+      opcode::exit,
+
+      // submits square( n ) via syscall 0
+      get_current_address( spawn ),
+      opcode::syscall, std::uint32_t( 0 ),
+      opcode::exit,
+
+      label( "coroutine" ),
+      opcode::yield, std::uint32_t( 0 )
+      );
+  }
+
+  perseus::detail::code_segment code;
+  address square, create, state, spawn;
+};
+
+static perseus::stack argument( const std::int32_t n )
+{
+  perseus::stack result;
+  result.push< std::int32_t >( n );
+  return result;
+}
+
+BOOST_AUTO_TEST_CASE( many_tasks )
+{
+  BOOST_TEST_MESSAGE( "running many tasks on several threads" );
+  programs p;
+  const processor proc( std::move( p.code ) );
+  scheduler sched( proc, 4 );
+  BOOST_CHECK_EQUAL( sched.threads(), 4u );
+  std::vector< std::future< perseus::stack > > results;
+  for( std::int32_t i = 0; i < 1000; ++i )
+  {
+    results.push_back( sched.submit( p.square, argument( i ) ) );
+  }
+  for( std::int32_t i = 0; i < 1000; ++i )
+  {
+    perseus::stack result = results[ i ].get();
+    BOOST_REQUIRE_EQUAL( result.size(), 4u );
+    BOOST_CHECK_EQUAL( result.pop< std::int32_t >(), i * i );
+  }
+}
+
+BOOST_AUTO_TEST_CASE( exceptions )
+{
+  BOOST_TEST_MESSAGE( "exceptions end up in the task's future" );
+  programs p;
+  const processor proc( std::move( p.code ) );
+  scheduler sched( proc, 2 );
+  std::future< perseus::stack > failing = sched.submit( p.square );
+  std::future< perseus::stack > succeeding = sched.submit( p.square, argument( 3 ) );
+  BOOST_CHECK_THROW( failing.get(), perseus::stack_segmentation_fault );
+  BOOST_CHECK_EQUAL( succeeding.get().pop< std::int32_t >(), 9 );
+}
+
+BOOST_AUTO_TEST_CASE( isolation )
+{
+  BOOST_TEST_MESSAGE( "tasks can't access each other's coroutines" );
+  programs p;
+  const processor proc( std::move( p.code ) );
+  scheduler sched( proc, 2 );
+  for( int i = 0; i < 100; ++i )
+  {
+    perseus::stack created = sched.submit( p.create ).get();
+    BOOST_REQUIRE_EQUAL( created.size(), sizeof( identifier ) );
+    BOOST_CHECK_THROW( sched.submit( p.state, std::move( created ) ).get(), perseus::invalid_coroutine_identifer );
+  }
+}
+
+BOOST_AUTO_TEST_CASE( nested_submission )
+{
+  BOOST_TEST_MESSAGE( "submitting tasks from within tasks" );
+  programs p;
+  std::mutex mutex;
+  std::vector< std::future< perseus::stack > > results;
+  scheduler* sched = nullptr;
+  const address square = p.square;
+  const processor proc( std::move( p.code ), {
+    [ & ]( perseus::stack& st )
+    {
+      const std::int32_t n = st.pop< std::int32_t >();
+      std::future< perseus::stack > result = sched->submit( square, argument( n ) );
+      std::lock_guard< std::mutex > lock( mutex );
+      results.push_back( std::move( result ) );
+    }
+  } );
+  {
+    scheduler s( proc, 3 );
+    sched = &s;
+    for( std::int32_t i = 0; i < 100; ++i )
+    {
+      s.submit( p.spawn, argument( i ) );
+    }
+    // the destructor runs all tasks, including the nested ones
+  }
+  BOOST_REQUIRE_EQUAL( results.size(), 100u );
+  std::int64_t sum = 0;
+  for( std::future< perseus::stack >& result : results )
+  {
+    sum += result.get().pop< std::int32_t >();
+  }
+  // sum of squares 0..99
+  BOOST_CHECK_EQUAL( sum, 99 * 100 * 199 / 6 );
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
+BOOST_AUTO_TEST_SUITE_END()
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,340 @@
+#include "../write_code_segment.hpp"
+#include "../temporary_file.hpp"
+
+#include "vm/processor.hpp"
+#include "vm/snapshot.hpp"
+#include "vm/stack.hpp"
+#include "vm/exceptions.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <utility>
+
+#include <dirent.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <boost/test/unit_test.hpp>
+
+/**
+@file
+
+Checks saving processors to snapshots and restoring them, including suspended executions.
+*/
+
+using perseus::detail::processor;
+using perseus::detail::opcode;
+using address = perseus::detail::instruction_pointer::value_type;
+using identifier = perseus::detail::coroutine::identifier;
+
+BOOST_AUTO_TEST_SUITE( vm )
+
+BOOST_AUTO_TEST_SUITE( execution )
+
+BOOST_AUTO_TEST_SUITE( snapshot )
+
+/// the program whose state gets saved
+struct program
+{
+  program()
+  {
+    code = create_code_segment(
+      // stack: [parameters]; leaves [parameters] [coroutine] [22]
+      opcode::absolute_coroutine, label_reference( "increment" ),
+      // creates and deletes another coroutine, so there's a free slot
+      opcode::absolute_coroutine, label_reference( "increment" ),
+      opcode::delete_coroutine,
+      opcode::push_32, std::int32_t( 20 ),
+      opcode::relative_load_stack, std::uint32_t( 4 ), std::int32_t( -8 ),
+      opcode::resume_coroutine, std::uint32_t( 4 ),
+      // suspends the first time
+      opcode::syscall, std::uint32_t( 0 ),
+      opcode::relative_load_stack, std::uint32_t( 4 ), std::int32_t( -8 ),
+      opcode::resume_coroutine, std::uint32_t( 4 ),
+      opcode::exit,
+
+      // leaves the identifier of a new coroutine
+      get_current_address( create ),
+      opcode::absolute_coroutine, label_reference( "increment" ),
+      opcode::exit,
+
+      // stack: [coroutine] [value]; leaves [coroutine] [value + 1]
+      get_current_address( advance ),
+      opcode::relative_load_stack, std::uint32_t( 4 ), std::int32_t( -8 ),
+      opcode::resume_coroutine, std::uint32_t( 4 ),
+      opcode::exit,
+
+      label( "increment" ),
+      opcode::push_32, std::int32_t( 1 ),
+      opcode::add_i32,
+      opcode::yield, std::uint32_t( 4 ),
+      opcode::relative_jump, label_reference_offset( "increment" )
+      );
+  }
+
+  /// a processor whose syscall suspends the first time if blocking is set
+  processor create_processor( const perseus::stack_backend backend, const bool blocking ) const
+  {
+    perseus::detail::code_segment copy( code );
+    return processor( std::move( copy ), {
+      [ suspend = blocking ]( perseus::stack& ) mutable
+      {
+        if( suspend )
+        {
+          suspend = false;
+          throw perseus::would_block( "not yet" );
+        }
+      }
+    }, perseus::detail::dispatch_engine::switch_, true, backend );
+  }
+
+  /// what the increment coroutine with the given identifier makes of the value
+  std::int32_t increment( processor& proc, const identifier coroutine, const std::int32_t value ) const
+  {
+    perseus::stack parameters;
+    parameters.push< identifier >( coroutine );
+    parameters.push< std::int32_t >( value );
+    return proc.execute( advance, std::move( parameters ) ).pop< std::int32_t >();
+  }
+
+  perseus::detail::code_segment code;
+  address create;
+  address advance;
+};
+
+static std::uint64_t file_size( const std::string& path )
+{
+  struct stat info;
+  BOOST_REQUIRE_EQUAL( stat( path.c_str(), &info ), 0 );
+  return static_cast< std::uint64_t >( info.st_size );
+}
+
+/// parameters spanning several pages, so they get mapped
+static perseus::stack big_parameters()
+{
+  perseus::stack result;
+  for( std::int32_t i = 0; i < 10000; ++i )
+  {
+    result.push< std::int32_t >( i * 7 );
+  }
+  return result;
+}
+
+BOOST_AUTO_TEST_CASE( suspended_execution )
+{
+  BOOST_TEST_MESSAGE( "a suspended execution continues in a restored processor" );
+  const program p;
+  for( const perseus::stack_backend backend : { perseus::stack_backend::heap, perseus::stack_backend::reserved } )
+  {
+    processor original = p.create_processor( perseus::stack_backend::heap, true );
+    BOOST_CHECK_THROW( original.execute( 0, big_parameters() ), perseus::would_block );
+    temporary_file file;
+    original.save_snapshot( file.path );
+
+    processor restored = p.create_processor( backend, false );
+    restored.restore_snapshot( file.path );
+    BOOST_CHECK( restored.is_suspended() );
+    BOOST_CHECK( restored.has_coroutines() );
+    perseus::stack result = restored.resume();
+    BOOST_CHECK( result == original.resume() );
+    BOOST_REQUIRE_EQUAL( result.size(), big_parameters().size() + sizeof( identifier ) + 4 );
+    BOOST_CHECK_EQUAL( result.pop< std::int32_t >(), 22 );
+    result.pop< identifier >();
+    BOOST_CHECK( result == big_parameters() );
+
+    // generations and the free list are restored, so both processors pick the same identifiers
+    BOOST_CHECK_EQUAL( restored.execute( p.create ).pop< identifier >(), original.execute( p.create ).pop< identifier >() );
+
+    // changes to mapped stacks don't reach the file
+    processor again = p.create_processor( backend, false );
+    again.restore_snapshot( file.path );
+    result = again.resume();
+    BOOST_CHECK_EQUAL( result.pop< std::int32_t >(), 22 );
+  }
+}
+
+BOOST_AUTO_TEST_CASE( different_code )
+{
+  BOOST_TEST_MESSAGE( "snapshots are only restored into processors with the same code" );
+  const program p;
+  processor original = p.create_processor( perseus::stack_backend::heap, true );
+  BOOST_CHECK_THROW( original.execute(), perseus::would_block );
+  temporary_file file;
+  original.save_snapshot( file.path );
+
+  processor other( create_code_segment( opcode::exit ) );
+  BOOST_CHECK_THROW( other.restore_snapshot( file.path ), perseus::invalid_snapshot );
+  BOOST_CHECK( !other.is_suspended() );
+  BOOST_CHECK( !other.has_coroutines() );
+}
+
+BOOST_AUTO_TEST_CASE( invalid_files )
+{
+  BOOST_TEST_MESSAGE( "damaged snapshots are rejected, leaving the processor unchanged" );
+  const program p;
+  processor original = p.create_processor( perseus::stack_backend::heap, true );
+  BOOST_CHECK_THROW( original.execute(), perseus::would_block );
+  temporary_file file;
+  original.save_snapshot( file.path );
+
+  processor restored = p.create_processor( perseus::stack_backend::heap, false );
+  BOOST_CHECK_THROW( restored.restore_snapshot( file.path + ".missing" ), std::system_error );
+
+  BOOST_REQUIRE_EQUAL( truncate( file.path.c_str(), sizeof( perseus::detail::snapshot::header ) + 4 ), 0 );
+  BOOST_CHECK_THROW( restored.restore_snapshot( file.path ), perseus::invalid_snapshot );
+  BOOST_REQUIRE_EQUAL( truncate( file.path.c_str(), 4 ), 0 );
+  BOOST_CHECK_THROW( restored.restore_snapshot( file.path ), perseus::invalid_snapshot );
+
+  // an intact snapshot, apart from its first byte
+  original.resume();
+  original.save_snapshot( file.path );
+  std::FILE* const f = std::fopen( file.path.c_str(), "r+b" );
+  BOOST_REQUIRE( f );
+  std::fputc( 'X', f );
+  std::fclose( f );
+  BOOST_CHECK_THROW( restored.restore_snapshot( file.path ), perseus::invalid_snapshot );
+  BOOST_CHECK( !restored.is_suspended() );
+  BOOST_CHECK( !restored.has_coroutines() );
+}
+
+/// overwrites part of a snapshot or delta
+template< typename T >
+static void overwrite( const std::string& path, const std::size_t offset, const T value )
+{
+  std::FILE* const f = std::fopen( path.c_str(), "r+b" );
+  BOOST_REQUIRE( f );
+  BOOST_REQUIRE_EQUAL( std::fseek( f, offset, SEEK_SET ), 0 );
+  BOOST_REQUIRE_EQUAL( std::fwrite( &value, sizeof( value ), 1, f ), 1u );
+  std::fclose( f );
+}
+
+/// overwrites the stack size of the first slot record in a snapshot or delta
+static void set_first_stack_size( const std::string& path, const std::uint64_t size )
+{
+  overwrite( path, sizeof( perseus::detail::snapshot::header ) + offsetof( perseus::detail::snapshot::slot, stack_size ), size );
+}
+
+BOOST_AUTO_TEST_CASE( damaged_stacks )
+{
+  BOOST_TEST_MESSAGE( "executions restored from files with damaged stacks continue checked, so the damage is detected" );
+  const program p;
+  processor original = p.create_processor( perseus::stack_backend::heap, true );
+  BOOST_CHECK_THROW( original.execute( 0, big_parameters() ), perseus::would_block );
+  temporary_file file, delta;
+  original.save_snapshot( file.path );
+  original.save_delta( delta.path );
+
+  // the suspended execution's coroutine is in the first slot; its stack is truncated, which leaves the delta's changes outside of it
+  set_first_stack_size( delta.path, 0 );
+  processor restored = p.create_processor( perseus::stack_backend::heap, false );
+  BOOST_CHECK_THROW( restored.restore_snapshot( file.path, { delta.path } ), perseus::invalid_snapshot );
+
+  // claiming the execution ran unchecked must not make it skip the stack checks
+  set_first_stack_size( file.path, 0 );
+  overwrite( file.path, offsetof( perseus::detail::snapshot::header, checked ), std::uint32_t( 0 ) );
+  for( const perseus::stack_backend backend : { perseus::stack_backend::heap, perseus::stack_backend::reserved } )
+  {
+    processor restored = p.create_processor( backend, false );
+    restored.restore_snapshot( file.path );
+    BOOST_CHECK_THROW( restored.resume(), std::out_of_range );
+  }
+}
+
+BOOST_AUTO_TEST_CASE( saving_over_restored_snapshot )
+{
+  BOOST_TEST_MESSAGE( "saving to the snapshot mapped by the restored stacks leaves them intact" );
+  const program p;
+  processor original = p.create_processor( perseus::stack_backend::heap, true );
+  BOOST_CHECK_THROW( original.execute( 0, big_parameters() ), perseus::would_block );
+  temporary_file file;
+  original.save_snapshot( file.path );
+
+  processor restored = p.create_processor( perseus::stack_backend::reserved, false );
+  restored.restore_snapshot( file.path );
+  restored.save_snapshot( file.path );
+  restored.save_delta( file.path );
+  perseus::stack result = restored.resume();
+  BOOST_CHECK_EQUAL( result.pop< std::int32_t >(), 22 );
+  result.pop< identifier >();
+  BOOST_CHECK( result == big_parameters() );
+
+  // no temporary files are left behind
+  const std::string directory = file.path.substr( 0, file.path.rfind( '/' ) );
+  const std::string name = file.path.substr( directory.size() + 1 );
+  std::size_t leftovers = 0;
+  if( DIR* const d = opendir( directory.c_str() ) )
+  {
+    while( const dirent* const entry = readdir( d ) )
+    {
+      leftovers += std::string( entry->d_name ).compare( 0, name.size() + 4, name + ".tmp" ) == 0;
+    }
+    closedir( d );
+  }
+  BOOST_CHECK_EQUAL( leftovers, 0u );
+}
+
+BOOST_AUTO_TEST_CASE( deltas )
+{
+  BOOST_TEST_MESSAGE( "deltas only contain what changed, and restore on top of their snapshot" );
+  const program p;
+  processor original = p.create_processor( perseus::stack_backend::heap, true );
+  temporary_file base, unchanged, resumed, continued;
+  BOOST_CHECK_THROW( original.save_delta( unchanged.path ), perseus::no_base_snapshot );
+  BOOST_CHECK_THROW( original.execute( 0, big_parameters() ), perseus::would_block );
+  original.save_snapshot( base.path );
+  original.save_delta( unchanged.path );
+  BOOST_CHECK_LT( file_size( unchanged.path ), perseus::stack::dirty_page_size );
+
+  // finishes the suspended execution and creates another coroutine
+  perseus::stack result = original.resume();
+  BOOST_CHECK_EQUAL( result.pop< std::int32_t >(), 22 );
+  const identifier first = result.pop< identifier >();
+  const identifier second = original.execute( p.create ).pop< identifier >();
+  BOOST_CHECK_EQUAL( p.increment( original, second, 10 ), 11 );
+  original.save_delta( resumed.path );
+
+  for( const perseus::stack_backend backend : { perseus::stack_backend::heap, perseus::stack_backend::reserved } )
+  {
+    processor restored = p.create_processor( backend, false );
+    restored.restore_snapshot( base.path, { unchanged.path } );
+    BOOST_CHECK( restored.is_suspended() );
+    result = restored.resume();
+    BOOST_CHECK_EQUAL( result.pop< std::int32_t >(), 22 );
+    result.pop< identifier >();
+    BOOST_CHECK( result == big_parameters() );
+
+    restored.restore_snapshot( base.path, { unchanged.path, resumed.path } );
+    BOOST_CHECK( !restored.is_suspended() );
+    BOOST_CHECK_EQUAL( p.increment( restored, first, 5 ), 6 );
+    BOOST_CHECK_EQUAL( p.increment( restored, second, 5 ), 6 );
+
+    // the restored processor continues the chain of deltas
+    restored.save_delta( continued.path );
+    processor again = p.create_processor( backend, false );
+    again.restore_snapshot( base.path, { unchanged.path, resumed.path, continued.path } );
+    BOOST_CHECK_EQUAL( p.increment( again, second, 7 ), 8 );
+  }
+
+  // generations and the free list are restored, so both processors pick the same identifiers
+  processor restored = p.create_processor( perseus::stack_backend::heap, false );
+  restored.restore_snapshot( base.path, { unchanged.path, resumed.path } );
+  BOOST_CHECK_EQUAL( restored.execute( p.create ).pop< identifier >(), original.execute( p.create ).pop< identifier >() );
+
+  // deltas must follow their snapshot in order
+  restored = p.create_processor( perseus::stack_backend::heap, false );
+  BOOST_CHECK_THROW( restored.restore_snapshot( base.path, { resumed.path } ), perseus::invalid_snapshot );
+  BOOST_CHECK_THROW( restored.restore_snapshot( base.path, { resumed.path, unchanged.path } ), perseus::invalid_snapshot );
+  BOOST_CHECK_THROW( restored.restore_snapshot( unchanged.path ), perseus::invalid_snapshot );
+  BOOST_CHECK( !restored.is_suspended() );
+  BOOST_CHECK( !restored.has_coroutines() );
+}
+
+BOOST_AUTO_TEST_SUITE_END() // snapshot
+
+BOOST_AUTO_TEST_SUITE_END() // execution
+
+BOOST_AUTO_TEST_SUITE_END() // vm
@@ -13,6 +13,8 @@
 using perseus::detail::processor;
 using perseus::detail::opcode;
 using perseus::stack_underflow;
+using perseus::stack_overflow;
+using perseus::stack_backend;
 
 BOOST_AUTO_TEST_SUITE( vm )
 
@@ -62,6 +64,52 @@ BOOST_AUTO_TEST_CASE( reserve_3_test )
   BOOST_CHECK_EQUAL( result.pop< std::uint8_t >(), 0 );
 }
 
+BOOST_AUTO_TEST_CASE( reserved_stack_test )
+{
+  BOOST_TEST_MESSAGE( "reserved stacks don't move and throw when full" );
+  perseus::stack st( stack_backend::reserved, 1 );
+  BOOST_CHECK( st.backend() == stack_backend::reserved );
+  BOOST_REQUIRE_GE( st.capacity(), 1u );
+  BOOST_CHECK_EQUAL( st.max_size(), st.capacity() );
+  const void* const data = st.data();
+  while( st.size() < st.capacity() )
+  {
+    st.push< std::uint8_t >( 42 );
+  }
+  BOOST_CHECK_EQUAL( static_cast< const void* >( st.data() ), data );
+  BOOST_CHECK_THROW( st.push< std::uint8_t >( 42 ), stack_overflow );
+  BOOST_CHECK_EQUAL( st.size(), st.capacity() );
+  BOOST_CHECK_EQUAL( st.pop< std::uint8_t >(), 42 );
+  // appending part of itself
+  st.clear();
+  st.push< std::uint32_t >( 1337 );
+  st.append( st.data(), 4 );
+  BOOST_CHECK_EQUAL( st.pop< std::uint32_t >(), 1337 );
+  BOOST_CHECK_EQUAL( st.pop< std::uint32_t >(), 1337 );
+}
+
+BOOST_AUTO_TEST_CASE( reserved_backend_test )
+{
+  BOOST_TEST_MESSAGE( "running on reserved stacks" );
+  {
+    auto code = create_code_segment( opcode::pop, std::uint32_t( 2 ), opcode::reserve, std::uint32_t( 3 ), opcode::exit );
+    perseus::stack initial_stack;
+    initial_stack.push( std::array< char, 4 >{ 'a', 'b', 'c', 'd' } );
+    auto result = processor( std::move( code ), {}, perseus::detail::dispatch_engine::switch_, true, stack_backend::reserved ).execute( 0u, std::move( initial_stack ) );
+    BOOST_CHECK( result.backend() == stack_backend::reserved );
+    BOOST_REQUIRE_EQUAL( result.size(), 5 );
+    BOOST_CHECK_EQUAL( result.pop< std::uint8_t >(), 0 );
+    BOOST_CHECK_EQUAL( result.pop< std::uint8_t >(), 0 );
+    BOOST_CHECK_EQUAL( result.pop< std::uint8_t >(), 0 );
+    BOOST_CHECK_EQUAL( result.pop< char >(), 'b' );
+    BOOST_CHECK_EQUAL( result.pop< char >(), 'a' );
+  }
+  {
+    auto code = create_code_segment( opcode::reserve, std::uint32_t( 2 * perseus::stack::default_reserved_capacity ), opcode::exit );
+    BOOST_CHECK_THROW( processor( std::move( code ), {}, perseus::detail::dispatch_engine::switch_, true, stack_backend::reserved ).execute(), stack_overflow );
+  }
+}
+
 BOOST_AUTO_TEST_SUITE_END()
 
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,155 @@
+#include "../write_code_segment.hpp"
+
+#include "vm/processor.hpp"
+#include "vm/stack.hpp"
+#include "vm/exceptions.hpp"
+
+#include <utility>
+#include <cstdint>
+#include <limits>
+
+#include <boost/test/unit_test.hpp>
+
+/**
+@file
+
+Checks that the superinstructions behave like the sequences they replace.
+*/
+
+using perseus::detail::processor;
+using perseus::detail::opcode;
+using perseus::detail::dispatch_engine;
+
+/// recursive factorial of the top of the stack, as the compiler generates it
+static perseus::detail::code_segment factorial_code()
+{
+  return create_code_segment(
+    opcode::reserve, std::uint32_t( 4 ),
+    opcode::load_local_32, std::int32_t( -8 ),
+    opcode::call, label_reference( "factorial" ),
+    opcode::exit,
+
+    label( "factorial" ),
+    opcode::load_local_32, std::int32_t( -8 ),
+    opcode::push_32, std::int32_t( 1 ),
+    opcode::greater_than_i32_jump_if_false, label_reference_offset( "n <= 1" ),
+    opcode::reserve, std::uint32_t( 4 ),
+    opcode::load_local_32, std::int32_t( -12 ),
+    opcode::add_immediate_i32, std::int32_t( -1 ),
+    opcode::call, label_reference( "factorial" ),
+    opcode::load_local_32, std::int32_t( -12 ),
+    opcode::multiply_i32,
+    opcode::store_pop_return, std::uint32_t( 4 ), std::uint32_t( 4 ), std::uint32_t( 4 ),
+
+    label( "n <= 1" ),
+    opcode::push_32, std::int32_t( 1 ),
+    opcode::store_pop_return, std::uint32_t( 4 ), std::uint32_t( 4 ), std::uint32_t( 4 )
+    );
+}
+
+BOOST_AUTO_TEST_SUITE( vm )
+
+BOOST_AUTO_TEST_SUITE( execution )
+
+BOOST_AUTO_TEST_SUITE( superinstructions )
+
+BOOST_AUTO_TEST_CASE( factorial )
+{
+  BOOST_TEST_MESSAGE( "a recursive function made of superinstructions" );
+  BOOST_CHECK( processor( factorial_code() ).is_verified( 0, 4 ) );
+  for( dispatch_engine engine : dispatch_engines )
+  {
+    BOOST_TEST_MESSAGE( perseus::detail::get_name( engine ) );
+    for( bool verify : { false, true } )
+    {
+      perseus::stack input;
+      input.push< std::int32_t >( 5 );
+      perseus::stack result = processor( factorial_code(), {}, engine, verify ).execute( 0, std::move( input ) );
+      BOOST_CHECK_EQUAL( result.pop< std::int32_t >(), 120 );
+      BOOST_CHECK_EQUAL( result.pop< std::int32_t >(), 5 );
+      BOOST_CHECK_EQUAL( result.size(), 0 );
+    }
+  }
+}
+
+BOOST_AUTO_TEST_CASE( compare_and_branch )
+{
+  BOOST_TEST_MESSAGE( "each comparison jumps iff it's false" );
+  struct comparison
+  {
+    opcode code;
+    bool less, equal, greater;
+  };
+  const comparison comparisons[] = {
+    { opcode::equals_i32_jump_if_false, false, true, false },
+    { opcode::not_equals_i32_jump_if_false, true, false, true },
+    { opcode::less_than_i32_jump_if_false, true, false, false },
+    { opcode::less_than_or_equals_i32_jump_if_false, true, true, false },
+    { opcode::greater_than_i32_jump_if_false, false, false, true },
+    { opcode::greater_than_or_equals_i32_jump_if_false, false, true, true },
+  };
+  for( const comparison& comp : comparisons )
+  {
+    for( std::int32_t operand1 : { -1, 0, 1 } )
+    {
+      perseus::stack result = processor( create_code_segment(
+        opcode::push_32, operand1,
+        opcode::push_32, std::int32_t( 0 ),
+        comp.code, label_reference_offset( "false" ),
+        opcode::push_8, char( 1 ),
+        opcode::exit,
+        label( "false" ),
+        opcode::push_8, char( 0 ),
+        opcode::exit
+        ) ).execute();
+      const bool expected = operand1 < 0 ? comp.less : operand1 == 0 ? comp.equal : comp.greater;
+      BOOST_CHECK_EQUAL( result.pop< bool >(), expected );
+      BOOST_CHECK_EQUAL( result.size(), 0 );
+    }
+  }
+}
+
+BOOST_AUTO_TEST_CASE( add_immediate )
+{
+  auto code = create_code_segment(
+    opcode::push_32, std::numeric_limits< std::int32_t >::max(),
+    opcode::add_immediate_i32, std::int32_t( 1 ),
+    opcode::push_32, std::int32_t( 40 ),
+    opcode::add_immediate_i32, std::int32_t( 2 ),
+    opcode::exit
+    );
+  perseus::stack result = processor( std::move( code ) ).execute();
+  BOOST_CHECK_EQUAL( result.pop< std::int32_t >(), 42 );
+  BOOST_CHECK_EQUAL( result.pop< std::int32_t >(), std::numeric_limits< std::int32_t >::min() );
+  BOOST_CHECK_EQUAL( result.size(), 0 );
+}
+
+BOOST_AUTO_TEST_CASE( checks )
+{
+  BOOST_TEST_MESSAGE( "unverified superinstructions check the stack like the sequences they replace" );
+  BOOST_CHECK_THROW( processor( create_code_segment(
+    opcode::push_8, char( 0 ),
+    opcode::load_local_32, std::int32_t( -1 ),
+    opcode::exit
+    ) ).execute(), perseus::stack_segmentation_fault );
+  // no return address below the result
+  BOOST_CHECK_THROW( processor( create_code_segment(
+    opcode::push_32, std::int32_t( 0 ),
+    opcode::store_pop_return, std::uint32_t( 4 ), std::uint32_t( 4 ), std::uint32_t( 0 )
+    ) ).execute(), perseus::stack_segmentation_fault );
+  BOOST_CHECK_THROW( processor( create_code_segment(
+    opcode::push_32, std::int32_t( 0 ),
+    opcode::push_32, std::int32_t( 0 ),
+    opcode::less_than_i32_jump_if_false, std::int32_t( 1000 )
+    ) ).execute(), perseus::code_segmentation_fault );
+  // the implied store offset must fit into 32 bits
+  BOOST_CHECK_THROW( processor( create_code_segment(
+    opcode::store_pop_return, std::uint32_t( 0 ), std::numeric_limits< std::uint32_t >::max(), std::uint32_t( 0 )
+    ) ).execute(), perseus::invalid_opcode );
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
+BOOST_AUTO_TEST_SUITE_END()
+
+BOOST_AUTO_TEST_SUITE_END()
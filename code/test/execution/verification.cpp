@@ -0,0 +1,149 @@
+#include "../write_code_segment.hpp"
+
+#include "vm/processor.hpp"
+#include "vm/stack.hpp"
+#include "vm/exceptions.hpp"
+
+#include <utility>
+#include <cstdint>
+
+#include <boost/test/unit_test.hpp>
+
+/**
+@file
+
+Checks which code the verification accepts, and that verified code runs like unverified code.
+*/
+
+using perseus::detail::processor;
+using perseus::detail::opcode;
+using perseus::detail::dispatch_engine;
+
+/// recursive factorial of the top of the stack
+static perseus::detail::code_segment factorial_code()
+{
+  return create_code_segment(
+    opcode::relative_load_stack, std::uint32_t( 4 ), std::int32_t( -4 ),
+    opcode::call, label_reference( "factorial" ),
+    opcode::exit,
+
+    label( "factorial" ),
+    opcode::relative_load_stack, std::uint32_t( 4 ), std::int32_t( -8 ),
+    opcode::push_32, std::int32_t( 1 ),
+    opcode::less_than_or_equals_i32,
+    opcode::relative_jump_if_false, label_reference_offset( "n > 1" ),
+    opcode::push_32, std::int32_t( 1 ),
+    opcode::relative_jump, label_reference_offset( "return_top_of_stack" ),
+
+    label( "n > 1" ),
+    opcode::reserve, std::uint32_t( 4 ),
+    opcode::relative_load_stack, std::uint32_t( 4 ), std::int32_t( -12 ),
+    opcode::push_32, std::int32_t( 1 ),
+    opcode::subtract_i32,
+    opcode::call, label_reference( "factorial" ),
+    opcode::relative_load_stack, std::uint32_t( 4 ), std::int32_t( -12 ),
+    opcode::multiply_i32,
+
+    label( "return_top_of_stack" ),
+    opcode::relative_store_stack, std::uint32_t( 4 ), std::int32_t( -16 ),
+    opcode::pop, std::uint32_t( 4 ),
+    opcode::return_, std::uint32_t( 4 )
+    );
+}
+
+BOOST_AUTO_TEST_SUITE( vm )
+
+BOOST_AUTO_TEST_SUITE( execution )
+
+BOOST_AUTO_TEST_SUITE( verification )
+
+BOOST_AUTO_TEST_CASE( recursion )
+{
+  BOOST_TEST_MESSAGE( "verifying a recursive function" );
+  processor proc( factorial_code() );
+  BOOST_CHECK( proc.is_verified( 0, 4 ) );
+  // the parameter is read
+  BOOST_CHECK( !proc.is_verified( 0, 0 ) );
+  // the function returns, so it can't be the start
+  BOOST_CHECK( !proc.is_verified( 15, 8 ) );
+  BOOST_CHECK( !processor( factorial_code(), {}, dispatch_engine::switch_, false ).is_verified( 0, 4 ) );
+
+  for( dispatch_engine engine : dispatch_engines )
+  {
+    BOOST_TEST_MESSAGE( perseus::detail::get_name( engine ) );
+    for( bool verify : { false, true } )
+    {
+      perseus::stack input;
+      input.push< std::int32_t >( 5 );
+      perseus::stack result = processor( factorial_code(), {}, engine, verify ).execute( 0, std::move( input ) );
+      BOOST_CHECK_EQUAL( result.pop< std::int32_t >(), 120 );
+      BOOST_CHECK_EQUAL( result.size(), 0 );
+    }
+    // too few parameters still get caught
+    BOOST_CHECK_THROW( processor( factorial_code(), {}, engine ).execute(), perseus::stack_segmentation_fault );
+  }
+}
+
+BOOST_AUTO_TEST_CASE( rejected )
+{
+  BOOST_TEST_MESSAGE( "code the verification can't prove safe" );
+  // stack size differs depending on the branch
+  BOOST_CHECK( !processor( create_code_segment(
+    opcode::push_8, char( 0 ),
+    opcode::relative_jump_if_false, label_reference_offset( "end" ),
+    opcode::push_32, std::int32_t( 1 ),
+    label( "end" ),
+    opcode::exit
+    ) ).is_verified( 0, 0 ) );
+  // indirect jump
+  BOOST_CHECK( !processor( create_code_segment(
+    opcode::push_32, std::int32_t( 5 ),
+    opcode::indirect_jump,
+    opcode::exit
+    ) ).is_verified( 0, 0 ) );
+  // overwriting the return address
+  BOOST_CHECK( !processor( create_code_segment(
+    opcode::call, label_reference( "function" ),
+    opcode::exit,
+    label( "function" ),
+    opcode::push_32, std::int32_t( 0 ),
+    opcode::relative_store_stack, std::uint32_t( 4 ), std::int32_t( -8 ),
+    opcode::pop, std::uint32_t( 4 ),
+    opcode::return_, std::uint32_t( 0 )
+    ) ).is_verified( 0, 0 ) );
+  // running off the end
+  BOOST_CHECK( !processor( create_code_segment(
+    opcode::no_operation
+    ) ).is_verified( 0, 0 ) );
+}
+
+BOOST_AUTO_TEST_CASE( syscall_changing_stack )
+{
+  BOOST_TEST_MESSAGE( "syscalls changing the stack size hand over to the checked engines" );
+  auto code = create_code_segment(
+    opcode::syscall, std::uint32_t( 0 ),
+    opcode::push_32, std::int32_t( 2 ),
+    opcode::add_i32,
+    opcode::exit
+    );
+  for( dispatch_engine engine : dispatch_engines )
+  {
+    BOOST_TEST_MESSAGE( perseus::detail::get_name( engine ) );
+    processor proc( perseus::detail::code_segment( code ), { []( perseus::stack& st ){ st.push< std::int32_t >( 40 ); } }, engine );
+    // the verification assumed the add would underflow an empty stack
+    BOOST_CHECK( proc.is_verified( 0, 4 ) );
+    BOOST_CHECK( !proc.is_verified( 0, 0 ) );
+    perseus::stack input;
+    input.push< std::int32_t >( 0 );
+    perseus::stack result = proc.execute( 0, std::move( input ) );
+    BOOST_CHECK_EQUAL( result.pop< std::int32_t >(), 42 );
+    BOOST_CHECK_EQUAL( result.pop< std::int32_t >(), 0 );
+    BOOST_CHECK_EQUAL( result.size(), 0 );
+  }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
+BOOST_AUTO_TEST_SUITE_END()
+
+BOOST_AUTO_TEST_SUITE_END()
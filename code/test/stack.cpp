@@ -1,11 +1,20 @@
 #include "vm/stack.hpp"
 #include "vm/exceptions.hpp"
 #include "vm/processor.hpp"
+#include "vm/stack_pool.hpp"
 
 #include <boost/test/unit_test.hpp>
+#include <algorithm>
 #include <array>
+#include <cstdint>
+#include <vector>
 #include <utility>
 
+#ifdef __linux__
+# include <sys/mman.h>
+# include <unistd.h>
+#endif
+
 // Testing the stack
 
 BOOST_AUTO_TEST_SUITE( vm )
@@ -111,6 +120,137 @@ BOOST_AUTO_TEST_CASE( split_0_test_2 )
   BOOST_CHECK_EQUAL( stack2.size(), 0 );
 }
 
+BOOST_AUTO_TEST_CASE( transfer_test )
+{
+  BOOST_TEST_MESSAGE( "moving the top of a stack onto another" );
+  perseus::stack stack1, stack2;
+  stack1.push< std::array< char, 4 > >( { 'a', 'b', 'c', 'd' } );
+  stack2.push< char >( 'x' );
+  stack2.transfer( stack1, 3 );
+
+  BOOST_CHECK_EQUAL( stack1.size(), 1 );
+  BOOST_CHECK_EQUAL( stack2.size(), 4 );
+  BOOST_CHECK_THROW( stack2.transfer( stack1, 2 ), perseus::stack_underflow );
+  BOOST_CHECK_EQUAL( stack1.size(), 1 );
+  BOOST_CHECK_EQUAL( stack2.size(), 4 );
+  stack2.transfer( stack1, 0 );
+  BOOST_CHECK_EQUAL( stack2.size(), 4 );
+  BOOST_CHECK_EQUAL( stack2.pop< char >(), 'd' );
+  BOOST_CHECK_EQUAL( stack2.pop< char >(), 'c' );
+  BOOST_CHECK_EQUAL( stack2.pop< char >(), 'b' );
+  BOOST_CHECK_EQUAL( stack2.pop< char >(), 'x' );
+  BOOST_CHECK_EQUAL( stack1.pop< char >(), 'a' );
+}
+
+BOOST_AUTO_TEST_CASE( dirty_test )
+{
+  BOOST_TEST_MESSAGE( "tracking changed pages" );
+  typedef std::vector< std::pair< perseus::stack::size_type, perseus::stack::size_type > > ranges;
+  const perseus::stack::size_type page = perseus::stack::dirty_page_size;
+  perseus::stack st;
+  st.resize( 4 * page );
+  BOOST_CHECK( st.dirty_ranges() == ranges( { { 0, 4 * page } } ) );
+  st.clear_dirty();
+  BOOST_CHECK( st.dirty_ranges().empty() );
+
+  // writes below the top only count once marked
+  st.data()[ page + 1 ] = 'x';
+  BOOST_CHECK( st.dirty_ranges().empty() );
+  st.mark_dirty( page + 1, 1 );
+  st.mark_dirty( 2 * page - 2, 4 );
+  st.push< std::int32_t >( 42 );
+  BOOST_CHECK( st.dirty_ranges() == ranges( { { page, 2 * page }, { 4 * page, 4 } } ) );
+
+  // popping below a checkpoint makes the next push dirty its page
+  st.clear_dirty();
+  st.discard( page + 4 );
+  BOOST_CHECK( st.dirty_ranges().empty() );
+  st.push< char >( 'y' );
+  BOOST_CHECK( st.dirty_ranges() == ranges( { { 3 * page, 1 } } ) );
+
+  st.mark_all_dirty();
+  BOOST_CHECK( st.dirty_ranges() == ranges( { { 0, st.size() } } ) );
+}
+
+BOOST_AUTO_TEST_CASE( pool_test )
+{
+  BOOST_TEST_MESSAGE( "recycling stacks" );
+  perseus::detail::stack_pool pool;
+  perseus::stack stack1 = pool.acquire( 100 );
+  BOOST_CHECK_GE( stack1.capacity(), 100u );
+  BOOST_CHECK_EQUAL( pool.get_statistics().misses, 1u );
+  stack1.push< int >( 42 );
+  const void* const data = stack1.data();
+  pool.release( std::move( stack1 ) );
+  BOOST_CHECK_EQUAL( pool.get_statistics().pooled, 1u );
+
+  // too big for the pooled one
+  perseus::stack stack2 = pool.acquire( 1000 );
+  BOOST_CHECK_EQUAL( pool.get_statistics().misses, 2u );
+  perseus::stack stack3 = pool.acquire( 10 );
+  BOOST_CHECK_EQUAL( pool.get_statistics().hits, 1u );
+  BOOST_CHECK_EQUAL( static_cast< const void* >( stack3.data() ), data );
+  BOOST_CHECK( stack3.empty() );
+  BOOST_CHECK_EQUAL( pool.get_statistics().pooled, 0u );
+
+  // empty stacks and those beyond the limits are freed
+  pool.release( perseus::stack() );
+  BOOST_CHECK_EQUAL( pool.get_statistics().pooled, 0u );
+  perseus::detail::stack_pool::limits limits;
+  limits.max_capacity = 500;
+  pool.set_limits( limits );
+  pool.release( std::move( stack2 ) );
+  pool.release( std::move( stack3 ) );
+  BOOST_CHECK_EQUAL( pool.get_statistics().pooled, 1u );
+  BOOST_CHECK_EQUAL( pool.get_statistics().discarded, 1u );
+  limits.max_stacks_per_bucket = 0;
+  pool.set_limits( limits );
+  BOOST_CHECK_EQUAL( pool.get_statistics().pooled, 0u );
+  BOOST_CHECK_EQUAL( pool.get_statistics().discarded, 2u );
+}
+
+#ifdef __linux__
+/// number of pages of [data, data + size) that are in memory
+static std::size_t resident_pages( const char* const data, const std::size_t size )
+{
+  const std::size_t page = static_cast< std::size_t >( sysconf( _SC_PAGESIZE ) );
+  std::vector< unsigned char > pages( ( size + page - 1 ) / page );
+  BOOST_REQUIRE_EQUAL( mincore( const_cast< char* >( data ), size, pages.data() ), 0 );
+  std::size_t count = 0;
+  for( const unsigned char p : pages )
+  {
+    count += p & 1;
+  }
+  return count;
+}
+
+BOOST_AUTO_TEST_CASE( pool_decommit_test )
+{
+  BOOST_TEST_MESSAGE( "pooled reserved stacks only keep max_capacity bytes committed" );
+  perseus::detail::stack_pool pool( perseus::stack_backend::reserved );
+  perseus::detail::stack_pool::limits limits;
+  limits.max_capacity = 64 * 1024;
+  pool.set_limits( limits );
+  perseus::stack st = pool.acquire( 0 );
+  const std::size_t page = static_cast< std::size_t >( sysconf( _SC_PAGESIZE ) );
+  const std::size_t used = 4 * 1024 * 1024;
+  st.resize( used );
+  std::fill( st.data(), st.data() + used, 1 );
+  const char* const data = st.data();
+  BOOST_CHECK_EQUAL( resident_pages( data, used ), used / page );
+  pool.release( std::move( st ) );
+  BOOST_REQUIRE_EQUAL( pool.get_statistics().pooled, 1u );
+  BOOST_CHECK_LE( resident_pages( data, used ), limits.max_capacity / page );
+
+  // the pooled stack is still usable, and reads as zero beyond what was kept
+  st = pool.acquire( 0 );
+  BOOST_CHECK_EQUAL( static_cast< const void* >( st.data() ), static_cast< const void* >( data ) );
+  st.resize( used );
+  BOOST_CHECK_EQUAL( st.data()[ limits.max_capacity ], 0 );
+  BOOST_CHECK_EQUAL( st.data()[ used - 1 ], 0 );
+}
+#endif
+
 BOOST_AUTO_TEST_SUITE_END()
 
 BOOST_AUTO_TEST_SUITE_END()
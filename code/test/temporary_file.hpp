@@ -0,0 +1,72 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdio>
+#include <string>
+
+#include <dirent.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <boost/test/unit_test.hpp>
+
+/// a file name that's free to use, deleted on destruction
+struct temporary_file
+{
+  temporary_file()
+  {
+    char name[] = "/tmp/perseus_XXXXXX";
+    const int descriptor = mkstemp( name );
+    BOOST_REQUIRE_GE( descriptor, 0 );
+    close( descriptor );
+    path = name;
+  }
+  ~temporary_file()
+  {
+    std::remove( path.c_str() );
+  }
+  std::string path;
+};
+
+/// an empty directory, deleted with its files on destruction
+struct temporary_directory
+{
+  temporary_directory()
+  {
+    char name[] = "/tmp/perseus_XXXXXX";
+    BOOST_REQUIRE( mkdtemp( name ) );
+    path = name;
+  }
+  ~temporary_directory()
+  {
+    if( DIR* const directory = opendir( path.c_str() ) )
+    {
+      while( const dirent* const entry = readdir( directory ) )
+      {
+        const std::string name = entry->d_name;
+        if( name != "." && name != ".." )
+        {
+          std::remove( ( path + "/" + name ).c_str() );
+        }
+      }
+      closedir( directory );
+    }
+    rmdir( path.c_str() );
+  }
+  /// number of files in the directory
+  std::size_t files() const
+  {
+    std::size_t result = 0;
+    if( DIR* const directory = opendir( path.c_str() ) )
+    {
+      while( const dirent* const entry = readdir( directory ) )
+      {
+        const std::string name = entry->d_name;
+        result += name != "." && name != "..";
+      }
+      closedir( directory );
+    }
+    return result;
+  }
+  std::string path;
+};
@@ -8,8 +8,18 @@
 #include <type_traits>
 
 #include "vm/code_segment.hpp"
+#include "vm/dispatch.hpp"
 #include "vm/instruction_pointer.hpp"
 
+/// every dispatch engine, for tests that check they all behave the same
+static const perseus::detail::dispatch_engine dispatch_engines[] = {
+  perseus::detail::dispatch_engine::switch_,
+  perseus::detail::dispatch_engine::computed_goto,
+  perseus::detail::dispatch_engine::tail_call,
+  perseus::detail::dispatch_engine::top_of_stack,
+  perseus::detail::dispatch_engine::jit
+};
+
 struct get_current_address
 {
   get_current_address( perseus::detail::instruction_pointer::value_type& adr ) : address( adr ) {}